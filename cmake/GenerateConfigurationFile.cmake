@@ -26,8 +26,10 @@ endforeach()
 include(CheckFunctionExists)
 set(functions
     asctime_r
+    copy_file_range
     geteuid
     getopt_long
+    getpeereid
     getpwuid
     gettimeofday
     posix_fallocate
@@ -56,10 +56,16 @@ Args::from_gcc_atfile(const std::string& filename)
     return nullopt;
   }
 
+  return from_quoted_string(argtext);
+}
+
+Args
+Args::from_quoted_string(const std::string& text)
+{
   Args args;
-  auto pos = argtext.c_str();
+  auto pos = text.c_str();
   std::string argbuf;
-  argbuf.resize(argtext.length() + 1);
+  argbuf.resize(text.length() + 1);
   auto argpos = argbuf.begin();
 
   // Used to track quoting state; if \0 we are not inside quotes. Otherwise
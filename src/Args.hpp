@@ -40,6 +40,11 @@ public:
   static Args from_string(const std::string& command);
   static nonstd::optional<Args> from_gcc_atfile(const std::string& filename);
 
+  // Split `text` into arguments according to the quoting rules of GCC's @file
+  // syntax, i.e. whitespace separates arguments unless quoted with single or
+  // double quotes and a backslash escapes the next character.
+  static Args from_quoted_string(const std::string& text);
+
   Args& operator=(const Args& other) = default;
   Args& operator=(Args&& other) noexcept;
 
@@ -0,0 +1,616 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include "Batch.hpp"
+
+#include "Config.hpp"
+#include "Fd.hpp"
+#include "Logging.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <sys/wait.h>
+
+#include <algorithm>
+#include <numeric>
+#include <unordered_map>
+#include <utility>
+
+namespace {
+
+// Exit status of a lookup process that retrieved a cached result. Any other
+// exit status means that the compilation still has to be run.
+const int k_lookup_hit = 0;
+const int k_lookup_miss = 1;
+
+// Parser for the subset of JSON used by compilation databases. Strings and
+// arrays of strings are extracted; other values are only validated and
+// skipped.
+class JsonParser
+{
+public:
+  explicit JsonParser(nonstd::string_view text);
+
+  // Consume `c` if it is the next non-whitespace character. Returns true if
+  // `c` was consumed.
+  bool accept(char c);
+
+  // Consume `c`, which must be the next non-whitespace character.
+  void expect(char c);
+
+  // Verify that only whitespace remains.
+  void expect_end();
+
+  std::string parse_string();
+  std::vector<std::string> parse_string_array();
+  void skip_value();
+
+  [[noreturn]] void fail(const std::string& reason) const;
+
+private:
+  nonstd::string_view m_text;
+  size_t m_pos = 0;
+
+  char peek();
+  uint32_t parse_hex4();
+};
+
+JsonParser::JsonParser(nonstd::string_view text) : m_text(text)
+{
+}
+
+char
+JsonParser::peek()
+{
+  while (m_pos < m_text.size()
+         && (m_text[m_pos] == ' ' || m_text[m_pos] == '\t'
+             || m_text[m_pos] == '\n' || m_text[m_pos] == '\r')) {
+    ++m_pos;
+  }
+  return m_pos < m_text.size() ? m_text[m_pos] : '\0';
+}
+
+bool
+JsonParser::accept(char c)
+{
+  if (peek() != c) {
+    return false;
+  }
+  ++m_pos;
+  return true;
+}
+
+void
+JsonParser::expect(char c)
+{
+  if (!accept(c)) {
+    fail(FMT("expected '{}'", c));
+  }
+}
+
+void
+JsonParser::expect_end()
+{
+  if (peek() != '\0') {
+    fail("trailing data");
+  }
+}
+
+void
+JsonParser::fail(const std::string& reason) const
+{
+  throw Error("invalid compilation database: {} at offset {}", reason, m_pos);
+}
+
+uint32_t
+JsonParser::parse_hex4()
+{
+  if (m_pos + 4 > m_text.size()) {
+    fail("truncated \\u escape");
+  }
+  uint32_t value = 0;
+  for (size_t i = 0; i < 4; ++i) {
+    const char c = m_text[m_pos++];
+    value <<= 4;
+    if (c >= '0' && c <= '9') {
+      value |= c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      value |= c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      value |= c - 'A' + 10;
+    } else {
+      fail("invalid \\u escape");
+    }
+  }
+  return value;
+}
+
+std::string
+JsonParser::parse_string()
+{
+  expect('"');
+  std::string result;
+  while (true) {
+    if (m_pos >= m_text.size()) {
+      fail("unterminated string");
+    }
+    const char c = m_text[m_pos++];
+    if (c == '"') {
+      return result;
+    }
+    if (static_cast<unsigned char>(c) < 0x20) {
+      fail("control character in string");
+    }
+    if (c != '\\') {
+      result += c;
+      continue;
+    }
+    if (m_pos >= m_text.size()) {
+      fail("unterminated string");
+    }
+    const char escape = m_text[m_pos++];
+    switch (escape) {
+    case '"':
+    case '\\':
+    case '/':
+      result += escape;
+      break;
+    case 'b':
+      result += '\b';
+      break;
+    case 'f':
+      result += '\f';
+      break;
+    case 'n':
+      result += '\n';
+      break;
+    case 'r':
+      result += '\r';
+      break;
+    case 't':
+      result += '\t';
+      break;
+    case 'u': {
+      uint32_t code_point = parse_hex4();
+      if (code_point >= 0xD800 && code_point <= 0xDBFF
+          && m_text.substr(m_pos, 2) == "\\u") {
+        m_pos += 2;
+        const uint32_t low = parse_hex4();
+        if (low < 0xDC00 || low > 0xDFFF) {
+          fail("invalid surrogate pair");
+        }
+        code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+      }
+      // Encode as UTF-8.
+      if (code_point < 0x80) {
+        result += static_cast<char>(code_point);
+      } else if (code_point < 0x800) {
+        result += static_cast<char>(0xC0 | (code_point >> 6));
+        result += static_cast<char>(0x80 | (code_point & 0x3F));
+      } else if (code_point < 0x10000) {
+        result += static_cast<char>(0xE0 | (code_point >> 12));
+        result += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        result += static_cast<char>(0x80 | (code_point & 0x3F));
+      } else {
+        result += static_cast<char>(0xF0 | (code_point >> 18));
+        result += static_cast<char>(0x80 | ((code_point >> 12) & 0x3F));
+        result += static_cast<char>(0x80 | ((code_point >> 6) & 0x3F));
+        result += static_cast<char>(0x80 | (code_point & 0x3F));
+      }
+      break;
+    }
+    default:
+      fail("invalid escape sequence");
+    }
+  }
+}
+
+std::vector<std::string>
+JsonParser::parse_string_array()
+{
+  std::vector<std::string> result;
+  expect('[');
+  if (!accept(']')) {
+    do {
+      result.push_back(parse_string());
+    } while (accept(','));
+    expect(']');
+  }
+  return result;
+}
+
+void
+JsonParser::skip_value()
+{
+  switch (peek()) {
+  case '"':
+    parse_string();
+    break;
+
+  case '[':
+    ++m_pos;
+    if (!accept(']')) {
+      do {
+        skip_value();
+      } while (accept(','));
+      expect(']');
+    }
+    break;
+
+  case '{':
+    ++m_pos;
+    if (!accept('}')) {
+      do {
+        parse_string();
+        expect(':');
+        skip_value();
+      } while (accept(','));
+      expect('}');
+    }
+    break;
+
+  default: {
+    // Number, true, false or null.
+    const size_t start = m_pos;
+    while (m_pos < m_text.size()
+           && (isalnum(static_cast<unsigned char>(m_text[m_pos]))
+               || m_text[m_pos] == '+' || m_text[m_pos] == '-'
+               || m_text[m_pos] == '.')) {
+      ++m_pos;
+    }
+    if (m_pos == start) {
+      fail("unexpected character");
+    }
+    break;
+  }
+  }
+}
+
+Batch::Command
+parse_command(JsonParser& parser, size_t index)
+{
+  Batch::Command command;
+  bool has_directory = false;
+  bool has_file = false;
+  bool has_arguments = false;
+  nonstd::optional<std::string> command_string;
+
+  parser.expect('{');
+  if (!parser.accept('}')) {
+    do {
+      const std::string key = parser.parse_string();
+      parser.expect(':');
+      if (key == "directory") {
+        command.directory = parser.parse_string();
+        has_directory = true;
+      } else if (key == "file") {
+        command.file = parser.parse_string();
+        has_file = true;
+      } else if (key == "arguments") {
+        for (const auto& arg : parser.parse_string_array()) {
+          command.args.push_back(arg);
+        }
+        has_arguments = true;
+      } else if (key == "command") {
+        command_string = parser.parse_string();
+      } else {
+        parser.skip_value();
+      }
+    } while (parser.accept(','));
+    parser.expect('}');
+  }
+
+  // "arguments" takes precedence over "command" if both are present.
+  if (!has_arguments && command_string) {
+    command.args = Args::from_quoted_string(*command_string);
+  }
+
+  if (!has_directory) {
+    parser.fail(FMT("entry {} lacks \"directory\"", index + 1));
+  }
+  if (!has_file) {
+    parser.fail(FMT("entry {} lacks \"file\"", index + 1));
+  }
+  if (command.args.empty()) {
+    parser.fail(FMT("entry {} lacks \"arguments\" or \"command\"", index + 1));
+  }
+  return command;
+}
+
+void
+print_status(const Batch::Command& command, const std::string& status)
+{
+  PRINT(stdout, "{}: {}\n", status, command.file);
+  fflush(stdout);
+}
+
+// Function run in a child process for the command with index `index`. Returns
+// the exit status of the child. `output` is passed back to the parent.
+using ChildFunction = std::function<int(
+  size_t index, int argc, const char* const* argv, std::string& output)>;
+
+struct Child
+{
+  size_t index;
+  Fd output_fd; // Read end of a pipe from the child.
+};
+
+// Run `function` for the command with index `index` in a child process.
+// Returns the process ID of the child, or -1 on error.
+pid_t
+spawn(const std::vector<Batch::Command>& commands,
+      size_t index,
+      const std::string& ccache_path,
+      const ChildFunction& function,
+      Fd& output_fd)
+{
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    return -1;
+  }
+  output_fd = Fd(pipe_fds[0]);
+  Fd write_fd(pipe_fds[1]);
+  Util::set_cloexec_flag(*output_fd);
+  Util::set_cloexec_flag(*write_fd);
+  const int flags = fcntl(*output_fd, F_GETFL);
+  if (flags == -1 || fcntl(*output_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    return -1;
+  }
+
+  // Don't let the child process flush data buffered by the parent.
+  fflush(stdout);
+  fflush(stderr);
+
+  const pid_t pid = fork();
+  if (pid != 0) {
+    return pid;
+  }
+
+  output_fd.close();
+  const Batch::Command& command = commands[index];
+  std::string output;
+  int status = EXIT_FAILURE;
+  if (chdir(command.directory.c_str()) != 0) {
+    PRINT(stderr,
+          "ccache: error: failed to change directory to {}: {}\n",
+          command.directory,
+          strerror(errno));
+  } else {
+    Args args = command.args;
+    if (!Util::same_program_name(Util::base_name(args[0]),
+                                 Util::base_name(ccache_path))) {
+      args.push_front(ccache_path);
+    }
+    const auto argv = args.to_argv();
+    try {
+      status =
+        function(index, static_cast<int>(args.size()), argv.data(), output);
+    } catch (const ErrorBase& e) {
+      PRINT(stderr, "ccache: error: {}\n", e.what());
+    }
+  }
+  fflush(stdout);
+  fflush(stderr);
+  // The output is small enough to fit in the pipe buffer, so this doesn't
+  // block until the parent reads it.
+  try {
+    Util::write_fd(*write_fd, output.data(), output.size());
+  } catch (const ErrorBase&) {
+    // Ignore, the parent just gets less output.
+  }
+  _exit(status);
+}
+
+// Read what the exited child process wrote to `fd`. `fd` is nonblocking since
+// processes started by the child may still have the write end open.
+std::string
+read_output(int fd)
+{
+  std::string output;
+  char buffer[256];
+  ssize_t count;
+  while ((count = read(fd, buffer, sizeof(buffer))) != 0) {
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    output.append(buffer, count);
+  }
+  return output;
+}
+
+// Run `function` for each command in `commands` referred to by `indexes`,
+// using at most `jobs` concurrent child processes. `on_done` is called with
+// the index, the exit status and the output of each command as it finishes.
+void
+run_phase(const std::vector<Batch::Command>& commands,
+          const std::vector<size_t>& indexes,
+          const std::string& ccache_path,
+          unsigned jobs,
+          const ChildFunction& function,
+          const std::function<void(
+            size_t index, int status, const std::string& output)>& on_done)
+{
+  std::unordered_map<pid_t, Child> running;
+  size_t next = 0;
+
+  while (next < indexes.size() || !running.empty()) {
+    while (running.size() < jobs && next < indexes.size()) {
+      const size_t index = indexes[next++];
+      Fd output_fd;
+      const pid_t pid =
+        spawn(commands, index, ccache_path, function, output_fd);
+      if (pid == -1) {
+        LOG("Failed to fork: {}", strerror(errno));
+        on_done(index, EXIT_FAILURE, "");
+      } else {
+        running.emplace(pid, Child{index, std::move(output_fd)});
+      }
+    }
+    if (running.empty()) {
+      continue;
+    }
+
+    int wstatus;
+    const pid_t pid = wait(&wstatus);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw Fatal("Failed to wait for child process: {}", strerror(errno));
+    }
+    const auto it = running.find(pid);
+    if (it == running.end()) {
+      continue;
+    }
+    const size_t index = it->second.index;
+    const std::string output = read_output(*it->second.output_fd);
+    running.erase(it);
+    on_done(index,
+            WIFEXITED(wstatus) ? WEXITSTATUS(wstatus)
+                               : 128 + WTERMSIG(wstatus),
+            output);
+  }
+}
+
+} // namespace
+
+namespace Batch {
+
+std::vector<Command>
+parse_compile_commands(const std::string& json)
+{
+  JsonParser parser(json);
+  std::vector<Command> commands;
+  parser.expect('[');
+  if (!parser.accept(']')) {
+    do {
+      commands.push_back(parse_command(parser, commands.size()));
+    } while (parser.accept(','));
+    parser.expect(']');
+  }
+  parser.expect_end();
+  return commands;
+}
+
+int
+run(const Config& config,
+    const std::vector<Command>& commands,
+    const std::string& ccache_path,
+    unsigned jobs,
+    const LookupFunction& lookup_function,
+    const CompileFunction& compile_function)
+{
+  std::vector<size_t> to_compile(commands.size());
+  std::iota(to_compile.begin(), to_compile.end(), 0);
+  std::vector<std::string> miss_states(commands.size());
+  size_t n_direct_hits = 0;
+  size_t n_preprocessed_hits = 0;
+  size_t n_compiled = 0;
+  size_t n_failed = 0;
+
+  if (config.direct_mode() && !config.disable()) {
+    LOG("Looking up {} compilations with {} jobs", commands.size(), jobs);
+    const std::vector<size_t> to_look_up = std::move(to_compile);
+    to_compile.clear();
+    run_phase(
+      commands,
+      to_look_up,
+      ccache_path,
+      jobs,
+      [&](size_t /*index*/,
+          int argc,
+          const char* const* argv,
+          std::string& output) {
+        return lookup_function(argc, argv, output) ? k_lookup_hit
+                                                   : k_lookup_miss;
+      },
+      [&](size_t index, int status, const std::string& output) {
+        if (status == k_lookup_hit) {
+          print_status(commands[index], "cached (direct)");
+          ++n_direct_hits;
+        } else {
+          if (status == k_lookup_miss) {
+            miss_states[index] = output;
+          }
+          to_compile.push_back(index);
+        }
+      });
+    // Compile in database order.
+    std::sort(to_compile.begin(), to_compile.end());
+  }
+
+  LOG("Compiling {} compilations with {} jobs", to_compile.size(), jobs);
+  run_phase(
+    commands,
+    to_compile,
+    ccache_path,
+    jobs,
+    [&](size_t index,
+        int argc,
+        const char* const* argv,
+        std::string& output) {
+      Outcome outcome = Outcome::compiled;
+      const int status =
+        compile_function(argc, argv, miss_states[index], outcome);
+      output.push_back(static_cast<char>(outcome));
+      return status;
+    },
+    [&](size_t index, int status, const std::string& output) {
+      if (status != EXIT_SUCCESS) {
+        print_status(commands[index], FMT("failed (exit status {})", status));
+        ++n_failed;
+        return;
+      }
+      // A child that ran the real compiler directly has no output.
+      const Outcome outcome = output.size() == 1
+                                ? static_cast<Outcome>(output[0])
+                                : Outcome::compiled;
+      switch (outcome) {
+      case Outcome::direct_hit:
+        print_status(commands[index], "cached (direct)");
+        ++n_direct_hits;
+        break;
+      case Outcome::preprocessed_hit:
+        print_status(commands[index], "cached (preprocessed)");
+        ++n_preprocessed_hits;
+        break;
+      case Outcome::compiled:
+        print_status(commands[index], "compiled");
+        ++n_compiled;
+        break;
+      }
+    });
+
+  PRINT(stdout,
+        "{} cached (direct), {} cached (preprocessed), {} compiled,"
+        " {} failed\n",
+        n_direct_hits,
+        n_preprocessed_hits,
+        n_compiled,
+        n_failed);
+  return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+} // namespace Batch
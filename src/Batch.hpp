@@ -0,0 +1,95 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#pragma once
+
+#include "system.hpp"
+
+#include "Args.hpp"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+class Config;
+
+// Batch mode runs all compilations of a compilation database
+// (compile_commands.json) from one ccache invocation. The compilations are
+// run in two phases, each spreading the work over a number of child
+// processes:
+//
+// 1. All compilations are looked up in the cache in direct mode, retrieving
+//    the results of those that are hits.
+// 2. The remaining compilations are run as ordinary ccache invocations, i.e.
+//    they are looked up in preprocessor mode and finally compiled by the real
+//    compiler. The state of each compilation's miss in phase 1 is passed on so
+//    that the direct mode lookup isn't repeated.
+//
+// Each child process takes on the next compilation when done, so a few slow
+// compilations don't hold up the rest of the batch.
+namespace Batch {
+
+struct Command
+{
+  std::string directory;
+  std::string file;
+  Args args;
+};
+
+// How a compilation that succeeded got its result.
+enum class Outcome {
+  direct_hit,
+  preprocessed_hit,
+  compiled,
+};
+
+// Run the compilation described by `argc` and `argv` in the current working
+// directory. `miss_state` is the state set by the lookup function in phase 1,
+// if any. `outcome` is set if the compilation succeeded and it's known how.
+// Returns the exit status of the compilation.
+using CompileFunction = std::function<int(int argc,
+                                          const char* const* argv,
+                                          const std::string& miss_state,
+                                          Outcome& outcome)>;
+
+// Look up the compilation described by `argc` and `argv` in the current
+// working directory. Returns true if a cached result was retrieved, otherwise
+// false, in which case `miss_state` may be set to data that is passed on to
+// the compile function.
+using LookupFunction = std::function<bool(
+  int argc, const char* const* argv, std::string& miss_state)>;
+
+// Parse the compilation database in `json`. Throws Error on malformed input.
+std::vector<Command> parse_compile_commands(const std::string& json);
+
+// Run `commands` with at most `jobs` concurrent child processes. The commands
+// are prefixed with `ccache_path` unless already invoking ccache. The child
+// processes are forked from the calling process, so anything that `config`
+// and the functions refer to is set up once for all of them. The status of
+// each command is printed to stdout when it is done, followed by a summary
+// at the end. Returns EXIT_SUCCESS if all commands succeeded, otherwise
+// EXIT_FAILURE.
+int run(const Config& config,
+        const std::vector<Command>& commands,
+        const std::string& ccache_path,
+        unsigned jobs,
+        const LookupFunction& lookup_function,
+        const CompileFunction& compile_function);
+
+} // namespace Batch
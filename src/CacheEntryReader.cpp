@@ -26,7 +26,8 @@
 
 CacheEntryReader::CacheEntryReader(FILE* stream,
                                    const uint8_t* expected_magic,
-                                   uint8_t expected_version)
+                                   uint8_t expected_version,
+                                   uint8_t min_version)
 {
   uint8_t header_bytes[15];
   if (fread(header_bytes, sizeof(header_bytes), 1, stream) != 1) {
@@ -46,7 +47,9 @@ CacheEntryReader::CacheEntryReader(FILE* stream,
                 m_magic[2],
                 m_magic[3]);
   }
-  if (m_version != expected_version) {
+  if (m_version != expected_version
+      && (min_version == 0 || m_version < min_version
+          || m_version > expected_version)) {
     throw Error(
       "Unknown version (actual {}, expected {})", m_version, expected_version);
   }
@@ -75,7 +78,7 @@ CacheEntryReader::read(void* data, size_t count)
 }
 
 void
-CacheEntryReader::finalize()
+CacheEntryReader::finalize(TrailingData trailing_data)
 {
   uint64_t actual_digest = m_checksum.digest();
 
@@ -90,5 +93,7 @@ CacheEntryReader::finalize()
                 expected_digest);
   }
 
-  m_decompressor->finalize();
+  if (trailing_data == TrailingData::forbidden) {
+    m_decompressor->finalize();
+  }
 }
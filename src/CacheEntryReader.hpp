@@ -39,9 +39,12 @@ public:
   // - expected_magic: Expected file format magic (first four bytes of the
   //   file).
   // - expected_version: Expected file format version.
+  // - min_version: Oldest file format version that is also accepted, or 0 if
+  //   only `expected_version` is accepted.
   CacheEntryReader(FILE* stream,
                    const uint8_t* expected_magic,
-                   uint8_t expected_version);
+                   uint8_t expected_version,
+                   uint8_t min_version = 0);
 
   // Dump header information in text format.
   //
@@ -66,11 +69,15 @@ public:
   // Throws Error on failure.
   template<typename T> void read(T& value);
 
+  // Whether other data may follow the cache entry in the stream.
+  enum class TrailingData { forbidden, allowed };
+
   // Close for reading.
   //
   // This method potentially verifies the end state after reading the cache
-  // entry and throws Error if any integrity issues are found.
-  void finalize();
+  // entry and throws Error if any integrity issues are found. If
+  // `trailing_data` is `allowed`, only the checksum is verified.
+  void finalize(TrailingData trailing_data = TrailingData::forbidden);
 
   // Get size of the payload,
   uint64_t payload_size() const;
@@ -18,15 +18,17 @@
 
 #include "CacheEntryWriter.hpp"
 
-CacheEntryWriter::CacheEntryWriter(FILE* stream,
-                                   const uint8_t* magic,
-                                   uint8_t version,
-                                   Compression::Type compression_type,
-                                   int8_t compression_level,
-                                   uint64_t payload_size)
+CacheEntryWriter::CacheEntryWriter(
+  FILE* stream,
+  const uint8_t* magic,
+  uint8_t version,
+  Compression::Type compression_type,
+  int8_t compression_level,
+  uint64_t payload_size,
+  const CompressionDictionary::Dictionary* dictionary)
   // clang-format off
-  : m_compressor(
-      Compressor::create_from_type(compression_type, stream, compression_level))
+  : m_compressor(Compressor::create_from_type(
+      compression_type, stream, compression_level, 0, dictionary))
 // clang-format on
 {
   uint8_t header_bytes[15];
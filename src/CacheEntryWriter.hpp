@@ -41,12 +41,15 @@ public:
   // - compression_type: Compression type to use.
   // - compression_level: Compression level to use.
   // - payload_size: Payload size.
-  CacheEntryWriter(FILE* stream,
-                   const uint8_t* magic,
-                   uint8_t version,
-                   Compression::Type compression_type,
-                   int8_t compression_level,
-                   uint64_t payload_size);
+  // - dictionary: Compression dictionary to use, or nullptr for none.
+  CacheEntryWriter(
+    FILE* stream,
+    const uint8_t* magic,
+    uint8_t version,
+    Compression::Type compression_type,
+    int8_t compression_level,
+    uint64_t payload_size,
+    const CompressionDictionary::Dictionary* dictionary = nullptr);
 
   // Write data to the payload from a buffer.
   //
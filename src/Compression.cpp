@@ -20,6 +20,7 @@
 
 #include "Config.hpp"
 #include "Context.hpp"
+#include "ZstdCompressor.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
@@ -31,6 +32,20 @@ level_from_config(const Config& config)
   return config.compression() ? config.compression_level() : 0;
 }
 
+int8_t
+actual_level(Type type, int8_t level)
+{
+  switch (type) {
+  case Type::none:
+    return 0;
+
+  case Type::zstd:
+    return ZstdCompressor::actual_compression_level(level);
+  }
+
+  ASSERT(false);
+}
+
 Type
 type_from_config(const Config& config)
 {
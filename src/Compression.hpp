@@ -33,6 +33,10 @@ enum class Type : uint8_t {
 
 int8_t level_from_config(const Config& config);
 
+// Return the level that a compressor of `type` created with `level` uses,
+// without creating one.
+int8_t actual_level(Type type, int8_t level);
+
 Type type_from_config(const Config& config);
 
 Type type_from_int(uint8_t type);
@@ -0,0 +1,267 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "CompressionDictionary.hpp"
+
+#include "AtomicFile.hpp"
+#include "Logging.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "exceptions.hpp"
+#include "fmtmacros.hpp"
+
+#include <algorithm>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <zdict.h>
+#include <zstd.h>
+
+namespace {
+
+// Zstandard's default dictionary size.
+const size_t k_max_dictionary_size = 110 * 1024;
+
+// Smaller dictionaries are not worth the trouble.
+const size_t k_min_dictionary_size = 1024;
+
+// Zstandard recommends about 100 times more sample data than the dictionary
+// size, but 10 times is enough to get a useful dictionary.
+const size_t k_min_samples_to_dictionary_ratio = 10;
+
+const size_t k_min_samples = 8;
+
+using DictionaryPtr = std::shared_ptr<const CompressionDictionary::Dictionary>;
+
+// Protects the variables below, which are used by worker threads when
+// retrieving results.
+std::mutex dictionaries_mutex;
+std::string dictionary_dir;
+std::unordered_map<uint32_t, DictionaryPtr> dictionaries_by_id;
+// nullptr means that there is no dictionary for the kind.
+std::map<CompressionDictionary::Kind, DictionaryPtr> dictionaries_by_kind;
+
+std::string
+get_id_path(uint32_t id)
+{
+  return FMT("{}/{:08x}.zdict", dictionary_dir, id);
+}
+
+std::string
+get_kind_path(CompressionDictionary::Kind kind)
+{
+  return FMT(
+    "{}/{}.zdict", dictionary_dir, CompressionDictionary::kind_to_string(kind));
+}
+
+void
+store(const std::string& path, nonstd::string_view content)
+{
+  AtomicFile file(path, AtomicFile::Mode::binary);
+  file.write(std::string(content));
+  file.commit();
+}
+
+} // namespace
+
+namespace CompressionDictionary {
+
+const char*
+kind_to_string(Kind kind)
+{
+  switch (kind) {
+  case Kind::manifest:
+    return "manifest";
+  case Kind::object:
+    return "object";
+  case Kind::dependency:
+    return "dependency";
+  case Kind::stderr_output:
+    return "stderr";
+  }
+
+  return "unknown";
+}
+
+Dictionary::Dictionary(std::string content)
+  : m_content(std::move(content)),
+    m_id(ZDICT_getDictID(m_content.data(), m_content.size())),
+    m_ddict(nullptr)
+{
+  if (m_id == 0) {
+    throw Error("not a Zstandard dictionary");
+  }
+  m_ddict = ZSTD_createDDict(m_content.data(), m_content.size());
+  if (!m_ddict) {
+    throw Error("failed to load Zstandard dictionary {:08x}", m_id);
+  }
+}
+
+Dictionary::~Dictionary()
+{
+  ZSTD_freeDDict(m_ddict);
+}
+
+uint32_t
+Dictionary::id() const
+{
+  return m_id;
+}
+
+nonstd::string_view
+Dictionary::content() const
+{
+  return m_content;
+}
+
+const ZSTD_DDict*
+Dictionary::ddict() const
+{
+  return m_ddict;
+}
+
+bool
+is_supported()
+{
+  return ZSTD_VERSION_NUMBER >= 10400;
+}
+
+void
+set_directory(const std::string& dir)
+{
+  std::unique_lock<std::mutex> lock(dictionaries_mutex);
+  if (dir != dictionary_dir) {
+    dictionary_dir = dir;
+    dictionaries_by_id.clear();
+    dictionaries_by_kind.clear();
+  }
+}
+
+std::shared_ptr<const Dictionary>
+get_for_kind(Kind kind)
+{
+  std::unique_lock<std::mutex> lock(dictionaries_mutex);
+  const auto it = dictionaries_by_kind.find(kind);
+  if (it != dictionaries_by_kind.end()) {
+    return it->second;
+  }
+
+  DictionaryPtr dictionary;
+  if (!dictionary_dir.empty()) {
+    const auto path = get_kind_path(kind);
+    if (Stat::stat(path)) {
+      try {
+        dictionary = std::make_shared<const Dictionary>(Util::read_file(path));
+        LOG("Using compression dictionary {:08x} for {} data",
+            dictionary->id(),
+            kind_to_string(kind));
+      } catch (const Error& e) {
+        LOG("Failed to load {}: {}", path, e.what());
+      }
+    }
+  }
+  dictionaries_by_kind.emplace(kind, dictionary);
+  return dictionary;
+}
+
+std::shared_ptr<const Dictionary>
+get_by_id(uint32_t id)
+{
+  std::unique_lock<std::mutex> lock(dictionaries_mutex);
+  const auto it = dictionaries_by_id.find(id);
+  if (it != dictionaries_by_id.end()) {
+    return it->second;
+  }
+
+  if (dictionary_dir.empty()) {
+    throw Error("compression dictionary {:08x} not available", id);
+  }
+  const auto path = get_id_path(id);
+  DictionaryPtr dictionary;
+  try {
+    dictionary = std::make_shared<const Dictionary>(Util::read_file(path));
+  } catch (const Error& e) {
+    throw Error("failed to load compression dictionary {}: {}", path, e.what());
+  }
+  if (dictionary->id() != id) {
+    throw Error("bad compression dictionary ID in {}", path);
+  }
+  dictionaries_by_id.emplace(id, dictionary);
+  return dictionary;
+}
+
+std::shared_ptr<const Dictionary>
+train(Kind kind, const std::vector<std::string>& samples)
+{
+  if (!is_supported()) {
+    throw Error("compression dictionaries require libzstd 1.4.0 or newer");
+  }
+
+  std::string sample_buffer;
+  std::vector<size_t> sample_sizes;
+  for (const auto& sample : samples) {
+    if (!sample.empty()) {
+      sample_buffer += sample;
+      sample_sizes.push_back(sample.size());
+    }
+  }
+
+  const size_t capacity =
+    std::min(k_max_dictionary_size,
+             sample_buffer.size() / k_min_samples_to_dictionary_ratio);
+  if (sample_sizes.size() < k_min_samples
+      || capacity < k_min_dictionary_size) {
+    return nullptr;
+  }
+
+  std::string content(capacity, '\0');
+  const size_t size = ZDICT_trainFromBuffer(&content[0],
+                                            content.size(),
+                                            sample_buffer.data(),
+                                            sample_sizes.data(),
+                                            sample_sizes.size());
+  if (ZDICT_isError(size)) {
+    LOG("Failed to train {} dictionary: {}",
+        kind_to_string(kind),
+        ZDICT_getErrorName(size));
+    return nullptr;
+  }
+  content.resize(size);
+  const auto dictionary =
+    std::make_shared<const Dictionary>(std::move(content));
+
+  std::unique_lock<std::mutex> lock(dictionaries_mutex);
+  if (dictionary_dir.empty()) {
+    throw Error("no directory to store compression dictionaries in");
+  }
+  if (!Util::create_dir(dictionary_dir)) {
+    throw Error("failed to create directory {}: {}",
+                dictionary_dir,
+                strerror(errno));
+  }
+  // Store the dictionary under its ID first so that data compressed with it
+  // can always be decompressed.
+  store(get_id_path(dictionary->id()), dictionary->content());
+  store(get_kind_path(kind), dictionary->content());
+  dictionaries_by_id[dictionary->id()] = dictionary;
+  dictionaries_by_kind[kind] = dictionary;
+
+  return dictionary;
+}
+
+} // namespace CompressionDictionary
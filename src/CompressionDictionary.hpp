@@ -0,0 +1,88 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Same as in zstd.h, which is not needed by users of this header.
+typedef struct ZSTD_DDict_s ZSTD_DDict;
+
+// Zstandard dictionaries trained on the content of the cache.
+//
+// Each dictionary is stored as <dir>/<id>.zdict, where <id> is the dictionary
+// ID as an 8 digit hexadecimal number. The dictionary to use when compressing
+// data of a certain kind is additionally stored as <dir>/<kind>.zdict. A
+// compressed stream refers to its dictionary via the dictionary ID in the
+// Zstandard frame header, so old dictionaries are kept when training new ones.
+namespace CompressionDictionary {
+
+// Kind of data that a dictionary is trained for.
+enum class Kind { manifest, object, dependency, stderr_output };
+
+const char* kind_to_string(Kind kind);
+
+class Dictionary : NonCopyable
+{
+public:
+  // Throws Error if `content` is not a Zstandard dictionary.
+  explicit Dictionary(std::string content);
+  ~Dictionary();
+
+  uint32_t id() const;
+  nonstd::string_view content() const;
+
+  // Digested form of the dictionary for decompression.
+  const ZSTD_DDict* ddict() const;
+
+private:
+  const std::string m_content;
+  uint32_t m_id;
+  ZSTD_DDict* m_ddict;
+};
+
+// Whether libzstd is new enough to compress with dictionaries.
+bool is_supported();
+
+// Look up dictionaries in `dir` from now on. An empty `dir` (the initial
+// state) means that there are no dictionaries.
+void set_directory(const std::string& dir);
+
+// Get the dictionary to compress data of `kind` with, or nullptr if there is
+// none.
+std::shared_ptr<const Dictionary> get_for_kind(Kind kind);
+
+// Get the dictionary with ID `id`. Throws Error if it can't be loaded.
+std::shared_ptr<const Dictionary> get_by_id(uint32_t id);
+
+// Train a dictionary for `kind` on `samples` and store it as the dictionary to
+// use for `kind`. Returns nullptr if there are too few samples to train on.
+// Throws Error if dictionaries are not supported or if the dictionary can't be
+// stored.
+std::shared_ptr<const Dictionary>
+train(Kind kind, const std::vector<std::string>& samples);
+
+} // namespace CompressionDictionary
@@ -24,16 +24,20 @@
 #include "assertions.hpp"
 
 std::unique_ptr<Compressor>
-Compressor::create_from_type(Compression::Type type,
-                             FILE* stream,
-                             int8_t compression_level)
+Compressor::create_from_type(
+  Compression::Type type,
+  FILE* stream,
+  int8_t compression_level,
+  uint32_t n_threads,
+  const CompressionDictionary::Dictionary* dictionary)
 {
   switch (type) {
   case Compression::Type::none:
     return std::make_unique<NullCompressor>(stream);
 
   case Compression::Type::zstd:
-    return std::make_unique<ZstdCompressor>(stream, compression_level);
+    return std::make_unique<ZstdCompressor>(
+      stream, compression_level, n_threads, dictionary);
   }
 
   ASSERT(false);
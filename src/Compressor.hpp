@@ -24,6 +24,10 @@
 
 #include <memory>
 
+namespace CompressionDictionary {
+class Dictionary;
+}
+
 class Compressor
 {
 public:
@@ -35,9 +39,16 @@ public:
   // - type: The type.
   // - stream: The stream to write to.
   // - compression_level: Desired compression level.
-  static std::unique_ptr<Compressor> create_from_type(Compression::Type type,
-                                                      FILE* stream,
-                                                      int8_t compression_level);
+  // - n_threads: Number of worker threads to compress with if supported by the
+  //   type, or 0 to compress on the calling thread.
+  // - dictionary: Dictionary to compress with if supported by the type, or
+  //   nullptr for none. Only needs to be valid during the call.
+  static std::unique_ptr<Compressor> create_from_type(
+    Compression::Type type,
+    FILE* stream,
+    int8_t compression_level,
+    uint32_t n_threads = 0,
+    const CompressionDictionary::Dictionary* dictionary = nullptr);
 
   // Get the actual compression level used for the compressed stream.
   virtual int8_t actual_compression_level() const = 0;
@@ -43,13 +43,16 @@ namespace {
 
 enum class ConfigItem {
   absolute_paths_in_stderr,
+  async_store,
   base_dir,
   cache_dir,
   compiler,
   compiler_check,
+  compiler_check_cache,
   compiler_type,
   compression,
   compression_level,
+  compression_threads,
   cpp_extension,
   debug,
   debug_dir,
@@ -58,15 +61,21 @@ enum class ConfigItem {
   disable,
   extra_files_to_hash,
   file_clone,
+  file_hash_cache,
   hard_link,
   hash_dir,
   ignore_headers_in_manifest,
   ignore_options,
   inode_cache,
+  inode_cache_persistent,
+  inode_cache_size,
   keep_comments_cpp,
   limit_multiple,
   log_file,
+  manifest_cache,
   max_files,
+  max_manifest_entries,
+  max_manifest_file_infos,
   max_size,
   path,
   pch_external_checksum,
@@ -75,22 +84,30 @@ enum class ConfigItem {
   read_only,
   read_only_direct,
   recache,
+  retrieve_threads,
   run_second_cpp,
+  server,
+  server_idle_timeout,
   sloppiness,
+  stat_threads,
   stats,
+  stream_cpp_output,
   temporary_dir,
   umask,
 };
 
 const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"absolute_paths_in_stderr", ConfigItem::absolute_paths_in_stderr},
+  {"async_store", ConfigItem::async_store},
   {"base_dir", ConfigItem::base_dir},
   {"cache_dir", ConfigItem::cache_dir},
   {"compiler", ConfigItem::compiler},
   {"compiler_check", ConfigItem::compiler_check},
+  {"compiler_check_cache", ConfigItem::compiler_check_cache},
   {"compiler_type", ConfigItem::compiler_type},
   {"compression", ConfigItem::compression},
   {"compression_level", ConfigItem::compression_level},
+  {"compression_threads", ConfigItem::compression_threads},
   {"cpp_extension", ConfigItem::cpp_extension},
   {"debug", ConfigItem::debug},
   {"debug_dir", ConfigItem::debug_dir},
@@ -99,15 +116,21 @@ const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"disable", ConfigItem::disable},
   {"extra_files_to_hash", ConfigItem::extra_files_to_hash},
   {"file_clone", ConfigItem::file_clone},
+  {"file_hash_cache", ConfigItem::file_hash_cache},
   {"hard_link", ConfigItem::hard_link},
   {"hash_dir", ConfigItem::hash_dir},
   {"ignore_headers_in_manifest", ConfigItem::ignore_headers_in_manifest},
   {"ignore_options", ConfigItem::ignore_options},
   {"inode_cache", ConfigItem::inode_cache},
+  {"inode_cache_persistent", ConfigItem::inode_cache_persistent},
+  {"inode_cache_size", ConfigItem::inode_cache_size},
   {"keep_comments_cpp", ConfigItem::keep_comments_cpp},
   {"limit_multiple", ConfigItem::limit_multiple},
   {"log_file", ConfigItem::log_file},
+  {"manifest_cache", ConfigItem::manifest_cache},
   {"max_files", ConfigItem::max_files},
+  {"max_manifest_entries", ConfigItem::max_manifest_entries},
+  {"max_manifest_file_infos", ConfigItem::max_manifest_file_infos},
   {"max_size", ConfigItem::max_size},
   {"path", ConfigItem::path},
   {"pch_external_checksum", ConfigItem::pch_external_checksum},
@@ -116,22 +139,30 @@ const std::unordered_map<std::string, ConfigItem> k_config_key_table = {
   {"read_only", ConfigItem::read_only},
   {"read_only_direct", ConfigItem::read_only_direct},
   {"recache", ConfigItem::recache},
+  {"retrieve_threads", ConfigItem::retrieve_threads},
   {"run_second_cpp", ConfigItem::run_second_cpp},
+  {"server", ConfigItem::server},
+  {"server_idle_timeout", ConfigItem::server_idle_timeout},
   {"sloppiness", ConfigItem::sloppiness},
+  {"stat_threads", ConfigItem::stat_threads},
   {"stats", ConfigItem::stats},
+  {"stream_cpp_output", ConfigItem::stream_cpp_output},
   {"temporary_dir", ConfigItem::temporary_dir},
   {"umask", ConfigItem::umask},
 };
 
 const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"ABSSTDERR", "absolute_paths_in_stderr"},
+  {"ASYNCSTORE", "async_store"},
   {"BASEDIR", "base_dir"},
   {"CC", "compiler"}, // Alias for CCACHE_COMPILER
   {"COMMENTS", "keep_comments_cpp"},
   {"COMPILER", "compiler"},
   {"COMPILERCHECK", "compiler_check"},
   {"COMPILERTYPE", "compiler_type"},
+  {"COMPILER_CHECK_CACHE", "compiler_check_cache"},
   {"COMPRESS", "compression"},
+  {"COMPRESSION_THREADS", "compression_threads"},
   {"COMPRESSLEVEL", "compression_level"},
   {"CPP2", "run_second_cpp"},
   {"DEBUG", "debug"},
@@ -143,15 +174,21 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"EXTENSION", "cpp_extension"},
   {"EXTRAFILES", "extra_files_to_hash"},
   {"FILECLONE", "file_clone"},
+  {"FILEHASHCACHE", "file_hash_cache"},
   {"HARDLINK", "hard_link"},
   {"HASHDIR", "hash_dir"},
   {"IGNOREHEADERS", "ignore_headers_in_manifest"},
   {"IGNOREOPTIONS", "ignore_options"},
   {"INODECACHE", "inode_cache"},
+  {"INODE_CACHE_PERSISTENT", "inode_cache_persistent"},
+  {"INODE_CACHE_SIZE", "inode_cache_size"},
   {"LIMIT_MULTIPLE", "limit_multiple"},
   {"LOGFILE", "log_file"},
+  {"MANIFESTCACHE", "manifest_cache"},
   {"MAXFILES", "max_files"},
   {"MAXSIZE", "max_size"},
+  {"MAX_MANIFEST_ENTRIES", "max_manifest_entries"},
+  {"MAX_MANIFEST_FILE_INFOS", "max_manifest_file_infos"},
   {"PATH", "path"},
   {"PCH_EXTSUM", "pch_external_checksum"},
   {"PREFIX", "prefix_command"},
@@ -159,8 +196,13 @@ const std::unordered_map<std::string, std::string> k_env_variable_table = {
   {"READONLY", "read_only"},
   {"READONLY_DIRECT", "read_only_direct"},
   {"RECACHE", "recache"},
+  {"RETRIEVE_THREADS", "retrieve_threads"},
+  {"SERVER", "server"},
+  {"SERVER_IDLE_TIMEOUT", "server_idle_timeout"},
   {"SLOPPINESS", "sloppiness"},
   {"STATS", "stats"},
+  {"STAT_THREADS", "stat_threads"},
+  {"STREAM_CPP_OUTPUT", "stream_cpp_output"},
   {"TEMPDIR", "temporary_dir"},
   {"UMASK", "umask"},
 };
@@ -527,6 +569,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::absolute_paths_in_stderr:
     return format_bool(m_absolute_paths_in_stderr);
 
+  case ConfigItem::async_store:
+    return format_bool(m_async_store);
+
   case ConfigItem::base_dir:
     return m_base_dir;
 
@@ -539,6 +584,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::compiler_check:
     return m_compiler_check;
 
+  case ConfigItem::compiler_check_cache:
+    return format_bool(m_compiler_check_cache);
+
   case ConfigItem::compiler_type:
     return compiler_type_to_string(m_compiler_type);
 
@@ -548,6 +596,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::compression_level:
     return FMT("{}", m_compression_level);
 
+  case ConfigItem::compression_threads:
+    return FMT("{}", m_compression_threads);
+
   case ConfigItem::cpp_extension:
     return m_cpp_extension;
 
@@ -572,6 +623,9 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::file_clone:
     return format_bool(m_file_clone);
 
+  case ConfigItem::file_hash_cache:
+    return format_bool(m_file_hash_cache);
+
   case ConfigItem::hard_link:
     return format_bool(m_hard_link);
 
@@ -587,6 +641,12 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::inode_cache:
     return format_bool(m_inode_cache);
 
+  case ConfigItem::inode_cache_persistent:
+    return format_bool(m_inode_cache_persistent);
+
+  case ConfigItem::inode_cache_size:
+    return format_cache_size(m_inode_cache_size);
+
   case ConfigItem::keep_comments_cpp:
     return format_bool(m_keep_comments_cpp);
 
@@ -596,9 +656,18 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::log_file:
     return m_log_file;
 
+  case ConfigItem::manifest_cache:
+    return format_bool(m_manifest_cache);
+
   case ConfigItem::max_files:
     return FMT("{}", m_max_files);
 
+  case ConfigItem::max_manifest_entries:
+    return FMT("{}", m_max_manifest_entries);
+
+  case ConfigItem::max_manifest_file_infos:
+    return FMT("{}", m_max_manifest_file_infos);
+
   case ConfigItem::max_size:
     return format_cache_size(m_max_size);
 
@@ -623,15 +692,30 @@ Config::get_string_value(const std::string& key) const
   case ConfigItem::recache:
     return format_bool(m_recache);
 
+  case ConfigItem::retrieve_threads:
+    return FMT("{}", m_retrieve_threads);
+
   case ConfigItem::run_second_cpp:
     return format_bool(m_run_second_cpp);
 
+  case ConfigItem::server:
+    return format_bool(m_server);
+
+  case ConfigItem::server_idle_timeout:
+    return FMT("{}", m_server_idle_timeout);
+
   case ConfigItem::sloppiness:
     return format_sloppiness(m_sloppiness);
 
+  case ConfigItem::stat_threads:
+    return FMT("{}", m_stat_threads);
+
   case ConfigItem::stats:
     return format_bool(m_stats);
 
+  case ConfigItem::stream_cpp_output:
+    return format_bool(m_stream_cpp_output);
+
   case ConfigItem::temporary_dir:
     return m_temporary_dir;
 
@@ -725,6 +809,10 @@ Config::set_item(const std::string& key,
     m_absolute_paths_in_stderr = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::async_store:
+    m_async_store = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::base_dir:
     m_base_dir = Util::expand_environment_variables(value);
     if (!m_base_dir.empty()) { // The empty string means "disable"
@@ -745,6 +833,10 @@ Config::set_item(const std::string& key,
     m_compiler_check = value;
     break;
 
+  case ConfigItem::compiler_check_cache:
+    m_compiler_check_cache = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::compiler_type:
     m_compiler_type = parse_compiler_type(value);
     break;
@@ -759,6 +851,14 @@ Config::set_item(const std::string& key,
     break;
   }
 
+  case ConfigItem::compression_threads:
+    m_compression_threads =
+      Util::parse_unsigned(value,
+                           nullopt,
+                           std::numeric_limits<uint32_t>::max(),
+                           "compression_threads");
+    break;
+
   case ConfigItem::cpp_extension:
     m_cpp_extension = value;
     break;
@@ -791,6 +891,10 @@ Config::set_item(const std::string& key,
     m_file_clone = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::file_hash_cache:
+    m_file_hash_cache = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::hard_link:
     m_hard_link = parse_bool(value, env_var_key, negate);
     break;
@@ -811,6 +915,14 @@ Config::set_item(const std::string& key,
     m_inode_cache = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::inode_cache_persistent:
+    m_inode_cache_persistent = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::inode_cache_size:
+    m_inode_cache_size = Util::parse_size(value);
+    break;
+
   case ConfigItem::keep_comments_cpp:
     m_keep_comments_cpp = parse_bool(value, env_var_key, negate);
     break;
@@ -823,10 +935,30 @@ Config::set_item(const std::string& key,
     m_log_file = Util::expand_environment_variables(value);
     break;
 
+  case ConfigItem::manifest_cache:
+    m_manifest_cache = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::max_files:
     m_max_files = Util::parse_unsigned(value, nullopt, nullopt, "max_files");
     break;
 
+  case ConfigItem::max_manifest_entries:
+    m_max_manifest_entries =
+      Util::parse_unsigned(value,
+                           1,
+                           std::numeric_limits<uint32_t>::max(),
+                           "max_manifest_entries");
+    break;
+
+  case ConfigItem::max_manifest_file_infos:
+    m_max_manifest_file_infos =
+      Util::parse_unsigned(value,
+                           1,
+                           std::numeric_limits<uint32_t>::max(),
+                           "max_manifest_file_infos");
+    break;
+
   case ConfigItem::max_size:
     m_max_size = Util::parse_size(value);
     break;
@@ -859,18 +991,44 @@ Config::set_item(const std::string& key,
     m_recache = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::retrieve_threads:
+    m_retrieve_threads = Util::parse_unsigned(
+      value, nullopt, std::numeric_limits<uint32_t>::max(), "retrieve_threads");
+    break;
+
   case ConfigItem::run_second_cpp:
     m_run_second_cpp = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::server:
+    m_server = parse_bool(value, env_var_key, negate);
+    break;
+
+  case ConfigItem::server_idle_timeout:
+    m_server_idle_timeout =
+      Util::parse_unsigned(value,
+                           nullopt,
+                           std::numeric_limits<uint32_t>::max(),
+                           "server_idle_timeout");
+    break;
+
   case ConfigItem::sloppiness:
     m_sloppiness = parse_sloppiness(value);
     break;
 
+  case ConfigItem::stat_threads:
+    m_stat_threads = Util::parse_unsigned(
+      value, nullopt, std::numeric_limits<uint32_t>::max(), "stat_threads");
+    break;
+
   case ConfigItem::stats:
     m_stats = parse_bool(value, env_var_key, negate);
     break;
 
+  case ConfigItem::stream_cpp_output:
+    m_stream_cpp_output = parse_bool(value, env_var_key, negate);
+    break;
+
   case ConfigItem::temporary_dir:
     m_temporary_dir = Util::expand_environment_variables(value);
     m_temporary_dir_configured_explicitly = true;
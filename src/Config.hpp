@@ -42,13 +42,16 @@ public:
   Config& operator=(const Config&) = default;
 
   bool absolute_paths_in_stderr() const;
+  bool async_store() const;
   const std::string& base_dir() const;
   const std::string& cache_dir() const;
   const std::string& compiler() const;
   const std::string& compiler_check() const;
+  bool compiler_check_cache() const;
   CompilerType compiler_type() const;
   bool compression() const;
   int8_t compression_level() const;
+  uint32_t compression_threads() const;
   const std::string& cpp_extension() const;
   bool debug() const;
   const std::string& debug_dir() const;
@@ -57,15 +60,21 @@ public:
   bool disable() const;
   const std::string& extra_files_to_hash() const;
   bool file_clone() const;
+  bool file_hash_cache() const;
   bool hard_link() const;
   bool hash_dir() const;
   const std::string& ignore_headers_in_manifest() const;
   const std::string& ignore_options() const;
   bool inode_cache() const;
+  bool inode_cache_persistent() const;
+  uint64_t inode_cache_size() const;
   bool keep_comments_cpp() const;
   double limit_multiple() const;
   const std::string& log_file() const;
+  bool manifest_cache() const;
   uint64_t max_files() const;
+  uint32_t max_manifest_entries() const;
+  uint32_t max_manifest_file_infos() const;
   uint64_t max_size() const;
   const std::string& path() const;
   bool pch_external_checksum() const;
@@ -74,9 +83,14 @@ public:
   bool read_only() const;
   bool read_only_direct() const;
   bool recache() const;
+  uint32_t retrieve_threads() const;
   bool run_second_cpp() const;
+  bool server() const;
+  uint32_t server_idle_timeout() const;
   uint32_t sloppiness() const;
+  uint32_t stat_threads() const;
   bool stats() const;
+  bool stream_cpp_output() const;
   const std::string& temporary_dir() const;
   uint32_t umask() const;
 
@@ -88,11 +102,17 @@ public:
   void set_depend_mode(bool value);
   void set_debug(bool value);
   void set_direct_mode(bool value);
+  void set_file_hash_cache(bool value);
   void set_ignore_options(const std::string& value);
   void set_inode_cache(bool value);
+  void set_inode_cache_persistent(bool value);
+  void set_inode_cache_size(uint64_t value);
+  void set_manifest_cache(bool value);
   void set_max_files(uint64_t value);
   void set_max_size(uint64_t value);
+  void set_read_only_direct(bool value);
   void set_run_second_cpp(bool value);
+  void set_stream_cpp_output(bool value);
 
   // Where to write configuration changes.
   const std::string& primary_config_path() const;
@@ -134,13 +154,16 @@ private:
   std::string m_secondary_config_path;
 
   bool m_absolute_paths_in_stderr = false;
+  bool m_async_store = false;
   std::string m_base_dir;
   std::string m_cache_dir;
   std::string m_compiler;
   std::string m_compiler_check = "mtime";
+  bool m_compiler_check_cache = false;
   CompilerType m_compiler_type = CompilerType::auto_guess;
   bool m_compression = true;
   int8_t m_compression_level = 0; // Use default level
+  uint32_t m_compression_threads = 0;
   std::string m_cpp_extension;
   bool m_debug = false;
   std::string m_debug_dir;
@@ -149,15 +172,21 @@ private:
   bool m_disable = false;
   std::string m_extra_files_to_hash;
   bool m_file_clone = false;
+  bool m_file_hash_cache = false;
   bool m_hard_link = false;
   bool m_hash_dir = true;
   std::string m_ignore_headers_in_manifest;
   std::string m_ignore_options;
   bool m_inode_cache = false;
+  bool m_inode_cache_persistent = false;
+  uint64_t m_inode_cache_size = 10 * 1000 * 1000;
   bool m_keep_comments_cpp = false;
   double m_limit_multiple = 0.8;
   std::string m_log_file;
+  bool m_manifest_cache = false;
   uint64_t m_max_files = 0;
+  uint32_t m_max_manifest_entries = 100;
+  uint32_t m_max_manifest_file_infos = 10000;
   uint64_t m_max_size = 5ULL * 1000 * 1000 * 1000;
   std::string m_path;
   bool m_pch_external_checksum = false;
@@ -166,9 +195,14 @@ private:
   bool m_read_only = false;
   bool m_read_only_direct = false;
   bool m_recache = false;
+  uint32_t m_retrieve_threads = 0;
   bool m_run_second_cpp = true;
+  bool m_server = false;
+  uint32_t m_server_idle_timeout = 600;
   uint32_t m_sloppiness = 0;
+  uint32_t m_stat_threads = 0;
   bool m_stats = true;
+  bool m_stream_cpp_output = false;
   std::string m_temporary_dir;
   uint32_t m_umask = std::numeric_limits<uint32_t>::max(); // Don't set umask
 
@@ -191,6 +225,12 @@ Config::absolute_paths_in_stderr() const
   return m_absolute_paths_in_stderr;
 }
 
+inline bool
+Config::async_store() const
+{
+  return m_async_store;
+}
+
 inline const std::string&
 Config::base_dir() const
 {
@@ -215,6 +255,12 @@ Config::compiler_check() const
   return m_compiler_check;
 }
 
+inline bool
+Config::compiler_check_cache() const
+{
+  return m_compiler_check_cache;
+}
+
 inline CompilerType
 Config::compiler_type() const
 {
@@ -233,6 +279,12 @@ Config::compression_level() const
   return m_compression_level;
 }
 
+inline uint32_t
+Config::compression_threads() const
+{
+  return m_compression_threads;
+}
+
 inline const std::string&
 Config::cpp_extension() const
 {
@@ -281,6 +333,12 @@ Config::file_clone() const
   return m_file_clone;
 }
 
+inline bool
+Config::file_hash_cache() const
+{
+  return m_file_hash_cache;
+}
+
 inline bool
 Config::hard_link() const
 {
@@ -311,6 +369,18 @@ Config::inode_cache() const
   return m_inode_cache;
 }
 
+inline bool
+Config::inode_cache_persistent() const
+{
+  return m_inode_cache_persistent;
+}
+
+inline uint64_t
+Config::inode_cache_size() const
+{
+  return m_inode_cache_size;
+}
+
 inline bool
 Config::keep_comments_cpp() const
 {
@@ -329,12 +399,30 @@ Config::log_file() const
   return m_log_file;
 }
 
+inline bool
+Config::manifest_cache() const
+{
+  return m_manifest_cache;
+}
+
 inline uint64_t
 Config::max_files() const
 {
   return m_max_files;
 }
 
+inline uint32_t
+Config::max_manifest_entries() const
+{
+  return m_max_manifest_entries;
+}
+
+inline uint32_t
+Config::max_manifest_file_infos() const
+{
+  return m_max_manifest_file_infos;
+}
+
 inline uint64_t
 Config::max_size() const
 {
@@ -383,24 +471,54 @@ Config::recache() const
   return m_recache;
 }
 
+inline uint32_t
+Config::retrieve_threads() const
+{
+  return m_retrieve_threads;
+}
+
 inline bool
 Config::run_second_cpp() const
 {
   return m_run_second_cpp;
 }
 
+inline bool
+Config::server() const
+{
+  return m_server;
+}
+
+inline uint32_t
+Config::server_idle_timeout() const
+{
+  return m_server_idle_timeout;
+}
+
 inline uint32_t
 Config::sloppiness() const
 {
   return m_sloppiness;
 }
 
+inline uint32_t
+Config::stat_threads() const
+{
+  return m_stat_threads;
+}
+
 inline bool
 Config::stats() const
 {
   return m_stats;
 }
 
+inline bool
+Config::stream_cpp_output() const
+{
+  return m_stream_cpp_output;
+}
+
 inline const std::string&
 Config::temporary_dir() const
 {
@@ -464,6 +582,12 @@ Config::set_direct_mode(bool value)
   m_direct_mode = value;
 }
 
+inline void
+Config::set_file_hash_cache(bool value)
+{
+  m_file_hash_cache = value;
+}
+
 inline void
 Config::set_ignore_options(const std::string& value)
 {
@@ -476,6 +600,24 @@ Config::set_inode_cache(bool value)
   m_inode_cache = value;
 }
 
+inline void
+Config::set_inode_cache_persistent(bool value)
+{
+  m_inode_cache_persistent = value;
+}
+
+inline void
+Config::set_inode_cache_size(uint64_t value)
+{
+  m_inode_cache_size = value;
+}
+
+inline void
+Config::set_manifest_cache(bool value)
+{
+  m_manifest_cache = value;
+}
+
 inline void
 Config::set_max_files(uint64_t value)
 {
@@ -488,8 +630,20 @@ Config::set_max_size(uint64_t value)
   m_max_size = value;
 }
 
+inline void
+Config::set_read_only_direct(bool value)
+{
+  m_read_only_direct = value;
+}
+
 inline void
 Config::set_run_second_cpp(bool value)
 {
   m_run_second_cpp = value;
 }
+
+inline void
+Config::set_stream_cpp_output(bool value)
+{
+  m_stream_cpp_output = value;
+}
@@ -21,22 +21,50 @@
 #include "Counters.hpp"
 #include "Logging.hpp"
 #include "SignalHandler.hpp"
+#include "StdMakeUnique.hpp"
 #include "Util.hpp"
 #include "hashutil.hpp"
 
 #include <algorithm>
 #include <string>
+#include <utility>
 #include <vector>
 
 using nonstd::string_view;
 
-Context::Context()
+CacheMappings::CacheMappings(const Config& config)
+#ifdef INODE_CACHE_SUPPORTED
+  : inode_cache(config),
+    manifest_cache(config),
+    file_hash_cache(config)
+#endif
+{
+#ifndef INODE_CACHE_SUPPORTED
+  (void)config;
+#endif
+}
+
+Context::Context(CacheMappings* cache_mappings)
+  : Context(cache_mappings ? nullptr : std::make_unique<CacheMappings>(config),
+            cache_mappings)
+{
+}
+
+Context::Context(std::unique_ptr<CacheMappings> own_cache_mappings,
+                 CacheMappings* shared_cache_mappings)
   : actual_cwd(Util::get_actual_cwd()),
-    apparent_cwd(Util::get_apparent_cwd(actual_cwd))
+    apparent_cwd(Util::get_apparent_cwd(actual_cwd)),
 #ifdef INODE_CACHE_SUPPORTED
-    ,
-    inode_cache(config)
+    inode_cache(shared_cache_mappings ? shared_cache_mappings->inode_cache
+                                      : own_cache_mappings->inode_cache),
+    manifest_cache(shared_cache_mappings
+                     ? shared_cache_mappings->manifest_cache
+                     : own_cache_mappings->manifest_cache),
+    file_hash_cache(shared_cache_mappings
+                      ? shared_cache_mappings->file_hash_cache
+                      : own_cache_mappings->file_hash_cache),
 #endif
+    m_own_cache_mappings(std::move(own_cache_mappings))
 {
 }
 
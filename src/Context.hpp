@@ -31,22 +31,42 @@
 #include "Sloppiness.hpp"
 
 #ifdef INODE_CACHE_SUPPORTED
+#  include "FileHashCache.hpp"
 #  include "InodeCache.hpp"
+#  include "ManifestCache.hpp"
 #endif
 
 #include "third_party/nonstd/optional.hpp"
 #include "third_party/nonstd/string_view.hpp"
 
+#include <memory>
 #include <string>
 #include <unordered_map>
 #include <vector>
 
 class SignalHandler;
 
+// The memory mapped caches used by a Context. A process that handles several
+// compilations can share one set between its Contexts so that the cache files
+// are only mapped once.
+struct CacheMappings : NonCopyable
+{
+  explicit CacheMappings(const Config& config);
+
+#ifdef INODE_CACHE_SUPPORTED
+  InodeCache inode_cache;
+  ManifestCache manifest_cache;
+  FileHashCache file_hash_cache;
+#endif
+};
+
 class Context : NonCopyable
 {
 public:
-  Context();
+  // Use `cache_mappings`, which must outlive the Context, instead of mapping
+  // the caches anew if not null.
+  explicit Context(CacheMappings* cache_mappings = nullptr);
+
   ~Context();
 
   ArgsInfo args_info;
@@ -88,6 +108,9 @@ public:
   // Have we tried and failed to get colored diagnostics?
   bool diagnostics_color_failed = false;
 
+  // Whether the direct mode lookup read the manifest file without errors.
+  bool manifest_is_intact = false;
+
   // The name of the temporary preprocessed file.
   std::string i_tmpfile;
 
@@ -102,7 +125,14 @@ public:
 
 #ifdef INODE_CACHE_SUPPORTED
   // InodeCache that caches source file hashes when enabled.
-  mutable InodeCache inode_cache;
+  InodeCache& inode_cache;
+
+  // ManifestCache that caches decoded manifests when enabled.
+  ManifestCache& manifest_cache;
+
+  // FileHashCache that caches source file hashes by path and status when
+  // enabled.
+  FileHashCache& file_hash_cache;
 #endif
 
   // Statistics updates which get written into the statistics file belonging to
@@ -117,6 +147,15 @@ public:
   // no ongoing compilation.
   pid_t compiler_pid = 0;
 
+  // Whether this is the background process that stores the result after the
+  // original ccache process has returned to the build system.
+  bool async_store_detached = false;
+
+  // Whether to stop after the direct mode lookup on a miss, e.g. when a server
+  // worker looks up a compilation on behalf of a client. Unlike read-only
+  // direct mode, hits are still recorded in the manifest.
+  bool direct_lookup_only = false;
+
   // Files used by the hash debugging functionality.
   std::vector<File> hash_debug_files;
 
@@ -142,6 +181,9 @@ public:
   void register_pending_tmp_file(const std::string& path);
 
 private:
+  Context(std::unique_ptr<CacheMappings> own_cache_mappings,
+          CacheMappings* shared_cache_mappings);
+
   nonstd::optional<Digest> m_manifest_name;
   nonstd::optional<std::string> m_manifest_path;
 
@@ -158,6 +200,9 @@ private:
 
   // [End of variables touched by the signal handler]
 
+  // Cache mappings owned by this Context, if not shared.
+  std::unique_ptr<CacheMappings> m_own_cache_mappings;
+
   friend SignalHandler;
   void unlink_pending_tmp_files();
   void unlink_pending_tmp_files_signal_safe(); // called from signal handler
@@ -0,0 +1,270 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include "FileHashCache.hpp"
+
+#include "Config.hpp"
+#include "Digest.hpp"
+#include "Hash.hpp"
+#include "Logging.hpp"
+#include "SeqlockEntry.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <atomic>
+
+// The file hash cache resides on a file that is mapped into shared memory by
+// running processes. It consists of a direct-mapped table of entries, each
+// mapping a key to a file digest and a return value. An insertion simply
+// replaces the entry that the key maps to.
+//
+// Concurrent access is lock-free since each entry is a SeqlockEntry.
+
+namespace {
+
+// The version number corresponds to the layout of the shared region and to
+// the semantics of the key.
+const uint32_t k_version = 1;
+
+// Note: Increment the version number if constants affecting storage size are
+// changed.
+const uint32_t k_num_entries = 64 * 1024;
+
+static_assert(Digest::size() == 20,
+              "Increment version number if size of digest is changed.");
+static_assert(IS_TRIVIALLY_COPYABLE(Digest),
+              "Digest is expected to be trivially copyable.");
+
+} // namespace
+
+struct FileHashCache::Value
+{
+  Digest key;         // Key supplied by the caller
+  Digest file_digest; // Cached file hash
+  int return_value;   // Cached return value
+};
+
+struct FileHashCache::SharedRegion
+{
+  uint32_t version;
+  std::atomic<int64_t> hits;
+  std::atomic<int64_t> misses;
+  std::atomic<int64_t> errors;
+  SeqlockEntry<Value> entries[k_num_entries];
+};
+
+bool
+FileHashCache::mmap_file(const std::string& file_hash_cache_file)
+{
+  m_sr = nullptr;
+  const bool mapped = m_mapping.map(
+    file_hash_cache_file, k_version, [](const void* /*data*/, size_t size) {
+      return size == sizeof(SharedRegion);
+    });
+  if (!mapped) {
+    return false;
+  }
+  m_sr = static_cast<SharedRegion*>(m_mapping.data());
+  if (m_config.debug()) {
+    LOG("file hash cache file loaded: {}", file_hash_cache_file);
+  }
+  return true;
+}
+
+bool
+FileHashCache::create_new_file(const std::string& filename)
+{
+  LOG_RAW("Creating a new file hash cache");
+
+  // The entries are zero-filled, i.e. unused.
+  return m_mapping.create(
+    filename, sizeof(SharedRegion), k_version, [](void* /*data*/) {});
+}
+
+bool
+FileHashCache::initialize()
+{
+  if (m_failed || !m_config.file_hash_cache()) {
+    return false;
+  }
+
+  if (m_sr) {
+    return true;
+  }
+
+  std::string filename = get_file();
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  // Try to create a new cache if we failed to map an existing file.
+  create_new_file(filename);
+
+  // Concurrent processes could try to create new files simultaneously and the
+  // file that actually landed on disk will be from the process that won the
+  // race. Thus we try to open the file from disk instead of reusing the file
+  // handle to the file we just created.
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  m_failed = true;
+  return false;
+}
+
+FileHashCache::FileHashCache(const Config& config)
+  : m_config(config),
+    m_mapping("file hash cache")
+{
+}
+
+FileHashCache::~FileHashCache()
+{
+}
+
+Digest
+FileHashCache::get_key(const std::string& path,
+                       const Stat& stat,
+                       InodeCache::ContentType type)
+{
+  Hash hash;
+  hash.hash(static_cast<int64_t>(type));
+  hash.hash(path);
+  hash.hash(static_cast<int64_t>(stat.device()));
+  hash.hash(static_cast<int64_t>(stat.inode()));
+  hash.hash(static_cast<int64_t>(stat.mode()));
+  hash.hash(static_cast<int64_t>(stat.size()));
+  hash.hash(static_cast<int64_t>(stat.mtim().tv_sec));
+  hash.hash(static_cast<int64_t>(stat.mtim().tv_nsec));
+  hash.hash(static_cast<int64_t>(stat.ctim().tv_sec));
+  hash.hash(static_cast<int64_t>(stat.ctim().tv_nsec));
+  return hash.digest();
+}
+
+bool
+FileHashCache::get(const Digest& key, Digest& file_digest, int& return_value)
+{
+  if (!initialize()) {
+    return false;
+  }
+
+  uint32_t hash;
+  Util::big_endian_to_int(key.bytes(), hash);
+  Value value;
+  const auto result = m_sr->entries[hash % k_num_entries].read(value);
+  const bool busy = result == SeqlockEntry<Value>::ReadResult::busy;
+  const bool found =
+    result == SeqlockEntry<Value>::ReadResult::ok && value.key == key;
+  if (found) {
+    file_digest = value.file_digest;
+    return_value = value.return_value;
+  }
+
+  LOG("file hash cache {}: {}", found ? "hit" : "miss", key.to_string());
+
+  if (m_config.debug()) {
+    if (found) {
+      ++m_sr->hits;
+    } else {
+      ++m_sr->misses;
+      if (busy) {
+        ++m_sr->errors;
+      }
+    }
+  }
+  return found;
+}
+
+bool
+FileHashCache::put(const Digest& key,
+                   const Digest& file_digest,
+                   int return_value)
+{
+  if (!initialize()) {
+    return false;
+  }
+
+  uint32_t hash;
+  Util::big_endian_to_int(key.bytes(), hash);
+  Value value;
+  value.key = key;
+  value.file_digest = file_digest;
+  value.return_value = return_value;
+  if (!m_sr->entries[hash % k_num_entries].write(value)) {
+    LOG("file hash cache entry busy, not inserting: {}", key.to_string());
+    if (m_config.debug()) {
+      ++m_sr->errors;
+    }
+    return false;
+  }
+
+  LOG("file hash cache insert: {}", key.to_string());
+
+  return true;
+}
+
+bool
+FileHashCache::is_stable(const Stat& stat) const
+{
+  const time_t now = m_current_time ? *m_current_time : time(nullptr);
+  return stat.mtime() < now - 1 && stat.ctime() < now - 1;
+}
+
+void
+FileHashCache::set_current_time(time_t time)
+{
+  m_current_time = time;
+}
+
+bool
+FileHashCache::drop()
+{
+  std::string file = get_file();
+  if (unlink(file.c_str()) != 0) {
+    return false;
+  }
+  m_mapping.unmap();
+  m_sr = nullptr;
+  return true;
+}
+
+std::string
+FileHashCache::get_file()
+{
+  return FMT("{}/file-hash-cache.v{}", m_config.temporary_dir(), k_version);
+}
+
+int64_t
+FileHashCache::get_hits()
+{
+  return initialize() ? m_sr->hits.load() : -1;
+}
+
+int64_t
+FileHashCache::get_misses()
+{
+  return initialize() ? m_sr->misses.load() : -1;
+}
+
+int64_t
+FileHashCache::get_errors()
+{
+  return initialize() ? m_sr->errors.load() : -1;
+}
@@ -0,0 +1,122 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "InodeCache.hpp"
+#include "SharedMapping.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+
+#include <string>
+
+class Config;
+class Digest;
+class Stat;
+
+// Cache of source code file hashes shared by concurrently running ccache
+// processes. The cache maps a key identifying a file by its path and status
+// information to the digest and return value of a previous hashing of the
+// file, so that files included by many compilations only need to be read and
+// hashed once.
+//
+// Any change to a file gives it a new key, so entries are never invalidated
+// explicitly; entries for old versions of files are simply overwritten
+// eventually. Callers must not store entries for files whose status
+// information may not reflect their content, e.g. files modified within the
+// timestamp granularity of the filesystem.
+class FileHashCache
+{
+public:
+  FileHashCache(const Config& config);
+  ~FileHashCache();
+
+  // Returns the key for the file at `path` with status `stat` hashed in the
+  // role `type`.
+  static Digest get_key(const std::string& path,
+                        const Stat& stat,
+                        InodeCache::ContentType type);
+
+  // Get digest and return value stored for `key` by a previous call to put().
+  //
+  // Returns true if values could be retrieved from the cache, false otherwise.
+  bool get(const Digest& key, Digest& file_digest, int& return_value);
+
+  // Store digest and return value for `key`, possibly replacing values stored
+  // for another key.
+  //
+  // Returns true if values could be stored in the cache, false otherwise.
+  bool put(const Digest& key, const Digest& file_digest, int return_value);
+
+  // Returns whether the status information `stat` of a file can be trusted to
+  // reflect its content, i.e. whether entries may be stored for the file. A
+  // file that was modified within the last second could be modified again
+  // without getting a new mtime or ctime on a filesystem with coarse
+  // timestamps.
+  bool is_stable(const Stat& stat) const;
+
+  // Use `time` instead of the current time in is_stable. Called from unit
+  // tests.
+  void set_current_time(time_t time);
+
+  // Map the cache file, creating it if needed. The other methods do this on
+  // demand, but a process may call it before forking so that its children
+  // share the mapping.
+  //
+  // Returns true if the cache is enabled and could be mapped, false otherwise.
+  bool initialize();
+
+  // Unmaps the current cache and removes the mapped file from disk.
+  //
+  // Returns true on success, false otherwise.
+  bool drop();
+
+  // Returns name of the persistent file.
+  std::string get_file();
+
+  // Returns total number of cache hits.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_hits();
+
+  // Returns total number of cache misses.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_misses();
+
+  // Returns total number of lookups and insertions that failed because of
+  // concurrent writes to the same entry.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_errors();
+
+private:
+  struct SharedRegion;
+  struct Value;
+
+  bool mmap_file(const std::string& file_hash_cache_file);
+  bool create_new_file(const std::string& filename);
+
+  const Config& m_config;
+  SharedMapping m_mapping;
+  struct SharedRegion* m_sr = nullptr; // Content of m_mapping
+  bool m_failed = false;
+  nonstd::optional<time_t> m_current_time;
+};
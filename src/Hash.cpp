@@ -20,12 +20,99 @@
 
 #include "Fd.hpp"
 #include "Logging.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 
+#include "third_party/blake3/blake3_subtree_ccache.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+#include <vector>
+
 using nonstd::string_view;
 
 const string_view HASH_DELIMITER("\000cCaChE\000", 8);
 
+namespace {
+
+// Buffers at least this large are hashed by several threads.
+const size_t k_min_parallel_hash_size = 4 * 1024 * 1024;
+
+// Size of the BLAKE3 subtrees that are hashed in parallel. Must be a power of
+// two multiple of BLAKE3_CHUNK_LEN.
+const size_t k_parallel_subtree_size = 512 * 1024;
+
+// Hashing is limited by memory bandwidth rather than CPU with more threads.
+const size_t k_max_hash_threads = 8;
+
+// Files at least k_min_parallel_hash_size large are read in blocks of this
+// size instead of READ_BUFFER_SIZE.
+const size_t k_parallel_read_size = 16 * 1024 * 1024;
+
+size_t
+get_hash_thread_count()
+{
+  static const size_t count =
+    std::min<size_t>(std::thread::hardware_concurrency(), k_max_hash_threads);
+  return count;
+}
+
+// Equivalent to blake3_hasher_update, but the whole subtrees of `data` are
+// compressed in parallel (if there is more than one CPU) since they are
+// independent of each other.
+void
+update_hasher_in_parallel(blake3_hasher& hasher,
+                          const uint8_t* data,
+                          size_t size)
+{
+  // Hash the start of the data serially so that the first subtree is aligned
+  // in the message.
+  const uint64_t count = blake3_hasher_count(&hasher);
+  const size_t prefix_size =
+    (k_parallel_subtree_size - count % k_parallel_subtree_size)
+    % k_parallel_subtree_size;
+  blake3_hasher_update(&hasher, data, prefix_size);
+  data += prefix_size;
+  size -= prefix_size;
+
+  const size_t n_subtrees = size / k_parallel_subtree_size;
+  const size_t n_threads = std::min(get_hash_thread_count(), n_subtrees);
+  const uint64_t offset = count + prefix_size;
+  std::vector<uint8_t> cvs(n_subtrees * 2 * BLAKE3_OUT_LEN);
+
+  const auto compress_subtrees = [&](size_t first, size_t step) {
+    for (size_t i = first; i < n_subtrees; i += step) {
+      const size_t subtree_offset = i * k_parallel_subtree_size;
+      blake3_hasher_compress_subtree(&hasher,
+                                     data + subtree_offset,
+                                     k_parallel_subtree_size,
+                                     offset + subtree_offset,
+                                     &cvs[i * 2 * BLAKE3_OUT_LEN]);
+    }
+  };
+  if (n_threads < 2) {
+    compress_subtrees(0, 1);
+  } else {
+    ThreadPool thread_pool(n_threads);
+    for (size_t t = 0; t < n_threads; ++t) {
+      // Each thread writes to its own elements of cvs.
+      thread_pool.enqueue([&, t] { compress_subtrees(t, n_threads); });
+    }
+    thread_pool.shut_down();
+  }
+
+  for (size_t i = 0; i < n_subtrees; ++i) {
+    blake3_hasher_push_subtree(
+      &hasher, &cvs[i * 2 * BLAKE3_OUT_LEN], k_parallel_subtree_size);
+  }
+
+  const size_t hashed = n_subtrees * k_parallel_subtree_size;
+  blake3_hasher_update(&hasher, data + hashed, size - hashed);
+}
+
+} // namespace
+
 Hash::Hash()
 {
   blake3_hasher_init(&m_hasher);
@@ -105,8 +192,38 @@ Hash::hash(int64_t x)
 bool
 Hash::hash_fd(int fd)
 {
-  return Util::read_fd(
-    fd, [this](const void* data, size_t size) { hash(data, size); });
+  struct stat st;
+  if (get_hash_thread_count() < 2 || fstat(fd, &st) != 0
+      || !S_ISREG(st.st_mode)
+      || static_cast<uint64_t>(st.st_size) < k_min_parallel_hash_size) {
+    return Util::read_fd(
+      fd, [this](const void* data, size_t size) { hash(data, size); });
+  }
+
+  // Read large files in big blocks so that hash_buffer can hash them in
+  // parallel.
+  std::unique_ptr<char[]> buffer(new char[k_parallel_read_size]);
+  while (true) {
+    size_t size = 0;
+    while (size < k_parallel_read_size) {
+      const ssize_t n = read(fd, &buffer[size], k_parallel_read_size - size);
+      if (n == 0) {
+        break;
+      } else if (n == -1) {
+        if (errno == EINTR) {
+          continue;
+        }
+        return false;
+      }
+      size += n;
+    }
+    if (size > 0) {
+      hash(buffer.get(), size);
+    }
+    if (size < k_parallel_read_size) {
+      return true;
+    }
+  }
 }
 
 bool
@@ -125,7 +242,13 @@ Hash::hash_file(const std::string& path)
 void
 Hash::hash_buffer(string_view buffer)
 {
-  blake3_hasher_update(&m_hasher, buffer.data(), buffer.size());
+  if (buffer.size() >= k_min_parallel_hash_size) {
+    update_hasher_in_parallel(m_hasher,
+                              reinterpret_cast<const uint8_t*>(buffer.data()),
+                              buffer.size());
+  } else {
+    blake3_hasher_update(&m_hasher, buffer.data(), buffer.size());
+  }
   if (!buffer.empty() && m_debug_binary) {
     (void)fwrite(buffer.data(), 1, buffer.size(), m_debug_binary);
   }
@@ -19,31 +19,42 @@
 #include "InodeCache.hpp"
 
 #include "Config.hpp"
-#include "Fd.hpp"
-#include "Finalizer.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
+#include "SeqlockEntry.hpp"
 #include "Stat.hpp"
-#include "TemporaryFile.hpp"
 #include "Util.hpp"
 #include "fmtmacros.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <libgen.h>
-#include <sys/mman.h>
+#include <limits>
 #include <type_traits>
 
 // The inode cache resides on a file that is mapped into shared memory by
 // running processes. It is implemented as a two level structure, where the top
-// level is a hash table consisting of buckets. Each bucket contains entries
-// that are sorted in LRU order. Entries map from keys representing files to
-// cached hash results.
+// level is a hash table consisting of buckets. Each bucket contains a fixed
+// number of entries that are replaced using the CLOCK algorithm: a lookup hit
+// marks the entry as referenced and a clock hand per bucket sweeps over the
+// entries when a victim is needed, giving referenced entries a second chance.
+// Entries map from keys representing files to cached hash results.
 //
-// Concurrent access is guarded by a mutex in each bucket.
+// Concurrent access is lock-free since each entry is a SeqlockEntry. The
+// reference mark is only a hint for the replacement and is kept outside of it.
 //
-// Current cache size is fixed and the given constants are considered large
-// enough for most projects. The size could be made configurable if there is a
-// demand for it.
+// The number of buckets is decided by the inode_cache_size configuration
+// option when the file is created. If a larger size is configured later, the
+// entries are migrated to a new file which then atomically replaces the old
+// one. Processes that still have the old file mapped notice that it has been
+// superseded and map the new file on their next access.
+//
+// The file is normally located in temporary_dir, but with the
+// inode_cache_persistent option it's stored in cache_dir so that it survives
+// reboots. Since device numbers may be assigned differently after a reboot,
+// files are then identified by the filesystem ID reported by statfs instead,
+// or by the device number together with the boot ID if the filesystem doesn't
+// report an ID.
 
 namespace {
 
@@ -53,12 +64,11 @@ namespace {
 // Note: The key is hashed using the main hash algorithm, so the version number
 // does not need to be incremented if said algorithm is changed (except if the
 // digest size changes since that affects the entry format).
-const uint32_t k_version = 1;
+const uint32_t k_version = 5;
 
 // Note: Increment the version number if constants affecting storage size are
 // changed.
-const uint32_t k_num_buckets = 32 * 1024;
-const uint32_t k_num_entries = 4;
+const uint32_t k_num_entries = 8;
 
 static_assert(Digest::size() == 20,
               "Increment version number if size of digest is changed.");
@@ -83,7 +93,7 @@ static_assert(
 struct InodeCache::Key
 {
   ContentType type;
-  dev_t st_dev;
+  Digest filesystem;
   ino_t st_ino;
   mode_t st_mode;
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
@@ -100,73 +110,126 @@ struct InodeCache::Key
   bool sloppy_time_macros;
 };
 
-struct InodeCache::Entry
+struct InodeCache::Value
 {
   Digest key_digest;  // Hashed key
   Digest file_digest; // Cached file hash
   int return_value;   // Cached return value
 };
 
+struct InodeCache::Entry
+{
+  SeqlockEntry<Value> seqlock;
+  std::atomic<uint8_t> referenced; // Set on hit, cleared by the clock hand
+};
+
 struct InodeCache::Bucket
 {
-  pthread_mutex_t mt;
+  std::atomic<uint32_t> clock_hand; // Next entry to consider, modulo size
   Entry entries[k_num_entries];
 };
 
 struct InodeCache::SharedRegion
 {
   uint32_t version;
+  uint32_t num_buckets;
+  std::atomic<uint32_t> superseded; // Set when migrated to a new file
   std::atomic<int64_t> hits;
   std::atomic<int64_t> misses;
   std::atomic<int64_t> errors;
-  Bucket buckets[k_num_buckets];
+  std::atomic<int64_t> evictions;
+
+  // The buckets follow directly after the header.
+  Bucket*
+  buckets()
+  {
+    return reinterpret_cast<Bucket*>(this + 1);
+  }
 };
 
+size_t
+InodeCache::region_size(uint32_t num_buckets)
+{
+  return sizeof(SharedRegion) + size_t(num_buckets) * sizeof(Bucket);
+}
+
+uint32_t
+InodeCache::num_buckets_for_size(uint64_t size)
+{
+  const uint64_t num_buckets =
+    size > sizeof(SharedRegion)
+      ? (size - sizeof(SharedRegion)) / sizeof(Bucket)
+      : 0;
+  return static_cast<uint32_t>(std::min<uint64_t>(
+    std::max<uint64_t>(num_buckets, 1), std::numeric_limits<uint32_t>::max()));
+}
+
+void
+InodeCache::unmap()
+{
+  m_mapping.unmap();
+  m_sr = nullptr;
+}
+
 bool
 InodeCache::mmap_file(const std::string& inode_cache_file)
 {
-  if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
-    m_sr = nullptr;
-  }
-  Fd fd(open(inode_cache_file.c_str(), O_RDWR));
-  if (!fd) {
-    LOG("Failed to open inode cache {}: {}", inode_cache_file, strerror(errno));
-    return false;
-  }
-  bool is_nfs;
-  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
-    LOG(
-      "Inode cache not supported because the cache file is located on nfs: {}",
-      inode_cache_file);
-    return false;
-  }
-  SharedRegion* sr = reinterpret_cast<SharedRegion*>(mmap(
-    nullptr, sizeof(SharedRegion), PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0));
-  fd.close();
-  if (sr == reinterpret_cast<void*>(-1)) {
-    LOG("Failed to mmap {}: {}", inode_cache_file, strerror(errno));
-    return false;
-  }
-  // Drop the file from disk if the found version is not matching. This will
-  // allow a new file to be generated.
-  if (sr->version != k_version) {
-    LOG(
-      "Dropping inode cache because found version {} does not match expected"
-      " version {}",
-      sr->version,
-      k_version);
-    munmap(sr, sizeof(SharedRegion));
-    unlink(inode_cache_file.c_str());
+  m_sr = nullptr;
+  const bool mapped = m_mapping.map(
+    inode_cache_file, k_version, [](const void* data, size_t size) {
+      const auto sr = static_cast<const SharedRegion*>(data);
+      if (size < sizeof(SharedRegion) || size != region_size(sr->num_buckets)) {
+        LOG("Inode cache file size {} does not match its number of buckets",
+            size);
+        return false;
+      }
+      return true;
+    });
+  if (!mapped) {
     return false;
   }
-  m_sr = sr;
+  m_sr = static_cast<SharedRegion*>(m_mapping.data());
   if (m_config.debug()) {
     LOG("inode cache file loaded: {}", inode_cache_file);
   }
   return true;
 }
 
+nonstd::optional<Digest>
+InodeCache::identify_filesystem(const std::string& path, const Stat& stat)
+{
+  const auto it = m_filesystems.find(stat.device());
+  if (it != m_filesystems.end()) {
+    return it->second;
+  }
+
+  nonstd::optional<Digest> result;
+  Hash hash;
+  if (!m_config.inode_cache_persistent()) {
+    hash.hash("device");
+    hash.hash(static_cast<int64_t>(stat.device()));
+    result = hash.digest();
+  } else if (const uint64_t fs_id = Util::get_filesystem_id(path)) {
+    hash.hash("filesystem");
+    hash.hash(static_cast<int64_t>(fs_id));
+    result = hash.digest();
+  } else {
+    if (!m_boot_id) {
+      m_boot_id = Util::get_boot_id();
+    }
+    if (!m_boot_id->empty()) {
+      hash.hash("boot");
+      hash.hash(*m_boot_id);
+      hash.hash(static_cast<int64_t>(stat.device()));
+      result = hash.digest();
+    } else {
+      LOG("Can't identify the filesystem of {} across reboots", path);
+    }
+  }
+  m_filesystems.emplace(stat.device(), result);
+  return result;
+}
+
 bool
 InodeCache::hash_inode(const std::string& path,
                        ContentType type,
@@ -177,11 +240,15 @@ InodeCache::hash_inode(const std::string& path,
     LOG("Could not stat {}: {}", path, strerror(stat.error_number()));
     return false;
   }
+  const auto filesystem = identify_filesystem(path, stat);
+  if (!filesystem) {
+    return false;
+  }
 
   Key key;
   memset(&key, 0, sizeof(Key));
   key.type = type;
-  key.st_dev = stat.device();
+  key.filesystem = *filesystem;
   key.st_ino = stat.inode();
   key.st_mode = stat.mode();
 #ifdef HAVE_STRUCT_STAT_ST_MTIM
@@ -202,112 +269,108 @@ InodeCache::hash_inode(const std::string& path,
   return true;
 }
 
-bool
-InodeCache::with_bucket(const Digest& key_digest,
-                        const BucketHandler& bucket_handler)
+InodeCache::Bucket&
+InodeCache::get_bucket(SharedRegion& sr, const Digest& key_digest)
 {
   uint32_t hash;
   Util::big_endian_to_int(key_digest.bytes(), hash);
-  const uint32_t index = hash % k_num_buckets;
-  Bucket* bucket = &m_sr->buckets[index];
-  int err = pthread_mutex_lock(&bucket->mt);
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
-  if (err == EOWNERDEAD) {
-    if (m_config.debug()) {
-      ++m_sr->errors;
+  return sr.buckets()[hash % sr.num_buckets];
+}
+
+InodeCache::Entry&
+InodeCache::find_victim(Bucket& bucket, const Digest& key_digest)
+{
+  // Overwrite an existing entry for the key or fill an unused entry if there
+  // is one. This is only a hint since the entry could be written concurrently.
+  Entry* unused = nullptr;
+  for (auto& entry : bucket.entries) {
+    Value value;
+    const auto result = entry.seqlock.read(value);
+    if (result == SeqlockEntry<Value>::ReadResult::ok
+        && value.key_digest == key_digest) {
+      return entry;
     }
-    err = pthread_mutex_consistent(&bucket->mt);
-    if (err) {
-      LOG(
-        "Can't consolidate stale mutex at index {}: {}", index, strerror(err));
-      LOG_RAW("Consider removing the inode cache file if the problem persists");
-      return false;
+    if (!unused && result == SeqlockEntry<Value>::ReadResult::unused) {
+      unused = &entry;
     }
-    LOG("Wiping bucket at index {} because of stale mutex", index);
-    memset(bucket->entries, 0, sizeof(Bucket::entries));
-  } else {
-#endif
-    if (err != 0) {
-      LOG("Failed to lock mutex at index {}: {}", index, strerror(err));
-      LOG_RAW("Consider removing the inode cache file if problem persists");
-      ++m_sr->errors;
-      return false;
+  }
+  if (unused) {
+    return *unused;
+  }
+
+  // Otherwise let the clock hand sweep over the entries, clearing reference
+  // marks, until it finds an entry that has not been referenced since the hand
+  // last passed it. Give up after two turns in case other processes keep
+  // marking entries concurrently.
+  uint32_t index = 0;
+  for (uint32_t i = 0; i < 2 * k_num_entries; ++i) {
+    index =
+      bucket.clock_hand.fetch_add(1, std::memory_order_relaxed) % k_num_entries;
+    Entry& entry = bucket.entries[index];
+    if (!entry.referenced.load(std::memory_order_relaxed)) {
+      return entry;
     }
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
+    entry.referenced.store(0, std::memory_order_relaxed);
   }
-#endif
+  return bucket.entries[index];
+}
 
-  try {
-    bucket_handler(bucket);
-  } catch (...) {
-    pthread_mutex_unlock(&bucket->mt);
-    throw;
+uint32_t
+InodeCache::migrate_entries(SharedRegion& from, SharedRegion& to)
+{
+  to.hits = from.hits.load();
+  to.misses = from.misses.load();
+  to.errors = from.errors.load();
+  to.evictions = from.evictions.load();
+
+  uint32_t migrated = 0;
+  for (uint32_t i = 0; i < from.num_buckets; ++i) {
+    for (const auto& entry : from.buckets()[i].entries) {
+      Value value;
+      if (entry.seqlock.read(value) != SeqlockEntry<Value>::ReadResult::ok) {
+        continue;
+      }
+      // The new region is not shared yet, so no other writers can interfere.
+      for (auto& new_entry : get_bucket(to, value.key_digest).entries) {
+        if (!new_entry.seqlock.is_used()) {
+          new_entry.seqlock.write(value);
+          new_entry.referenced = entry.referenced.load();
+          ++migrated;
+          break;
+        }
+      }
+    }
   }
-  pthread_mutex_unlock(&bucket->mt);
-  return true;
+  return migrated;
 }
 
 bool
-InodeCache::create_new_file(const std::string& filename)
+InodeCache::create_new_file(const std::string& filename, uint32_t num_buckets)
 {
-  LOG_RAW("Creating a new inode cache");
-
-  // Create the new file to a temporary name to prevent other processes from
-  // mapping it before it is fully initialized.
-  TemporaryFile tmp_file(filename);
-
-  Finalizer temp_file_remover([&] { unlink(tmp_file.path.c_str()); });
-
-  bool is_nfs;
-  if (Util::is_nfs_fd(*tmp_file.fd, &is_nfs) == 0 && is_nfs) {
-    LOG(
-      "Inode cache not supported because the cache file would be located on"
-      " nfs: {}",
-      filename);
-    return false;
-  }
-  int err = Util::fallocate(*tmp_file.fd, sizeof(SharedRegion));
-  if (err) {
-    LOG("Failed to allocate file space for inode cache: {}", strerror(err));
-    return false;
-  }
-  SharedRegion* sr =
-    reinterpret_cast<SharedRegion*>(mmap(nullptr,
-                                         sizeof(SharedRegion),
-                                         PROT_READ | PROT_WRITE,
-                                         MAP_SHARED,
-                                         *tmp_file.fd,
-                                         0));
-  if (sr == reinterpret_cast<void*>(-1)) {
-    LOG("Failed to mmap new inode cache: {}", strerror(errno));
+  LOG("Creating a new inode cache with {} buckets", num_buckets);
+
+  // The file is zero-filled, which is a valid initial state for the entries.
+  // If a file is currently mapped, it's replaced by the new file. Processes
+  // that have it mapped will remap when they see that it has been superseded.
+  const bool created = m_mapping.create(
+    filename,
+    region_size(num_buckets),
+    k_version,
+    [&](void* data) {
+      auto sr = static_cast<SharedRegion*>(data);
+      sr->num_buckets = num_buckets;
+      if (m_sr) {
+        const uint32_t migrated = migrate_entries(*m_sr, *sr);
+        LOG("Migrated {} entries to the new inode cache", migrated);
+      }
+    },
+    m_sr != nullptr);
+  if (!created) {
     return false;
   }
-
-  // Initialize new shared region.
-  sr->version = k_version;
-  pthread_mutexattr_t mattr;
-  pthread_mutexattr_init(&mattr);
-  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
-#ifdef HAVE_PTHREAD_MUTEX_ROBUST
-  pthread_mutexattr_setrobust(&mattr, PTHREAD_MUTEX_ROBUST);
-#endif
-  for (auto& bucket : sr->buckets) {
-    pthread_mutex_init(&bucket.mt, &mattr);
-  }
-
-  munmap(sr, sizeof(SharedRegion));
-  tmp_file.fd.close();
-
-  // link() will fail silently if a file with the same name already exists.
-  // This will be the case if two processes try to create a new file
-  // simultaneously. Thus close the current file handle and reopen a new one,
-  // which will make us use the first created file even if we didn't win the
-  // race.
-  if (link(tmp_file.path.c_str(), filename.c_str()) != 0) {
-    LOG("Failed to link new inode cache: {}", strerror(errno));
-    return false;
+  if (m_sr) {
+    m_sr->superseded = 1;
   }
-
   return true;
 }
 
@@ -318,18 +381,30 @@ InodeCache::initialize()
     return false;
   }
 
-  if (m_sr) {
+  if (m_sr && !m_sr->superseded.load(std::memory_order_relaxed)) {
     return true;
   }
 
   std::string filename = get_file();
-  if (m_sr || mmap_file(filename)) {
-    return true;
+  const uint32_t num_buckets =
+    num_buckets_for_size(m_config.inode_cache_size());
+  if (mmap_file(filename)) {
+    // Only grow the cache since processes with different configurations would
+    // otherwise keep replacing each other's files.
+    if (m_sr->num_buckets >= num_buckets) {
+      return true;
+    }
+    LOG("Growing inode cache from {} to {} buckets",
+        m_sr->num_buckets,
+        num_buckets);
+    if (!create_new_file(filename, num_buckets)) {
+      return true;
+    }
+  } else {
+    // Try to create a new cache if we failed to map an existing file.
+    create_new_file(filename, num_buckets);
   }
 
-  // Try to create a new cache if we failed to map an existing file.
-  create_new_file(filename);
-
   // Concurrent processes could try to create new files simultaneously and the
   // file that actually landed on disk will be from the process that won the
   // race. Thus we try to open the file from disk instead of reusing the file
@@ -342,15 +417,14 @@ InodeCache::initialize()
   return false;
 }
 
-InodeCache::InodeCache(const Config& config) : m_config(config)
+InodeCache::InodeCache(const Config& config)
+  : m_config(config),
+    m_mapping("inode cache")
 {
 }
 
 InodeCache::~InodeCache()
 {
-  if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
-  }
 }
 
 bool
@@ -369,26 +443,24 @@ InodeCache::get(const std::string& path,
   }
 
   bool found = false;
-  const bool success = with_bucket(key_digest, [&](Bucket* const bucket) {
-    for (uint32_t i = 0; i < k_num_entries; ++i) {
-      if (bucket->entries[i].key_digest == key_digest) {
-        if (i > 0) {
-          Entry tmp = bucket->entries[i];
-          memmove(&bucket->entries[1], &bucket->entries[0], sizeof(Entry) * i);
-          bucket->entries[0] = tmp;
-        }
-
-        file_digest = bucket->entries[0].file_digest;
-        if (return_value) {
-          *return_value = bucket->entries[0].return_value;
-        }
-        found = true;
-        break;
+  bool busy = false;
+  for (auto& entry : get_bucket(*m_sr, key_digest).entries) {
+    Value value;
+    const auto result = entry.seqlock.read(value);
+    if (result == SeqlockEntry<Value>::ReadResult::busy) {
+      busy = true;
+    } else if (result == SeqlockEntry<Value>::ReadResult::ok
+               && value.key_digest == key_digest) {
+      if (!entry.referenced.load(std::memory_order_relaxed)) {
+        entry.referenced.store(1, std::memory_order_relaxed);
+      }
+      file_digest = value.file_digest;
+      if (return_value) {
+        *return_value = value.return_value;
       }
+      found = true;
+      break;
     }
-  });
-  if (!success) {
-    return false;
   }
 
   LOG("inode cache {}: {}", found ? "hit" : "miss", path);
@@ -398,6 +470,9 @@ InodeCache::get(const std::string& path,
       ++m_sr->hits;
     } else {
       ++m_sr->misses;
+      if (busy) {
+        ++m_sr->errors;
+      }
     }
     LOG("Accumulated stats for inode cache: hits={}, misses={}, errors={}",
         m_sr->hits.load(),
@@ -422,20 +497,28 @@ InodeCache::put(const std::string& path,
     return false;
   }
 
-  const bool success = with_bucket(key_digest, [&](Bucket* const bucket) {
-    memmove(&bucket->entries[1],
-            &bucket->entries[0],
-            sizeof(Entry) * (k_num_entries - 1));
+  Entry& entry = find_victim(get_bucket(*m_sr, key_digest), key_digest);
 
-    bucket->entries[0].key_digest = key_digest;
-    bucket->entries[0].file_digest = file_digest;
-    bucket->entries[0].return_value = return_value;
+  bool evicted = false;
+  const bool written = entry.seqlock.update([&](Value& value, bool used) {
+    evicted = used && value.key_digest != key_digest;
+    entry.referenced.store(0, std::memory_order_relaxed);
+    value.key_digest = key_digest;
+    value.file_digest = file_digest;
+    value.return_value = return_value;
   });
-
-  if (!success) {
+  if (!written) {
+    LOG("inode cache entry busy, not inserting: {}", path);
+    if (m_config.debug()) {
+      ++m_sr->errors;
+    }
     return false;
   }
 
+  if (evicted && m_config.debug()) {
+    ++m_sr->evictions;
+  }
+
   LOG("inode cache insert: {}", path);
 
   return true;
@@ -449,8 +532,7 @@ InodeCache::drop()
     return false;
   }
   if (m_sr) {
-    munmap(m_sr, sizeof(SharedRegion));
-    m_sr = nullptr;
+    unmap();
   }
   return true;
 }
@@ -458,7 +540,10 @@ InodeCache::drop()
 std::string
 InodeCache::get_file()
 {
-  return FMT("{}/inode-cache.v{}", m_config.temporary_dir(), k_version);
+  return FMT("{}/inode-cache.v{}",
+             m_config.inode_cache_persistent() ? m_config.cache_dir()
+                                               : m_config.temporary_dir(),
+             k_version);
 }
 
 int64_t
@@ -478,3 +563,32 @@ InodeCache::get_errors()
 {
   return initialize() ? m_sr->errors.load() : -1;
 }
+
+int64_t
+InodeCache::get_evictions()
+{
+  return initialize() ? m_sr->evictions.load() : -1;
+}
+
+int64_t
+InodeCache::get_used_entries()
+{
+  if (!initialize()) {
+    return -1;
+  }
+  int64_t used_entries = 0;
+  for (uint32_t i = 0; i < m_sr->num_buckets; ++i) {
+    for (const auto& entry : m_sr->buckets()[i].entries) {
+      if (entry.seqlock.is_used()) {
+        ++used_entries;
+      }
+    }
+  }
+  return used_entries;
+}
+
+int64_t
+InodeCache::get_capacity()
+{
+  return initialize() ? int64_t(m_sr->num_buckets) * k_num_entries : -1;
+}
@@ -20,14 +20,19 @@
 
 #include "system.hpp"
 
+#include "Digest.hpp"
+#include "SharedMapping.hpp"
+
 #include "config.h"
 
-#include <functional>
+#include "third_party/nonstd/optional.hpp"
+
 #include <string>
+#include <unordered_map>
 
 class Config;
 class Context;
-class Digest;
+class Stat;
 
 class InodeCache
 {
@@ -64,6 +69,13 @@ public:
            const Digest& file_digest,
            int return_value = 0);
 
+  // Map the cache file, creating it if needed. The other methods do this on
+  // demand, but a process may call it before forking so that its children
+  // share the mapping.
+  //
+  // Returns true if the cache is enabled and could be mapped, false otherwise.
+  bool initialize();
+
   // Unmaps the current cache and removes the mapped file from disk.
   //
   // Returns true on success, false otherwise.
@@ -84,28 +96,48 @@ public:
 
   // Returns total number of errors.
   //
-  // Currently only lock errors will be counted, since the counter is not
+  // Currently only lookups and insertions that failed because of concurrent
+  // writes to the same entries will be counted, since the counter is not
   // accessible before the file has been successfully mapped into memory.
   //
   // Counters are incremented in debug mode only.
   int64_t get_errors();
 
+  // Returns total number of entries that have been replaced by entries for
+  // other files.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_evictions();
+
+  // Returns number of entries in use. The entries are counted on each call.
+  int64_t get_used_entries();
+
+  // Returns number of entries that fit in the cache.
+  int64_t get_capacity();
+
 private:
   struct Bucket;
   struct Entry;
   struct Key;
   struct SharedRegion;
-  using BucketHandler = std::function<void(Bucket* bucket)>;
+  struct Value;
 
+  static size_t region_size(uint32_t num_buckets);
+  static uint32_t num_buckets_for_size(uint64_t size);
+  void unmap();
   bool mmap_file(const std::string& inode_cache_file);
-  static bool
-  hash_inode(const std::string& path, ContentType type, Digest& digest);
-  bool with_bucket(const Digest& key_digest,
-                   const BucketHandler& bucket_handler);
-  static bool create_new_file(const std::string& filename);
-  bool initialize();
+  nonstd::optional<Digest> identify_filesystem(const std::string& path,
+                                               const Stat& stat);
+  bool hash_inode(const std::string& path, ContentType type, Digest& digest);
+  static Bucket& get_bucket(SharedRegion& sr, const Digest& key_digest);
+  static Entry& find_victim(Bucket& bucket, const Digest& key_digest);
+  static uint32_t migrate_entries(SharedRegion& from, SharedRegion& to);
+  bool create_new_file(const std::string& filename, uint32_t num_buckets);
 
   const Config& m_config;
-  struct SharedRegion* m_sr = nullptr;
+  SharedMapping m_mapping;
+  struct SharedRegion* m_sr = nullptr; // Content of m_mapping
   bool m_failed = false;
+  nonstd::optional<std::string> m_boot_id;
+  std::unordered_map<dev_t, nonstd::optional<Digest>> m_filesystems;
 };
@@ -26,6 +26,8 @@
 #include "execute.hpp"
 #include "fmtmacros.hpp"
 
+#include <mutex>
+
 #ifdef HAVE_SYSLOG_H
 #  include <syslog.h>
 #endif
@@ -62,6 +64,9 @@ std::string debug_log_buffer;
 // Whether debug logging is enabled via configuration or environment variable.
 bool debug_log_enabled = false;
 
+// Serializes logging from worker threads.
+std::mutex log_mutex;
+
 // Print error message to stderr about failure writing to the log file and exit
 // with failure.
 [[noreturn]] void
@@ -78,6 +83,8 @@ print_fatal_error_and_exit()
 void
 do_log(string_view message, bool bulk)
 {
+  std::unique_lock<std::mutex> lock(log_mutex);
+
   static char prefix[200];
 
   if (!bulk) {
@@ -127,13 +134,19 @@ do_log(string_view message, bool bulk)
 
 namespace Logging {
 
-// Initialize logging. Call only once.
 void
 init(const Config& config)
 {
   debug_log_enabled = config.debug();
+  debug_log_buffer.clear();
+  logfile.close();
+  logfile_path.clear();
 
 #ifdef HAVE_SYSLOG
+  if (use_syslog) {
+    closelog();
+    use_syslog = false;
+  }
   if (config.log_file() == "syslog") {
     use_syslog = true;
     openlog("ccache", LOG_PID, LOG_USER);
@@ -57,8 +57,10 @@ class Config;
 
 namespace Logging {
 
-// Initialize global logging state. Must be called once before using the other
-// logging functions.
+// Initialize global logging state. Must be called before using the other
+// logging functions. May be called again to start over with a new
+// configuration, which closes the previous log file and clears the debug log
+// buffer.
 void init(const Config& config);
 
 // Return whether logging is enabled to at least one destination.
@@ -22,55 +22,100 @@
 #include "CacheEntryReader.hpp"
 #include "CacheEntryWriter.hpp"
 #include "Checksum.hpp"
+#include "CompressionDictionary.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
 #include "Digest.hpp"
+#include "Fd.hpp"
 #include "File.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
+#include "NonCopyable.hpp"
 #include "Sloppiness.hpp"
+#include "Stat.hpp"
+#include "Statistic.hpp"
 #include "StdMakeUnique.hpp"
+#include "ThreadPool.hpp"
 #include "fmtmacros.hpp"
 #include "hashutil.hpp"
 
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+#ifdef INODE_CACHE_SUPPORTED
+#  include "ManifestCache.hpp"
+#endif
+
+#ifdef HAVE_SYS_MMAN_H
+#  include <sys/mman.h>
+#endif
+
 // Manifest data format
 // ====================
 //
 // Integers are big-endian.
 //
-// <manifest>      ::= <header> <body> <epilogue
+// <manifest>      ::= <header> <body> <epilogue> <journal_frame>*
 // <header>        ::= <magic> <version> <compr_type> <compr_level>
 //                     <content_len>
-// <magic>         ::= 4 bytes ("cCrS")
+// <magic>         ::= 4 bytes ("cCmF")
 // <version>       ::= uint8_t
 // <compr_type>    ::= <compr_none> | <compr_zstd>
 // <compr_none>    ::= 0 (uint8_t)
 // <compr_zstd>    ::= 1 (uint8_t)
 // <compr_level>   ::= int8_t
 // <content_len>   ::= uint64_t ; size of file if stored uncompressed
-// <body>          ::= <paths> <includes> <results> ; body is potentially
+// <body>          ::= <counts> <path_entry>* <include_entry>* <result>*
+//                     <include_index>* <path_data> ; body is potentially
 //                                                  ; compressed
-// <paths>         ::= <n_paths> <path_entry>*
+// <counts>        ::= <n_paths> <n_includes> <n_results> <n_indexes>
 // <n_paths>       ::= uint32_t
-// <path_entry>    ::= <path_len> <path>
-// <path_len>      ::= uint16_t
-// <path>          ::= path_len bytes
-// <includes>      ::= <n_includes> <include_entry>*
 // <n_includes>    ::= uint32_t
+// <n_results>     ::= uint32_t
+// <n_indexes>     ::= uint32_t ; total number of include indexes
+// <path_entry>    ::= <path_offset> <path_len>
+// <path_offset>   ::= uint32_t ; offset of path in path_data
+// <path_len>      ::= uint32_t
 // <include_entry> ::= <path_index> <digest> <fsize> <mtime> <ctime>
 // <path_index>    ::= uint32_t
 // <digest>        ::= Digest::size() bytes
 // <fsize>         ::= uint64_t ; file size
 // <mtime>         ::= int64_t ; modification time
 // <ctime>         ::= int64_t ; status change time
-// <results>       ::= <n_results> <result>*
-// <n_results>     ::= uint32_t
-// <result>        ::= <n_indexes> <include_index>* <name>
-// <n_indexes>     ::= uint32_t
+// <result>        ::= <first_index> <n_indexes> <name> <last_used>
+// <first_index>   ::= uint32_t ; position of first include_index
 // <include_index> ::= uint32_t
 // <name>          ::= Digest::size() bytes
+// <last_used>     ::= int64_t ; time of last store or use
+// <path_data>     ::= concatenated paths
 // <epilogue>      ::= <checksum>
 // <checksum>      ::= uint64_t ; XXH3 of content bytes
+// <journal_frame> ::= <frame_body> <frame_len> <frame_checksum> <frame_magic>
+// <frame_body>    ::= <counts> <path_entry>* <include_entry>* <result>*
+//                     <include_index>* <path_data> ; never compressed
+// <frame_len>     ::= uint32_t ; size of frame_body
+// <frame_checksum>::= uint64_t ; XXH3 of frame_body
+// <frame_magic>   ::= 4 bytes ("cCmJ")
+//
+// All parts of the body except <path_data> have a fixed size, so the body can
+// be used in place without parsing it, for instance when an uncompressed
+// manifest is mapped into memory. The body is called a "flat manifest" below.
+//
+// New results are normally appended to an existing manifest file as journal
+// frames instead of rewriting the whole file. A frame is a self-contained flat
+// manifest with one result, and the frames are located by
+// reading their trailers backwards from the end of the file. When the journal
+// becomes larger than the rest of the file, the frames are merged into the body
+// again, which is called compaction below. Data after the last intact frame,
+// e.g. from an interrupted append, is ignored and dropped by the next
+// compaction.
+//
+// When there are too many results or file infos, compaction evicts the least
+// recently used results. A cache hit updates the modification time of the
+// result file instead of the manifest, which would otherwise change on every
+// hit, so the last use of the results is refreshed from their files before
+// evicting.
 //
 // Sketch of concrete layout:
 
@@ -81,11 +126,14 @@
 // <content_len>   8 bytes
 // --- [potentially compressed from here] -------------------------------------
 // <n_paths>       4 bytes
-// <path_len>      2 bytes
-// <path>          path_len bytes
+// <n_includes>    4 bytes
+// <n_results>     4 bytes
+// <n_indexes>     4 bytes
+// ----------------------------------------------------------------------------
+// <path_offset>   4 bytes
+// <path_len>      4 bytes
 // ...
 // ----------------------------------------------------------------------------
-// <n_includes>    4 bytes
 // <path_index>    4 bytes
 // <digest>        Digest::size() bytes
 // <fsize>         8 bytes
@@ -93,13 +141,23 @@
 // <ctime>         8 bytes
 // ...
 // ----------------------------------------------------------------------------
-// <n_results>     4 bytes
+// <first_index>   4 bytes
 // <n_indexes>     4 bytes
-// <include_index> 4 bytes
-// ...
 // <name>          Digest::size() bytes
+// <last_used>     8 bytes
+// ...
+// ----------------------------------------------------------------------------
+// <include_index> 4 bytes
 // ...
+// ----------------------------------------------------------------------------
+// <path_data>     sum of path_len bytes
 // checksum        8 bytes
+// --- [optional journal frames from here] ------------------------------------
+// <frame_body>    frame_len bytes
+// <frame_len>     4 bytes
+// <frame_checksum> 8 bytes
+// <frame_magic>   4 bytes
+// ...
 //
 //
 // Version history
@@ -107,13 +165,23 @@
 //
 // 1: Introduced in ccache 3.0. (Files are always compressed with gzip.)
 // 2: Introduced in ccache 4.0.
+// 3: Introduced in ccache 4.4.
+//
+// Version 2 is still supported for reading. Its body is a sequential stream
+// that has to be parsed:
+//
+// <body_v2>       ::= <paths> <includes> <results>
+// <paths>         ::= <n_paths> <path_entry_v2>*
+// <path_entry_v2> ::= <path_len_v2> <path>
+// <path_len_v2>   ::= uint16_t
+// <path>          ::= path_len_v2 bytes
+// <includes>      ::= <n_includes> <include_entry>*
+// <results>       ::= <n_results> <result_v2>*
+// <result_v2>     ::= <n_indexes> <include_index>* <name>
 
 using nonstd::nullopt;
 using nonstd::optional;
 
-const uint32_t k_max_manifest_entries = 100;
-const uint32_t k_max_manifest_file_info_entries = 10000;
-
 namespace {
 
 struct FileInfo
@@ -165,6 +233,10 @@ struct ResultEntry
 
   // Name of the result.
   Digest name;
+
+  // Time of the last store or use as known at the last compaction. Not part of
+  // the identity of the entry.
+  int64_t last_used;
 };
 
 bool
@@ -213,7 +285,8 @@ struct ManifestData
                                                       save_timestamp));
     }
 
-    ResultEntry entry{std::move(file_info_indexes), result_digest};
+    ResultEntry entry{
+      std::move(file_info_indexes), result_digest, time_of_compilation};
     if (std::find(results.begin(), results.end(), entry) == results.end()) {
       results.push_back(std::move(entry));
       return true;
@@ -222,7 +295,194 @@ struct ManifestData
     }
   }
 
+  // Add the results in `others` that don't already exist.
+  //
+  // Throws Error if an element in `others` is inconsistent.
+  void
+  add_results(const std::vector<ManifestData>& others)
+  {
+    std::unordered_map<std::string, uint32_t /*index*/> mf_files;
+    for (uint32_t i = 0; i < files.size(); ++i) {
+      mf_files.emplace(files[i], i);
+    }
+
+    std::unordered_map<FileInfo, uint32_t /*index*/> mf_file_infos;
+    for (uint32_t i = 0; i < file_infos.size(); ++i) {
+      mf_file_infos.emplace(file_infos[i], i);
+    }
+
+    for (const auto& other : others) {
+      for (const auto& result : other.results) {
+        ResultEntry entry{{}, result.name, result.last_used};
+        entry.file_info_indexes.reserve(result.file_info_indexes.size());
+        for (uint32_t index : result.file_info_indexes) {
+          if (index >= other.file_infos.size()
+              || other.file_infos[index].index >= other.files.size()) {
+            throw Error("Corrupt manifest: bad file info index {}", index);
+          }
+          FileInfo fi = other.file_infos[index];
+          const auto& path = other.files[fi.index];
+          const auto f_it = mf_files.emplace(path, files.size());
+          if (f_it.second) {
+            files.push_back(path);
+          }
+          fi.index = f_it.first->second;
+          const auto fi_it = mf_file_infos.emplace(fi, file_infos.size());
+          if (fi_it.second) {
+            file_infos.push_back(fi);
+          }
+          entry.file_info_indexes.push_back(fi_it.first->second);
+        }
+        const auto it = std::find(results.begin(), results.end(), entry);
+        if (it == results.end()) {
+          results.push_back(std::move(entry));
+        } else {
+          it->last_used = std::max(it->last_used, entry.last_used);
+        }
+      }
+    }
+  }
+
+  // Check whether `result` in `other` also exists in this manifest. Unlike
+  // add_results, this doesn't need to index all files and file infos.
+  bool
+  has_result(const ManifestData& other, const ResultEntry& result) const
+  {
+    for (const auto& entry : results) {
+      if (entry.name != result.name
+          || entry.file_info_indexes.size()
+               != result.file_info_indexes.size()) {
+        continue;
+      }
+      bool equal = true;
+      for (size_t i = 0; i < entry.file_info_indexes.size() && equal; ++i) {
+        equal = file_info_equals(entry.file_info_indexes[i],
+                                 other,
+                                 result.file_info_indexes[i]);
+      }
+      if (equal) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Update the last use of the results with `get_last_used`.
+  void
+  refresh_last_used(const Manifest::LastUsedFunction& get_last_used)
+  {
+    for (auto& result : results) {
+      result.last_used = get_last_used(result.name);
+    }
+  }
+
+  // Remove the least recently used results until at most `max_results`
+  // results referring to at most `max_file_infos` file infos remain, and then
+  // remove file infos and paths that are no longer referenced.
+  //
+  // Returns the number of removed results. Throws Error if the manifest is
+  // inconsistent.
+  size_t
+  evict(uint32_t max_results, uint32_t max_file_infos)
+  {
+    std::vector<uint32_t> ref_counts(file_infos.size(), 0);
+    size_t n_referenced = 0;
+    for (const auto& result : results) {
+      for (uint32_t index : result.file_info_indexes) {
+        if (index >= file_infos.size()) {
+          throw Error("Corrupt manifest: bad file info index {}", index);
+        }
+        if (ref_counts[index]++ == 0) {
+          ++n_referenced;
+        }
+      }
+    }
+
+    std::vector<uint32_t> lru_order(results.size());
+    for (uint32_t i = 0; i < results.size(); ++i) {
+      lru_order[i] = i;
+    }
+    std::stable_sort(lru_order.begin(),
+                     lru_order.end(),
+                     [&](uint32_t a, uint32_t b) {
+                       return results[a].last_used < results[b].last_used;
+                     });
+
+    std::vector<bool> keep(results.size(), true);
+    size_t n_results = results.size();
+    for (uint32_t i : lru_order) {
+      if (n_results <= max_results && n_referenced <= max_file_infos) {
+        break;
+      }
+      keep[i] = false;
+      --n_results;
+      for (uint32_t index : results[i].file_info_indexes) {
+        if (--ref_counts[index] == 0) {
+          --n_referenced;
+        }
+      }
+    }
+
+    const uint32_t k_removed = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> new_file_indexes(files.size(), k_removed);
+    std::vector<uint32_t> new_file_info_indexes(file_infos.size(), k_removed);
+    std::vector<std::string> kept_files;
+    std::vector<FileInfo> kept_file_infos;
+    for (uint32_t i = 0; i < file_infos.size(); ++i) {
+      if (ref_counts[i] == 0) {
+        continue;
+      }
+      FileInfo fi = file_infos[i];
+      if (fi.index >= files.size()) {
+        throw Error("Corrupt manifest: bad path index {}", fi.index);
+      }
+      if (new_file_indexes[fi.index] == k_removed) {
+        new_file_indexes[fi.index] = kept_files.size();
+        kept_files.push_back(std::move(files[fi.index]));
+      }
+      fi.index = new_file_indexes[fi.index];
+      new_file_info_indexes[i] = kept_file_infos.size();
+      kept_file_infos.push_back(fi);
+    }
+
+    std::vector<ResultEntry> kept_results;
+    kept_results.reserve(n_results);
+    for (uint32_t i = 0; i < results.size(); ++i) {
+      if (keep[i]) {
+        kept_results.push_back(std::move(results[i]));
+        for (auto& index : kept_results.back().file_info_indexes) {
+          index = new_file_info_indexes[index];
+        }
+      }
+    }
+
+    const size_t n_evicted = results.size() - kept_results.size();
+    files = std::move(kept_files);
+    file_infos = std::move(kept_file_infos);
+    results = std::move(kept_results);
+    return n_evicted;
+  }
+
 private:
+  bool
+  file_info_equals(uint32_t index,
+                   const ManifestData& other,
+                   uint32_t other_index) const
+  {
+    if (index >= file_infos.size() || file_infos[index].index >= files.size()
+        || other_index >= other.file_infos.size()
+        || other.file_infos[other_index].index >= other.files.size()) {
+      return false;
+    }
+    const FileInfo& fi = file_infos[index];
+    FileInfo other_fi = other.file_infos[other_index];
+    if (files[fi.index] != other.files[other_fi.index]) {
+      return false;
+    }
+    other_fi.index = fi.index;
+    return fi == other_fi;
+  }
+
   uint32_t
   get_file_info_index(
     const std::string& path,
@@ -290,20 +550,532 @@ struct FileStats
   int64_t ctime;
 };
 
+const size_t k_header_size = 15;
+const size_t k_flat_header_size = 4 * 4;
+const size_t k_flat_path_entry_size = 4 + 4;
+const size_t k_flat_include_entry_size = 4 + Digest::size() + 8 + 8 + 8;
+const size_t k_flat_result_size = 4 + 4 + Digest::size() + 8;
+const size_t k_flat_include_index_size = 4;
+const size_t k_journal_trailer_size = 4 + 8 + 4;
+
+const uint8_t k_frame_magic[4] = {'c', 'C', 'm', 'J'};
+
+template<typename T>
+void
+append_int(std::string& data, T value)
+{
+  uint8_t buffer[sizeof(T)];
+  Util::int_to_big_endian(value, buffer);
+  data.append(reinterpret_cast<const char*>(buffer), sizeof(buffer));
+}
+
+// View of a manifest body in the flat manifest format.
+class FlatManifest
+{
+public:
+  struct Result
+  {
+    // Position of the first index to file infos.
+    uint32_t first_index;
+
+    // Number of indexes to file infos.
+    uint32_t n_indexes;
+
+    // Name of the result.
+    Digest name;
+
+    // Time of the last store or use as known at the last compaction.
+    int64_t last_used;
+  };
+
+  // Throws Error if `data` is too small for the counts in its header. Other
+  // inconsistencies are detected lazily by the accessors.
+  explicit FlatManifest(nonstd::string_view data);
+
+  uint32_t n_files() const;
+  uint32_t n_file_infos() const;
+  uint32_t n_results() const;
+
+  // The accessors throw Error for out of range indexes.
+  nonstd::string_view file(uint32_t index) const;
+  FileInfo file_info(uint32_t index) const;
+  Result result(uint32_t index) const;
+  uint32_t file_info_index(uint32_t position) const;
+
+  std::unique_ptr<ManifestData> to_manifest_data() const;
+  static std::string serialize(const ManifestData& mf);
+
+private:
+  nonstd::string_view m_data;
+  uint32_t m_n_files;
+  uint32_t m_n_file_infos;
+  uint32_t m_n_results;
+  uint32_t m_n_indexes;
+  size_t m_file_infos_offset;
+  size_t m_results_offset;
+  size_t m_indexes_offset;
+  size_t m_path_data_offset;
+
+  template<typename T> T read_int(size_t offset) const;
+};
+
+FlatManifest::FlatManifest(nonstd::string_view data) : m_data(data)
+{
+  if (m_data.size() < k_flat_header_size) {
+    throw Error("Corrupt flat manifest: too small header");
+  }
+  m_n_files = read_int<uint32_t>(0);
+  m_n_file_infos = read_int<uint32_t>(4);
+  m_n_results = read_int<uint32_t>(8);
+  m_n_indexes = read_int<uint32_t>(12);
+
+  // Counts are 32-bit, so the offsets can't overflow.
+  m_file_infos_offset = k_flat_header_size
+                        + static_cast<uint64_t>(m_n_files)
+                            * k_flat_path_entry_size;
+  m_results_offset = m_file_infos_offset
+                     + static_cast<uint64_t>(m_n_file_infos)
+                         * k_flat_include_entry_size;
+  m_indexes_offset =
+    m_results_offset + static_cast<uint64_t>(m_n_results) * k_flat_result_size;
+  m_path_data_offset = m_indexes_offset
+                       + static_cast<uint64_t>(m_n_indexes)
+                           * k_flat_include_index_size;
+  if (m_path_data_offset > m_data.size()) {
+    throw Error("Corrupt flat manifest: too small for {} bytes of tables",
+                m_path_data_offset);
+  }
+}
+
+inline uint32_t
+FlatManifest::n_files() const
+{
+  return m_n_files;
+}
+
+inline uint32_t
+FlatManifest::n_file_infos() const
+{
+  return m_n_file_infos;
+}
+
+inline uint32_t
+FlatManifest::n_results() const
+{
+  return m_n_results;
+}
+
+nonstd::string_view
+FlatManifest::file(uint32_t index) const
+{
+  if (index >= m_n_files) {
+    throw Error("Corrupt flat manifest: bad path index {}", index);
+  }
+  const size_t entry_offset =
+    k_flat_header_size + index * k_flat_path_entry_size;
+  const uint32_t offset = read_int<uint32_t>(entry_offset);
+  const uint32_t length = read_int<uint32_t>(entry_offset + 4);
+  if (static_cast<uint64_t>(offset) + length
+      > m_data.size() - m_path_data_offset) {
+    throw Error("Corrupt flat manifest: bad path entry {}", index);
+  }
+  return m_data.substr(m_path_data_offset + offset, length);
+}
+
+FileInfo
+FlatManifest::file_info(uint32_t index) const
+{
+  if (index >= m_n_file_infos) {
+    throw Error("Corrupt flat manifest: bad file info index {}", index);
+  }
+  const size_t offset = m_file_infos_offset + index * k_flat_include_entry_size;
+  FileInfo fi;
+  fi.index = read_int<uint32_t>(offset);
+  memcpy(fi.digest.bytes(), &m_data[offset + 4], Digest::size());
+  fi.fsize = read_int<uint64_t>(offset + 4 + Digest::size());
+  fi.mtime = read_int<int64_t>(offset + 4 + Digest::size() + 8);
+  fi.ctime = read_int<int64_t>(offset + 4 + Digest::size() + 16);
+  return fi;
+}
+
+FlatManifest::Result
+FlatManifest::result(uint32_t index) const
+{
+  if (index >= m_n_results) {
+    throw Error("Corrupt flat manifest: bad result index {}", index);
+  }
+  const size_t offset = m_results_offset + index * k_flat_result_size;
+  Result result;
+  result.first_index = read_int<uint32_t>(offset);
+  result.n_indexes = read_int<uint32_t>(offset + 4);
+  memcpy(result.name.bytes(), &m_data[offset + 8], Digest::size());
+  result.last_used = read_int<int64_t>(offset + 8 + Digest::size());
+  return result;
+}
+
+uint32_t
+FlatManifest::file_info_index(uint32_t position) const
+{
+  if (position >= m_n_indexes) {
+    throw Error("Corrupt flat manifest: bad include index position {}",
+                position);
+  }
+  return read_int<uint32_t>(m_indexes_offset
+                            + position * k_flat_include_index_size);
+}
+
 std::unique_ptr<ManifestData>
-read_manifest(const std::string& path, FILE* dump_stream = nullptr)
+FlatManifest::to_manifest_data() const
 {
-  File file(path, "rb");
-  if (!file) {
-    return {};
+  auto mf = std::make_unique<ManifestData>();
+
+  mf->files.reserve(m_n_files);
+  for (uint32_t i = 0; i < m_n_files; ++i) {
+    mf->files.emplace_back(std::string(file(i)));
   }
 
-  CacheEntryReader reader(file.get(), Manifest::k_magic, Manifest::k_version);
+  mf->file_infos.reserve(m_n_file_infos);
+  for (uint32_t i = 0; i < m_n_file_infos; ++i) {
+    mf->file_infos.push_back(file_info(i));
+  }
 
-  if (dump_stream) {
-    reader.dump_header(dump_stream);
+  mf->results.reserve(m_n_results);
+  for (uint32_t i = 0; i < m_n_results; ++i) {
+    const auto flat_result = result(i);
+    mf->results.emplace_back();
+    auto& entry = mf->results.back();
+    entry.file_info_indexes.reserve(flat_result.n_indexes);
+    for (uint32_t j = 0; j < flat_result.n_indexes; ++j) {
+      entry.file_info_indexes.push_back(
+        file_info_index(flat_result.first_index + j));
+    }
+    entry.name = flat_result.name;
+    entry.last_used = flat_result.last_used;
+  }
+
+  return mf;
+}
+
+std::string
+FlatManifest::serialize(const ManifestData& mf)
+{
+  size_t n_indexes = 0;
+  for (const auto& result : mf.results) {
+    n_indexes += result.file_info_indexes.size();
+  }
+  size_t path_data_size = 0;
+  for (const auto& file : mf.files) {
+    path_data_size += file.length();
+  }
+
+  std::string data;
+  data.reserve(k_flat_header_size + mf.files.size() * k_flat_path_entry_size
+               + mf.file_infos.size() * k_flat_include_entry_size
+               + mf.results.size() * k_flat_result_size
+               + n_indexes * k_flat_include_index_size + path_data_size);
+
+  append_int(data, static_cast<uint32_t>(mf.files.size()));
+  append_int(data, static_cast<uint32_t>(mf.file_infos.size()));
+  append_int(data, static_cast<uint32_t>(mf.results.size()));
+  append_int(data, static_cast<uint32_t>(n_indexes));
+
+  uint32_t path_offset = 0;
+  for (const auto& file : mf.files) {
+    append_int(data, path_offset);
+    append_int(data, static_cast<uint32_t>(file.length()));
+    path_offset += file.length();
+  }
+
+  for (const auto& file_info : mf.file_infos) {
+    append_int(data, file_info.index);
+    data.append(reinterpret_cast<const char*>(file_info.digest.bytes()),
+                Digest::size());
+    append_int(data, file_info.fsize);
+    append_int(data, file_info.mtime);
+    append_int(data, file_info.ctime);
+  }
+
+  uint32_t first_index = 0;
+  for (const auto& result : mf.results) {
+    append_int(data, first_index);
+    append_int(data, static_cast<uint32_t>(result.file_info_indexes.size()));
+    data.append(reinterpret_cast<const char*>(result.name.bytes()),
+                Digest::size());
+    append_int(data, result.last_used);
+    first_index += result.file_info_indexes.size();
+  }
+
+  for (const auto& result : mf.results) {
+    for (auto index : result.file_info_indexes) {
+      append_int(data, index);
+    }
+  }
+
+  for (const auto& file : mf.files) {
+    data.append(file);
+  }
+
+  return data;
+}
+
+template<typename T>
+inline T
+FlatManifest::read_int(size_t offset) const
+{
+  T value;
+  Util::big_endian_to_int(
+    reinterpret_cast<const uint8_t*>(m_data.data()) + offset, value);
+  return value;
+}
+
+// An uncompressed manifest file in the current version mapped into memory.
+class MappedManifest : NonCopyable
+{
+public:
+  ~MappedManifest();
+
+  // Map the manifest file opened as `fd` into memory. Returns false if the
+  // file is not an uncompressed manifest in the current version, if it has
+  // journal frames or if it's corrupt, in which case the file should be read
+  // normally instead.
+  bool map(int fd);
+
+  // The mapped body in the flat manifest format.
+  nonstd::string_view body() const;
+
+private:
+  void* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+MappedManifest::~MappedManifest()
+{
+#ifdef HAVE_SYS_MMAN_H
+  if (m_data) {
+    munmap(m_data, m_size);
+  }
+#endif
+}
+
+bool
+MappedManifest::map(int fd)
+{
+#ifdef HAVE_SYS_MMAN_H
+  const size_t epilogue_size = 8;
+
+  struct stat st;
+  if (fstat(fd, &st) != 0
+      || static_cast<uint64_t>(st.st_size) < k_header_size + epilogue_size) {
+    return false;
+  }
+  const size_t size = st.st_size;
+  void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap manifest: {}", strerror(errno));
+    return false;
+  }
+
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t content_size;
+  Util::big_endian_to_int(bytes + 7, content_size);
+  uint64_t expected_checksum;
+  Util::big_endian_to_int(bytes + size - epilogue_size, expected_checksum);
+  Checksum checksum;
+  checksum.update(bytes, size - epilogue_size);
+
+  if (memcmp(bytes, Manifest::k_magic, sizeof(Manifest::k_magic)) != 0
+      || bytes[4] != Manifest::k_version
+      || bytes[5] != static_cast<uint8_t>(Compression::Type::none)
+      || content_size != size || checksum.digest() != expected_checksum) {
+    munmap(data, size);
+    return false;
+  }
+
+  m_data = data;
+  m_size = size;
+  return true;
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+nonstd::string_view
+MappedManifest::body() const
+{
+  return nonstd::string_view(static_cast<const char*>(m_data) + k_header_size,
+                             m_size - k_header_size - 8);
+}
+
+// Journal frames at the end of a manifest file.
+struct Journal
+{
+  // Frame bodies in the flat manifest format, oldest first.
+  std::vector<std::string> frames;
+
+  // Total size of the frames including trailers.
+  uint64_t size = 0;
+
+  // Size of incomplete data after the frames, e.g. from an append that was
+  // interrupted.
+  uint64_t ignored_size = 0;
+};
+
+// Whether data may follow the body of a manifest read by `reader`. The body of
+// the current version is followed by journal frames and possibly incomplete
+// data, which read_journal takes care of.
+CacheEntryReader::TrailingData
+trailing_data(const CacheEntryReader& reader)
+{
+  return reader.version() == Manifest::k_version
+           ? CacheEntryReader::TrailingData::allowed
+           : CacheEntryReader::TrailingData::forbidden;
+}
+
+// Read the journal frame that ends at `end` in `data`, which starts at the
+// beginning of the manifest file. Returns false if there is no intact frame.
+bool
+read_frame(nonstd::string_view data, size_t end, std::string& frame)
+{
+  if (end < k_header_size + k_journal_trailer_size || end > data.size()) {
+    return false;
+  }
+  const auto trailer = reinterpret_cast<const uint8_t*>(data.data()) + end
+                       - k_journal_trailer_size;
+  if (memcmp(trailer + 12, k_frame_magic, sizeof(k_frame_magic)) != 0) {
+    return false;
+  }
+  uint32_t length;
+  Util::big_endian_to_int(trailer, length);
+  uint64_t expected_checksum;
+  Util::big_endian_to_int(trailer + 4, expected_checksum);
+  if (length < k_flat_header_size
+      || length > end - k_journal_trailer_size - k_header_size) {
+    return false;
+  }
+
+  const size_t start = end - k_journal_trailer_size - length;
+  Checksum checksum;
+  checksum.update(data.data() + start, length);
+  if (checksum.digest() != expected_checksum) {
+    return false;
+  }
+  frame.assign(data.data() + start, length);
+  return true;
+}
+
+// Find the end of the last intact journal frame before `end` in `data`, which
+// starts at the beginning of the manifest file. Returns 0 if there is none.
+size_t
+find_journal_end(nonstd::string_view data, size_t end)
+{
+  std::string frame;
+  for (size_t candidate = end; candidate > k_header_size; --candidate) {
+    if (data[candidate - 4] == 'c' && read_frame(data, candidate, frame)) {
+      return candidate;
+    }
+  }
+  return 0;
+}
+
+// Read the journal frames of the manifest file opened as `stream` by following
+// the frame trailers backwards from the end of the file. Data after the last
+// intact frame, which is what an interrupted append leaves behind, is ignored.
+// `stream` is rewound afterwards.
+Journal
+read_journal(FILE* stream)
+{
+  std::string data;
+  char buffer[READ_BUFFER_SIZE];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), stream)) > 0) {
+    data.append(buffer, n);
+  }
+  if (ferror(stream)) {
+    throw Error("Error reading manifest: {}", strerror(errno));
+  }
+  rewind(stream);
+
+  Journal journal;
+  if (data.size() < k_header_size) {
+    return journal;
+  }
+
+  // An uncompressed body ends at the content size, so there are no frames if
+  // the file ends there. The end of a compressed body is unknown.
+  uint64_t content_size;
+  Util::big_endian_to_int(reinterpret_cast<const uint8_t*>(data.data()) + 7,
+                          content_size);
+  const bool is_plain_body =
+    data[5] == static_cast<char>(Compression::Type::none)
+    && content_size == data.size();
+
+  size_t position = data.size();
+  std::string frame;
+  if (!is_plain_body && !read_frame(data, position, frame)) {
+    const size_t journal_end = find_journal_end(data, position);
+    if (journal_end > 0) {
+      position = journal_end;
+    } else if (data[5] == static_cast<char>(Compression::Type::none)
+               && content_size < data.size()) {
+      position = content_size;
+    }
+    journal.ignored_size = data.size() - position;
+    if (journal.ignored_size > 0) {
+      LOG("Ignoring {} bytes of incomplete data at the end of the manifest",
+          journal.ignored_size);
+    }
+  }
+
+  while (read_frame(data, position, frame)) {
+    position -= k_journal_trailer_size + frame.size();
+    journal.frames.push_back(std::move(frame));
   }
+  std::reverse(journal.frames.begin(), journal.frames.end());
+  journal.size = data.size() - journal.ignored_size - position;
+  return journal;
+}
 
+// Create a journal frame by adding a trailer to `body`.
+std::string
+create_journal_frame(std::string body)
+{
+  Checksum checksum;
+  checksum.update(body.data(), body.size());
+  append_int(body, static_cast<uint32_t>(body.size()));
+  append_int(body, checksum.digest());
+  body.append(reinterpret_cast<const char*>(k_frame_magic),
+              sizeof(k_frame_magic));
+  return body;
+}
+
+// Append `frame` to the existing manifest file `path`. Concurrent appends
+// don't interleave since the file is opened in append mode.
+void
+append_journal_frame(const std::string& path, const std::string& frame)
+{
+  Fd fd(open(path.c_str(), O_WRONLY | O_APPEND | O_BINARY));
+  if (!fd) {
+    throw Error("Failed to open {} for appending: {}", path, strerror(errno));
+  }
+  Util::write_fd(*fd, frame.data(), frame.size());
+}
+
+// Read the body of a manifest in the flat manifest format.
+std::string
+read_body(CacheEntryReader& reader,
+          CacheEntryReader::TrailingData trailing_data)
+{
+  std::string body(reader.payload_size(), 0);
+  reader.read(&body[0], body.size());
+  reader.finalize(trailing_data);
+  return body;
+}
+
+std::unique_ptr<ManifestData>
+read_manifest_v2(CacheEntryReader& reader,
+                 CacheEntryReader::TrailingData trailing_data)
+{
   auto mf = std::make_unique<ManifestData>();
 
   uint32_t entry_count;
@@ -345,144 +1117,545 @@ read_manifest(const std::string& path, FILE* dump_stream = nullptr)
     reader.read(entry.name.bytes(), Digest::size());
   }
 
-  reader.finalize();
+  reader.finalize(trailing_data);
   return mf;
 }
 
+std::unique_ptr<CacheEntryReader>
+create_reader(FILE* stream)
+{
+  return std::make_unique<CacheEntryReader>(
+    stream, Manifest::k_magic, Manifest::k_version, Manifest::k_min_version);
+}
+
+// Read the manifest opened by `reader` and merge `journal` into it.
+std::unique_ptr<ManifestData>
+read_manifest_data(CacheEntryReader& reader, const Journal& journal)
+{
+  auto mf = reader.version() == 2
+              ? read_manifest_v2(reader, trailing_data(reader))
+              : FlatManifest(read_body(reader, trailing_data(reader)))
+                  .to_manifest_data();
+
+  if (!journal.frames.empty()) {
+    std::vector<ManifestData> entries;
+    entries.reserve(journal.frames.size());
+    for (const auto& frame : journal.frames) {
+      entries.push_back(std::move(*FlatManifest(frame).to_manifest_data()));
+    }
+    mf->add_results(entries);
+  }
+  return mf;
+}
+
+std::unique_ptr<ManifestData>
+read_manifest(const std::string& path, FILE* dump_stream = nullptr)
+{
+  File file(path, "rb");
+  if (!file) {
+    return {};
+  }
+
+  const Journal journal = read_journal(file.get());
+  auto reader = create_reader(file.get());
+  if (dump_stream) {
+    reader->dump_header(dump_stream);
+    PRINT(dump_stream, "Journal frames: {}\n", journal.frames.size());
+  }
+
+  return read_manifest_data(*reader, journal);
+}
+
+// Read the body of the manifest file opened as `stream` in the flat manifest
+// format, converting it from an older version and merging journal frames if
+// needed.
+std::string
+read_flat_manifest(FILE* stream)
+{
+  const Journal journal = read_journal(stream);
+  auto reader = create_reader(stream);
+  if (reader->version() == Manifest::k_version && journal.size == 0) {
+    return read_body(*reader, trailing_data(*reader));
+  }
+  return FlatManifest::serialize(*read_manifest_data(*reader, journal));
+}
+
+#ifdef INODE_CACHE_SUPPORTED
+// Compute a key that identifies the content of the manifest file `path` opened
+// as `stream`. The checksum stored at the end of the file can't be used for
+// this since it's part of the compressed data, so the raw file content is
+// checksummed instead, which is much cheaper than decompressing and parsing
+// it. `stream` is rewound afterwards.
+optional<Digest>
+get_manifest_cache_key(const std::string& path, FILE* stream)
+{
+  Checksum checksum;
+  uint64_t size = 0;
+  char buffer[READ_BUFFER_SIZE];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), stream)) > 0) {
+    checksum.update(buffer, n);
+    size += n;
+  }
+  if (ferror(stream)) {
+    return nullopt;
+  }
+  rewind(stream);
+
+  Hash hash;
+  hash.hash_delimiter("flat manifest");
+  hash.hash(path);
+  hash.hash(size);
+  hash.hash(checksum.digest());
+  return hash.digest();
+}
+#endif
+
+// Get the body of the manifest file `path` opened as `stream` in the flat
+// manifest format. An uncompressed manifest is mapped into memory by `mapped`,
+// otherwise the body is decompressed into `buffer`, using the manifest cache
+// if enabled. The returned view refers to either `mapped` or `buffer`.
+nonstd::string_view
+get_flat_manifest(const Context& ctx,
+                  const std::string& path,
+                  FILE* stream,
+                  MappedManifest& mapped,
+                  std::string& buffer)
+{
+  if (mapped.map(fileno(stream))) {
+    return mapped.body();
+  }
+
+#ifdef INODE_CACHE_SUPPORTED
+  optional<Digest> key;
+  if (ctx.config.manifest_cache()) {
+    key = get_manifest_cache_key(path, stream);
+    if (key && ctx.manifest_cache.get(*key, buffer)) {
+      return buffer;
+    }
+  }
+#else
+  (void)ctx;
+  (void)path;
+#endif
+
+  buffer = read_flat_manifest(stream);
+
+#ifdef INODE_CACHE_SUPPORTED
+  if (key) {
+    ctx.manifest_cache.put(*key, buffer);
+  }
+#endif
+
+  return buffer;
+}
+
 bool
 write_manifest(const Config& config,
                const std::string& path,
                const ManifestData& mf)
 {
-  uint64_t payload_size = 0;
-  payload_size += 4; // n_files
-  for (const auto& file : mf.files) {
-    payload_size += 2 + file.length();
-  }
-  payload_size += 4; // n_file_infos
-  payload_size += mf.file_infos.size() * (4 + Digest::size() + 8 + 8 + 8);
-  payload_size += 4; // n_results
-  for (const auto& result : mf.results) {
-    payload_size += 4; // n_file_info_indexes
-    payload_size += result.file_info_indexes.size() * 4;
-    payload_size += Digest::size();
-  }
+  const std::string body = FlatManifest::serialize(mf);
 
+  const auto dictionary = CompressionDictionary::get_for_kind(
+    CompressionDictionary::Kind::manifest);
   AtomicFile atomic_manifest_file(path, AtomicFile::Mode::binary);
   CacheEntryWriter writer(atomic_manifest_file.stream(),
                           Manifest::k_magic,
                           Manifest::k_version,
                           Compression::type_from_config(config),
                           Compression::level_from_config(config),
-                          payload_size);
-  writer.write<uint32_t>(mf.files.size());
-  for (const auto& file : mf.files) {
-    writer.write<uint16_t>(file.length());
-    writer.write(file.data(), file.length());
-  }
+                          body.size(),
+                          dictionary.get());
+  writer.write(body.data(), body.size());
+  writer.finalize();
+  atomic_manifest_file.commit();
+  return true;
+}
 
-  writer.write<uint32_t>(mf.file_infos.size());
-  for (const auto& file_info : mf.file_infos) {
-    writer.write<uint32_t>(file_info.index);
-    writer.write(file_info.digest.bytes(), Digest::size());
-    writer.write(file_info.fsize);
-    writer.write(file_info.mtime);
-    writer.write(file_info.ctime);
+// Return the size that a manifest exceeding `limit` is reduced to. Evicting
+// below the limit leaves room for appending the following results to the
+// journal instead of rewriting the whole manifest for each of them.
+uint32_t
+low_water_mark(uint32_t limit)
+{
+  return limit - limit / 10;
+}
+
+// Rewrite the manifest file `path` with the content of `mf`, which includes
+// the merged journal. If there are too many results or file infos, the least
+// recently used results according to `get_last_used` are evicted.
+void
+compact_manifest(const Config& config,
+                 const std::string& path,
+                 ManifestData& mf,
+                 const Manifest::LastUsedFunction& get_last_used)
+{
+  const size_t n_results = mf.results.size();
+  uint32_t max_results = config.max_manifest_entries();
+  uint32_t max_file_infos = config.max_manifest_file_infos();
+  if (n_results > max_results || mf.file_infos.size() > max_file_infos) {
+    mf.refresh_last_used(get_last_used);
+    max_results = low_water_mark(max_results);
+    max_file_infos = low_water_mark(max_file_infos);
   }
+  const size_t n_evicted = mf.evict(max_results, max_file_infos);
+  if (n_evicted > 0) {
+    LOG("Evicted {} of {} entries from manifest", n_evicted, n_results);
+  }
+  write_manifest(config, path, mf);
+}
 
-  writer.write<uint32_t>(mf.results.size());
-  for (const auto& result : mf.results) {
-    writer.write<uint32_t>(result.file_info_indexes.size());
-    for (auto index : result.file_info_indexes) {
-      writer.write(index);
+// Read the entries of the intact journal frames of the manifest file `path`.
+std::unique_ptr<ManifestData>
+read_journal_entries(const std::string& path)
+{
+  auto mf = std::make_unique<ManifestData>();
+  try {
+    File file(path, "rb");
+    if (!file) {
+      return mf;
+    }
+    const Journal journal = read_journal(file.get());
+    std::vector<ManifestData> entries;
+    entries.reserve(journal.frames.size());
+    for (const auto& frame : journal.frames) {
+      entries.push_back(std::move(*FlatManifest(frame).to_manifest_data()));
+    }
+    mf->add_results(entries);
+    if (!mf->results.empty()) {
+      LOG("Kept {} entries from the manifest journal", mf->results.size());
     }
-    writer.write(result.name.bytes(), Digest::size());
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
+    mf = std::make_unique<ManifestData>();
   }
+  return mf;
+}
 
-  writer.finalize();
-  atomic_manifest_file.commit();
+// Append `entry` to the journal of the intact manifest file `path` as long as
+// the journal is smaller than the rest of the manifest, which bounds the
+// overhead of reading journal frames, and the limits aren't exceeded. This only
+// reads the counts of the body and the journal frames instead of the whole
+// manifest. Returns false if the manifest has to be compacted instead.
+bool
+append_result(const Config& config,
+              const std::string& path,
+              const ManifestData& entry)
+{
+  File file(path, "rb");
+  if (!file) {
+    return false;
+  }
+  const Journal journal = read_journal(file.get());
+  auto reader = create_reader(file.get());
+  if (reader->version() != Manifest::k_version || journal.ignored_size > 0) {
+    return false;
+  }
+
+  // The counts at the start of the body are <n_paths> <n_includes> <n_results>.
+  uint32_t n_body_paths;
+  uint32_t n_body_file_infos;
+  uint32_t n_body_results;
+  reader->read(n_body_paths);
+  reader->read(n_body_file_infos);
+  reader->read(n_body_results);
+  uint64_t n_results = n_body_results;
+  uint64_t n_file_infos = n_body_file_infos;
+  for (const auto& frame : journal.frames) {
+    const FlatManifest flat_frame(frame);
+    n_results += flat_frame.n_results();
+    n_file_infos += flat_frame.n_file_infos();
+  }
+  // Frames may repeat file infos, so the file info count is an upper bound.
+  if (n_results >= config.max_manifest_entries()
+      || n_file_infos + entry.file_infos.size()
+           > config.max_manifest_file_infos()) {
+    return false;
+  }
+
+  const std::string frame =
+    create_journal_frame(FlatManifest::serialize(entry));
+  if (journal.size + frame.size() > reader->content_size()) {
+    if (journal.size > 0) {
+      LOG("Compacting manifest journal ({} bytes)", journal.size);
+    }
+    return false;
+  }
+  file.close();
+  append_journal_frame(path, frame);
+  LOG("Appended entry to manifest journal ({} bytes)",
+      journal.size + frame.size());
   return true;
 }
 
+// Check whether `fi` matches the current state of its path.
 bool
-verify_result(const Context& ctx,
-              const ManifestData& mf,
-              const ResultEntry& result,
-              std::unordered_map<std::string, FileStats>& stated_files,
-              std::unordered_map<std::string, Digest>& hashed_files)
-{
-  for (uint32_t file_info_index : result.file_info_indexes) {
-    const auto& fi = mf.file_infos[file_info_index];
-    const auto& path = mf.files[fi.index];
-
-    auto stated_files_iter = stated_files.find(path);
-    if (stated_files_iter == stated_files.end()) {
-      auto file_stat = Stat::stat(path, Stat::OnError::log);
-      if (!file_stat) {
-        return false;
+file_info_matches(const Context& ctx,
+                  const FlatManifest& mf,
+                  const FileInfo& fi,
+                  std::vector<optional<FileStats>>& stated_files,
+                  std::vector<optional<Digest>>& hashed_files)
+{
+  const auto path = mf.file(fi.index);
+
+  auto& stated_file = stated_files[fi.index];
+  if (!stated_file) {
+    auto file_stat = Stat::stat(std::string(path), Stat::OnError::log);
+    if (!file_stat) {
+      return false;
+    }
+    FileStats st;
+    st.size = file_stat.size();
+    st.mtime = file_stat.mtime();
+    st.ctime = file_stat.ctime();
+    stated_file = st;
+  }
+  const FileStats& fs = *stated_file;
+
+  if (fi.fsize != fs.size) {
+    return false;
+  }
+
+  // Clang stores the mtime of the included files in the precompiled header,
+  // and will error out if that header is later used without rebuilding.
+  if ((ctx.config.compiler_type() == CompilerType::clang
+       || ctx.config.compiler_type() == CompilerType::other)
+      && ctx.args_info.output_is_precompiled_header
+      && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime) {
+    LOG("Precompiled header includes {}, which has a new mtime", path);
+    return false;
+  }
+
+  if (ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES) {
+    if (!(ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES_CTIME)) {
+      if (fi.mtime == fs.mtime && fi.ctime == fs.ctime) {
+        LOG("mtime/ctime hit for {}", path);
+        return true;
+      } else {
+        LOG("mtime/ctime miss for {}", path);
+      }
+    } else {
+      if (fi.mtime == fs.mtime) {
+        LOG("mtime hit for {}", path);
+        return true;
+      } else {
+        LOG("mtime miss for {}", path);
       }
-      FileStats st;
-      st.size = file_stat.size();
-      st.mtime = file_stat.mtime();
-      st.ctime = file_stat.ctime();
-      stated_files_iter = stated_files.emplace(path, st).first;
     }
-    const FileStats& fs = stated_files_iter->second;
+  }
 
-    if (fi.fsize != fs.size) {
+  auto& hashed_file = hashed_files[fi.index];
+  if (!hashed_file) {
+    Hash hash;
+    int ret = hash_source_code_file(ctx, hash, std::string(path));
+    if (ret & HASH_SOURCE_CODE_ERROR) {
+      LOG("Failed hashing {}", path);
       return false;
     }
-
-    // Clang stores the mtime of the included files in the precompiled header,
-    // and will error out if that header is later used without rebuilding.
-    if ((ctx.config.compiler_type() == CompilerType::clang
-         || ctx.config.compiler_type() == CompilerType::other)
-        && ctx.args_info.output_is_precompiled_header
-        && !ctx.args_info.fno_pch_timestamp && fi.mtime != fs.mtime) {
-      LOG("Precompiled header includes {}, which has a new mtime", path);
+    if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
       return false;
     }
 
-    if (ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES) {
-      if (!(ctx.config.sloppiness() & SLOPPY_FILE_STAT_MATCHES_CTIME)) {
-        if (fi.mtime == fs.mtime && fi.ctime == fs.ctime) {
-          LOG("mtime/ctime hit for {}", path);
-          continue;
-        } else {
-          LOG("mtime/ctime miss for {}", path);
-        }
-      } else {
-        if (fi.mtime == fs.mtime) {
-          LOG("mtime hit for {}", path);
-          continue;
-        } else {
-          LOG("mtime miss for {}", path);
+    hashed_file = hash.digest();
+  }
+
+  return fi.digest == *hashed_file;
+}
+
+// Stat all paths referenced by file infos in `path_file_infos` concurrently
+// and store the results in `stated_files`. Paths that can't be stated are left
+// for file_info_matches to handle.
+void
+prefetch_stats(const Context& ctx,
+               const FlatManifest& mf,
+               const std::vector<std::vector<uint32_t>>& path_file_infos,
+               std::vector<optional<FileStats>>& stated_files)
+{
+  // Look up the paths on this thread since FlatManifest::file throws on a
+  // corrupt manifest and exceptions must not escape the worker threads.
+  std::vector<std::pair<uint32_t, std::string>> paths;
+  for (uint32_t i = 0; i < path_file_infos.size(); ++i) {
+    if (!path_file_infos[i].empty()) {
+      paths.emplace_back(i, std::string(mf.file(i)));
+    }
+  }
+  if (paths.size() < 2) {
+    return;
+  }
+
+  const size_t n_threads =
+    std::min<size_t>(ctx.config.stat_threads(), paths.size());
+  ThreadPool thread_pool(n_threads);
+  for (size_t t = 0; t < n_threads; ++t) {
+    // Each thread writes to its own elements of stated_files.
+    thread_pool.enqueue([&, t] {
+      for (size_t i = t; i < paths.size(); i += n_threads) {
+        const uint32_t path_index = paths[i].first;
+        const auto file_stat =
+          Stat::stat(paths[i].second, Stat::OnError::ignore);
+        if (file_stat) {
+          FileStats st;
+          st.size = file_stat.size();
+          st.mtime = file_stat.mtime();
+          st.ctime = file_stat.ctime();
+          stated_files[path_index] = st;
         }
       }
+    });
+  }
+  thread_pool.shut_down();
+
+  LOG("Prefetched file information for {} paths using {} threads",
+      paths.size(),
+      n_threads);
+}
+
+// Find the newest result in `mf` for which all included files match the
+// current state of the file system.
+//
+// Instead of verifying results one by one, which could stat and hash the same
+// paths over and over for results that can't match, a file info that doesn't
+// match eliminates all results that reference it. Paths that are referenced by
+// several file infos, i.e. paths that discriminate between results, are
+// checked first, most discriminating first, since that eliminates the most
+// candidates. The remaining candidates are then verified newest first.
+//
+// Returns the index of the found result. `entries_examined` is set to the
+// number of results that were verified after the elimination.
+optional<uint32_t>
+find_result(const Context& ctx,
+            const FlatManifest& mf,
+            uint32_t& entries_examined)
+{
+  entries_examined = 0;
+
+  const uint32_t n_results = mf.n_results();
+  const uint32_t n_file_infos = mf.n_file_infos();
+  const uint32_t n_files = mf.n_files();
+
+  // Index from file infos to results that reference them, stored as ranges
+  // [result_offsets[i], result_offsets[i + 1]) in referencing_results.
+  std::vector<uint32_t> result_offsets(n_file_infos + 1, 0);
+  for (uint32_t i = 0; i < n_results; ++i) {
+    const auto result = mf.result(i);
+    for (uint32_t j = 0; j < result.n_indexes; ++j) {
+      const uint32_t fi_index = mf.file_info_index(result.first_index + j);
+      if (fi_index >= n_file_infos) {
+        throw Error("Corrupt flat manifest: bad file info index {}", fi_index);
+      }
+      ++result_offsets[fi_index + 1];
     }
+  }
+  for (uint32_t i = 0; i < n_file_infos; ++i) {
+    result_offsets[i + 1] += result_offsets[i];
+  }
+  std::vector<uint32_t> referencing_results(result_offsets[n_file_infos]);
+  {
+    std::vector<uint32_t> positions(result_offsets.begin(),
+                                    result_offsets.end() - 1);
+    for (uint32_t i = 0; i < n_results; ++i) {
+      const auto result = mf.result(i);
+      for (uint32_t j = 0; j < result.n_indexes; ++j) {
+        const uint32_t fi_index = mf.file_info_index(result.first_index + j);
+        referencing_results[positions[fi_index]++] = i;
+      }
+    }
+  }
 
-    auto hashed_files_iter = hashed_files.find(path);
-    if (hashed_files_iter == hashed_files.end()) {
-      Hash hash;
-      int ret = hash_source_code_file(ctx, hash, path, fs.size);
-      if (ret & HASH_SOURCE_CODE_ERROR) {
-        LOG("Failed hashing {}", path);
-        return false;
+  // Referenced file infos per path.
+  std::vector<std::vector<uint32_t>> path_file_infos(n_files);
+  for (uint32_t i = 0; i < n_file_infos; ++i) {
+    if (result_offsets[i + 1] > result_offsets[i]) {
+      const auto fi = mf.file_info(i);
+      if (fi.index >= n_files) {
+        throw Error("Corrupt flat manifest: bad path index {}", fi.index);
       }
-      if (ret & HASH_SOURCE_CODE_FOUND_TIME) {
-        return false;
+      path_file_infos[fi.index].push_back(i);
+    }
+  }
+
+  std::vector<bool> candidates(n_results, true);
+  uint32_t n_candidates = n_results;
+  std::vector<int8_t> file_info_matched(n_file_infos, -1); // -1: not checked
+  std::vector<optional<FileStats>> stated_files(n_files);
+  std::vector<optional<Digest>> hashed_files(n_files);
+
+  if (ctx.config.stat_threads() > 1) {
+    prefetch_stats(ctx, mf, path_file_infos, stated_files);
+  }
+
+  // Check whether file info `fi_index` matches, eliminating the results that
+  // reference it if not.
+  const auto check_file_info = [&](uint32_t fi_index) {
+    if (file_info_matched[fi_index] == -1) {
+      file_info_matched[fi_index] = file_info_matches(
+        ctx, mf, mf.file_info(fi_index), stated_files, hashed_files);
+      if (!file_info_matched[fi_index]) {
+        for (uint32_t i = result_offsets[fi_index];
+             i < result_offsets[fi_index + 1];
+             ++i) {
+          if (candidates[referencing_results[i]]) {
+            candidates[referencing_results[i]] = false;
+            --n_candidates;
+          }
+        }
       }
+    }
+    return file_info_matched[fi_index] == 1;
+  };
+
+  const auto is_referenced_by_candidate = [&](uint32_t fi_index) {
+    const uint32_t end = result_offsets[fi_index + 1];
+    for (uint32_t i = result_offsets[fi_index]; i < end; ++i) {
+      if (candidates[referencing_results[i]]) {
+        return true;
+      }
+    }
+    return false;
+  };
 
-      Digest actual = hash.digest();
-      hashed_files_iter = hashed_files.emplace(path, actual).first;
+  std::vector<uint32_t> discriminating_paths;
+  for (uint32_t i = 0; i < n_files; ++i) {
+    if (path_file_infos[i].size() > 1) {
+      discriminating_paths.push_back(i);
+    }
+  }
+  std::stable_sort(discriminating_paths.begin(),
+                   discriminating_paths.end(),
+                   [&](uint32_t a, uint32_t b) {
+                     return path_file_infos[a].size()
+                            > path_file_infos[b].size();
+                   });
+
+  for (uint32_t path_index : discriminating_paths) {
+    if (n_candidates <= 1) {
+      break;
+    }
+    for (uint32_t fi_index : path_file_infos[path_index]) {
+      if (is_referenced_by_candidate(fi_index)) {
+        check_file_info(fi_index);
+      }
     }
+  }
 
-    if (fi.digest != hashed_files_iter->second) {
-      return false;
+  // Check newest result first since it's a bit more likely to match.
+  for (uint32_t i = n_results; i > 0 && n_candidates > 0; i--) {
+    if (!candidates[i - 1]) {
+      continue;
+    }
+    ++entries_examined;
+    const auto result = mf.result(i - 1);
+    bool matched = true;
+    for (uint32_t j = 0; j < result.n_indexes && matched; ++j) {
+      matched = check_file_info(mf.file_info_index(result.first_index + j));
+    }
+    if (matched) {
+      return i - 1;
     }
   }
 
-  return true;
+  return nullopt;
 }
 
 } // namespace
@@ -491,36 +1664,44 @@ namespace Manifest {
 
 const std::string k_file_suffix = "M";
 const uint8_t k_magic[4] = {'c', 'C', 'm', 'F'};
-const uint8_t k_version = 2;
+const uint8_t k_version = 3;
+const uint8_t k_min_version = 2;
 
 // Try to get the result name from a manifest file. Returns nullopt on failure.
 optional<Digest>
-get(const Context& ctx, const std::string& path)
+get(Context& ctx, const std::string& path)
 {
-  std::unique_ptr<ManifestData> mf;
+  File file(path, "rb");
+  if (!file) {
+    LOG_RAW("No such manifest file");
+    return nullopt;
+  }
+
   try {
-    mf = read_manifest(path);
-    if (mf) {
-      // Update modification timestamp to save files from LRU cleanup.
-      Util::update_mtime(path);
-    } else {
-      LOG_RAW("No such manifest file");
+    MappedManifest mapped;
+    std::string buffer;
+    const FlatManifest mf(
+      get_flat_manifest(ctx, path, file.get(), mapped, buffer));
+    ctx.manifest_is_intact = true;
+
+    // Update modification timestamp to save files from LRU cleanup.
+    Util::update_mtime(path);
+
+    uint32_t entries_examined;
+    const auto result_index = find_result(ctx, mf, entries_examined);
+    LOG("Examined {} of {} manifest entries",
+        entries_examined,
+        mf.n_results());
+    ctx.counter_updates.increment(Statistic::manifest_lookup);
+    ctx.counter_updates.increment(Statistic::manifest_entries_examined,
+                                  entries_examined);
+    if (!result_index) {
       return nullopt;
     }
+
+    return mf.result(*result_index).name;
   } catch (const Error& e) {
     LOG("Error: {}", e.what());
-    return nullopt;
-  }
-
-  std::unordered_map<std::string, FileStats> stated_files;
-  std::unordered_map<std::string, Digest> hashed_files;
-
-  // Check newest result first since it's a bit more likely to match.
-  for (uint32_t i = mf->results.size(); i > 0; i--) {
-    if (verify_result(
-          ctx, *mf, mf->results[i - 1], stated_files, hashed_files)) {
-      return mf->results[i - 1].name;
-    }
   }
 
   return nullopt;
@@ -535,12 +1716,26 @@ put(const Config& config,
     const std::unordered_map<std::string, Digest>& included_files,
 
     time_t time_of_compilation,
-    bool save_timestamp)
+    bool save_timestamp,
+    bool is_intact,
+    const LastUsedFunction& get_last_used)
 {
   // We don't bother to acquire a lock when writing the manifest to disk. A
   // race between two processes will only result in one lost entry, which is
   // not a big deal, and it's also very unlikely.
 
+  std::vector<ManifestData> entries(1);
+  entries[0].add_result_entry(
+    result_name, included_files, time_of_compilation, save_timestamp);
+
+  try {
+    if (is_intact && append_result(config, path, entries[0])) {
+      return true;
+    }
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
+  }
+
   std::unique_ptr<ManifestData> mf;
   try {
     mf = read_manifest(path);
@@ -549,46 +1744,23 @@ put(const Config& config,
       mf = std::make_unique<ManifestData>();
     }
   } catch (const Error& e) {
-    LOG("Error: {}", e.what());
-    // Manifest file was corrupt, ignore.
-    mf = std::make_unique<ManifestData>();
+    // The journal frames are checksummed separately, so their entries survive
+    // a corrupt body.
+    LOG("Replacing unreadable manifest: {}", e.what());
+    mf = read_journal_entries(path);
   }
 
-  if (mf->results.size() > k_max_manifest_entries) {
-    // Normally, there shouldn't be many result entries in the manifest since
-    // new entries are added only if an include file has changed but not the
-    // source file, and you typically change source files more often than
-    // header files. However, it's certainly possible to imagine cases where
-    // the manifest will grow large (for instance, a generated header file that
-    // changes for every build), and this must be taken care of since
-    // processing an ever growing manifest eventually will take too much time.
-    // A good way of solving this would be to maintain the result entries in
-    // LRU order and discarding the old ones. An easy way is to throw away all
-    // entries when there are too many. Let's do that for now.
-    LOG("More than {} entries in manifest file; discarding",
-        k_max_manifest_entries);
-    mf = std::make_unique<ManifestData>();
-  } else if (mf->file_infos.size() > k_max_manifest_file_info_entries) {
-    // Rarely, FileInfo entries can grow large in pathological cases where
-    // many included files change, but the main file does not. This also puts
-    // an upper bound on the number of FileInfo entries.
-    LOG("More than {} FileInfo entries in manifest file; discarding",
-        k_max_manifest_file_info_entries);
-    mf = std::make_unique<ManifestData>();
+  if (mf->has_result(entries[0], entries[0].results[0])) {
+    LOG_RAW("The entry already exists in the manifest, not adding");
+    return false;
   }
 
-  bool added = mf->add_result_entry(
-    result_name, included_files, time_of_compilation, save_timestamp);
-
-  if (added) {
-    try {
-      write_manifest(config, path, *mf);
-      return true;
-    } catch (const Error& e) {
-      LOG("Error: {}", e.what());
-    }
-  } else {
-    LOG_RAW("The entry already exists in the manifest, not adding");
+  try {
+    mf->add_results(entries);
+    compact_manifest(config, path, *mf, get_last_used);
+    return true;
+  } catch (const Error& e) {
+    LOG("Error: {}", e.what());
   }
   return false;
 }
@@ -631,9 +1803,29 @@ dump(const std::string& path, FILE* stream)
     }
     PRINT_RAW(stream, "\n");
     PRINT(stream, "    Name: {}\n", mf->results[i].name.to_string());
+    PRINT(stream, "    Last used: {}\n", mf->results[i].last_used);
   }
 
   return true;
 }
 
+std::string
+read_raw_journal(FILE* stream)
+{
+  const Journal frames = read_journal(stream);
+  const uint64_t size = frames.size;
+  std::string journal(size, 0);
+  if (size > 0) {
+    if (fseek(stream,
+              -static_cast<long>(size + frames.ignored_size),
+              SEEK_END)
+          != 0
+        || fread(&journal[0], size, 1, stream) != 1) {
+      throw Error("Error reading manifest journal");
+    }
+    rewind(stream);
+  }
+  return journal;
+}
+
 } // namespace Manifest
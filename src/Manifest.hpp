@@ -22,6 +22,7 @@
 
 #include "third_party/nonstd/optional.hpp"
 
+#include <functional>
 #include <string>
 #include <unordered_map>
 
@@ -34,14 +35,32 @@ namespace Manifest {
 extern const std::string k_file_suffix;
 extern const uint8_t k_magic[4];
 extern const uint8_t k_version;
+extern const uint8_t k_min_version; // Oldest version that can be read.
 
-nonstd::optional<Digest> get(const Context& ctx, const std::string& path);
+nonstd::optional<Digest> get(Context& ctx, const std::string& path);
+
+// Return when the result named `name` was last used, or 0 if it's gone.
+using LastUsedFunction = std::function<int64_t(const Digest& name)>;
+
+// Add `result_name` to the manifest file `path`. `is_intact` tells whether the
+// file was just read without errors, in which case the result may be appended
+// without reading the whole file again. `get_last_used` is called for the
+// results of the manifest if some of them have to be evicted.
 bool put(const Config& config,
          const std::string& path,
          const Digest& result_name,
          const std::unordered_map<std::string, Digest>& included_files,
          time_t time_of_compilation,
-         bool save_timestamp);
+         bool save_timestamp,
+         bool is_intact,
+         const LastUsedFunction& get_last_used);
 bool dump(const std::string& path, FILE* stream);
 
+// Read the journal frames appended to the manifest file opened as `stream`
+// without interpreting them, leaving out incomplete data after them. `stream`
+// is rewound afterwards.
+//
+// Throws Error on failure.
+std::string read_raw_journal(FILE* stream);
+
 } // namespace Manifest
@@ -0,0 +1,271 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "ManifestCache.hpp"
+
+#include "Config.hpp"
+#include "Digest.hpp"
+#include "Logging.hpp"
+#include "SeqlockEntry.hpp"
+#include "Util.hpp"
+#include "fmtmacros.hpp"
+
+#include <atomic>
+
+// The manifest cache resides on a file that is mapped into shared memory by
+// running processes. It consists of a direct-mapped index of entries and a
+// data area used as a ring buffer. Each entry maps a key to a range of the
+// data area. Stored data is never moved, so an entry is valid until the ring
+// buffer has wrapped around and new data has been written over its range.
+//
+// Concurrent access is lock-free since each entry is a SeqlockEntry. A writer
+// first reserves a range of the data area by advancing the write position
+// atomically and copies its data there before writing the entry. After copying
+// the data, a reader checks that the write position has not moved so far that
+// the range could have been reused by another writer meanwhile.
+
+namespace {
+
+// The version number corresponds to the layout of the shared region.
+//
+// Note: The key is supplied by the caller, so the version number does not
+// need to be incremented if the semantics of the key or data change.
+const uint32_t k_version = 3;
+
+// Note: Increment the version number if constants affecting storage size are
+// changed.
+const uint32_t k_num_entries = 8 * 1024;
+const uint64_t k_data_size = 32 * 1024 * 1024;
+
+// Data larger than this is not stored since it would evict too much.
+const uint64_t k_max_data_size = k_data_size / 8;
+
+static_assert(Digest::size() == 20,
+              "Increment version number if size of digest is changed.");
+static_assert(IS_TRIVIALLY_COPYABLE(Digest),
+              "Digest is expected to be trivially copyable.");
+
+} // namespace
+
+struct ManifestCache::Value
+{
+  Digest key;      // Key supplied by the caller
+  uint64_t offset; // Position in the data stream, not wrapped
+  uint64_t size;   // Size of data
+};
+
+struct ManifestCache::SharedRegion
+{
+  uint32_t version;
+  std::atomic<int64_t> hits;
+  std::atomic<int64_t> misses;
+  std::atomic<int64_t> errors;
+  // Total number of bytes ever reserved in data.
+  std::atomic<uint64_t> write_position;
+  SeqlockEntry<Value> entries[k_num_entries];
+  uint8_t data[k_data_size];
+};
+
+bool
+ManifestCache::mmap_file(const std::string& manifest_cache_file)
+{
+  m_sr = nullptr;
+  const bool mapped = m_mapping.map(
+    manifest_cache_file, k_version, [](const void* /*data*/, size_t size) {
+      return size == sizeof(SharedRegion);
+    });
+  if (!mapped) {
+    return false;
+  }
+  m_sr = static_cast<SharedRegion*>(m_mapping.data());
+  if (m_config.debug()) {
+    LOG("manifest cache file loaded: {}", manifest_cache_file);
+  }
+  return true;
+}
+
+bool
+ManifestCache::create_new_file(const std::string& filename)
+{
+  LOG_RAW("Creating a new manifest cache");
+
+  // The entries are zero-filled, i.e. unused.
+  return m_mapping.create(
+    filename, sizeof(SharedRegion), k_version, [](void* /*data*/) {});
+}
+
+bool
+ManifestCache::initialize()
+{
+  if (m_failed || !m_config.manifest_cache()) {
+    return false;
+  }
+
+  if (m_sr) {
+    return true;
+  }
+
+  std::string filename = get_file();
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  // Try to create a new cache if we failed to map an existing file.
+  create_new_file(filename);
+
+  // Concurrent processes could try to create new files simultaneously and the
+  // file that actually landed on disk will be from the process that won the
+  // race. Thus we try to open the file from disk instead of reusing the file
+  // handle to the file we just created.
+  if (mmap_file(filename)) {
+    return true;
+  }
+
+  m_failed = true;
+  return false;
+}
+
+ManifestCache::ManifestCache(const Config& config)
+  : m_config(config),
+    m_mapping("manifest cache")
+{
+}
+
+ManifestCache::~ManifestCache()
+{
+}
+
+bool
+ManifestCache::get(const Digest& key, std::string& data)
+{
+  if (!initialize()) {
+    return false;
+  }
+
+  uint32_t hash;
+  Util::big_endian_to_int(key.bytes(), hash);
+  Value value;
+  const auto result = m_sr->entries[hash % k_num_entries].read(value);
+  const bool busy = result == SeqlockEntry<Value>::ReadResult::busy;
+  bool found = false;
+  if (result == SeqlockEntry<Value>::ReadResult::ok && value.key == key
+      && value.size <= k_max_data_size
+      && value.offset % k_data_size + value.size <= k_data_size) {
+    data.assign(
+      reinterpret_cast<const char*>(&m_sr->data[value.offset % k_data_size]),
+      value.size);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    found = m_sr->write_position.load(std::memory_order_relaxed)
+            <= value.offset + k_data_size;
+  }
+
+  LOG("manifest cache {}: {}", found ? "hit" : "miss", key.to_string());
+
+  if (m_config.debug()) {
+    if (found) {
+      ++m_sr->hits;
+    } else {
+      ++m_sr->misses;
+      if (busy) {
+        ++m_sr->errors;
+      }
+    }
+    LOG("Accumulated stats for manifest cache: hits={}, misses={}, errors={}",
+        m_sr->hits.load(),
+        m_sr->misses.load(),
+        m_sr->errors.load());
+  }
+  return found;
+}
+
+bool
+ManifestCache::put(const Digest& key, nonstd::string_view data)
+{
+  if (data.empty() || data.size() > k_max_data_size || !initialize()) {
+    return false;
+  }
+
+  // Reserve a range of the data area that doesn't wrap around the end.
+  uint64_t position = m_sr->write_position.load(std::memory_order_relaxed);
+  uint64_t offset;
+  do {
+    offset = position;
+    const uint64_t wrapped_offset = offset % k_data_size;
+    if (wrapped_offset + data.size() > k_data_size) {
+      offset += k_data_size - wrapped_offset;
+    }
+  } while (!m_sr->write_position.compare_exchange_weak(
+    position, offset + data.size(), std::memory_order_relaxed));
+
+  memcpy(&m_sr->data[offset % k_data_size], data.data(), data.size());
+
+  uint32_t hash;
+  Util::big_endian_to_int(key.bytes(), hash);
+  Value value;
+  value.key = key;
+  value.offset = offset;
+  value.size = data.size();
+  // The entry is released after the data copied above has been stored.
+  if (!m_sr->entries[hash % k_num_entries].write(value)) {
+    LOG("manifest cache entry busy, not inserting: {}", key.to_string());
+    if (m_config.debug()) {
+      ++m_sr->errors;
+    }
+    return false;
+  }
+
+  LOG("manifest cache insert: {}", key.to_string());
+
+  return true;
+}
+
+bool
+ManifestCache::drop()
+{
+  std::string file = get_file();
+  if (unlink(file.c_str()) != 0) {
+    return false;
+  }
+  m_mapping.unmap();
+  m_sr = nullptr;
+  return true;
+}
+
+std::string
+ManifestCache::get_file()
+{
+  return FMT("{}/manifest-cache.v{}", m_config.temporary_dir(), k_version);
+}
+
+int64_t
+ManifestCache::get_hits()
+{
+  return initialize() ? m_sr->hits.load() : -1;
+}
+
+int64_t
+ManifestCache::get_misses()
+{
+  return initialize() ? m_sr->misses.load() : -1;
+}
+
+int64_t
+ManifestCache::get_errors()
+{
+  return initialize() ? m_sr->errors.load() : -1;
+}
@@ -0,0 +1,94 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "SharedMapping.hpp"
+
+#include "third_party/nonstd/string_view.hpp"
+
+#include <string>
+
+class Config;
+class Digest;
+
+// Cache of decoded manifests shared by concurrently running ccache processes.
+// The cache maps a key identifying the content of a manifest file to an opaque
+// blob that the caller can use without decompressing or parsing the manifest
+// file again.
+class ManifestCache
+{
+public:
+  ManifestCache(const Config& config);
+  ~ManifestCache();
+
+  // Get data stored for `key` by a previous call to put().
+  //
+  // Returns true if data could be retrieved from the cache, false otherwise.
+  bool get(const Digest& key, std::string& data);
+
+  // Store `data` for `key`, possibly evicting data stored for other keys.
+  //
+  // Returns true if data could be stored in the cache, false otherwise.
+  bool put(const Digest& key, nonstd::string_view data);
+
+  // Map the cache file, creating it if needed. The other methods do this on
+  // demand, but a process may call it before forking so that its children
+  // share the mapping.
+  //
+  // Returns true if the cache is enabled and could be mapped, false otherwise.
+  bool initialize();
+
+  // Unmaps the current cache and removes the mapped file from disk.
+  //
+  // Returns true on success, false otherwise.
+  bool drop();
+
+  // Returns name of the persistent file.
+  std::string get_file();
+
+  // Returns total number of cache hits.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_hits();
+
+  // Returns total number of cache misses.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_misses();
+
+  // Returns total number of lookups and insertions that failed because of
+  // concurrent writes to the same entry.
+  //
+  // Counters are incremented in debug mode only.
+  int64_t get_errors();
+
+private:
+  struct SharedRegion;
+  struct Value;
+
+  bool mmap_file(const std::string& manifest_cache_file);
+  bool create_new_file(const std::string& filename);
+
+  const Config& m_config;
+  SharedMapping m_mapping;
+  struct SharedRegion* m_sr = nullptr; // Content of m_mapping
+  bool m_failed = false;
+};
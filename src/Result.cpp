@@ -20,9 +20,11 @@
 
 #include "AtomicFile.hpp"
 #include "CacheEntryReader.hpp"
-#include "CacheEntryWriter.hpp"
+#include "Checksum.hpp"
+#include "Compressor.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Decompressor.hpp"
 #include "Fd.hpp"
 #include "File.hpp"
 #include "Logging.hpp"
@@ -33,13 +35,15 @@
 #include "fmtmacros.hpp"
 
 #include <algorithm>
+#include <functional>
 
 // Result data format
 // ==================
 //
 // Integers are big-endian.
 //
-// <result>               ::= <header> <body> <epilogue>
+// <result>               ::= <header> <n_entries> <table_entry>*
+//                            <table_checksum> <entry_data>*
 // <header>               ::= <magic> <version> <compr_type> <compr_level>
 //                            <content_len>
 // <magic>                ::= 4 bytes ("cCrS")
@@ -49,20 +53,18 @@
 // <compr_zstd>           ::= 1 (uint8_t)
 // <compr_level>          ::= int8_t
 // <content_len>          ::= uint64_t ; size of file if stored uncompressed
-// <body>                 ::= <n_entries> <entry>* ; potentially compressed
 // <n_entries>            ::= uint8_t
-// <entry>                ::= <embedded_file_entry> | <raw_file_entry>
-// <embedded_file_entry>  ::= <embedded_file_marker> <suffix_len> <suffix>
-//                            <data_len> <data>
+// <table_entry>          ::= <entry_marker> <file_type> <file_len> <data_len>
+//                            <data_checksum>
+// <entry_marker>         ::= <embedded_file_marker> | <raw_file_marker>
 // <embedded_file_marker> ::= 0 (uint8_t)
-// <embedded_file_type>   ::= uint8_t
-// <data_len>             ::= uint64_t
-// <data>                 ::= data_len bytes
-// <raw_file_entry>       ::= <raw_file_marker> <suffix_len> <suffix> <file_len>
 // <raw_file_marker>      ::= 1 (uint8_t)
-// <file_len>             ::= uint64_t
-// <epilogue>             ::= <checksum>
-// <checksum>             ::= uint64_t ; XXH3 of content bytes
+// <file_type>            ::= uint8_t
+// <file_len>             ::= uint64_t ; size of the uncompressed file
+// <data_len>             ::= uint64_t ; size of <entry_data>, 0 for raw files
+// <data_checksum>        ::= uint64_t ; XXH3 of file, 0 for raw files
+// <table_checksum>       ::= uint64_t ; XXH3 of header and entry table
+// <entry_data>           ::= data_len bytes ; separately compressed
 //
 // Sketch of concrete layout:
 //
@@ -71,24 +73,34 @@
 // <compr_type>           1 byte
 // <compr_level>          1 byte
 // <content_len>          8 bytes
-// --- [potentially compressed from here] -------------------------------------
 // <n_entries>            1 byte
-// <embedded_file_marker> 1 byte
-// <embedded_file_type>   1 byte
+// <entry_marker>         1 byte
+// <file_type>            1 byte
+// <file_len>             8 bytes
 // <data_len>             8 bytes
-// <data>                 data_len bytes
+// <data_checksum>        8 bytes
 // ...
-// <ref_marker>           1 byte
-// <key_len>              1 byte
-// <key>                  key_len bytes
+// <table_checksum>       8 bytes
+// <entry_data>           data_len bytes (compressed stream of file_len bytes)
 // ...
-// checksum               8 bytes
+//
+// Entry data is stored in table order for embedded entries only, so the
+// position of an entry's data is the end of the table plus the sum of the
+// preceding data_len fields. Since each entry is compressed on its own, a
+// reader can seek to and decompress any entry without touching the others.
+//
+// Version 1 (still readable) instead had a single compressed body:
+//
+// <body>                 ::= <n_entries> <entry>* ; potentially compressed
+// <entry>                ::= <entry_marker> <file_type> <file_len> [<data>]
+// <epilogue>             ::= <checksum> ; XXH3 of content bytes
 //
 //
 // Version history
 // ===============
 //
 // 1: Introduced in ccache 4.0.
+// 2: Entry table with separately compressed entry data.
 
 using nonstd::nullopt;
 using nonstd::optional;
@@ -136,13 +148,357 @@ should_store_raw_file(const Config& config, Result::FileType type)
   return type == Result::FileType::object;
 }
 
+// Size of <header>.
+const size_t k_header_size = 15;
+
+// Size of <table_entry>.
+const size_t k_table_entry_size = 1 + 1 + 8 + 8 + 8;
+
+// Smaller files are compressed without worker threads since libzstd hands out
+// work to its threads in jobs of a few MiB each.
+const uint64_t k_min_threaded_compression_size = 4 * 1024 * 1024;
+
+struct TableEntry
+{
+  uint8_t marker;
+  Result::FileType file_type;
+  uint64_t file_len;
+  uint64_t data_len;
+  uint64_t data_checksum;
+};
+
+struct EntryTable
+{
+  Compression::Type compression_type;
+  std::vector<TableEntry> entries;
+  std::vector<uint64_t> offsets; // File position of each entry's data
+};
+
+// Called to produce or consume a chunk of entry data.
+using DataHandler = std::function<void(uint8_t* data, size_t size)>;
+
+// Note: ctime is not compared since storing a raw file as a hard link changes
+// it.
+bool
+is_unchanged(const Stat& before, const Stat& after)
+{
+  return after && after.device() == before.device()
+         && after.inode() == before.inode() && after.size() == before.size()
+         && after.mtim().tv_sec == before.mtim().tv_sec
+         && after.mtim().tv_nsec == before.mtim().tv_nsec;
+}
+
+uint64_t
+get_entry_data_start(size_t n_entries)
+{
+  return k_header_size + 1 + n_entries * k_table_entry_size + 8;
+}
+
+// fseek and ftell use long, which is 32 bits on Windows, so use the 64-bit
+// variants to support results larger than 2 GiB.
+void
+seek(FILE* stream, uint64_t offset, int whence = SEEK_SET)
+{
+#ifdef _WIN32
+  const int ret = _fseeki64(stream, static_cast<int64_t>(offset), whence);
+#else
+  const int ret = fseeko(stream, static_cast<off_t>(offset), whence);
+#endif
+  if (ret != 0) {
+    throw Error("Failed to seek in result file: {}", strerror(errno));
+  }
+}
+
+uint64_t
+tell(FILE* stream)
+{
+#ifdef _WIN32
+  const int64_t position = _ftelli64(stream);
+#else
+  const off_t position = ftello(stream);
+#endif
+  if (position < 0) {
+    throw Error("Failed to get position in result file: {}", strerror(errno));
+  }
+  return position;
+}
+
+void
+write_entry_table(FILE* stream,
+                  Compression::Type compression_type,
+                  int8_t compression_level,
+                  const std::vector<TableEntry>& entries)
+{
+  std::vector<uint8_t> bytes(get_entry_data_start(entries.size()));
+
+  uint64_t content_len = bytes.size();
+  for (const auto& entry : entries) {
+    if (entry.marker == k_embedded_file_marker) {
+      content_len += entry.file_len;
+    }
+  }
+
+  memcpy(&bytes[0], Result::k_magic, sizeof(Result::k_magic));
+  bytes[4] = Result::k_version;
+  bytes[5] = static_cast<uint8_t>(compression_type);
+  bytes[6] = compression_level;
+  Util::int_to_big_endian(content_len, &bytes[7]);
+  bytes[k_header_size] = entries.size();
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    const auto& entry = entries[i];
+    uint8_t* p = &bytes[k_header_size + 1 + i * k_table_entry_size];
+    p[0] = entry.marker;
+    p[1] = static_cast<Result::UnderlyingFileTypeInt>(entry.file_type);
+    Util::int_to_big_endian(entry.file_len, p + 2);
+    Util::int_to_big_endian(entry.data_len, p + 10);
+    Util::int_to_big_endian(entry.data_checksum, p + 18);
+  }
+
+  Checksum checksum;
+  checksum.update(bytes.data(), bytes.size() - 8);
+  Util::int_to_big_endian(checksum.digest(), &bytes[bytes.size() - 8]);
+
+  seek(stream, 0);
+  if (fwrite(bytes.data(), bytes.size(), 1, stream) != 1) {
+    throw Error("Failed to write result entry table");
+  }
+}
+
+EntryTable
+read_entry_table(FILE* stream)
+{
+  seek(stream, 0);
+
+  uint8_t header[k_header_size + 1];
+  if (fread(header, sizeof(header), 1, stream) != 1) {
+    throw Error("Error reading entry table");
+  }
+  const uint8_t n_entries = header[k_header_size];
+  std::vector<uint8_t> table(n_entries * k_table_entry_size + 8);
+  if (fread(table.data(), table.size(), 1, stream) != 1) {
+    throw Error("Error reading entry table");
+  }
+
+  Checksum checksum;
+  checksum.update(header, sizeof(header));
+  checksum.update(table.data(), table.size() - 8);
+  uint64_t expected_checksum;
+  Util::big_endian_to_int(&table[table.size() - 8], expected_checksum);
+  if (checksum.digest() != expected_checksum) {
+    throw Error(
+      "Incorrect entry table checksum (actual 0x{:016x}, expected 0x{:016x})",
+      checksum.digest(),
+      expected_checksum);
+  }
+
+  EntryTable result;
+  result.compression_type = Compression::type_from_int(header[5]);
+  uint64_t offset = get_entry_data_start(n_entries);
+  for (size_t i = 0; i < n_entries; ++i) {
+    const uint8_t* p = &table[i * k_table_entry_size];
+    TableEntry entry;
+    entry.marker = p[0];
+    if (entry.marker != k_embedded_file_marker
+        && entry.marker != k_raw_file_marker) {
+      throw Error("Unknown entry type: {}", entry.marker);
+    }
+    entry.file_type = Result::FileType(p[1]);
+    Util::big_endian_to_int(p + 2, entry.file_len);
+    Util::big_endian_to_int(p + 10, entry.data_len);
+    Util::big_endian_to_int(p + 18, entry.data_checksum);
+    result.entries.push_back(entry);
+    result.offsets.push_back(offset);
+    offset += entry.data_len;
+  }
+
+  seek(stream, 0, SEEK_END);
+  const uint64_t file_size = tell(stream);
+  if (file_size != offset) {
+    throw Error("Bad result file size (actual {} bytes, expected {} bytes)",
+                file_size,
+                offset);
+  }
+
+  return result;
+}
+
+// Write `entry.file_len` bytes produced by `producer` as a separately
+// compressed stream at the end of `stream`, updating the data length and
+// checksum of `entry`. Large entries are compressed using `n_threads` worker
+// threads if nonzero. The dictionary trained for the file type is used if there
+// is one.
+void
+write_entry_data(FILE* stream,
+                 Compression::Type compression_type,
+                 int8_t compression_level,
+                 TableEntry& entry,
+                 const DataHandler& producer,
+                 uint32_t n_threads = 0)
+{
+  seek(stream, 0, SEEK_END);
+  const uint64_t start = tell(stream);
+
+  std::shared_ptr<const CompressionDictionary::Dictionary> dictionary;
+  if (compression_type == Compression::Type::zstd) {
+    const auto kind = Result::file_type_to_dictionary_kind(entry.file_type);
+    if (kind) {
+      dictionary = CompressionDictionary::get_for_kind(*kind);
+    }
+  }
+  auto compressor = Compressor::create_from_type(
+    compression_type,
+    stream,
+    compression_level,
+    entry.file_len >= k_min_threaded_compression_size ? n_threads : 0,
+    dictionary.get());
+  Checksum checksum;
+  uint64_t remain = entry.file_len;
+  while (remain > 0) {
+    uint8_t buf[READ_BUFFER_SIZE];
+    size_t n = std::min(remain, static_cast<uint64_t>(sizeof(buf)));
+    producer(buf, n);
+    compressor->write(buf, n);
+    checksum.update(buf, n);
+    remain -= n;
+  }
+  compressor->finalize();
+
+  entry.data_len = tell(stream) - start;
+  entry.data_checksum = checksum.digest();
+}
+
+#ifdef HAVE_SYS_MMAN_H
+// Verify the checksum of the uncompressed data of `entry` located at `offset`
+// in `fd` by mapping it instead of reading it into a buffer.
+void
+verify_entry_data_in_place(int fd, uint64_t offset, const TableEntry& entry)
+{
+  Checksum checksum;
+  if (entry.file_len > 0) {
+    const size_t size = offset + entry.file_len;
+    void* data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+      throw Error("Failed to mmap result file: {}", strerror(errno));
+    }
+    checksum.update(static_cast<const uint8_t*>(data) + offset, entry.file_len);
+    munmap(data, size);
+  }
+
+  if (checksum.digest() != entry.data_checksum) {
+    throw Error(
+      "Incorrect entry checksum (actual 0x{:016x}, expected 0x{:016x})",
+      checksum.digest(),
+      entry.data_checksum);
+  }
+}
+#endif
+
+// Decompress the data of `entry` located at `offset` in `stream`, pass it to
+// `consumer` and verify its checksum.
+void
+read_entry_data(FILE* stream,
+                Compression::Type compression_type,
+                uint64_t offset,
+                const TableEntry& entry,
+                const DataHandler& consumer)
+{
+  seek(stream, offset);
+
+  auto decompressor = Decompressor::create_from_type(compression_type, stream);
+  Checksum checksum;
+  uint64_t remain = entry.file_len;
+  while (remain > 0) {
+    uint8_t buf[READ_BUFFER_SIZE];
+    size_t n = std::min(remain, static_cast<uint64_t>(sizeof(buf)));
+    decompressor->read(buf, n);
+    checksum.update(buf, n);
+    consumer(buf, n);
+    remain -= n;
+  }
+
+  if (checksum.digest() != entry.data_checksum) {
+    throw Error(
+      "Incorrect entry checksum (actual 0x{:016x}, expected 0x{:016x})",
+      checksum.digest(),
+      entry.data_checksum);
+  }
+}
+
+Result::Reader::EntryDataWriter
+get_entry_data_writer(const std::string& result_path,
+                      Compression::Type compression_type,
+                      uint64_t offset,
+                      const TableEntry& entry)
+{
+  return [=](int fd) {
+    File file(result_path, "rb");
+    if (!file) {
+      throw Error(
+        "Failed to open {} for reading: {}", result_path, strerror(errno));
+    }
+#ifdef HAVE_SYS_MMAN_H
+    if (compression_type == Compression::Type::none) {
+      Util::copy_fd_range(fileno(file.get()), offset, fd, entry.file_len);
+      verify_entry_data_in_place(fileno(file.get()), offset, entry);
+      return;
+    }
+#endif
+    read_entry_data(file.get(),
+                    compression_type,
+                    offset,
+                    entry,
+                    [&](uint8_t* data, size_t size) {
+                      Util::write_fd(fd, data, size);
+                    });
+  };
+}
+
+void
+write_embedded_file_entry(FILE* stream,
+                          Compression::Type compression_type,
+                          int8_t compression_level,
+                          TableEntry& entry,
+                          const std::string& path,
+                          uint32_t n_threads)
+{
+  Fd file(open(path.c_str(), O_RDONLY | O_BINARY));
+  if (!file) {
+    throw Error("Failed to open {} for reading", path);
+  }
+
+  write_entry_data(
+    stream,
+    compression_type,
+    compression_level,
+    entry,
+    [&](uint8_t* data, size_t size) {
+      while (size > 0) {
+        ssize_t bytes_read = read(*file, data, size);
+        if (bytes_read == -1) {
+          if (errno == EINTR) {
+            continue;
+          }
+          throw Error("Error reading from {}: {}", path, strerror(errno));
+        }
+        if (bytes_read == 0) {
+          throw Error("Error reading from {}: end of file", path);
+        }
+        data += bytes_read;
+        size -= bytes_read;
+      }
+    },
+    n_threads);
+}
+
 } // namespace
 
 namespace Result {
 
 const std::string k_file_suffix = "R";
 const uint8_t k_magic[4] = {'c', 'C', 'r', 'S'};
-const uint8_t k_version = 1;
+const uint8_t k_version = 2;
+const uint8_t k_min_version = 1;
 const char* const k_unknown_file_type = "<unknown type>";
 
 const char*
@@ -177,6 +533,25 @@ file_type_to_string(FileType type)
   return k_unknown_file_type;
 }
 
+optional<CompressionDictionary::Kind>
+file_type_to_dictionary_kind(FileType type)
+{
+  // Other file types are too rare to be worth dictionaries of their own.
+  switch (type) {
+  case FileType::object:
+    return CompressionDictionary::Kind::object;
+
+  case FileType::dependency:
+    return CompressionDictionary::Kind::dependency;
+
+  case FileType::stderr_output:
+    return CompressionDictionary::Kind::stderr_output;
+
+  default:
+    return nullopt;
+  }
+}
+
 std::string
 gcno_file_in_mangled_form(const Context& ctx)
 {
@@ -226,10 +601,58 @@ Reader::read_result(Consumer& consumer)
     return false;
   }
 
-  CacheEntryReader cache_entry_reader(file.get(), k_magic, k_version);
+  CacheEntryReader cache_entry_reader(
+    file.get(), k_magic, k_version, k_min_version);
 
   consumer.on_header(cache_entry_reader);
 
+  if (cache_entry_reader.version() < 2) {
+    read_sequential_entries(cache_entry_reader, consumer);
+    consumer.on_result_end();
+    return true;
+  }
+
+  const auto table = read_entry_table(file.get());
+  for (uint32_t i = 0; i < table.entries.size(); ++i) {
+    const auto& entry = table.entries[i];
+    if (entry.marker == k_raw_file_marker) {
+      read_raw_file_entry(i, entry.file_type, entry.file_len, consumer);
+    } else if (!consumer.on_entry_start(
+                 i, entry.file_type, entry.file_len, nullopt)) {
+      // Skip unwanted data.
+    } else if (consumer.on_entry_data_writer(
+                 get_entry_data_writer(m_result_path,
+                                       table.compression_type,
+                                       table.offsets[i],
+                                       entry))) {
+      // The consumer writes the data itself.
+#ifdef HAVE_SYS_MMAN_H
+    } else if (table.compression_type == Compression::Type::none
+               && consumer.on_entry_data_range(
+                 fileno(file.get()), table.offsets[i], entry.file_len)) {
+      // Like when streaming the data, it's verified after being handed over.
+      verify_entry_data_in_place(fileno(file.get()), table.offsets[i], entry);
+#endif
+    } else {
+      read_entry_data(file.get(),
+                      table.compression_type,
+                      table.offsets[i],
+                      entry,
+                      [&](uint8_t* data, size_t size) {
+                        consumer.on_entry_data(data, size);
+                      });
+    }
+    consumer.on_entry_end();
+  }
+
+  consumer.on_result_end();
+  return true;
+}
+
+void
+Reader::read_sequential_entries(CacheEntryReader& cache_entry_reader,
+                                Consumer& consumer)
+{
   uint8_t n_entries;
   cache_entry_reader.read(n_entries);
 
@@ -243,7 +666,6 @@ Reader::read_result(Consumer& consumer)
   }
 
   cache_entry_reader.finalize();
-  return true;
 }
 
 void
@@ -271,32 +693,45 @@ Reader::read_entry(CacheEntryReader& cache_entry_reader,
   cache_entry_reader.read(file_len);
 
   if (marker == k_embedded_file_marker) {
-    consumer.on_entry_start(entry_number, file_type, file_len, nullopt);
+    const bool wanted =
+      consumer.on_entry_start(entry_number, file_type, file_len, nullopt);
 
+    // The data must be read even if unwanted since the body is a single
+    // compressed stream.
     uint8_t buf[READ_BUFFER_SIZE];
     size_t remain = file_len;
     while (remain > 0) {
       size_t n = std::min(remain, sizeof(buf));
       cache_entry_reader.read(buf, n);
-      consumer.on_entry_data(buf, n);
+      if (wanted) {
+        consumer.on_entry_data(buf, n);
+      }
       remain -= n;
     }
   } else {
     ASSERT(marker == k_raw_file_marker);
+    read_raw_file_entry(entry_number, file_type, file_len, consumer);
+  }
 
-    auto raw_path = get_raw_file_path(m_result_path, entry_number);
-    auto st = Stat::stat(raw_path, Stat::OnError::throw_error);
-    if (st.size() != file_len) {
-      throw Error("Bad file size of {} (actual {} bytes, expected {} bytes)",
-                  raw_path,
-                  st.size(),
-                  file_len);
-    }
+  consumer.on_entry_end();
+}
 
-    consumer.on_entry_start(entry_number, file_type, file_len, raw_path);
+void
+Reader::read_raw_file_entry(uint32_t entry_number,
+                            FileType file_type,
+                            uint64_t file_len,
+                            Consumer& consumer)
+{
+  auto raw_path = get_raw_file_path(m_result_path, entry_number);
+  auto st = Stat::stat(raw_path, Stat::OnError::throw_error);
+  if (st.size() != file_len) {
+    throw Error("Bad file size of {} (actual {} bytes, expected {} bytes)",
+                raw_path,
+                st.size(),
+                file_len);
   }
 
-  consumer.on_entry_end();
+  consumer.on_entry_start(entry_number, file_type, file_len, raw_path);
 }
 
 Writer::Writer(Context& ctx, const std::string& result_path)
@@ -308,7 +743,7 @@ Writer::Writer(Context& ctx, const std::string& result_path)
 void
 Writer::write(FileType file_type, const std::string& file_path)
 {
-  m_entries_to_write.emplace_back(file_type, file_path);
+  m_entries_to_write.push_back({file_type, file_path, Stat::stat(file_path)});
 }
 
 optional<std::string>
@@ -325,89 +760,73 @@ Writer::finalize()
 void
 Writer::do_finalize()
 {
-  uint64_t payload_size = 0;
-  payload_size += 1; // n_entries
-  for (const auto& pair : m_entries_to_write) {
-    const auto& path = pair.second;
-    auto st = Stat::stat(path, Stat::OnError::throw_error);
-
-    payload_size += 1;         // embedded_file_marker
-    payload_size += 1;         // embedded_file_type
-    payload_size += 8;         // data_len
-    payload_size += st.size(); // data
+  const auto compression_type = Compression::type_from_config(m_ctx.config);
+  const auto compression_level = Compression::level_from_config(m_ctx.config);
+
+  std::vector<TableEntry> entries;
+  for (const auto& entry_to_write : m_entries_to_write) {
+    if (!entry_to_write.stat) {
+      throw Error("failed to stat {}: {}",
+                  entry_to_write.path,
+                  strerror(entry_to_write.stat.error_number()));
+    }
+    TableEntry entry;
+    const bool store_raw =
+      should_store_raw_file(m_ctx.config, entry_to_write.file_type);
+    entry.marker = store_raw ? k_raw_file_marker : k_embedded_file_marker;
+    entry.file_type = entry_to_write.file_type;
+    entry.file_len = entry_to_write.stat.size();
+    entry.data_len = 0;
+    entry.data_checksum = 0;
+    entries.push_back(entry);
   }
 
   AtomicFile atomic_result_file(m_result_path, AtomicFile::Mode::binary);
-  CacheEntryWriter writer(atomic_result_file.stream(),
-                          k_magic,
-                          k_version,
-                          Compression::type_from_config(m_ctx.config),
-                          Compression::level_from_config(m_ctx.config),
-                          payload_size);
-
-  writer.write<uint8_t>(m_entries_to_write.size());
-
-  uint32_t entry_number = 0;
-  for (const auto& pair : m_entries_to_write) {
-    const auto file_type = pair.first;
-    const auto& path = pair.second;
-    LOG("Storing result {}", path);
+  FILE* stream = atomic_result_file.stream();
+
+  // Reserve space for the header and entry table, which are written when the
+  // lengths and checksums of the entry data are known.
+  write_entry_table(stream, compression_type, compression_level, entries);
 
-    const bool store_raw = should_store_raw_file(m_ctx.config, file_type);
-    uint64_t file_size = Stat::stat(path, Stat::OnError::throw_error).size();
+  for (uint32_t i = 0; i < entries.size(); ++i) {
+    auto& entry = entries[i];
+    const auto& path = m_entries_to_write[i].path;
+    LOG("Storing result {}", path);
 
+    const bool store_raw = entry.marker == k_raw_file_marker;
     LOG("Storing {} file #{} {} ({} bytes) from {}",
         store_raw ? "raw" : "embedded",
-        entry_number,
-        file_type_to_string(file_type),
-        file_size,
+        i,
+        file_type_to_string(entry.file_type),
+        entry.file_len,
         path);
 
-    writer.write<uint8_t>(store_raw ? k_raw_file_marker
-                                    : k_embedded_file_marker);
-    writer.write(UnderlyingFileTypeInt(file_type));
-    writer.write(file_size);
-
     if (store_raw) {
-      write_raw_file_entry(path, entry_number);
+      write_raw_file_entry(path, i);
     } else {
-      write_embedded_file_entry(writer, path, file_size);
+      write_embedded_file_entry(stream,
+                                compression_type,
+                                compression_level,
+                                entry,
+                                path,
+                                m_ctx.config.compression_threads());
     }
-
-    ++entry_number;
   }
 
-  writer.finalize();
-  atomic_result_file.commit();
-}
-
-void
-Result::Writer::write_embedded_file_entry(CacheEntryWriter& writer,
-                                          const std::string& path,
-                                          uint64_t file_size)
-{
-  Fd file(open(path.c_str(), O_RDONLY | O_BINARY));
-  if (!file) {
-    throw Error("Failed to open {} for reading", path);
-  }
+  const int8_t actual_compression_level =
+    Compression::actual_level(compression_type, compression_level);
+  write_entry_table(
+    stream, compression_type, actual_compression_level, entries);
 
-  uint64_t remain = file_size;
-  while (remain > 0) {
-    uint8_t buf[READ_BUFFER_SIZE];
-    size_t n = std::min(remain, static_cast<uint64_t>(sizeof(buf)));
-    ssize_t bytes_read = read(*file, buf, n);
-    if (bytes_read == -1) {
-      if (errno == EINTR) {
-        continue;
-      }
-      throw Error("Error reading from {}: {}", path, strerror(errno));
-    }
-    if (bytes_read == 0) {
-      throw Error("Error reading from {}: end of file", path);
+  // The files may have been stored long after they were registered (see
+  // Config::async_store), so make sure that they are still the same.
+  for (const auto& entry_to_write : m_entries_to_write) {
+    if (!is_unchanged(entry_to_write.stat, Stat::stat(entry_to_write.path))) {
+      throw Error("{} was modified while being stored", entry_to_write.path);
     }
-    writer.write(buf, bytes_read);
-    remain -= bytes_read;
   }
+
+  atomic_result_file.commit();
 }
 
 void
@@ -430,4 +849,43 @@ Result::Writer::write_raw_file_entry(const std::string& path,
                                   (new_stat ? 1 : 0) - (old_stat ? 1 : 0));
 }
 
+void
+recompress(FILE* input,
+           FILE* output,
+           Compression::Type compression_type,
+           int8_t compression_level)
+{
+  const auto table = read_entry_table(input);
+  auto entries = table.entries;
+
+  write_entry_table(output, compression_type, compression_level, entries);
+
+  for (size_t i = 0; i < entries.size(); ++i) {
+    if (entries[i].marker != k_embedded_file_marker) {
+      continue;
+    }
+    seek(input, table.offsets[i]);
+    auto decompressor =
+      Decompressor::create_from_type(table.compression_type, input);
+    write_entry_data(output,
+                     compression_type,
+                     compression_level,
+                     entries[i],
+                     [&](uint8_t* data, size_t size) {
+                       decompressor->read(data, size);
+                     });
+    if (entries[i].data_checksum != table.entries[i].data_checksum) {
+      throw Error(
+        "Incorrect entry checksum (actual 0x{:016x}, expected 0x{:016x})",
+        entries[i].data_checksum,
+        table.entries[i].data_checksum);
+    }
+  }
+
+  const int8_t actual_compression_level =
+    Compression::actual_level(compression_type, compression_level);
+  write_entry_table(
+    output, compression_type, actual_compression_level, entries);
+}
+
 } // namespace Result
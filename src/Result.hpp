@@ -20,14 +20,18 @@
 
 #include "system.hpp"
 
+#include "Compression.hpp"
+#include "CompressionDictionary.hpp"
+#include "Stat.hpp"
+
 #include "third_party/nonstd/optional.hpp"
 
+#include <functional>
 #include <map>
 #include <string>
 #include <vector>
 
 class CacheEntryReader;
-class CacheEntryWriter;
 class Context;
 
 namespace Result {
@@ -35,6 +39,7 @@ namespace Result {
 extern const std::string k_file_suffix;
 extern const uint8_t k_magic[4];
 extern const uint8_t k_version;
+extern const uint8_t k_min_version; // Oldest version that can be read.
 
 extern const char* const k_unknown_file_type;
 
@@ -76,6 +81,10 @@ enum class FileType : UnderlyingFileTypeInt {
 
 const char* file_type_to_string(FileType type);
 
+// Get the kind of compression dictionary to use for entries of `type`, if any.
+nonstd::optional<CompressionDictionary::Kind>
+file_type_to_dictionary_kind(FileType type);
+
 std::string gcno_file_in_mangled_form(const Context& ctx);
 std::string gcno_file_in_unmangled_form(const Context& ctx);
 
@@ -85,17 +94,50 @@ class Reader
 public:
   Reader(const std::string& result_path);
 
+  // Writes the data of an embedded entry to a file descriptor. Throws Error on
+  // error.
+  using EntryDataWriter = std::function<void(int fd)>;
+
   class Consumer
   {
   public:
     virtual ~Consumer() = default;
 
     virtual void on_header(CacheEntryReader& cache_entry_reader) = 0;
-    virtual void on_entry_start(uint32_t entry_number,
+    // Returns whether on_entry_data should be called with the data of an
+    // embedded file. Data of unwanted entries is skipped if possible.
+    virtual bool on_entry_start(uint32_t entry_number,
                                 FileType file_type,
                                 uint64_t file_len,
                                 nonstd::optional<std::string> raw_file) = 0;
     virtual void on_entry_data(const uint8_t* data, size_t size) = 0;
+
+    // Called instead of on_entry_data when the wanted entry data is stored
+    // uncompressed at `offset` in `fd`, so that the consumer can copy it
+    // without reading it into memory. Returns false if on_entry_data should
+    // be called instead.
+    virtual bool
+    on_entry_data_range(int /*fd*/, uint64_t /*offset*/, uint64_t /*size*/)
+    {
+      return false;
+    }
+
+    // Called instead of on_entry_data (and on_entry_data_range) with a
+    // function that writes the wanted entry data to a file descriptor. The
+    // function does not depend on the Reader, so it can be called later on
+    // another thread. Returns false if on_entry_data should be called instead.
+    virtual bool
+    on_entry_data_writer(const EntryDataWriter& /*writer*/)
+    {
+      return false;
+    }
+
+    // Called after all entries have been handled.
+    virtual void
+    on_result_end()
+    {
+    }
+
     virtual void on_entry_end() = 0;
   };
 
@@ -106,9 +148,15 @@ private:
   const std::string m_result_path;
 
   bool read_result(Consumer& consumer);
+  void read_sequential_entries(CacheEntryReader& cache_entry_reader,
+                               Consumer& consumer);
   void read_entry(CacheEntryReader& cache_entry_reader,
                   uint32_t entry_number,
                   Reader::Consumer& consumer);
+  void read_raw_file_entry(uint32_t entry_number,
+                           FileType file_type,
+                           uint64_t file_len,
+                           Consumer& consumer);
 };
 
 // This class knows how to write a result cache entry.
@@ -120,19 +168,32 @@ public:
   // Register a file to include in the result. Does not throw.
   void write(FileType file_type, const std::string& file_path);
 
-  // Write registered files to the result. Returns an error message on error.
+  // Write registered files to the result. Returns an error message on error,
+  // including when a registered file has changed since it was registered.
   nonstd::optional<std::string> finalize();
 
 private:
+  struct EntryToWrite
+  {
+    FileType file_type;
+    std::string path;
+    Stat stat;
+  };
+
   Context& m_ctx;
   const std::string m_result_path;
-  std::vector<std::pair<FileType, std::string>> m_entries_to_write;
+  std::vector<EntryToWrite> m_entries_to_write;
 
   void do_finalize();
-  static void write_embedded_file_entry(CacheEntryWriter& writer,
-                                        const std::string& path,
-                                        uint64_t file_size);
   void write_raw_file_entry(const std::string& path, uint32_t entry_number);
 };
 
+// Rewrite the result in `input` (which must be of the current version) to
+// `output` using another compression type and level. Raw files are left as is.
+// Throws Error on failure.
+void recompress(FILE* input,
+                FILE* output,
+                Compression::Type compression_type,
+                int8_t compression_level);
+
 } // namespace Result
@@ -35,7 +35,7 @@ ResultDumper::on_header(CacheEntryReader& cache_entry_reader)
   cache_entry_reader.dump_header(m_stream);
 }
 
-void
+bool
 ResultDumper::on_entry_start(uint32_t entry_number,
                              Result::FileType file_type,
                              uint64_t file_len,
@@ -47,6 +47,7 @@ ResultDumper::on_entry_start(uint32_t entry_number,
         entry_number,
         Result::file_type_to_string(file_type),
         file_len);
+  return false;
 }
 
 void
@@ -29,7 +29,7 @@ public:
   ResultDumper(FILE* stream);
 
   void on_header(CacheEntryReader& cache_entry_reader) override;
-  void on_entry_start(uint32_t entry_number,
+  bool on_entry_start(uint32_t entry_number,
                       Result::FileType file_type,
                       uint64_t file_len,
                       nonstd::optional<std::string> raw_file) override;
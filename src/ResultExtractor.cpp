@@ -31,7 +31,7 @@ ResultExtractor::on_header(CacheEntryReader& /*cache_entry_reader*/)
 {
 }
 
-void
+bool
 ResultExtractor::on_entry_start(uint32_t /*entry_number*/,
                                 Result::FileType file_type,
                                 uint64_t /*file_len*/,
@@ -62,6 +62,8 @@ ResultExtractor::on_entry_start(uint32_t /*entry_number*/,
         "Failed to copy {} to {}: {}", *raw_file, m_dest_path, e.what());
     }
   }
+
+  return true;
 }
 
 void
@@ -76,6 +78,19 @@ ResultExtractor::on_entry_data(const uint8_t* data, size_t size)
   }
 }
 
+bool
+ResultExtractor::on_entry_data_range(int fd, uint64_t offset, uint64_t size)
+{
+  ASSERT(m_dest_fd);
+
+  try {
+    Util::copy_fd_range(fd, offset, *m_dest_fd, size);
+  } catch (Error& e) {
+    throw Error("Failed to write to {}: {}", m_dest_path, e.what());
+  }
+  return true;
+}
+
 void
 ResultExtractor::on_entry_end()
 {
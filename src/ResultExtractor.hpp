@@ -32,11 +32,12 @@ public:
   ResultExtractor(const std::string& directory);
 
   void on_header(CacheEntryReader& cache_entry_reader) override;
-  void on_entry_start(uint32_t entry_number,
+  bool on_entry_start(uint32_t entry_number,
                       Result::FileType file_type,
                       uint64_t file_len,
                       nonstd::optional<std::string> raw_file) override;
   void on_entry_data(const uint8_t* data, size_t size) override;
+  bool on_entry_data_range(int fd, uint64_t offset, uint64_t size) override;
   void on_entry_end() override;
 
 private:
@@ -21,9 +21,21 @@
 #include "Context.hpp"
 #include "Depfile.hpp"
 #include "Logging.hpp"
+#include "StdMakeUnique.hpp"
+
+#include <algorithm>
+#include <exception>
 
 using Result::FileType;
 
+namespace {
+
+// A result contains at most one file of each type, so more threads than this
+// would be idle.
+const uint32_t k_max_retrieve_threads = 8;
+
+} // namespace
+
 ResultRetriever::ResultRetriever(Context& ctx, bool rewrite_dependency_target)
   : m_ctx(ctx),
     m_rewrite_dependency_target(rewrite_dependency_target)
@@ -35,7 +47,7 @@ ResultRetriever::on_header(CacheEntryReader& /*cache_entry_reader*/)
 {
 }
 
-void
+bool
 ResultRetriever::on_entry_start(uint32_t entry_number,
                                 FileType file_type,
                                 uint64_t file_len,
@@ -106,14 +118,24 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
     // Written in on_entry_end.
   } else if (dest_path.empty()) {
     LOG_RAW("Not writing");
+    return false;
   } else if (dest_path == "/dev/null") {
     LOG_RAW("Not writing to /dev/null");
+    return false;
   } else if (raw_file) {
-    Util::clone_hard_link_or_copy_file(m_ctx, *raw_file, dest_path, false);
+    const std::string source = *raw_file;
+    const auto retrieve = [this, source, dest_path] {
+      Util::clone_hard_link_or_copy_file(m_ctx, source, dest_path, false);
 
-    // Update modification timestamp to save the file from LRU cleanup (and, if
-    // hard-linked, to make the object file newer than the source file).
-    Util::update_mtime(*raw_file);
+      // Update modification timestamp to save the file from LRU cleanup (and,
+      // if hard-linked, to make the object file newer than the source file).
+      Util::update_mtime(source);
+    };
+    if (retrieve_concurrently()) {
+      enqueue_task(retrieve);
+    } else {
+      retrieve();
+    }
   } else {
     LOG("Writing to {}", dest_path);
     m_dest_fd = Fd(
@@ -124,6 +146,8 @@ ResultRetriever::on_entry_start(uint32_t entry_number,
     }
     m_dest_path = dest_path;
   }
+
+  return true;
 }
 
 void
@@ -143,6 +167,46 @@ ResultRetriever::on_entry_data(const uint8_t* data, size_t size)
   }
 }
 
+bool
+ResultRetriever::on_entry_data_range(int fd, uint64_t offset, uint64_t size)
+{
+  // Stderr and dependency data is collected in memory, see on_entry_data.
+  if (!m_dest_fd || m_dest_file_type == FileType::dependency) {
+    return false;
+  }
+
+  try {
+    Util::copy_fd_range(fd, offset, *m_dest_fd, size);
+  } catch (Error& e) {
+    throw Error("Failed to write to {}: {}", m_dest_path, e.what());
+  }
+  return true;
+}
+
+bool
+ResultRetriever::on_entry_data_writer(
+  const Result::Reader::EntryDataWriter& writer)
+{
+  // Stderr and dependency data is collected in memory, see on_entry_data.
+  if (!retrieve_concurrently() || !m_dest_fd
+      || m_dest_file_type == FileType::dependency) {
+    return false;
+  }
+
+  // The task takes over the destination file descriptor.
+  const auto dest_fd = std::make_shared<Fd>(std::move(m_dest_fd));
+  const std::string dest_path = m_dest_path;
+  enqueue_task([writer, dest_fd, dest_path] {
+    try {
+      writer(**dest_fd);
+    } catch (Error& e) {
+      throw Error("Failed to write to {}: {}", dest_path, e.what());
+    }
+    dest_fd->close();
+  });
+  return true;
+}
+
 void
 ResultRetriever::on_entry_end()
 {
@@ -160,6 +224,46 @@ ResultRetriever::on_entry_end()
   m_dest_data.clear();
 }
 
+void
+ResultRetriever::on_result_end()
+{
+  if (m_thread_pool) {
+    m_thread_pool->shut_down();
+    m_thread_pool.reset();
+  }
+  if (m_task_error) {
+    throw Error(*m_task_error);
+  }
+}
+
+bool
+ResultRetriever::retrieve_concurrently() const
+{
+  return m_ctx.config.retrieve_threads() > 1;
+}
+
+void
+ResultRetriever::enqueue_task(const std::function<void()>& task)
+{
+  if (!m_thread_pool) {
+    m_thread_pool = std::make_unique<ThreadPool>(
+      std::min(m_ctx.config.retrieve_threads(), k_max_retrieve_threads));
+  }
+
+  m_thread_pool->enqueue([this, task] {
+    // An exception escaping a ThreadPool task would terminate the process, so
+    // remember any exception and rethrow it as an Error on the main thread.
+    try {
+      task();
+    } catch (const std::exception& e) {
+      std::unique_lock<std::mutex> lock(m_task_error_mutex);
+      if (!m_task_error) {
+        m_task_error = e.what();
+      }
+    }
+  });
+}
+
 void
 ResultRetriever::write_dependency_file()
 {
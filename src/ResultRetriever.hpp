@@ -22,6 +22,13 @@
 
 #include "Fd.hpp"
 #include "Result.hpp"
+#include "ThreadPool.hpp"
+
+#include "third_party/nonstd/optional.hpp"
+
+#include <functional>
+#include <memory>
+#include <mutex>
 
 class Context;
 
@@ -32,12 +39,16 @@ public:
   ResultRetriever(Context& ctx, bool rewrite_dependency_target);
 
   void on_header(CacheEntryReader& cache_entry_reader) override;
-  void on_entry_start(uint32_t entry_number,
+  bool on_entry_start(uint32_t entry_number,
                       Result::FileType file_type,
                       uint64_t file_len,
                       nonstd::optional<std::string> raw_file) override;
   void on_entry_data(const uint8_t* data, size_t size) override;
+  bool on_entry_data_range(int fd, uint64_t offset, uint64_t size) override;
+  bool on_entry_data_writer(
+    const Result::Reader::EntryDataWriter& writer) override;
   void on_entry_end() override;
+  void on_result_end() override;
 
 private:
   Context& m_ctx;
@@ -55,5 +66,17 @@ private:
   // destination object file.
   const bool m_rewrite_dependency_target;
 
+  // First error reported by a task run by m_thread_pool.
+  std::mutex m_task_error_mutex;
+  nonstd::optional<std::string> m_task_error;
+
+  // Threads writing files concurrently if retrieve_threads is larger than 1,
+  // created on demand. Declared last so that running tasks are finished before
+  // other members are destroyed.
+  std::unique_ptr<ThreadPool> m_thread_pool;
+
   void write_dependency_file();
+
+  bool retrieve_concurrently() const;
+  void enqueue_task(const std::function<void()>& task);
 };
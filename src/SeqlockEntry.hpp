@@ -0,0 +1,128 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <atomic>
+#include <type_traits>
+
+// An entry of a cache in a SharedMapping that is accessed lock-free by
+// concurrently running processes. The entry has a sequence number that is odd
+// while the entry is being written (a "seqlock") and 0 if the entry is unused.
+// A writer claims the entry by incrementing an even sequence number with
+// compare-and-swap and releases it by incrementing it again. A reader copies
+// the value and retries if the sequence number was odd or changed meanwhile,
+// so readers never block writers or each other. A writer that finds the entry
+// claimed by another writer gives up instead of waiting since the caches are
+// only optimizations. If a process dies while writing, the entry stays
+// unusable until the file is recreated, but nothing else is affected.
+//
+// A zero-filled entry is unused, so the entry can be placed in a newly created
+// file without initialization.
+template<typename T> class SeqlockEntry
+{
+public:
+  enum class ReadResult { ok, unused, busy };
+
+  static_assert(IS_TRIVIALLY_COPYABLE(T),
+                "Value is expected to be trivially copyable.");
+
+  // Copy the value to `value`, trying `max_attempts` times if the entry is
+  // concurrently written.
+  ReadResult read(T& value, uint32_t max_attempts = 4) const;
+
+  // Call `updater` with the value and whether the entry was used before, while
+  // the entry is claimed. The updater may modify the value in place.
+  //
+  // Returns true if the entry could be claimed, false otherwise.
+  template<typename Updater> bool update(Updater updater);
+
+  // Replace the value with `value`.
+  //
+  // Returns true if the entry could be claimed, false otherwise.
+  bool write(const T& value);
+
+  // Returns whether the entry has been written at some point. The result is
+  // only a hint since the entry could be written concurrently.
+  bool is_used() const;
+
+private:
+  std::atomic<uint32_t> m_sequence;
+  T m_value;
+};
+
+template<typename T>
+typename SeqlockEntry<T>::ReadResult
+SeqlockEntry<T>::read(T& value, uint32_t max_attempts) const
+{
+  for (uint32_t attempt = 0; attempt < max_attempts; ++attempt) {
+    const uint32_t sequence = m_sequence.load(std::memory_order_acquire);
+    if (sequence == 0) {
+      return ReadResult::unused;
+    }
+    if (sequence % 2 != 0) {
+      continue;
+    }
+    const T copy = m_value;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (m_sequence.load(std::memory_order_relaxed) != sequence) {
+      continue;
+    }
+
+    value = copy;
+    return ReadResult::ok;
+  }
+  return ReadResult::busy;
+}
+
+template<typename T>
+template<typename Updater>
+bool
+SeqlockEntry<T>::update(Updater updater)
+{
+  uint32_t sequence = m_sequence.load(std::memory_order_relaxed);
+  if (sequence % 2 != 0
+      || !m_sequence.compare_exchange_strong(
+        sequence, sequence + 1, std::memory_order_relaxed)) {
+    return false;
+  }
+  // Also orders stores made by the caller before the claim, e.g. to data that
+  // the value refers to, before the release of the entry.
+  std::atomic_thread_fence(std::memory_order_release);
+
+  updater(m_value, sequence != 0);
+
+  m_sequence.store(sequence + 2, std::memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool
+SeqlockEntry<T>::write(const T& value)
+{
+  return update([&](T& entry_value, bool /*used*/) { entry_value = value; });
+}
+
+template<typename T>
+inline bool
+SeqlockEntry<T>::is_used() const
+{
+  return m_sequence.load(std::memory_order_relaxed) != 0;
+}
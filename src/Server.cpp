@@ -0,0 +1,788 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "Server.hpp"
+
+#include "Config.hpp"
+#include "Fd.hpp"
+#include "Hash.hpp"
+#include "Lockfile.hpp"
+#include "Logging.hpp"
+#include "Stat.hpp"
+#include "Util.hpp"
+#include "ccache.hpp"
+#include "fmtmacros.hpp"
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include <algorithm>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Protocol
+// ========
+//
+// 1. The client connects to the socket.
+// 2. A server worker accepts the connection and sends <accepted>. If the client
+//    doesn't receive <accepted> within k_accept_timeout_ms (i.e., all workers
+//    are busy), it disconnects and does the work itself.
+// 3. The client sends <request>. Its stdout and stderr file descriptors are
+//    passed as ancillary data together with <request_len>.
+// 4. The worker performs the lookup and sends <hit> or <miss>.
+//
+// <request>      ::= <request_len> <version> <umask> <cwd> <n_args> <arg>*
+//                    <n_env> <env>*
+// <request_len>  ::= uint32_t in host byte order ; length of the rest
+// <version>      ::= string ; CCACHE_VERSION of the client
+// <umask>        ::= string ; decimal
+// <cwd>          ::= string
+// <n_args>       ::= string ; decimal
+// <n_env>        ::= string ; decimal
+// <string>       ::= NUL-terminated string
+// <accepted>     ::= 'a'
+// <hit>          ::= 'h'
+// <miss>         ::= 'm' <state_len> <state>
+// <state_len>    ::= uint32_t in host byte order ; length of <state>
+// <state>        ::= bytes ; miss state from the lookup function
+
+namespace {
+
+// Increment if the protocol is changed.
+const uint8_t k_protocol_version = 2;
+
+// How long the client waits for a worker to accept the request.
+const int k_accept_timeout_ms = 100;
+
+// How long a worker waits for the request after accepting a connection.
+const int k_request_timeout_ms = 5000;
+
+// How long the client waits for the reply after sending the request. A lookup
+// normally takes milliseconds, so a worker that takes longer is likely stuck
+// and the client is better off doing the work itself.
+const int k_reply_timeout_ms = 10000;
+
+// A worker that dies abnormally is replaced unless it died within this many
+// seconds after being started, in which case its replacement would likely die
+// as well.
+const time_t k_min_worker_lifetime = 1;
+
+// Largest request that a worker accepts.
+const uint32_t k_max_request_size = 16 * 1024 * 1024;
+
+// Largest miss state that a client accepts.
+const uint32_t k_max_miss_state_size = 64 * 1024;
+
+const char k_reply_accepted = 'a';
+const char k_reply_hit = 'h';
+const char k_reply_miss = 'm';
+
+struct Request
+{
+  std::string version;
+  mode_t umask = 0;
+  std::string cwd;
+  std::vector<std::string> args;
+  std::vector<std::string> env;
+};
+
+bool
+send_all(int fd, const void* data, size_t size)
+{
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  size_t sent = 0;
+  while (sent < size) {
+    const ssize_t count =
+      send(fd, static_cast<const char*>(data) + sent, size - sent, flags);
+    if (count == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      return false;
+    }
+    sent += count;
+  }
+  return true;
+}
+
+// Receive exactly `size` bytes. A negative `timeout_ms` means no timeout.
+bool
+receive_all(int fd, void* data, size_t size, int timeout_ms)
+{
+  size_t received = 0;
+  while (received < size) {
+    pollfd pfd = {fd, POLLIN, 0};
+    const int ret = poll(&pfd, 1, timeout_ms);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return false;
+    }
+    const ssize_t count =
+      recv(fd, static_cast<char*>(data) + received, size - received, 0);
+    if (count == -1 && errno == EINTR) {
+      continue;
+    }
+    if (count <= 0) {
+      return false;
+    }
+    received += count;
+  }
+  return true;
+}
+
+void
+disable_sigpipe(int fd)
+{
+#ifdef SO_NOSIGPIPE
+  const int on = 1;
+  setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#else
+  (void)fd;
+#endif
+}
+
+bool
+fill_address(const std::string& path, sockaddr_un& address)
+{
+  memset(&address, 0, sizeof(address));
+  address.sun_family = AF_UNIX;
+  if (path.length() >= sizeof(address.sun_path)) {
+    return false;
+  }
+  memcpy(address.sun_path, path.c_str(), path.length() + 1);
+  return true;
+}
+
+Fd
+connect_to_server(const std::string& path)
+{
+  sockaddr_un address;
+  if (!fill_address(path, address)) {
+    return Fd();
+  }
+  Fd fd(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (!fd) {
+    return Fd();
+  }
+  Util::set_cloexec_flag(*fd);
+  disable_sigpipe(*fd);
+  if (connect(*fd, reinterpret_cast<sockaddr*>(&address), sizeof(address))
+      != 0) {
+    return Fd();
+  }
+  return fd;
+}
+
+bool
+peer_is_same_user(int fd)
+{
+#if defined(SO_PEERCRED)
+  ucred credentials;
+  socklen_t length = sizeof(credentials);
+  return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &credentials, &length) == 0
+         && credentials.uid == geteuid();
+#elif defined(HAVE_GETPEEREID)
+  uid_t uid;
+  gid_t gid;
+  return getpeereid(fd, &uid, &gid) == 0 && uid == geteuid();
+#else
+  (void)fd;
+  return false;
+#endif
+}
+
+std::string
+serialize_request(int argc, const char* const* argv)
+{
+  std::string data;
+  const auto add = [&data](const std::string& s) {
+    data.append(s);
+    data.push_back('\0');
+  };
+
+  const mode_t mask = umask(0);
+  umask(mask);
+
+  add(CCACHE_VERSION);
+  add(FMT("{}", mask));
+  add(Util::get_actual_cwd());
+  add(FMT("{}", argc));
+  for (int i = 0; i < argc; ++i) {
+    add(argv[i]);
+  }
+  size_t n_env = 0;
+  while (environ[n_env]) {
+    ++n_env;
+  }
+  add(FMT("{}", n_env));
+  for (size_t i = 0; i < n_env; ++i) {
+    add(environ[i]);
+  }
+  return data;
+}
+
+bool
+parse_request(const std::string& data, Request& request)
+{
+  size_t pos = 0;
+  const auto next = [&data, &pos](std::string& s) {
+    const size_t end = data.find('\0', pos);
+    if (end == std::string::npos) {
+      return false;
+    }
+    s = data.substr(pos, end - pos);
+    pos = end + 1;
+    return true;
+  };
+  const auto next_number = [&next](uint64_t& n) {
+    std::string s;
+    if (!next(s)) {
+      return false;
+    }
+    try {
+      n = Util::parse_unsigned(s);
+    } catch (const Error&) {
+      return false;
+    }
+    return true;
+  };
+
+  uint64_t n;
+  if (!next(request.version) || !next_number(n)) {
+    return false;
+  }
+  request.umask = n;
+  if (!next(request.cwd) || !next_number(n) || n == 0) {
+    return false;
+  }
+  request.args.resize(n);
+  for (auto& arg : request.args) {
+    if (!next(arg)) {
+      return false;
+    }
+  }
+  if (!next_number(n)) {
+    return false;
+  }
+  request.env.resize(n);
+  for (auto& env : request.env) {
+    if (!next(env)) {
+      return false;
+    }
+  }
+  return pos == data.size();
+}
+
+bool
+send_request(int fd, int argc, const char* const* argv)
+{
+  const std::string data = serialize_request(argc, argv);
+  const uint32_t data_len = data.size();
+
+  iovec iov;
+  iov.iov_base = const_cast<uint32_t*>(&data_len);
+  iov.iov_len = sizeof(data_len);
+
+  const int fds[2] = {STDOUT_FILENO, STDERR_FILENO};
+  union
+  {
+    char buffer[CMSG_SPACE(sizeof(fds))];
+    cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+#ifdef MSG_NOSIGNAL
+  const int flags = MSG_NOSIGNAL;
+#else
+  const int flags = 0;
+#endif
+  ssize_t count;
+  do {
+    count = sendmsg(fd, &message, flags);
+  } while (count == -1 && errno == EINTR);
+  if (count == -1) {
+    LOG("Failed to send request to ccache server: {}", strerror(errno));
+    return false;
+  }
+  if (static_cast<size_t>(count) < sizeof(data_len)
+      && !send_all(fd,
+                   reinterpret_cast<const char*>(&data_len) + count,
+                   sizeof(data_len) - count)) {
+    return false;
+  }
+  return send_all(fd, data.data(), data.size());
+}
+
+bool
+receive_request(int fd, std::string& data, Fd& stdout_fd, Fd& stderr_fd)
+{
+  uint32_t data_len = 0;
+
+  iovec iov;
+  iov.iov_base = &data_len;
+  iov.iov_len = sizeof(data_len);
+
+  union
+  {
+    char buffer[CMSG_SPACE(2 * sizeof(int))];
+    cmsghdr align;
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  msghdr message;
+  memset(&message, 0, sizeof(message));
+  message.msg_iov = &iov;
+  message.msg_iovlen = 1;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  pollfd pfd = {fd, POLLIN, 0};
+  if (poll(&pfd, 1, k_request_timeout_ms) <= 0) {
+    return false;
+  }
+  ssize_t count;
+  do {
+    count = recvmsg(fd, &message, 0);
+  } while (count == -1 && errno == EINTR);
+  if (count <= 0) {
+    return false;
+  }
+
+  for (cmsghdr* cmsg = CMSG_FIRSTHDR(&message); cmsg;
+       cmsg = CMSG_NXTHDR(&message, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+        && cmsg->cmsg_len == CMSG_LEN(2 * sizeof(int))) {
+      int fds[2];
+      memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+      stdout_fd = Fd(fds[0]);
+      stderr_fd = Fd(fds[1]);
+    }
+  }
+  if (!stdout_fd || !stderr_fd) {
+    return false;
+  }
+
+  if (static_cast<size_t>(count) < sizeof(data_len)
+      && !receive_all(fd,
+                      reinterpret_cast<char*>(&data_len) + count,
+                      sizeof(data_len) - count,
+                      k_request_timeout_ms)) {
+    return false;
+  }
+  if (data_len > k_max_request_size) {
+    return false;
+  }
+  data.resize(data_len);
+  return receive_all(fd, &data[0], data_len, k_request_timeout_ms);
+}
+
+void
+serve_client(int fd,
+             Fd& null_fd,
+             std::vector<std::string>& env_storage,
+             std::vector<char*>& env_pointers,
+             const Server::LookupFunction& lookup_function)
+{
+  if (!peer_is_same_user(fd)) {
+    return;
+  }
+  if (!send_all(fd, &k_reply_accepted, 1)) {
+    return;
+  }
+
+  std::string data;
+  Fd stdout_fd;
+  Fd stderr_fd;
+  if (!receive_request(fd, data, stdout_fd, stderr_fd)) {
+    return;
+  }
+
+  Request request;
+  bool hit = false;
+  std::string miss_state;
+  if (parse_request(data, request) && request.version == CCACHE_VERSION
+      && chdir(request.cwd.c_str()) == 0) {
+    // The strings must outlive the request since environ refers to them.
+    env_storage = std::move(request.env);
+    env_pointers.clear();
+    for (auto& env : env_storage) {
+      env_pointers.push_back(&env[0]);
+    }
+    env_pointers.push_back(nullptr);
+    environ = env_pointers.data();
+
+    umask(request.umask);
+    dup2(*stdout_fd, STDOUT_FILENO);
+    dup2(*stderr_fd, STDERR_FILENO);
+    stdout_fd.close();
+    stderr_fd.close();
+
+    std::vector<const char*> argv;
+    for (const auto& arg : request.args) {
+      argv.push_back(arg.c_str());
+    }
+    argv.push_back(nullptr);
+    hit = lookup_function(
+      static_cast<int>(request.args.size()), argv.data(), miss_state);
+
+    // Let go of the client's stdout and stderr before replying so that the
+    // client's parent sees EOF when the client exits.
+    fflush(stdout);
+    fflush(stderr);
+    dup2(*null_fd, STDOUT_FILENO);
+    dup2(*null_fd, STDERR_FILENO);
+    if (chdir("/") != 0) {
+      // Ignore, not much to do about it.
+    }
+  }
+
+  if (hit) {
+    send_all(fd, &k_reply_hit, 1);
+    return;
+  }
+  const uint32_t state_len = miss_state.size();
+  if (send_all(fd, &k_reply_miss, 1)
+      && send_all(fd, &state_len, sizeof(state_len))) {
+    send_all(fd, miss_state.data(), miss_state.size());
+  }
+}
+
+void
+run_worker(const Config& config,
+           int listen_fd,
+           const Server::LookupFunction& lookup_function)
+{
+  const int timeout_ms = config.server_idle_timeout() > 0
+                           ? static_cast<int>(std::min<uint64_t>(
+                             config.server_idle_timeout() * 1000, INT_MAX))
+                           : -1;
+
+  Fd null_fd(open("/dev/null", O_RDWR));
+  if (!null_fd) {
+    return;
+  }
+  std::vector<std::string> env_storage;
+  std::vector<char*> env_pointers;
+
+  while (true) {
+    pollfd pfd = {listen_fd, POLLIN, 0};
+    const int ret = poll(&pfd, 1, timeout_ms);
+    if (ret == -1 && errno == EINTR) {
+      continue;
+    }
+    if (ret <= 0) {
+      return; // Idle timeout or error.
+    }
+    // The listening socket is nonblocking, so accept fails with EAGAIN if
+    // another worker won the race for the connection.
+    Fd fd(accept(listen_fd, nullptr, nullptr));
+    if (fd) {
+      Util::set_cloexec_flag(*fd);
+      disable_sigpipe(*fd);
+      serve_client(*fd, null_fd, env_storage, env_pointers, lookup_function);
+    }
+  }
+}
+
+[[noreturn]] void
+run_server(const Config& config,
+           int listen_fd,
+           const std::string& path,
+           const Server::LookupFunction& lookup_function)
+{
+  for (int signum : {SIGINT, SIGTERM, SIGHUP, SIGQUIT}) {
+    signal(signum, SIG_DFL);
+  }
+  signal(SIGPIPE, SIG_IGN);
+
+  // Detach from the client's working directory and file descriptors. The log
+  // file is closed via Logging before closing all other descriptors so that
+  // Logging doesn't refer to a reused descriptor later.
+  if (chdir("/") != 0) {
+    _exit(EXIT_FAILURE);
+  }
+  Logging::init(Config());
+  const int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd == -1) {
+    _exit(EXIT_FAILURE);
+  }
+  dup2(null_fd, STDIN_FILENO);
+  dup2(null_fd, STDOUT_FILENO);
+  dup2(null_fd, STDERR_FILENO);
+  const long max_fd = std::min(sysconf(_SC_OPEN_MAX), 65536L);
+  for (int fd = STDERR_FILENO + 1; fd < max_fd; ++fd) {
+    if (fd != listen_fd) {
+      close(fd);
+    }
+  }
+  Logging::init(config);
+
+  const int flags = fcntl(listen_fd, F_GETFL);
+  if (flags == -1 || fcntl(listen_fd, F_SETFL, flags | O_NONBLOCK) == -1) {
+    _exit(EXIT_FAILURE);
+  }
+  const auto socket_stat = Stat::lstat(path);
+
+  // Start time of each running worker.
+  std::unordered_map<pid_t, time_t> workers;
+  const auto start_worker = [&] {
+    const pid_t pid = fork();
+    if (pid == 0) {
+      run_worker(config, listen_fd, lookup_function);
+      _exit(EXIT_SUCCESS);
+    }
+    if (pid != -1) {
+      workers.emplace(pid, time(nullptr));
+    }
+  };
+
+  const unsigned n_workers = std::max(1u, std::thread::hardware_concurrency());
+  LOG("Started ccache server with {} workers listening on {}",
+      n_workers,
+      path);
+  for (unsigned i = 0; i < n_workers; ++i) {
+    start_worker();
+  }
+
+  // Workers exit successfully when idle. Replace those that crashed or were
+  // killed so that the server doesn't dwindle away while in use.
+  while (!workers.empty()) {
+    int status;
+    const pid_t pid = wait(&status);
+    if (pid == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      break;
+    }
+    const auto worker = workers.find(pid);
+    if (worker == workers.end()) {
+      continue;
+    }
+    const time_t started = worker->second;
+    workers.erase(worker);
+    if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS) {
+      continue;
+    }
+    if (time(nullptr) - started < k_min_worker_lifetime) {
+      LOG("ccache server worker {} died right after starting; not replacing it",
+          pid);
+    } else {
+      LOG("Replacing ccache server worker {} that died", pid);
+      start_worker();
+    }
+  }
+  close(listen_fd);
+
+  {
+    // Don't remove the socket of a server started after the workers exited.
+    Lockfile lock(path);
+    if (lock.acquired() && Stat::lstat(path).same_inode_as(socket_stat)) {
+      unlink(path.c_str());
+    }
+  }
+  _exit(EXIT_SUCCESS);
+}
+
+bool
+start_server(const Config& config,
+             const std::string& path,
+             const Server::LookupFunction& lookup_function)
+{
+  // Only the user should be able to reach the socket.
+  const std::string dir(Util::dir_name(path));
+  if (mkdir(dir.c_str(), 0700) != 0 && errno != EEXIST) {
+    LOG("Failed to create directory {}: {}", dir, strerror(errno));
+    return false;
+  }
+
+  Lockfile lock(path);
+  if (!lock.acquired()) {
+    return false;
+  }
+  if (connect_to_server(path)) {
+    return true; // Another client started a server.
+  }
+
+  sockaddr_un address;
+  fill_address(path, address);
+  Fd fd(socket(AF_UNIX, SOCK_STREAM, 0));
+  if (!fd) {
+    LOG("Failed to create socket: {}", strerror(errno));
+    return false;
+  }
+  Util::set_cloexec_flag(*fd);
+  unlink(path.c_str());
+  if (bind(*fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+      || chmod(path.c_str(), 0600) != 0 || listen(*fd, SOMAXCONN) != 0) {
+    LOG("Failed to listen on {}: {}", path, strerror(errno));
+    unlink(path.c_str());
+    return false;
+  }
+
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+    return false;
+  }
+  if (pid == 0) {
+    // Fork again in a new session so that the server isn't a child of the
+    // client and isn't affected by signals sent to the client's process group.
+    if (setsid() != -1 && fork() == 0) {
+      run_server(config, *fd, path, lookup_function);
+    }
+    _exit(EXIT_SUCCESS);
+  }
+  waitpid(pid, nullptr, 0);
+  LOG("Started ccache server listening on {}", path);
+  return true;
+}
+
+// Return the directory of the socket that a server for the current environment
+// listens to.
+std::string
+get_socket_dir()
+{
+  // The configuration hasn't been read, so the socket can't be placed in the
+  // temporary directory.
+  const char* const runtime_dir = getenv("XDG_RUNTIME_DIR");
+  const char* const tmp_dir = getenv("TMPDIR");
+  return runtime_dir && *runtime_dir
+           ? FMT("{}/ccache", runtime_dir)
+           : FMT("{}/ccache-{}",
+                 tmp_dir && *tmp_dir ? tmp_dir : "/tmp",
+                 geteuid());
+}
+
+} // namespace
+
+namespace Server {
+
+std::string
+get_socket_path()
+{
+  // Clients and servers of different ccache versions must not talk to each
+  // other. Neither must clients and servers whose configuration may differ, so
+  // include the environment variables that the configuration is read from.
+  std::vector<nonstd::string_view> config_env;
+  for (size_t i = 0; environ[i]; ++i) {
+    const nonstd::string_view env = environ[i];
+    if (Util::starts_with(env, "CCACHE_") || Util::starts_with(env, "HOME=")
+        || Util::starts_with(env, "XDG_CACHE_HOME=")
+        || Util::starts_with(env, "XDG_CONFIG_HOME=")) {
+      config_env.push_back(env);
+    }
+  }
+  std::sort(config_env.begin(), config_env.end());
+
+  Hash hash;
+  hash.hash(CCACHE_VERSION);
+  for (const auto& env : config_env) {
+    hash.hash_delimiter("env");
+    hash.hash(env);
+  }
+
+  return FMT("{}/server.v{}.{}.sock",
+             get_socket_dir(),
+             k_protocol_version,
+             hash.digest().to_string().substr(0, 16));
+}
+
+Reply
+look_up(int argc, const char* const* argv, std::string& miss_state)
+{
+  // This is done for every ccache invocation, so first check cheaply whether
+  // any server has been started in the environment at all.
+  if (!Stat::stat(get_socket_dir())) {
+    return Reply::none;
+  }
+  const std::string path = get_socket_path();
+  if (!Stat::lstat(path)) {
+    return Reply::none;
+  }
+
+  Fd fd = connect_to_server(path);
+  // Don't hand the request to a socket created by someone else.
+  if (!fd || !peer_is_same_user(*fd)) {
+    return Reply::none;
+  }
+
+  char reply;
+  if (!receive_all(*fd, &reply, 1, k_accept_timeout_ms)
+      || reply != k_reply_accepted) {
+    return Reply::none;
+  }
+  if (!send_request(*fd, argc, argv)) {
+    return Reply::none;
+  }
+  if (!receive_all(*fd, &reply, 1, k_reply_timeout_ms)) {
+    LOG("No reply from ccache server within {} ms", k_reply_timeout_ms);
+    return Reply::none;
+  }
+  if (reply == k_reply_hit) {
+    return Reply::hit;
+  }
+  uint32_t state_len;
+  if (reply != k_reply_miss
+      || !receive_all(
+        *fd, &state_len, sizeof(state_len), k_reply_timeout_ms)
+      || state_len > k_max_miss_state_size) {
+    return Reply::none;
+  }
+  miss_state.resize(state_len);
+  if (!receive_all(*fd, &miss_state[0], state_len, k_reply_timeout_ms)) {
+    miss_state.clear();
+    return Reply::none;
+  }
+  return Reply::miss;
+}
+
+void
+start(const Config& config, const LookupFunction& lookup_function)
+{
+  const std::string path = get_socket_path();
+  sockaddr_un address;
+  if (!fill_address(path, address)) {
+    LOG("Not starting ccache server since socket path {} is too long", path);
+    return;
+  }
+  start_server(config, path, lookup_function);
+}
+
+} // namespace Server
@@ -0,0 +1,72 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include <functional>
+#include <string>
+
+class Config;
+
+// A ccache server is a set of long-lived worker processes that answer direct
+// mode cache lookups on behalf of ccache invocations (clients). The client
+// sends its arguments, working directory, environment, umask, stdout and
+// stderr over a Unix socket before reading any configuration and a worker
+// performs the lookup as if it were the client, i.e. the worker writes the
+// result files and updates the statistics on a hit. On a miss, the worker
+// replies with state that lets the client continue without repeating the
+// lookup.
+//
+// The socket path is derived from the environment variables that the
+// configuration is read from, so a worker can keep the configuration and the
+// cache mappings loaded between requests. A server is started by a client
+// that found no server and exits when it has been idle for
+// Config::server_idle_timeout seconds.
+namespace Server {
+
+// Look up the compilation described by `argc` and `argv` in the cache. Called
+// in a server worker after the working directory, environment, umask, stdout
+// and stderr of the client have been installed. Returns true if a cached result
+// was retrieved, otherwise false, in which case `miss_state` may be set to data
+// that is passed on to the client.
+using LookupFunction = std::function<bool(
+  int argc, const char* const* argv, std::string& miss_state)>;
+
+enum class Reply {
+  none, // No server could be reached.
+  hit,  // The server retrieved a cached result.
+  miss, // The server did not find the result.
+};
+
+// Let a running ccache server look up the compilation described by `argc` and
+// `argv`. On Reply::miss, `miss_state` is set to what the server's lookup
+// function provided. On Reply::none, the caller should continue as if no server
+// was involved.
+Reply look_up(int argc, const char* const* argv, std::string& miss_state);
+
+// Start a ccache server running `lookup_function` in the background unless one
+// is already running.
+void start(const Config& config, const LookupFunction& lookup_function);
+
+// Return the path of the socket that a server for the current environment
+// listens to.
+std::string get_socket_path();
+
+} // namespace Server
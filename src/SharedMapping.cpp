@@ -0,0 +1,171 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "SharedMapping.hpp"
+
+#include "Fd.hpp"
+#include "Finalizer.hpp"
+#include "Logging.hpp"
+#include "TemporaryFile.hpp"
+#include "Util.hpp"
+
+#include <sys/mman.h>
+
+SharedMapping::SharedMapping(const std::string& name) : m_name(name)
+{
+}
+
+SharedMapping::~SharedMapping()
+{
+  unmap();
+}
+
+bool
+SharedMapping::map(const std::string& path,
+                   uint32_t version,
+                   const Validator& validator)
+{
+  unmap();
+
+  Fd fd(open(path.c_str(), O_RDWR));
+  if (!fd) {
+    LOG("Failed to open {} {}: {}", m_name, path, strerror(errno));
+    return false;
+  }
+  bool is_nfs;
+  if (Util::is_nfs_fd(*fd, &is_nfs) == 0 && is_nfs) {
+    LOG("Not using {} since the file is located on nfs: {}", m_name, path);
+    return false;
+  }
+  struct stat st;
+  if (fstat(*fd, &st) != 0) {
+    LOG("Failed to stat {}: {}", path, strerror(errno));
+    return false;
+  }
+  const size_t size = st.st_size;
+  if (size < sizeof(uint32_t)) {
+    LOG("Dropping truncated {} {}", m_name, path);
+    unlink(path.c_str());
+    return false;
+  }
+  void* data = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+  fd.close();
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap {}: {}", path, strerror(errno));
+    return false;
+  }
+
+  // Drop the file from disk if the found version is not matching. This will
+  // allow a new file to be generated.
+  uint32_t found_version;
+  memcpy(&found_version, data, sizeof(found_version));
+  if (found_version != version) {
+    LOG(
+      "Dropping {} because found version {} does not match expected version"
+      " {}",
+      m_name,
+      found_version,
+      version);
+    munmap(data, size);
+    unlink(path.c_str());
+    return false;
+  }
+  if (!validator(data, size)) {
+    LOG("Dropping invalid {} {}", m_name, path);
+    munmap(data, size);
+    unlink(path.c_str());
+    return false;
+  }
+
+  m_data = data;
+  m_size = size;
+  return true;
+}
+
+bool
+SharedMapping::create(const std::string& path,
+                      size_t size,
+                      uint32_t version,
+                      const Initializer& initializer,
+                      bool replace) const
+{
+  // Create the new file to a temporary name to prevent other processes from
+  // mapping it before it is fully initialized.
+  TemporaryFile tmp_file(path);
+
+  Finalizer temp_file_remover([&] { unlink(tmp_file.path.c_str()); });
+
+  bool is_nfs;
+  if (Util::is_nfs_fd(*tmp_file.fd, &is_nfs) == 0 && is_nfs) {
+    LOG("Not using {} since the file would be located on nfs: {}",
+        m_name,
+        path);
+    return false;
+  }
+  int err = Util::fallocate(*tmp_file.fd, size);
+  if (err) {
+    LOG("Failed to allocate file space for {}: {}", m_name, strerror(err));
+    return false;
+  }
+  void* data =
+    mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, *tmp_file.fd, 0);
+  if (data == MAP_FAILED) {
+    LOG("Failed to mmap new {}: {}", m_name, strerror(errno));
+    return false;
+  }
+
+  // The file is zero-filled, so only the version and what the initializer
+  // sets need to be written.
+  memcpy(data, &version, sizeof(version));
+  initializer(data);
+
+  munmap(data, size);
+  tmp_file.fd.close();
+
+  if (replace) {
+    // Processes that have the old file mapped keep using it until they map
+    // the file again.
+    if (rename(tmp_file.path.c_str(), path.c_str()) != 0) {
+      LOG("Failed to rename new {}: {}", m_name, strerror(errno));
+      return false;
+    }
+    return true;
+  }
+
+  // link() will fail silently if a file with the same name already exists.
+  // This will be the case if two processes try to create a new file
+  // simultaneously. Thus close the current file handle and reopen a new one,
+  // which will make us use the first created file even if we didn't win the
+  // race.
+  if (link(tmp_file.path.c_str(), path.c_str()) != 0) {
+    LOG("Failed to link new {}: {}", m_name, strerror(errno));
+    return false;
+  }
+
+  return true;
+}
+
+void
+SharedMapping::unmap()
+{
+  if (m_data) {
+    munmap(m_data, m_size);
+    m_data = nullptr;
+    m_size = 0;
+  }
+}
@@ -0,0 +1,90 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#pragma once
+
+#include "system.hpp"
+
+#include "NonCopyable.hpp"
+
+#include <functional>
+#include <string>
+
+// A file that is mapped into shared memory by concurrently running ccache
+// processes, used by the inode, file hash and manifest caches. The file starts
+// with a uint32_t version number that identifies the layout of the rest of the
+// file.
+//
+// A new file is created under a temporary name and then linked into place, so
+// other processes never see a partially initialized file.
+class SharedMapping : NonCopyable
+{
+public:
+  using Initializer = std::function<void(void* data)>;
+  using Validator = std::function<bool(const void* data, size_t size)>;
+
+  // `name` describes the file in log messages, e.g. "inode cache".
+  explicit SharedMapping(const std::string& name);
+  ~SharedMapping();
+
+  // Map the file at `path`, replacing any current mapping. If the file has
+  // another version than `version` or if `validator` rejects it, the file is
+  // removed from disk so that a new file can be created.
+  //
+  // Returns true on success, false otherwise.
+  bool map(const std::string& path,
+           uint32_t version,
+           const Validator& validator);
+
+  // Create a zero-filled file of `size` bytes at `path` with version number
+  // `version`. `initializer` is called with the content of the file before the
+  // file is made visible. An existing file at `path` is replaced if `replace`
+  // is true, otherwise the existing file is kept since another process won the
+  // race to create it. The current mapping, if any, is not affected.
+  //
+  // Returns true on success, false otherwise.
+  bool create(const std::string& path,
+              size_t size,
+              uint32_t version,
+              const Initializer& initializer,
+              bool replace = false) const;
+
+  void unmap();
+
+  // Returns the mapped content, or nullptr if nothing is mapped.
+  void* data() const;
+
+  size_t size() const;
+
+private:
+  const std::string m_name;
+  void* m_data = nullptr;
+  size_t m_size = 0;
+};
+
+inline void*
+SharedMapping::data() const
+{
+  return m_data;
+}
+
+inline size_t
+SharedMapping::size() const
+{
+  return m_size;
+}
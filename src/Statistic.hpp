@@ -53,6 +53,10 @@ enum class Statistic {
   unsupported_code_directive = 30,
   stats_zeroed_timestamp = 31,
   could_not_use_modules = 32,
+  manifest_lookup = 33,
+  manifest_entries_examined = 34,
+  compiler_check_cache_hit = 35,
+  compiler_check_cache_miss = 36,
 
   END
 };
@@ -26,6 +26,10 @@
 #include "exceptions.hpp"
 #include "fmtmacros.hpp"
 
+#ifdef INODE_CACHE_SUPPORTED
+#  include "InodeCache.hpp"
+#endif
+
 const unsigned FLAG_NOZERO = 1; // don't zero with the -z option
 const unsigned FLAG_ALWAYS = 2; // always show, even if zero
 const unsigned FLAG_NEVER = 4;  // never show
@@ -109,6 +113,42 @@ collect_counters(const Config& config)
   return std::make_pair(counters, last_updated);
 }
 
+static std::string
+format_inode_cache_statistics(const Config& config)
+{
+  std::string result;
+#ifdef INODE_CACHE_SUPPORTED
+  InodeCache inode_cache(config);
+  // Don't create the cache file just to report that it's empty.
+  if (!config.inode_cache() || !Stat::stat(inode_cache.get_file())) {
+    return result;
+  }
+  const int64_t hits = inode_cache.get_hits();
+  const int64_t misses = inode_cache.get_misses();
+  const int64_t capacity = inode_cache.get_capacity();
+  if (hits < 0 || misses < 0 || capacity <= 0) {
+    return result;
+  }
+  // The counters are only maintained in debug mode.
+  const int64_t lookups = hits + misses;
+  if (lookups > 0) {
+    result += FMT("{:32}{:8}\n", "inode cache hits", hits);
+    result += FMT("{:32}{:8}\n", "inode cache misses", misses);
+    result += FMT("{:34}{:6.2f} %\n",
+                  "inode cache hit rate",
+                  (100.0 * hits) / lookups);
+    result += FMT(
+      "{:32}{:8}\n", "inode cache evictions", inode_cache.get_evictions());
+  }
+  result += FMT("{:34}{:6.2f} %\n",
+                "inode cache occupancy",
+                (100.0 * inode_cache.get_used_entries()) / capacity);
+#else
+  (void)config;
+#endif
+  return result;
+}
+
 namespace {
 
 struct StatisticsField
@@ -173,6 +213,12 @@ const StatisticsField k_statistics_fields[] = {
   STATISTICS_FIELD(bad_output_file, "could not write to output file"),
   STATISTICS_FIELD(no_input_file, "no input file"),
   STATISTICS_FIELD(error_hashing_extra_file, "error hashing extra file"),
+  // Note: Keep the manifest and compiler check cache fields after the fields
+  // that are results of a ccache invocation, see Statistics::get_result.
+  STATISTICS_FIELD(manifest_lookup, "manifest lookups"),
+  STATISTICS_FIELD(manifest_entries_examined, "manifest entries examined"),
+  STATISTICS_FIELD(compiler_check_cache_hit, "compiler check cache hits"),
+  STATISTICS_FIELD(compiler_check_cache_miss, "compiler check cache misses"),
   STATISTICS_FIELD(cleanups_performed, "cleanups performed", FLAG_ALWAYS),
   STATISTICS_FIELD(files_in_cache, "files in cache", FLAG_NOZERO | FLAG_ALWAYS),
   STATISTICS_FIELD(cache_size_kibibyte,
@@ -318,8 +364,18 @@ format_human_readable(const Config& config)
       double percent = hit_rate(counters);
       result += FMT("{:34}{:6.2f} %\n", "cache hit rate", percent);
     }
+
+    if (statistic == Statistic::manifest_entries_examined
+        && counters.get(Statistic::manifest_lookup) > 0) {
+      const double average =
+        static_cast<double>(counters.get(statistic))
+        / counters.get(Statistic::manifest_lookup);
+      result += FMT("{:32}{:8.2f}\n", "manifest entries per lookup", average);
+    }
   }
 
+  result += format_inode_cache_statistics(config);
+
   if (config.max_files() != 0) {
     result += FMT("{:32}{:8}\n", "max files", config.max_files());
   }
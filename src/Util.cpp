@@ -85,6 +85,11 @@ using nonstd::string_view;
 
 namespace {
 
+#ifdef HAVE_COPY_FILE_RANGE
+// Maximum number of bytes to copy in one copy_file_range call.
+const uint64_t k_max_copy_size = 1024 * 1024 * 1024;
+#endif
+
 // Search for the first match of the following regular expression:
 //
 //   \x1b\[[\x30-\x3f]*[\x20-\x2f]*[Km]
@@ -340,10 +345,63 @@ common_dir_prefix_length(string_view dir, string_view path)
 void
 copy_fd(int fd_in, int fd_out)
 {
+#ifdef HAVE_COPY_FILE_RANGE
+  // Let the kernel copy (or reflink) the data if possible. Whatever is left,
+  // for instance if one of the descriptors is a pipe or if the file system
+  // reports a bogus size of zero, is then copied via a buffer from the current
+  // positions, which normally only costs a read call that returns 0.
+  ssize_t n;
+  do {
+    n = copy_file_range(fd_in, nullptr, fd_out, nullptr, k_max_copy_size, 0);
+  } while (n > 0 || (n == -1 && errno == EINTR));
+#endif
   read_fd(fd_in,
           [=](const void* data, size_t size) { write_fd(fd_out, data, size); });
 }
 
+void
+copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size)
+{
+#ifdef HAVE_COPY_FILE_RANGE
+  while (size > 0) {
+    loff_t in_offset = offset;
+    const ssize_t n = copy_file_range(
+      fd_in, &in_offset, fd_out, nullptr, std::min(size, k_max_copy_size), 0);
+    if (n == -1 && errno == EINTR) {
+      continue;
+    }
+    if (n <= 0) {
+      break; // Fall back to copying via a buffer.
+    }
+    offset += n;
+    size -= n;
+  }
+#endif
+  if (size == 0) {
+    return;
+  }
+
+  if (lseek(fd_in, offset, SEEK_SET) == -1) {
+    throw Error(strerror(errno));
+  }
+  while (size > 0) {
+    char buffer[READ_BUFFER_SIZE];
+    const ssize_t n = read(
+      fd_in, buffer, std::min(size, static_cast<uint64_t>(sizeof(buffer))));
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      throw Error(strerror(errno));
+    }
+    if (n == 0) {
+      throw Error("unexpected end of file");
+    }
+    write_fd(fd_out, buffer, n);
+    size -= n;
+  }
+}
+
 void
 copy_file(const std::string& src, const std::string& dest, bool via_tmp_file)
 {
@@ -634,6 +692,20 @@ get_apparent_cwd(const std::string& actual_cwd)
 #endif
 }
 
+std::string
+get_boot_id()
+{
+#ifdef __linux__
+  try {
+    return strip_whitespace(read_file("/proc/sys/kernel/random/boot_id"));
+  } catch (const Error&) {
+    return {};
+  }
+#else
+  return {};
+#endif
+}
+
 string_view
 get_extension(string_view path)
 {
@@ -654,6 +726,27 @@ get_extension(string_view path)
   }
 }
 
+#if defined(HAVE_LINUX_FS_H) || defined(HAVE_STRUCT_STATFS_F_FSTYPENAME)
+uint64_t
+get_filesystem_id(const std::string& path)
+{
+  struct statfs buf;
+  if (statfs(path.c_str(), &buf) != 0) {
+    return 0;
+  }
+  uint64_t id = 0;
+  static_assert(sizeof(buf.f_fsid) <= sizeof(id), "unexpected fsid size");
+  memcpy(&id, &buf.f_fsid, sizeof(buf.f_fsid));
+  return id;
+}
+#else
+uint64_t
+get_filesystem_id(const std::string& /*path*/)
+{
+  return 0;
+}
+#endif
+
 std::vector<CacheFile>
 get_level_1_files(const std::string& dir,
                   const ProgressReceiver& progress_receiver)
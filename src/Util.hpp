@@ -114,6 +114,11 @@ size_t common_dir_prefix_length(nonstd::string_view dir,
 // Copy all data from `fd_in` to `fd_out`. Throws `Error` on error.
 void copy_fd(int fd_in, int fd_out);
 
+// Copy `size` bytes starting at `offset` in `fd_in` to the current position of
+// `fd_out`. The position of `fd_in` is unspecified afterwards. Throws `Error`
+// on error.
+void copy_fd_range(int fd_in, uint64_t offset, int fd_out, uint64_t size);
+
 // Copy a file from `src` to `dest`. If via_tmp_file is true, `src` is copied to
 // a temporary file and then renamed to dest. Throws `Error` on error.
 void copy_file(const std::string& src,
@@ -190,10 +195,21 @@ std::string get_actual_cwd();
 // `actual_cwd` is returned instead.
 std::string get_apparent_cwd(const std::string& actual_cwd);
 
+// Return an identifier that is unique for the current boot of the system, or
+// the empty string if it can't be determined.
+std::string get_boot_id();
+
 // Return the file extension (including the dot) as a view into `path`. If
 // `path` has no file extension, an empty string_view is returned.
 nonstd::string_view get_extension(nonstd::string_view path);
 
+// Return the identifier that statfs(2) reports for the filesystem that `path`
+// is located on, or 0 if it can't be determined. On many filesystems (e.g.
+// ext4 and btrfs) the identifier is derived from the filesystem UUID and thus
+// stays the same across reboots, but on others it's derived from the device
+// number.
+uint64_t get_filesystem_id(const std::string& path);
+
 // Get a list of files in a level 1 subdirectory of the cache.
 //
 // The function works under the assumption that directory entries with one
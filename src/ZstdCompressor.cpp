@@ -18,49 +18,114 @@
 
 #include "ZstdCompressor.hpp"
 
+#include "CompressionDictionary.hpp"
 #include "Logging.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
 #include <algorithm>
+#include <vector>
 
-ZstdCompressor::ZstdCompressor(FILE* stream, int8_t compression_level)
-  : m_stream(stream),
-    m_zstd_stream(ZSTD_createCStream())
+namespace {
+
+// Creating a compression context is expensive, especially for high levels, so
+// each thread keeps released contexts for reuse by later compressors.
+const size_t k_max_pooled_streams = 4;
+
+class CStreamPool
 {
-  if (compression_level == 0) {
-    compression_level = default_compression_level;
-    LOG("Using default compression level {}", compression_level);
+public:
+  ~CStreamPool()
+  {
+    for (auto stream : m_streams) {
+      ZSTD_freeCStream(stream);
+    }
   }
 
-  // libzstd 1.3.4 and newer support negative levels. However, the query
-  // function ZSTD_minCLevel did not appear until 1.3.6, so perform detection
-  // based on version instead.
-  if (ZSTD_versionNumber() < 10304 && compression_level < 1) {
-    LOG(
-      "Using compression level 1 (minimum level supported by libzstd) instead"
-      " of {}",
-      compression_level);
-    compression_level = 1;
+  ZSTD_CStream*
+  acquire()
+  {
+    if (m_streams.empty()) {
+      return ZSTD_createCStream();
+    }
+    ZSTD_CStream* stream = m_streams.back();
+    m_streams.pop_back();
+    return stream;
   }
 
-  m_compression_level = std::min<int>(compression_level, ZSTD_maxCLevel());
-  if (m_compression_level != compression_level) {
-    LOG("Using compression level {} (max libzstd level) instead of {}",
-        m_compression_level,
-        compression_level);
+  void
+  release(ZSTD_CStream* stream)
+  {
+#if ZSTD_VERSION_NUMBER >= 10400
+    // Forget the dictionary and worker threads of the previous user.
+    ZSTD_CCtx_reset(stream, ZSTD_reset_session_and_parameters);
+#endif
+    if (m_streams.size() < k_max_pooled_streams) {
+      m_streams.push_back(stream);
+    } else {
+      ZSTD_freeCStream(stream);
+    }
   }
 
+private:
+  std::vector<ZSTD_CStream*> m_streams;
+};
+
+thread_local CStreamPool cstream_pool;
+
+} // namespace
+
+ZstdCompressor::ZstdCompressor(
+  FILE* stream,
+  int8_t compression_level,
+  uint32_t n_threads,
+  const CompressionDictionary::Dictionary* dictionary)
+  : m_stream(stream),
+    m_zstd_stream(cstream_pool.acquire()),
+    m_compression_level(actual_compression_level(compression_level))
+{
   size_t ret = ZSTD_initCStream(m_zstd_stream, m_compression_level);
   if (ZSTD_isError(ret)) {
-    ZSTD_freeCStream(m_zstd_stream);
+    cstream_pool.release(m_zstd_stream);
     throw Error("error initializing zstd compression stream");
   }
+
+  if (n_threads > 0) {
+#if ZSTD_VERSION_NUMBER >= 10400
+    // The frame is still an ordinary frame, so nothing changes for readers.
+    ret = ZSTD_CCtx_setParameter(m_zstd_stream, ZSTD_c_nbWorkers, n_threads);
+    if (ZSTD_isError(ret)) {
+      LOG("Not compressing with {} threads: {}",
+          n_threads,
+          ZSTD_getErrorName(ret));
+    }
+#else
+    LOG("Not compressing with {} threads since libzstd is too old", n_threads);
+#endif
+  }
+
+  if (dictionary) {
+#if ZSTD_VERSION_NUMBER >= 10400
+    // The dictionary ID is stored in the frame header, which is how readers
+    // find the dictionary.
+    const auto content = dictionary->content();
+    ret = ZSTD_CCtx_loadDictionary(
+      m_zstd_stream, content.data(), content.size());
+    if (ZSTD_isError(ret)) {
+      LOG("Not compressing with dictionary {:08x}: {}",
+          dictionary->id(),
+          ZSTD_getErrorName(ret));
+    }
+#else
+    LOG("Not compressing with dictionary {:08x} since libzstd is too old",
+        dictionary->id());
+#endif
+  }
 }
 
 ZstdCompressor::~ZstdCompressor()
 {
-  ZSTD_freeCStream(m_zstd_stream);
+  cstream_pool.release(m_zstd_stream);
 }
 
 int8_t
@@ -69,6 +134,35 @@ ZstdCompressor::actual_compression_level() const
   return m_compression_level;
 }
 
+int8_t
+ZstdCompressor::actual_compression_level(int8_t compression_level)
+{
+  if (compression_level == 0) {
+    compression_level = default_compression_level;
+    LOG("Using default compression level {}", compression_level);
+  }
+
+  // libzstd 1.3.4 and newer support negative levels. However, the query
+  // function ZSTD_minCLevel did not appear until 1.3.6, so perform detection
+  // based on version instead.
+  if (ZSTD_versionNumber() < 10304 && compression_level < 1) {
+    LOG(
+      "Using compression level 1 (minimum level supported by libzstd) instead"
+      " of {}",
+      compression_level);
+    compression_level = 1;
+  }
+
+  const int8_t actual_level =
+    std::min<int>(compression_level, ZSTD_maxCLevel());
+  if (actual_level != compression_level) {
+    LOG("Using compression level {} (max libzstd level) instead of {}",
+        actual_level,
+        compression_level);
+  }
+  return actual_level;
+}
+
 void
 ZstdCompressor::write(const void* data, size_t count)
 {
@@ -32,7 +32,14 @@ public:
   // Parameters:
   // - stream: The file to write data to.
   // - compression_level: Desired compression level.
-  ZstdCompressor(FILE* stream, int8_t compression_level);
+  // - n_threads: Number of worker threads, or 0 to compress on the calling
+  //   thread. Ignored if libzstd lacks multithreading support.
+  // - dictionary: Dictionary to compress with, or nullptr for none. Ignored if
+  //   libzstd is too old.
+  ZstdCompressor(FILE* stream,
+                 int8_t compression_level,
+                 uint32_t n_threads = 0,
+                 const CompressionDictionary::Dictionary* dictionary = nullptr);
 
   ~ZstdCompressor() override;
 
@@ -40,6 +47,9 @@ public:
   void write(const void* data, size_t count) override;
   void finalize() override;
 
+  // Return the level that a compressor created with `compression_level` uses.
+  static int8_t actual_compression_level(int8_t compression_level);
+
   constexpr static uint8_t default_compression_level = 1;
 
 private:
@@ -18,26 +18,80 @@
 
 #include "ZstdDecompressor.hpp"
 
+#include "CompressionDictionary.hpp"
 #include "assertions.hpp"
 #include "exceptions.hpp"
 
+#include <vector>
+
+namespace {
+
+// Creating a decompression context is relatively expensive, so each thread
+// keeps released contexts for reuse by later decompressors.
+const size_t k_max_pooled_streams = 4;
+
+class DStreamPool
+{
+public:
+  ~DStreamPool()
+  {
+    for (auto stream : m_streams) {
+      ZSTD_freeDStream(stream);
+    }
+  }
+
+  ZSTD_DStream*
+  acquire()
+  {
+    if (m_streams.empty()) {
+      return ZSTD_createDStream();
+    }
+    ZSTD_DStream* stream = m_streams.back();
+    m_streams.pop_back();
+    return stream;
+  }
+
+  void
+  release(ZSTD_DStream* stream)
+  {
+#if ZSTD_VERSION_NUMBER >= 10400
+    // Drop the reference to the dictionary of the previous user, which may be
+    // freed before the stream is used again.
+    ZSTD_DCtx_reset(stream, ZSTD_reset_session_and_parameters);
+#endif
+    if (m_streams.size() < k_max_pooled_streams) {
+      m_streams.push_back(stream);
+    } else {
+      ZSTD_freeDStream(stream);
+    }
+  }
+
+private:
+  std::vector<ZSTD_DStream*> m_streams;
+};
+
+thread_local DStreamPool dstream_pool;
+
+} // namespace
+
 ZstdDecompressor::ZstdDecompressor(FILE* stream)
   : m_stream(stream),
     m_input_size(0),
     m_input_consumed(0),
-    m_zstd_stream(ZSTD_createDStream()),
-    m_reached_stream_end(false)
+    m_zstd_stream(dstream_pool.acquire()),
+    m_reached_stream_end(false),
+    m_read_frame_header(false)
 {
   size_t ret = ZSTD_initDStream(m_zstd_stream);
   if (ZSTD_isError(ret)) {
-    ZSTD_freeDStream(m_zstd_stream);
+    dstream_pool.release(m_zstd_stream);
     throw Error("failed to initialize zstd decompression stream");
   }
 }
 
 ZstdDecompressor::~ZstdDecompressor()
 {
-  ZSTD_freeDStream(m_zstd_stream);
+  dstream_pool.release(m_zstd_stream);
 }
 
 void
@@ -52,6 +106,10 @@ ZstdDecompressor::read(void* data, size_t count)
         throw Error("failed to read from zstd input stream");
       }
       m_input_consumed = 0;
+      if (!m_read_frame_header) {
+        use_frame_dictionary();
+        m_read_frame_header = true;
+      }
     }
 
     m_zstd_in.src = (m_input_buffer + m_input_consumed);
@@ -74,6 +132,24 @@ ZstdDecompressor::read(void* data, size_t count)
   }
 }
 
+void
+ZstdDecompressor::use_frame_dictionary()
+{
+  const unsigned id = ZSTD_getDictID_fromFrame(m_input_buffer, m_input_size);
+  if (id == 0) {
+    return;
+  }
+#if ZSTD_VERSION_NUMBER >= 10400
+  m_dictionary = CompressionDictionary::get_by_id(id);
+  const size_t ret = ZSTD_DCtx_refDDict(m_zstd_stream, m_dictionary->ddict());
+  if (ZSTD_isError(ret)) {
+    throw Error("failed to use compression dictionary {:08x}", id);
+  }
+#else
+  throw Error("libzstd is too old to use compression dictionary {:08x}", id);
+#endif
+}
+
 void
 ZstdDecompressor::finalize()
 {
@@ -23,8 +23,13 @@
 #include "Decompressor.hpp"
 
 #include <fstream>
+#include <memory>
 #include <zstd.h>
 
+namespace CompressionDictionary {
+class Dictionary;
+}
+
 // A decompressor of a Zstandard stream.
 class ZstdDecompressor : public Decompressor
 {
@@ -39,6 +44,10 @@ public:
   void finalize() override;
 
 private:
+  // Use the dictionary referenced by the frame at the start of the input
+  // buffer, if any.
+  void use_frame_dictionary();
+
   FILE* m_stream;
   char m_input_buffer[READ_BUFFER_SIZE];
   size_t m_input_size;
@@ -47,4 +56,6 @@ private:
   ZSTD_inBuffer m_zstd_in;
   ZSTD_outBuffer m_zstd_out;
   bool m_reached_stream_end;
+  bool m_read_frame_header;
+  std::shared_ptr<const CompressionDictionary::Dictionary> m_dictionary;
 };
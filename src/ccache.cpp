@@ -21,8 +21,10 @@
 
 #include "Args.hpp"
 #include "ArgsInfo.hpp"
+#include "AtomicFile.hpp"
 #include "Checksum.hpp"
 #include "Compression.hpp"
+#include "CompressionDictionary.hpp"
 #include "Context.hpp"
 #include "Depfile.hpp"
 #include "Fd.hpp"
@@ -34,6 +36,7 @@
 #include "Logging.hpp"
 #include "Manifest.hpp"
 #include "MiniTrace.hpp"
+#include "NonCopyable.hpp"
 #include "ProgressBar.hpp"
 #include "Result.hpp"
 #include "ResultDumper.hpp"
@@ -71,11 +74,15 @@ extern "C" {
 
 #ifdef _WIN32
 #  include "Win32Util.hpp"
+#else
+#  include "Batch.hpp"
+#  include "Server.hpp"
 #endif
 
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <thread>
 
 #ifndef MYNAME
 #  define MYNAME "ccache"
@@ -107,6 +114,8 @@ constexpr const char USAGE_TEXT[] =
     compiler [compiler options]          (via symbolic link)
 
 Common options:
+        --batch PATH           run all compilations in the compilation database
+                               (compile_commands.json) at PATH
     -c, --cleanup              delete old files and recalculate size counters
                                (normally not needed as this is done
                                automatically)
@@ -131,9 +140,14 @@ Common options:
                                human-readable format
     -s, --show-stats           show summary of configuration and statistics
                                counters in human-readable format
+        --train-dictionary     train compression dictionaries on the cache
+                               content; see "Cache compression" in the manual
+                               for details
     -z, --zero-stats           zero statistics counters
 
     -h, --help                 print this help text
+    -j, --jobs NUM             run at most NUM compilations concurrently in
+                               batch mode (default: number of CPUs)
     -V, --version              print version and copyright information
 
 Options for scripting or debugging:
@@ -184,6 +198,10 @@ const uint8_t k_max_cache_levels = 4;
 // stored in the cache changes in a backwards-incompatible way.
 const char HASH_PREFIX[] = "3";
 
+// Suffix of compiler check cache entries, which are stored in the cache tree
+// like results and manifests so that cleanup covers them.
+const char k_compiler_check_file_suffix[] = "C";
+
 namespace {
 
 // Throw a Failure if ccache did not succeed in getting or putting a result in
@@ -537,36 +555,40 @@ print_included_files(const Context& ctx, FILE* fp)
   }
 }
 
-// This function reads and hashes a file. While doing this, it also does these
-// things:
+// This function hashes preprocessed output between `begin` and `end`. While
+// doing this, it also does these things:
 //
 // - Makes include file paths for which the base directory is a prefix relative
 //   when computing the hash sum.
 // - Stores the paths and hashes of included files in ctx.included_files.
 //
+// The output may be passed in several parts as long as each part except the
+// last one ends with a newline.
+//
 // Returns Statistic::none on success, otherwise a statistics counter to be
 // incremented.
 static Statistic
-process_preprocessed_file(Context& ctx,
+process_preprocessed_data(Context& ctx,
                           Hash& hash,
-                          const std::string& path,
+                          char* const begin,
+                          char* const end,
                           bool pump)
 {
-  std::string data;
-  try {
-    data = Util::read_file(path);
-  } catch (Error&) {
-    return Statistic::internal_error;
-  }
+  const string_view data(begin, end - begin);
 
   // Bytes between p and q are pending to be hashed.
-  const char* p = &data[0];
-  char* q = &data[0];
-  const char* end = p + data.length();
+  const char* p = begin;
+  char* q = begin;
 
   // There must be at least 7 characters (# 1 "x") left to potentially find an
   // include file path.
   while (q < end - 7) {
+    // Skip ahead to the next position that could be of interest.
+    q = begin + find_preprocessor_marker(data, q - begin, pump);
+    if (q >= end - 7) {
+      break;
+    }
+
     static const string_view pragma_gcc_pch_preprocess =
       "pragma GCC pch_preprocess ";
     static const string_view hash_31_command_line_newline =
@@ -602,7 +624,7 @@ process_preprocessed_file(Context& ctx,
             // HP/AIX:
             || (q[1] == 'l' && q[2] == 'i' && q[3] == 'n' && q[4] == 'e'
                 && q[5] == ' '))
-        && (q == data.data() || q[-1] == '\n')) {
+        && (q == begin || q[-1] == '\n')) {
       // Workarounds for preprocessor linemarker bugs in GCC version 6.
       if (q[2] == '3') {
         if (Util::starts_with(q, hash_31_command_line_newline)) {
@@ -713,7 +735,14 @@ process_preprocessed_file(Context& ctx,
   }
 
   hash.hash(p, (end - p));
+  return Statistic::none;
+}
 
+// Process included files that are not mentioned in the preprocessed output
+// after all of it has been passed to process_preprocessed_data.
+static void
+finish_preprocessed_output(Context& ctx, Hash& hash)
+{
   // Explicitly check the .gch/.pch/.pth file as Clang does not include any
   // mention of it in the preprocessed output.
   if (!ctx.included_pch_file.empty()) {
@@ -726,8 +755,29 @@ process_preprocessed_file(Context& ctx,
   if (debug_included) {
     print_included_files(ctx, stdout);
   }
+}
 
-  return Statistic::none;
+// Read and hash the preprocessed output in `path`. See
+// process_preprocessed_data.
+static Statistic
+process_preprocessed_file(Context& ctx,
+                          Hash& hash,
+                          const std::string& path,
+                          bool pump)
+{
+  std::string data;
+  try {
+    data = Util::read_file(path);
+  } catch (Error&) {
+    return Statistic::internal_error;
+  }
+
+  const Statistic error = process_preprocessed_data(
+    ctx, hash, &data[0], &data[0] + data.length(), pump);
+  if (error == Statistic::none) {
+    finish_preprocessed_output(ctx, hash);
+  }
+  return error;
 }
 
 // Extract the used includes from the dependency file. Note that we cannot
@@ -824,6 +874,96 @@ do_execute(Context& ctx,
   return status;
 }
 
+#ifndef _WIN32
+// Run the preprocessor with its output connected to a pipe and hash the output
+// while the preprocessor is running, only keeping incomplete lines in memory.
+// If `i_path` is not empty, the output is also written to that file. Like
+// do_execute, retries without requesting colored diagnostics if that fails.
+//
+// Returns the exit status of the preprocessor. `error` is set to
+// Statistic::none if the output could be processed, otherwise a statistics
+// counter to be incremented.
+static int
+execute_preprocessor_with_pipe(Context& ctx,
+                               Args& args,
+                               Hash& hash,
+                               bool pump,
+                               TemporaryFile&& tmp_stderr,
+                               const std::string& i_path,
+                               Statistic& error)
+{
+  UmaskScope umask_scope(ctx.original_umask);
+
+  if (ctx.diagnostics_color_failed) {
+    DEBUG_ASSERT(ctx.config.compiler_type() == CompilerType::gcc);
+    args.erase_last("-fdiagnostics-color");
+  }
+
+  Fd i_fd;
+  if (!i_path.empty()) {
+    i_fd = Fd(open(i_path.c_str(), O_WRONLY | O_TRUNC | O_BINARY));
+    if (!i_fd) {
+      LOG("Failed to open {}: {}", i_path, strerror(errno));
+      throw Failure(Statistic::internal_error);
+    }
+  }
+
+  const Hash original_hash = hash;
+  std::string pending;
+  error = Statistic::none;
+  const int status = execute_with_pipe(
+    ctx,
+    args.to_argv().data(),
+    std::move(tmp_stderr.fd),
+    [&](string_view data) {
+      if (i_fd) {
+        try {
+          Util::write_fd(*i_fd, data.data(), data.size());
+        } catch (Error& e) {
+          LOG("Failed to write to {}: {}", i_path, e.what());
+          throw Failure(Statistic::internal_error);
+        }
+      }
+      if (error != Statistic::none) {
+        return;
+      }
+      pending.append(data.data(), data.size());
+      const size_t line_end = pending.rfind('\n');
+      if (line_end != std::string::npos) {
+        error = process_preprocessed_data(
+          ctx, hash, &pending[0], &pending[line_end + 1], pump);
+        pending.erase(0, line_end + 1);
+      }
+    });
+
+  if (status != 0 && !ctx.diagnostics_color_failed
+      && ctx.config.compiler_type() == CompilerType::gcc) {
+    auto errors = Util::read_file(tmp_stderr.path);
+    if (errors.find("fdiagnostics-color") != std::string::npos) {
+      LOG_RAW("-fdiagnostics-color is unsupported; trying again without it");
+
+      tmp_stderr.fd = Fd(open(
+        tmp_stderr.path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_BINARY, 0600));
+      if (!tmp_stderr.fd) {
+        LOG("Failed to truncate {}: {}", tmp_stderr.path, strerror(errno));
+        throw Failure(Statistic::internal_error);
+      }
+
+      hash = original_hash;
+      ctx.diagnostics_color_failed = true;
+      return execute_preprocessor_with_pipe(
+        ctx, args, hash, pump, std::move(tmp_stderr), i_path, error);
+    }
+  }
+
+  if (status == 0 && error == Statistic::none) {
+    error = process_preprocessed_data(
+      ctx, hash, &pending[0], &pending[0] + pending.size(), pump);
+  }
+  return status;
+}
+#endif
+
 struct LookUpCacheFileResult
 {
   std::string path;
@@ -880,7 +1020,16 @@ update_manifest_file(Context& ctx)
                      *ctx.result_name(),
                      ctx.included_files,
                      ctx.time_of_compilation,
-                     save_timestamp)) {
+                     save_timestamp,
+                     ctx.manifest_is_intact,
+                     [&ctx](const Digest& name) {
+                       // Cache hits update the modification time of the
+                       // result file, and a missing file has time 0.
+                       return look_up_cache_file(ctx.config.cache_dir(),
+                                                 name,
+                                                 Result::k_file_suffix)
+                         .stat.mtime();
+                     })) {
     LOG("Failed to add result name to {}", *ctx.manifest_path());
   } else {
     const auto new_stat = Stat::stat(*ctx.manifest_path(), Stat::OnError::log);
@@ -954,6 +1103,65 @@ find_coverage_file(const Context& ctx)
   return {true, found_file, found_file == mangled_form};
 }
 
+#ifndef _WIN32
+// Let the ccache process invoked by the build system exit successfully while a
+// detached background process stores the result, updates the manifest and
+// finalizes the statistics. Returns in the background process, or in the
+// original process if detaching failed.
+static void
+detach_for_async_store(Context& ctx)
+{
+  // Don't let the background process flush data buffered by the parent.
+  fflush(stdout);
+  fflush(stderr);
+
+  const pid_t pid = fork();
+  if (pid == -1) {
+    LOG("Failed to fork: {}", strerror(errno));
+    return;
+  }
+  if (pid > 0) {
+    int status;
+    if (waitpid(pid, &status, 0) == pid && WIFEXITED(status)
+        && WEXITSTATUS(status) == EXIT_SUCCESS) {
+      LOG_RAW("Storing result in the background");
+      // Pending temporary files are now owned by the background process.
+      _exit(EXIT_SUCCESS);
+    }
+    LOG_RAW("Failed to detach; storing result in the foreground");
+    return;
+  }
+
+  // Fork again in a new session so that the background process isn't affected
+  // by signals sent to the build system's process group.
+  if (setsid() == -1) {
+    _exit(EXIT_FAILURE);
+  }
+  const pid_t background_pid = fork();
+  if (background_pid != 0) {
+    _exit(background_pid == -1 ? EXIT_FAILURE : EXIT_SUCCESS);
+  }
+
+  // Build systems that capture output wait until all writers of the output
+  // pipes have exited, so don't hold on to them.
+  const int null_fd = open("/dev/null", O_RDWR);
+  if (null_fd != -1) {
+    dup2(null_fd, STDIN_FILENO);
+    dup2(null_fd, STDOUT_FILENO);
+    dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+  }
+  const char* uncached_err_fd = getenv("UNCACHED_ERR_FD");
+  if (uncached_err_fd) {
+    close(atoi(uncached_err_fd));
+    Util::unsetenv("UNCACHED_ERR_FD");
+  }
+
+  ctx.async_store_detached = true;
+  LOG_RAW("Detached from the build system");
+}
+#endif
+
 // Run the real compiler and put the result in cache.
 static void
 to_cache(Context& ctx,
@@ -1132,6 +1340,17 @@ to_cache(Context& ctx,
                         ctx.args_info.output_dwo);
   }
 
+  bool stderr_sent = false;
+#ifndef _WIN32
+  if (ctx.config.async_store()) {
+    // The output files are in place, so the build system can continue as soon
+    // as it has got the compiler's stderr.
+    Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+    stderr_sent = true;
+    detach_for_async_store(ctx);
+  }
+#endif
+
   auto error = result_writer.finalize();
   if (error) {
     LOG("Error: {}", *error);
@@ -1157,7 +1376,9 @@ to_cache(Context& ctx,
   create_cachedir_tag(ctx);
 
   // Everything OK.
-  Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+  if (!stderr_sent) {
+    Util::send_to_stderr(ctx, Util::read_file(tmp_stderr_path));
+  }
 }
 
 // Find the result name by running the compiler in preprocessor mode and
@@ -1167,9 +1388,19 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
 {
   ctx.time_of_compilation = time(nullptr);
 
+  const bool is_pump = ctx.config.compiler_type() == CompilerType::pump;
+#ifdef _WIN32
+  const bool stream_output = false;
+#else
+  const bool stream_output =
+    ctx.config.stream_cpp_output() && !ctx.args_info.direct_i_file;
+#endif
+
   std::string stderr_path;
   std::string stdout_path;
   int status;
+  Statistic error = Statistic::none;
+  hash.hash_delimiter("cpp");
   if (ctx.args_info.direct_i_file) {
     // We are compiling a .i or .ii file - that means we can skip the cpp stage
     // and directly form the correct i_tmpfile.
@@ -1178,15 +1409,19 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
   } else {
     // Run cpp on the input file to obtain the .i.
 
-    TemporaryFile tmp_stdout(
-      FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
-    ctx.register_pending_tmp_file(tmp_stdout.path);
+    // When streaming, the output only needs to be stored if the compiler is
+    // going to compile it.
+    nonstd::optional<TemporaryFile> tmp_stdout;
+    if (!stream_output || !ctx.config.run_second_cpp()) {
+      tmp_stdout.emplace(FMT("{}/tmp.cpp_stdout", ctx.config.temporary_dir()));
+      ctx.register_pending_tmp_file(tmp_stdout->path);
 
-    // stdout_path needs the proper cpp_extension for the compiler to do its
-    // thing correctly.
-    stdout_path = FMT("{}.{}", tmp_stdout.path, ctx.config.cpp_extension());
-    Util::hard_link(tmp_stdout.path, stdout_path);
-    ctx.register_pending_tmp_file(stdout_path);
+      // stdout_path needs the proper cpp_extension for the compiler to do its
+      // thing correctly.
+      stdout_path = FMT("{}.{}", tmp_stdout->path, ctx.config.cpp_extension());
+      Util::hard_link(tmp_stdout->path, stdout_path);
+      ctx.register_pending_tmp_file(stdout_path);
+    }
 
     TemporaryFile tmp_stderr(
       FMT("{}/tmp.cpp_stderr", ctx.config.temporary_dir()));
@@ -1208,8 +1443,16 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
     add_prefix(ctx, args, ctx.config.prefix_command_cpp());
     LOG_RAW("Running preprocessor");
     MTR_BEGIN("execute", "preprocessor");
-    status =
-      do_execute(ctx, args, std::move(tmp_stdout), std::move(tmp_stderr));
+#ifndef _WIN32
+    if (stream_output) {
+      status = execute_preprocessor_with_pipe(
+        ctx, args, hash, is_pump, std::move(tmp_stderr), stdout_path, error);
+    } else
+#endif
+    {
+      status =
+        do_execute(ctx, args, std::move(*tmp_stdout), std::move(tmp_stderr));
+    }
     MTR_END("execute", "preprocessor");
     args.pop_back(args_added);
   }
@@ -1219,10 +1462,13 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
     throw Failure(Statistic::preprocessor_error);
   }
 
-  hash.hash_delimiter("cpp");
-  const bool is_pump = ctx.config.compiler_type() == CompilerType::pump;
-  const Statistic error =
-    process_preprocessed_file(ctx, hash, stdout_path, is_pump);
+  if (stream_output) {
+    if (error == Statistic::none) {
+      finish_preprocessed_output(ctx, hash);
+    }
+  } else {
+    error = process_preprocessed_file(ctx, hash, stdout_path, is_pump);
+  }
   if (error != Statistic::none) {
     throw Failure(error);
   }
@@ -1251,14 +1497,160 @@ get_result_name_from_cpp(Context& ctx, Args& args, Hash& hash)
   return hash.digest();
 }
 
+// Hash content of a file or the output of a command according to the
+// CCACHE_COMPILERCHECK setting.
+//
+// Returns false if the compiler could not be hashed completely.
+static bool
+hash_compiler_identity(const Context& ctx,
+                       Hash& hash,
+                       const std::string& path,
+                       bool allow_command)
+{
+  if (ctx.config.compiler_check() == "content" || !allow_command) {
+    hash.hash_delimiter("cc_content");
+    return hash_binary_file(ctx, hash, path);
+  } else { // command string
+    if (!hash_multicommand_output(
+          hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
+      LOG("Failure running compiler check command: {}",
+          ctx.config.compiler_check());
+      throw Failure(Statistic::compiler_check_failed);
+    }
+    return true;
+  }
+}
+
+// Hash what identifies the file version that `st` refers to.
+static void
+hash_file_identity(Hash& hash, const Stat& st)
+{
+  hash.hash(st.device());
+  hash.hash(st.inode());
+  hash.hash(st.size());
+  hash.hash(st.mtim().tv_sec);
+  hash.hash(st.mtim().tv_nsec);
+  hash.hash(st.ctim().tv_sec);
+  hash.hash(st.ctim().tv_nsec);
+}
+
+// Read the compiler check cache entry for `key`. Returns the empty string if
+// there is no entry.
+static std::string
+read_compiler_check_cache_entry(const Context& ctx, const Digest& key)
+{
+  const auto file = look_up_cache_file(
+    ctx.config.cache_dir(), key, k_compiler_check_file_suffix);
+  if (!file.stat) {
+    return {};
+  }
+  try {
+    std::string data = Util::read_file(file.path);
+    if (!ctx.config.read_only()) {
+      // Update modification timestamp to save the file from LRU cleanup.
+      Util::update_mtime(file.path);
+    }
+    return data;
+  } catch (const Error& e) {
+    LOG("Failed to read compiler identity from {}: {}", file.path, e.what());
+    return {};
+  }
+}
+
+// Store `data` as the compiler check cache entry for `key`.
+static void
+store_compiler_check_cache_entry(const Context& ctx,
+                                 const Digest& key,
+                                 const std::string& data)
+{
+  if (ctx.config.read_only()) {
+    return;
+  }
+  const auto file = look_up_cache_file(
+    ctx.config.cache_dir(), key, k_compiler_check_file_suffix);
+  try {
+    Util::ensure_dir_exists(Util::dir_name(file.path));
+    AtomicFile atomic_file(file.path, AtomicFile::Mode::binary);
+    atomic_file.write(data);
+    atomic_file.commit();
+  } catch (const Error& e) {
+    LOG("Failed to store compiler identity in {}: {}", file.path, e.what());
+    return;
+  }
+
+  if (!ctx.config.stats()) {
+    return;
+  }
+  // The entry doesn't belong to the result of this compilation, so account
+  // for it in the stats file of its own level 1 directory, which is what
+  // cleanup uses.
+  const auto new_stat = Stat::stat(file.path, Stat::OnError::log);
+  const auto stats_file =
+    FMT("{}/{:x}/stats", ctx.config.cache_dir(), key.bytes()[0] >> 4);
+  Statistics::update(stats_file, [&](Counters& cs) {
+    cs.increment(Statistic::cache_size_kibibyte,
+                 Util::size_change_kibibyte(file.stat, new_stat));
+    cs.increment(Statistic::files_in_cache,
+                 (new_stat ? 1 : 0) - (file.stat ? 1 : 0));
+  });
+}
+
+// Like hash_compiler_identity into a separate hash but the resulting digest is
+// stored in the cache directory for the compiler as identified by `st` and
+// reused as long as the compiler file is unchanged. The lookup is counted in
+// the statistics if `count_lookup` is true.
+static Digest
+get_compiler_identity_cached(Context& ctx,
+                             const Stat& st,
+                             const std::string& path,
+                             bool allow_command,
+                             bool count_lookup)
+{
+  Hash key_hash;
+  key_hash.hash_delimiter("compiler_check");
+  key_hash.hash(ctx.config.compiler_check());
+  key_hash.hash(allow_command ? ctx.orig_args[0] : "");
+  key_hash.hash(path);
+  hash_file_identity(key_hash, st);
+  const Digest key = key_hash.digest();
+
+  Digest digest;
+  const std::string data = read_compiler_check_cache_entry(ctx, key);
+  if (data.size() == Digest::size()) {
+    LOG("Using cached compiler identity for {}", path);
+    if (count_lookup) {
+      ctx.counter_updates.increment(Statistic::compiler_check_cache_hit);
+    }
+    memcpy(digest.bytes(), data.data(), Digest::size());
+  } else {
+    if (count_lookup) {
+      ctx.counter_updates.increment(Statistic::compiler_check_cache_miss);
+    }
+    Hash identity_hash;
+    const bool complete =
+      hash_compiler_identity(ctx, identity_hash, path, allow_command);
+    digest = identity_hash.digest();
+    if (complete) {
+      store_compiler_check_cache_entry(
+        ctx,
+        key,
+        std::string(reinterpret_cast<const char*>(digest.bytes()),
+                    Digest::size()));
+    }
+  }
+  return digest;
+}
+
 // Hash mtime or content of a file, or the output of a command, according to
-// the CCACHE_COMPILERCHECK setting.
+// the CCACHE_COMPILERCHECK setting. `count_cache_lookup` is passed on to
+// get_compiler_identity_cached.
 static void
-hash_compiler(const Context& ctx,
+hash_compiler(Context& ctx,
               Hash& hash,
               const Stat& st,
               const std::string& path,
-              bool allow_command)
+              bool allow_command,
+              bool count_cache_lookup = true)
 {
   if (ctx.config.compiler_check() == "none") {
     // Do nothing.
@@ -1269,29 +1661,27 @@ hash_compiler(const Context& ctx,
   } else if (Util::starts_with(ctx.config.compiler_check(), "string:")) {
     hash.hash_delimiter("cc_hash");
     hash.hash(&ctx.config.compiler_check()[7]);
-  } else if (ctx.config.compiler_check() == "content" || !allow_command) {
-    hash.hash_delimiter("cc_content");
-    hash_binary_file(ctx, hash, path);
-  } else { // command string
-    if (!hash_multicommand_output(
-          hash, ctx.config.compiler_check(), ctx.orig_args[0])) {
-      LOG("Failure running compiler check command: {}",
-          ctx.config.compiler_check());
-      throw Failure(Statistic::compiler_check_failed);
+  } else {
+    // The identity is hashed separately and only its digest is added, so that
+    // the hash is the same whether the compiler check cache is used or not.
+    Digest digest;
+    if (ctx.config.compiler_check_cache()) {
+      digest = get_compiler_identity_cached(
+        ctx, st, path, allow_command, count_cache_lookup);
+    } else {
+      Hash identity_hash;
+      hash_compiler_identity(ctx, identity_hash, path, allow_command);
+      digest = identity_hash.digest();
     }
+    hash.hash_delimiter("cc_identity");
+    hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
   }
 }
 
-// Hash the host compiler(s) invoked by nvcc.
-//
-// If `ccbin_st` and `ccbin` are set, they refer to a directory or compiler set
-// with -ccbin/--compiler-bindir. If `ccbin_st` is nullptr or `ccbin` is the
-// empty string, the compilers are looked up in PATH instead.
-static void
-hash_nvcc_host_compiler(const Context& ctx,
-                        Hash& hash,
-                        const Stat* ccbin_st = nullptr,
-                        const std::string& ccbin = {})
+// Find the host compilers that nvcc uses in the directory `ccbin` or, if
+// `ccbin` is the empty string, in PATH.
+static std::vector<std::string>
+find_nvcc_host_compilers(const Context& ctx, const std::string& ccbin)
 {
   // From <http://docs.nvidia.com/cuda/cuda-compiler-driver-nvcc/index.html>:
   //
@@ -1305,32 +1695,145 @@ hash_nvcc_host_compiler(const Context& ctx,
   //   Linux, clang and clang++ on Mac OS X, and cl.exe on Windows) found in
   //   the current execution search path will be used".
 
-  if (ccbin.empty() || !ccbin_st || ccbin_st->is_directory()) {
 #if defined(__APPLE__)
-    const char* compilers[] = {"clang", "clang++"};
+  const char* compilers[] = {"clang", "clang++"};
 #elif defined(_WIN32)
-    const char* compilers[] = {"cl.exe"};
+  const char* compilers[] = {"cl.exe"};
 #else
-    const char* compilers[] = {"gcc", "g++"};
+  const char* compilers[] = {"gcc", "g++"};
 #endif
-    for (const char* compiler : compilers) {
-      if (!ccbin.empty()) {
-        std::string path = FMT("{}/{}", ccbin, compiler);
-        auto st = Stat::stat(path);
-        if (st) {
-          hash_compiler(ctx, hash, st, path, false);
-        }
-      } else {
-        std::string path = find_executable(ctx, compiler, CCACHE_NAME);
-        if (!path.empty()) {
-          auto st = Stat::stat(path, Stat::OnError::log);
-          hash_compiler(ctx, hash, st, ccbin, false);
-        }
+  std::vector<std::string> paths;
+  for (const char* compiler : compilers) {
+    if (!ccbin.empty()) {
+      std::string path = FMT("{}/{}", ccbin, compiler);
+      if (Stat::stat(path)) {
+        paths.push_back(path);
+      }
+    } else {
+      std::string path = find_executable(ctx, compiler, CCACHE_NAME);
+      if (!path.empty()) {
+        paths.push_back(path);
       }
     }
+  }
+  return paths;
+}
+
+// Hash the identity of files `paths`, used to verify that a cached set of host
+// compilers is still valid.
+static Digest
+get_nvcc_host_compilers_identity(const std::vector<std::string>& paths)
+{
+  Hash hash;
+  for (const auto& path : paths) {
+    hash.hash(path);
+    hash_file_identity(hash, Stat::stat(path));
+  }
+  return hash.digest();
+}
+
+// Like hashing each compiler found by find_nvcc_host_compilers into a separate
+// hash but the resulting digest is stored in the cache directory together with
+// the found paths.
+//
+// The cache entry is keyed on the searched directories, so a compiler that is
+// added to or removed from any of them results in a new entry. An entry is only
+// used if the found compilers are unchanged as well.
+static Digest
+get_nvcc_host_compilers_digest_cached(Context& ctx, const std::string& ccbin)
+{
+  std::string search_path = ccbin;
+  if (search_path.empty()) {
+    search_path = ctx.config.path();
+  }
+  if (search_path.empty()) {
+    const char* path_env = getenv("PATH");
+    search_path = path_env ? path_env : "";
+  }
+
+  Hash key_hash;
+  key_hash.hash_delimiter("nvcc_host_compilers");
+  key_hash.hash(ctx.config.compiler_check());
+  key_hash.hash(ccbin);
+  for (const auto& dir : Util::split_into_strings(search_path, PATH_DELIM)) {
+    key_hash.hash(dir);
+    hash_file_identity(key_hash, Stat::stat(dir));
+  }
+  const Digest key = key_hash.digest();
+
+  // The entry consists of the identity of the found compilers, the resulting
+  // digest and the paths of the found compilers separated by newlines.
+  std::string data = read_compiler_check_cache_entry(ctx, key);
+
+  Digest identity;
+  Digest digest;
+  bool found = false;
+  if (data.size() >= 2 * Digest::size()) {
+    memcpy(identity.bytes(), data.data(), Digest::size());
+    memcpy(digest.bytes(), data.data() + Digest::size(), Digest::size());
+    const auto paths =
+      Util::split_into_strings(data.substr(2 * Digest::size()), "\n");
+    found = get_nvcc_host_compilers_identity(paths) == identity;
+  }
+
+  if (found) {
+    LOG_RAW("Using cached nvcc host compilers");
+    ctx.counter_updates.increment(Statistic::compiler_check_cache_hit);
   } else {
+    ctx.counter_updates.increment(Statistic::compiler_check_cache_miss);
+    const auto paths = find_nvcc_host_compilers(ctx, ccbin);
+    Hash compilers_hash;
+    for (const auto& path : paths) {
+      // This lookup has already been counted as a miss.
+      auto st = Stat::stat(path, Stat::OnError::log);
+      hash_compiler(ctx, compilers_hash, st, path, false, false);
+    }
+    identity = get_nvcc_host_compilers_identity(paths);
+    digest = compilers_hash.digest();
+
+    data.assign(reinterpret_cast<const char*>(identity.bytes()),
+                Digest::size());
+    data.append(reinterpret_cast<const char*>(digest.bytes()), Digest::size());
+    for (const auto& path : paths) {
+      data += path;
+      data += '\n';
+    }
+    store_compiler_check_cache_entry(ctx, key, data);
+  }
+  return digest;
+}
+
+// Hash the host compiler(s) invoked by nvcc.
+//
+// If `ccbin_st` and `ccbin` are set, they refer to a directory or compiler set
+// with -ccbin/--compiler-bindir. If `ccbin_st` is nullptr or `ccbin` is the
+// empty string, the compilers are looked up in PATH instead.
+static void
+hash_nvcc_host_compiler(Context& ctx,
+                        Hash& hash,
+                        const Stat* ccbin_st = nullptr,
+                        const std::string& ccbin = {})
+{
+  if (!ccbin.empty() && ccbin_st && !ccbin_st->is_directory()) {
     hash_compiler(ctx, hash, *ccbin_st, ccbin, false);
+    return;
   }
+
+  // As for hash_compiler, only the digest of the compilers is added so that
+  // the hash is the same whether the compiler check cache is used or not.
+  Digest digest;
+  if (ctx.config.compiler_check_cache()) {
+    digest = get_nvcc_host_compilers_digest_cached(ctx, ccbin);
+  } else {
+    Hash compilers_hash;
+    for (const auto& path : find_nvcc_host_compilers(ctx, ccbin)) {
+      auto st = Stat::stat(path, Stat::OnError::log);
+      hash_compiler(ctx, compilers_hash, st, path, false);
+    }
+    digest = compilers_hash.digest();
+  }
+  hash.hash_delimiter("nvcc_host_compilers");
+  hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
 }
 
 static bool
@@ -1341,7 +1844,7 @@ should_rewrite_dependency_target(const ArgsInfo& args_info)
 
 // update a hash with information common for the direct and preprocessor modes.
 static void
-hash_common_info(const Context& ctx,
+hash_common_info(Context& ctx,
                  const Args& args,
                  Hash& hash,
                  const ArgsInfo& args_info)
@@ -2047,6 +2550,8 @@ set_up_config(Config& config)
 
   // We have now determined config.cache_dir and populated the rest of config in
   // prio order (1. environment, 2. primary config, 3. secondary config).
+
+  CompressionDictionary::set_directory(config.cache_dir() + "/dictionaries");
 }
 
 static void
@@ -2059,11 +2564,19 @@ set_up_context(Context& ctx, int argc, const char* const* argv)
     Util::split_into_strings(ctx.config.ignore_options(), " "));
 }
 
-// Initialize ccache, must be called once before anything else is run.
+// Initialize ccache, must be called once before anything else is run. The
+// configuration is copied from `config` if not null instead of being read.
 static void
-initialize(Context& ctx, int argc, const char* const* argv)
+initialize(Context& ctx,
+           int argc,
+           const char* const* argv,
+           const Config* config = nullptr)
 {
-  set_up_config(ctx.config);
+  if (config) {
+    ctx.config = *config;
+  } else {
+    set_up_config(ctx.config);
+  }
   set_up_context(ctx, argc, argv);
   Logging::init(ctx.config);
 
@@ -2120,8 +2633,172 @@ configuration_printer(const std::string& key,
   PRINT(stdout, "({}) {} = {}\n", origin, key, value);
 }
 
+// Outcome of a direct mode lookup that missed. A ccache server worker or a
+// batch mode lookup passes it on to the process that runs the compilation so
+// that the lookup doesn't have to be repeated.
+struct DirectLookup
+{
+  // Digest of the common hash that the lookup was based on. The outcome is
+  // only reused for the same common hash.
+  Digest common_digest;
+
+  // False if the lookup disabled direct mode, e.g. since the source file uses
+  // time macros.
+  bool direct_mode = true;
+
+  optional<Digest> manifest_name;
+
+  // Result name found in the manifest, if any.
+  optional<Digest> result_name;
+
+  // Statistics updates made by the lookup, e.g. manifest lookups. They are
+  // added to the statistics of the compilation that reuses the outcome.
+  Counters counter_updates;
+
+  std::string serialize() const;
+  static optional<DirectLookup> deserialize(const std::string& data);
+};
+
+std::string
+DirectLookup::serialize() const
+{
+  std::string data;
+  const auto add = [&data](const Digest& digest) {
+    data.append(reinterpret_cast<const char*>(digest.bytes()), digest.size());
+  };
+
+  data.push_back((direct_mode ? 1 : 0) | (manifest_name ? 2 : 0)
+                 | (result_name ? 4 : 0));
+  add(common_digest);
+  if (manifest_name) {
+    add(*manifest_name);
+  }
+  if (result_name) {
+    add(*result_name);
+  }
+  for (size_t i = 0; i < counter_updates.size(); ++i) {
+    const uint64_t value = counter_updates.get_raw(i);
+    if (value != 0 && i <= UINT8_MAX) {
+      data.push_back(static_cast<char>(i));
+      data.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+  }
+  return data;
+}
+
+optional<DirectLookup>
+DirectLookup::deserialize(const std::string& data)
+{
+  if (data.empty()) {
+    return nullopt;
+  }
+  const uint8_t flags = data[0];
+  const size_t n_digests = 1 + ((flags & 2) ? 1 : 0) + ((flags & 4) ? 1 : 0);
+  const size_t counters_pos = 1 + n_digests * Digest::size();
+  if (data.size() < counters_pos
+      || (data.size() - counters_pos) % (1 + sizeof(uint64_t)) != 0) {
+    return nullopt;
+  }
+
+  size_t pos = 1;
+  const auto next = [&data, &pos]() {
+    Digest digest;
+    memcpy(digest.bytes(), data.data() + pos, digest.size());
+    pos += digest.size();
+    return digest;
+  };
+
+  DirectLookup direct_lookup;
+  direct_lookup.common_digest = next();
+  direct_lookup.direct_mode = flags & 1;
+  if (flags & 2) {
+    direct_lookup.manifest_name = next();
+  }
+  if (flags & 4) {
+    direct_lookup.result_name = next();
+  }
+  while (pos < data.size()) {
+    const size_t index = static_cast<uint8_t>(data[pos]);
+    uint64_t value;
+    memcpy(&value, data.data() + pos + 1, sizeof(value));
+    pos += 1 + sizeof(value);
+    if (index < direct_lookup.counter_updates.size()) {
+      direct_lookup.counter_updates.set_raw(index, value);
+    }
+  }
+  return direct_lookup;
+}
+
+// Return a description of the status of the configuration files of `config`
+// that changes when any of the files changes.
+static std::string
+get_config_files_status(const Config& config)
+{
+  std::string status;
+  for (const auto& path :
+       {config.primary_config_path(), config.secondary_config_path()}) {
+    const auto st = Stat::stat(path);
+    status += FMT("{} {} {} {}.{} {}.{}\n",
+                  st.device(),
+                  st.inode(),
+                  st.size(),
+                  st.mtim().tv_sec,
+                  st.mtim().tv_nsec,
+                  st.ctim().tv_sec,
+                  st.ctim().tv_nsec);
+  }
+  return status;
+}
+
+// Configuration and cache mappings that a process handling many compilations,
+// i.e. a ccache server worker or the batch mode process whose children inherit
+// them, loads once and uses for all of them.
+class LoadedConfig : NonCopyable
+{
+public:
+  // Read the configuration.
+  LoadedConfig();
+
+  // Use an already read configuration.
+  explicit LoadedConfig(const Config& read_config);
+
+  // Whether the configuration files are unchanged since they were read.
+  bool is_current() const;
+
+  Config config;
+  CacheMappings cache_mappings;
+
+private:
+  std::string m_config_files_status;
+};
+
+LoadedConfig::LoadedConfig() : cache_mappings(config)
+{
+  set_up_config(config);
+  m_config_files_status = get_config_files_status(config);
+}
+
+LoadedConfig::LoadedConfig(const Config& read_config) : cache_mappings(config)
+{
+  config = read_config;
+  m_config_files_status = get_config_files_status(config);
+}
+
+bool
+LoadedConfig::is_current() const
+{
+  return get_config_files_status(config) == m_config_files_status;
+}
+
 static int cache_compilation(int argc, const char* const* argv);
-static Statistic do_cache_compilation(Context& ctx, const char* const* argv);
+static Statistic do_cache_compilation(Context& ctx,
+                                      const char* const* argv,
+                                      optional<DirectLookup>& direct_lookup);
+#ifndef _WIN32
+static bool serve_compilation(int argc,
+                              const char* const* argv,
+                              std::string& miss_state);
+#endif
 
 static uint8_t
 calculate_wanted_cache_level(uint64_t files_in_level_1)
@@ -2293,9 +2970,17 @@ finalize_at_exit(Context& ctx)
   }
 }
 
-// The entry point when invoked to cache a compilation.
+// Run the compilation described by `argc` and `argv`. `loaded_config` is used
+// instead of reading the configuration if not null. `direct_lookup` is the
+// outcome of a direct mode lookup that already missed, if any. `statistic` is
+// set to the outcome of a successful compilation if not null.
 static int
-cache_compilation(int argc, const char* const* argv)
+run_compilation(int argc,
+                const char* const* argv,
+                LoadedConfig* loaded_config,
+                optional<DirectLookup> direct_lookup,
+                bool may_start_server,
+                Statistic* statistic = nullptr)
 {
   tzset(); // Needed for localtime_r.
 
@@ -2305,24 +2990,40 @@ cache_compilation(int argc, const char* const* argv)
   std::string saved_temp_dir;
 
   {
-    Context ctx;
+    Context ctx(loaded_config ? &loaded_config->cache_mappings : nullptr);
     SignalHandler signal_handler(ctx);
     Finalizer finalizer([&ctx] { finalize_at_exit(ctx); });
 
-    initialize(ctx, argc, argv);
+    initialize(
+      ctx, argc, argv, loaded_config ? &loaded_config->config : nullptr);
+
+#ifndef _WIN32
+    if (may_start_server && ctx.config.server() && !ctx.config.disable()) {
+      Server::start(ctx.config, serve_compilation);
+    }
+#else
+    (void)may_start_server;
+#endif
 
     MTR_BEGIN("main", "find_compiler");
     find_compiler(ctx, &find_executable);
     MTR_END("main", "find_compiler");
 
     try {
-      Statistic statistic = do_cache_compilation(ctx, argv);
-      ctx.counter_updates.increment(statistic);
+      const Statistic outcome = do_cache_compilation(ctx, argv, direct_lookup);
+      ctx.counter_updates.increment(outcome);
+      if (statistic) {
+        *statistic = outcome;
+      }
     } catch (const Failure& e) {
       if (e.statistic() != Statistic::none) {
         ctx.counter_updates.increment(e.statistic());
       }
 
+      if (ctx.async_store_detached) {
+        // The build system has already got the compiler's output.
+        return EXIT_SUCCESS;
+      }
       if (e.exit_code()) {
         return *e.exit_code();
       }
@@ -2360,8 +3061,110 @@ cache_compilation(int argc, const char* const* argv)
   return EXIT_SUCCESS;
 }
 
+// The entry point when invoked to cache a compilation.
+static int
+cache_compilation(int argc, const char* const* argv)
+{
+#ifndef _WIN32
+  // Ask a running server before doing anything else since the server already
+  // has the configuration loaded. Whether a server should be used at all isn't
+  // known until the configuration has been read, so a server is only started
+  // below.
+  std::string miss_state;
+  switch (Server::look_up(argc, argv, miss_state)) {
+  case Server::Reply::hit:
+    // The server has already logged the retrieval and updated the statistics.
+    return EXIT_SUCCESS;
+  case Server::Reply::miss:
+    return run_compilation(
+      argc, argv, nullptr, DirectLookup::deserialize(miss_state), false);
+  case Server::Reply::none:
+    break;
+  }
+#endif
+
+  return run_compilation(argc, argv, nullptr, nullopt, true);
+}
+
+// Look up the compilation described by `argc` and `argv` in direct mode with
+// `loaded_config`, retrieving the result on a hit. On a miss, nothing is done
+// except that `miss_state` is set to the outcome of the lookup (see
+// DirectLookup), if any.
+static bool
+look_up_compilation(LoadedConfig& loaded_config,
+                    int argc,
+                    const char* const* argv,
+                    std::string& miss_state)
+{
+  tzset(); // TZ may differ from the previous compilation's.
+
+  bool hit = false;
+  Context ctx(&loaded_config.cache_mappings);
+  Finalizer finalizer([&] {
+    if (hit) {
+      finalize_at_exit(ctx);
+    }
+  });
+
+  optional<DirectLookup> direct_lookup;
+  try {
+    initialize(ctx, argc, argv, &loaded_config.config);
+    find_compiler(ctx, &find_executable);
+    ctx.direct_lookup_only = true;
+    ctx.counter_updates.increment(
+      do_cache_compilation(ctx, argv, direct_lookup));
+    hit = true;
+  } catch (const Failure&) {
+    if (direct_lookup) {
+      direct_lookup->counter_updates = ctx.counter_updates;
+      miss_state = direct_lookup->serialize();
+    }
+  } catch (const ErrorBase& e) {
+    LOG("Error: {}", e.what());
+  }
+  return hit;
+}
+
+#ifndef _WIN32
+// The entry point when a ccache server worker looks up a compilation on behalf
+// of a client.
+static bool
+serve_compilation(int argc, const char* const* argv, std::string& miss_state)
+{
+  // UNCACHED_ERR_FD is set up below, but since it refers to the client's stderr
+  // it must not outlive the request.
+  Util::unsetenv("UNCACHED_ERR_FD");
+
+  // All clients of a server have the same configuration environment (see
+  // Server::get_socket_path), so the configuration only has to be read again
+  // if a configuration file has changed.
+  static std::unique_ptr<LoadedConfig> loaded_config;
+  if (!loaded_config || !loaded_config->is_current()) {
+    loaded_config = std::make_unique<LoadedConfig>();
+  }
+  if (!loaded_config->config.server()) {
+    return false;
+  }
+
+  const bool hit = look_up_compilation(*loaded_config, argc, argv, miss_state);
+  if (hit) {
+    LOG_RAW("Result retrieved by ccache server");
+  }
+
+  const char* uncached_err_fd = getenv("UNCACHED_ERR_FD");
+  if (uncached_err_fd) {
+    close(atoi(uncached_err_fd));
+    Util::unsetenv("UNCACHED_ERR_FD");
+  }
+
+  return hit;
+}
+#endif
+
 static Statistic
-do_cache_compilation(Context& ctx, const char* const* argv)
+do_cache_compilation(Context& ctx,
+                     const char* const* argv,
+                     optional<DirectLookup>& direct_lookup)
 {
   if (ctx.actual_cwd.empty()) {
     LOG("Unable to determine current working directory: {}", strerror(errno));
@@ -2471,13 +3274,43 @@ do_cache_compilation(Context& ctx, const char* const* argv)
   bool put_result_in_manifest = false;
   optional<Digest> result_name;
   optional<Digest> result_name_from_manifest;
-  if (ctx.config.direct_mode()) {
+  const Digest common_digest = common_hash.digest();
+  if (ctx.config.direct_mode() && direct_lookup
+      && direct_lookup->common_digest == common_digest
+      && !ctx.config.depend_mode()) {
+    // Depend mode needs the direct mode hash, so the lookup is only skipped
+    // when not in depend mode.
+    LOG_RAW("Reusing outcome of earlier direct lookup");
+    ctx.counter_updates.increment(direct_lookup->counter_updates);
+    if (!direct_lookup->direct_mode) {
+      LOG_RAW("Disabling direct mode");
+      ctx.config.set_direct_mode(false);
+    } else if (direct_lookup->manifest_name) {
+      ctx.set_manifest_name(*direct_lookup->manifest_name);
+      ctx.set_manifest_path(look_up_cache_file(ctx.config.cache_dir(),
+                                               *direct_lookup->manifest_name,
+                                               Manifest::k_file_suffix)
+                              .path);
+      result_name = direct_lookup->result_name;
+      if (result_name) {
+        ctx.set_result_name(*result_name);
+        result_name_from_manifest = result_name;
+      } else {
+        put_result_in_manifest = true;
+      }
+    }
+  } else if (ctx.config.direct_mode()) {
     LOG_RAW("Trying direct lookup");
     MTR_BEGIN("hash", "direct_hash");
     Args dummy_args;
     result_name =
       calculate_result_name(ctx, args_to_hash, dummy_args, direct_hash, true);
     MTR_END("hash", "direct_hash");
+    direct_lookup = DirectLookup();
+    direct_lookup->common_digest = common_digest;
+    direct_lookup->direct_mode = ctx.config.direct_mode();
+    direct_lookup->manifest_name = ctx.manifest_name();
+    direct_lookup->result_name = result_name;
     if (result_name) {
       ctx.set_result_name(*result_name);
 
@@ -2503,6 +3336,11 @@ do_cache_compilation(Context& ctx, const char* const* argv)
     throw Failure(Statistic::cache_miss);
   }
 
+  if (ctx.direct_lookup_only) {
+    LOG_RAW("Direct lookup only; leaving the rest to the caller");
+    throw Failure(Statistic::cache_miss);
+  }
+
   if (!ctx.config.depend_mode()) {
     // Find the hash using the preprocessed output. Also updates
     // ctx.included_files.
@@ -2571,7 +3409,11 @@ do_cache_compilation(Context& ctx, const char* const* argv)
            processed.compiler_args,
            ctx.args_info.depend_extra_args,
            depend_mode_hash);
-  update_manifest_file(ctx);
+  // The manifest doesn't need to be updated if the direct lookup found the
+  // result, e.g. in recache mode.
+  if (put_result_in_manifest) {
+    update_manifest_file(ctx);
+  }
   MTR_END("cache", "to_cache");
 
   return Statistic::cache_miss;
@@ -2582,6 +3424,7 @@ static int
 handle_main_options(int argc, const char* const* argv)
 {
   enum longopts {
+    BATCH,
     CHECKSUM_FILE,
     CONFIG_PATH,
     DUMP_MANIFEST,
@@ -2590,8 +3433,10 @@ handle_main_options(int argc, const char* const* argv)
     EXTRACT_RESULT,
     HASH_FILE,
     PRINT_STATS,
+    TRAIN_DICTIONARY,
   };
   static const struct option options[] = {
+    {"batch", required_argument, nullptr, BATCH},
     {"checksum-file", required_argument, nullptr, CHECKSUM_FILE},
     {"cleanup", no_argument, nullptr, 'c'},
     {"clear", no_argument, nullptr, 'C'},
@@ -2604,6 +3449,7 @@ handle_main_options(int argc, const char* const* argv)
     {"get-config", required_argument, nullptr, 'k'},
     {"hash-file", required_argument, nullptr, HASH_FILE},
     {"help", no_argument, nullptr, 'h'},
+    {"jobs", required_argument, nullptr, 'j'},
     {"max-files", required_argument, nullptr, 'F'},
     {"max-size", required_argument, nullptr, 'M'},
     {"print-stats", no_argument, nullptr, PRINT_STATS},
@@ -2612,6 +3458,7 @@ handle_main_options(int argc, const char* const* argv)
     {"show-compression", no_argument, nullptr, 'x'},
     {"show-config", no_argument, nullptr, 'p'},
     {"show-stats", no_argument, nullptr, 's'},
+    {"train-dictionary", no_argument, nullptr, TRAIN_DICTIONARY},
     {"version", no_argument, nullptr, 'V'},
     {"zero-stats", no_argument, nullptr, 'z'},
     {nullptr, 0, nullptr, 0}};
@@ -2619,16 +3466,23 @@ handle_main_options(int argc, const char* const* argv)
   Context ctx;
   initialize(ctx, argc, argv);
 
+  std::string batch_path;
+  unsigned jobs = std::max(1u, std::thread::hardware_concurrency());
+
   int c;
   while ((c = getopt_long(argc,
                           const_cast<char* const*>(argv),
-                          "cCd:k:hF:M:po:sVxX:z",
+                          "cCd:k:hj:F:M:po:sVxX:z",
                           options,
                           nullptr))
          != -1) {
     std::string arg = optarg ? optarg : std::string();
 
     switch (c) {
+    case BATCH:
+      batch_path = arg;
+      break;
+
     case CHECKSUM_FILE: {
       Checksum checksum;
       Fd fd(arg == "-" ? STDIN_FILENO : open(arg.c_str(), O_RDONLY));
@@ -2692,6 +3546,13 @@ handle_main_options(int argc, const char* const* argv)
       PRINT_RAW(stdout, Statistics::format_machine_readable(ctx.config));
       break;
 
+    case TRAIN_DICTIONARY: {
+      ProgressBar progress_bar("Sampling...");
+      compress_train_dictionaries(
+        ctx.config, [&](double progress) { progress_bar.update(progress); });
+      break;
+    }
+
     case 'c': // --cleanup
     {
       ProgressBar progress_bar("Cleaning...");
@@ -2721,6 +3582,11 @@ handle_main_options(int argc, const char* const* argv)
       PRINT(stdout, USAGE_TEXT, CCACHE_NAME, CCACHE_NAME);
       exit(EXIT_SUCCESS);
 
+    case 'j': // --jobs
+      jobs = static_cast<unsigned>(
+        Util::parse_unsigned(arg, 1, UINT_MAX, "number of jobs"));
+      break;
+
     case 'k': // --get-config
       PRINT(stdout, "{}\n", ctx.config.get_string_value(arg));
       break;
@@ -2817,6 +3683,54 @@ handle_main_options(int argc, const char* const* argv)
     set_up_config(ctx.config);
   }
 
+  if (!batch_path.empty()) {
+#ifdef _WIN32
+    throw Error("batch mode is not supported on Windows");
+#else
+    const auto commands =
+      Batch::parse_compile_commands(Util::read_file(batch_path));
+
+    // The child processes inherit the configuration and the cache mappings.
+    LoadedConfig loaded_config(ctx.config);
+#  ifdef INODE_CACHE_SUPPORTED
+    // Only the configured caches are mapped. Enabling a cache just for the
+    // batch would change the source file digests and thus the manifest names,
+    // so the batch would not share direct mode hits with normal invocations.
+    loaded_config.cache_mappings.inode_cache.initialize();
+    loaded_config.cache_mappings.manifest_cache.initialize();
+    loaded_config.cache_mappings.file_hash_cache.initialize();
+#  endif
+
+    return Batch::run(
+      loaded_config.config,
+      commands,
+      argv[0],
+      jobs,
+      [&](int argc, const char* const* argv, std::string& miss_state) {
+        return look_up_compilation(loaded_config, argc, argv, miss_state);
+      },
+      [&](int argc,
+          const char* const* argv,
+          const std::string& miss_state,
+          Batch::Outcome& outcome) {
+        Statistic statistic = Statistic::none;
+        const int status =
+          run_compilation(argc,
+                          argv,
+                          &loaded_config,
+                          DirectLookup::deserialize(miss_state),
+                          false,
+                          &statistic);
+        if (statistic == Statistic::direct_cache_hit) {
+          outcome = Batch::Outcome::direct_hit;
+        } else if (statistic == Statistic::preprocessed_cache_hit) {
+          outcome = Batch::Outcome::preprocessed_hit;
+        }
+        return status;
+      });
+#endif
+  }
+
   return 0;
 }
 
@@ -28,6 +28,7 @@
 
 #ifdef INODE_CACHE_SUPPORTED
 #  include "InodeCache.hpp"
+#  include "ManifestCache.hpp"
 #endif
 
 #include <algorithm>
@@ -227,5 +228,6 @@ wipe_all(const Context& ctx, const Util::ProgressReceiver& progress_receiver)
     ctx.config.cache_dir(), wipe_dir, progress_receiver);
 #ifdef INODE_CACHE_SUPPORTED
   ctx.inode_cache.drop();
+  ctx.manifest_cache.drop();
 #endif
 }
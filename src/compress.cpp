@@ -21,6 +21,7 @@
 #include "AtomicFile.hpp"
 #include "CacheEntryReader.hpp"
 #include "CacheEntryWriter.hpp"
+#include "CompressionDictionary.hpp"
 #include "Context.hpp"
 #include "File.hpp"
 #include "Logging.hpp"
@@ -35,9 +36,11 @@
 
 #include "third_party/fmt/core.h"
 
+#include <map>
 #include <string>
 #include <thread>
 
+using nonstd::nullopt;
 using nonstd::optional;
 
 namespace {
@@ -123,11 +126,11 @@ create_reader(const CacheFile& cache_file, FILE* stream)
   switch (cache_file.type()) {
   case CacheFile::Type::result:
     return std::make_unique<CacheEntryReader>(
-      stream, Result::k_magic, Result::k_version);
+      stream, Result::k_magic, Result::k_version, Result::k_min_version);
 
   case CacheFile::Type::manifest:
     return std::make_unique<CacheEntryReader>(
-      stream, Manifest::k_magic, Manifest::k_version);
+      stream, Manifest::k_magic, Manifest::k_version, Manifest::k_min_version);
 
   case CacheFile::Type::unknown:
     ASSERT(false); // Handled at function entry.
@@ -140,14 +143,127 @@ std::unique_ptr<CacheEntryWriter>
 create_writer(FILE* stream,
               const CacheEntryReader& reader,
               Compression::Type compression_type,
-              int8_t compression_level)
+              int8_t compression_level,
+              const CompressionDictionary::Dictionary* dictionary)
 {
   return std::make_unique<CacheEntryWriter>(stream,
                                             reader.magic(),
                                             reader.version(),
                                             compression_type,
                                             compression_level,
-                                            reader.payload_size());
+                                            reader.payload_size(),
+                                            dictionary);
+}
+
+// Only the start of large files is used for training dictionaries.
+const size_t k_max_sample_size = 128 * 1024;
+
+// Sampling stops when this much data has been collected for a dictionary kind.
+const size_t k_max_total_sample_size = 16 * 1024 * 1024;
+
+class DictionarySamples
+{
+public:
+  bool is_full(CompressionDictionary::Kind kind) const;
+  void add(CompressionDictionary::Kind kind, std::string sample);
+  const std::vector<std::string>& get(CompressionDictionary::Kind kind);
+
+private:
+  std::map<CompressionDictionary::Kind, std::vector<std::string>> m_samples;
+  std::map<CompressionDictionary::Kind, size_t> m_total_size;
+};
+
+bool
+DictionarySamples::is_full(CompressionDictionary::Kind kind) const
+{
+  const auto it = m_total_size.find(kind);
+  return it != m_total_size.end() && it->second >= k_max_total_sample_size;
+}
+
+void
+DictionarySamples::add(CompressionDictionary::Kind kind, std::string sample)
+{
+  m_total_size[kind] += sample.size();
+  m_samples[kind].push_back(std::move(sample));
+}
+
+const std::vector<std::string>&
+DictionarySamples::get(CompressionDictionary::Kind kind)
+{
+  return m_samples[kind];
+}
+
+// Collects the start of embedded result entries as dictionary samples.
+class ResultSampler : public Result::Reader::Consumer
+{
+public:
+  explicit ResultSampler(DictionarySamples& samples);
+
+  void on_header(CacheEntryReader& cache_entry_reader) override;
+  bool on_entry_start(uint32_t entry_number,
+                      Result::FileType file_type,
+                      uint64_t file_len,
+                      optional<std::string> raw_file) override;
+  void on_entry_data(const uint8_t* data, size_t size) override;
+  void on_entry_end() override;
+
+private:
+  DictionarySamples& m_samples;
+  optional<CompressionDictionary::Kind> m_kind;
+  std::string m_sample;
+};
+
+ResultSampler::ResultSampler(DictionarySamples& samples) : m_samples(samples)
+{
+}
+
+void
+ResultSampler::on_header(CacheEntryReader& /*cache_entry_reader*/)
+{
+}
+
+bool
+ResultSampler::on_entry_start(uint32_t /*entry_number*/,
+                              Result::FileType file_type,
+                              uint64_t /*file_len*/,
+                              optional<std::string> raw_file)
+{
+  m_kind = raw_file ? nullopt : Result::file_type_to_dictionary_kind(file_type);
+  if (m_kind && m_samples.is_full(*m_kind)) {
+    m_kind = nullopt;
+  }
+  m_sample.clear();
+  return static_cast<bool>(m_kind);
+}
+
+void
+ResultSampler::on_entry_data(const uint8_t* data, size_t size)
+{
+  const size_t n = std::min(size, k_max_sample_size - m_sample.size());
+  m_sample.append(reinterpret_cast<const char*>(data), n);
+}
+
+void
+ResultSampler::on_entry_end()
+{
+  if (m_kind) {
+    m_samples.add(*m_kind, std::move(m_sample));
+    m_kind = nullopt;
+  }
+}
+
+void
+sample_manifest(DictionarySamples& samples, const CacheFile& cache_file)
+{
+  if (samples.is_full(CompressionDictionary::Kind::manifest)) {
+    return;
+  }
+  auto file = open_file(cache_file.path(), "rb");
+  auto reader = create_reader(cache_file, file.get());
+  std::string sample(
+    std::min<uint64_t>(reader->payload_size(), k_max_sample_size), '\0');
+  reader->read(&sample[0], sample.size());
+  samples.add(CompressionDictionary::Kind::manifest, std::move(sample));
 }
 
 void
@@ -157,6 +273,11 @@ recompress_file(RecompressionStatistics& statistics,
                 optional<int8_t> level)
 {
   auto file = open_file(cache_file.path(), "rb");
+  // Journal frames of manifests are never compressed, so they are copied as is
+  // while incomplete data after them is dropped.
+  const std::string journal = cache_file.type() == CacheFile::Type::manifest
+                                ? Manifest::read_raw_journal(file.get())
+                                : std::string();
   auto reader = create_reader(cache_file, file.get());
 
   auto old_stat = Stat::stat(cache_file.path(), Stat::OnError::log);
@@ -174,22 +295,42 @@ recompress_file(RecompressionStatistics& statistics,
       cache_file.path(),
       level ? FMT("level {}", wanted_level) : "uncompressed");
   AtomicFile atomic_new_file(cache_file.path(), AtomicFile::Mode::binary);
-  auto writer =
-    create_writer(atomic_new_file.stream(),
-                  *reader,
-                  level ? Compression::Type::zstd : Compression::Type::none,
-                  wanted_level);
-
-  char buffer[READ_BUFFER_SIZE];
-  size_t bytes_left = reader->payload_size();
-  while (bytes_left > 0) {
-    size_t bytes_to_read = std::min(bytes_left, sizeof(buffer));
-    reader->read(buffer, bytes_to_read);
-    writer->write(buffer, bytes_to_read);
-    bytes_left -= bytes_to_read;
+  const auto compression_type =
+    level ? Compression::Type::zstd : Compression::Type::none;
+
+  if (cache_file.type() == CacheFile::Type::result && reader->version() >= 2) {
+    // Entries of results are compressed separately, so each one is
+    // recompressed on its own.
+    Result::recompress(
+      file.get(), atomic_new_file.stream(), compression_type, wanted_level);
+  } else {
+    const auto dictionary =
+      cache_file.type() == CacheFile::Type::manifest
+        ? CompressionDictionary::get_for_kind(
+          CompressionDictionary::Kind::manifest)
+        : nullptr;
+    auto writer = create_writer(atomic_new_file.stream(),
+                                *reader,
+                                compression_type,
+                                wanted_level,
+                                dictionary.get());
+
+    char buffer[READ_BUFFER_SIZE];
+    size_t bytes_left = reader->payload_size();
+    while (bytes_left > 0) {
+      size_t bytes_to_read = std::min(bytes_left, sizeof(buffer));
+      reader->read(buffer, bytes_to_read);
+      writer->write(buffer, bytes_to_read);
+      bytes_left -= bytes_to_read;
+    }
+    reader->finalize(cache_file.type() == CacheFile::Type::manifest
+                       ? CacheEntryReader::TrailingData::allowed
+                       : CacheEntryReader::TrailingData::forbidden);
+    writer->finalize();
+    if (!journal.empty()) {
+      atomic_new_file.write(journal);
+    }
   }
-  reader->finalize();
-  writer->finalize();
 
   file.close();
 
@@ -370,3 +511,60 @@ compress_recompress(Context& ctx,
         new_savings);
   PRINT(stdout, "Size change:          {:>9s}\n", size_difference_str);
 }
+
+void
+compress_train_dictionaries(const Config& config,
+                            const Util::ProgressReceiver& progress_receiver)
+{
+  DictionarySamples samples;
+
+  Util::for_each_level_1_subdir(
+    config.cache_dir(),
+    [&](const std::string& subdir,
+        const Util::ProgressReceiver& sub_progress_receiver) {
+      const std::vector<CacheFile> files = Util::get_level_1_files(
+        subdir, [&](double progress) { sub_progress_receiver(progress / 2); });
+
+      for (size_t i = 0; i < files.size(); ++i) {
+        const auto& cache_file = files[i];
+        try {
+          if (cache_file.type() == CacheFile::Type::manifest) {
+            sample_manifest(samples, cache_file);
+          } else if (cache_file.type() == CacheFile::Type::result) {
+            ResultSampler result_sampler(samples);
+            Result::Reader(cache_file.path()).read(result_sampler);
+          }
+        } catch (Error&) {
+          // Ignore for now.
+        }
+
+        sub_progress_receiver(1.0 / 2 + 1.0 * i / files.size() / 2);
+      }
+    },
+    progress_receiver);
+
+  if (isatty(STDOUT_FILENO)) {
+    PRINT_RAW(stdout, "\n\n");
+  }
+
+  for (const auto kind : {CompressionDictionary::Kind::manifest,
+                          CompressionDictionary::Kind::object,
+                          CompressionDictionary::Kind::dependency,
+                          CompressionDictionary::Kind::stderr_output}) {
+    const auto& kind_samples = samples.get(kind);
+    const auto dictionary = CompressionDictionary::train(kind, kind_samples);
+    if (dictionary) {
+      PRINT(stdout,
+            "Trained {} dictionary {:08x} ({}) from {} samples\n",
+            CompressionDictionary::kind_to_string(kind),
+            dictionary->id(),
+            Util::format_human_readable_size(dictionary->content().size()),
+            kind_samples.size());
+    } else {
+      PRINT(stdout,
+            "Not enough data to train a {} dictionary ({} samples)\n",
+            CompressionDictionary::kind_to_string(kind),
+            kind_samples.size());
+    }
+  }
+}
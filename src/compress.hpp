@@ -40,3 +40,13 @@ void compress_stats(const Config& config,
 void compress_recompress(Context& ctx,
                          nonstd::optional<int8_t> level,
                          const Util::ProgressReceiver& progress_receiver);
+
+// Train compression dictionaries on samples of the cache content and store
+// them in the cache directory. Only data compressed after the training uses
+// the dictionaries.
+//
+// Arguments:
+// - config: The configuration.
+// - progress_receiver: Function that will be called for progress updates.
+void compress_train_dictionaries(
+  const Config& config, const Util::ProgressReceiver& progress_receiver);
@@ -179,6 +179,33 @@ win32execute(const char* path,
 
 #else
 
+// Wait for the compiler process started by execute or execute_with_pipe to
+// exit and return its exit status.
+static int
+wait_for_compiler(Context& ctx)
+{
+  int status;
+  int result;
+
+  while ((result = waitpid(ctx.compiler_pid, &status, 0)) != ctx.compiler_pid) {
+    if (result == -1 && errno == EINTR) {
+      continue;
+    }
+    throw Fatal("waitpid failed: {}", strerror(errno));
+  }
+
+  {
+    SignalHandlerBlocker signal_handler_blocker;
+    ctx.compiler_pid = 0;
+  }
+
+  if (WEXITSTATUS(status) == 0 && WIFSIGNALED(status)) {
+    return -1;
+  }
+
+  return WEXITSTATUS(status);
+}
+
 // Execute a compiler backend, capturing all output to the given paths the full
 // path to the compiler to run is in argv[0].
 int
@@ -207,26 +234,70 @@ execute(Context& ctx, const char* const* argv, Fd&& fd_out, Fd&& fd_err)
   fd_out.close();
   fd_err.close();
 
-  int status;
-  int result;
+  return wait_for_compiler(ctx);
+}
 
-  while ((result = waitpid(ctx.compiler_pid, &status, 0)) != ctx.compiler_pid) {
-    if (result == -1 && errno == EINTR) {
-      continue;
-    }
-    throw Fatal("waitpid failed: {}", strerror(errno));
+int
+execute_with_pipe(Context& ctx,
+                  const char* const* argv,
+                  Fd&& fd_err,
+                  const OutputHandler& output_handler)
+{
+  LOG("Executing {}", Util::format_argv_for_logging(argv));
+
+  int pipe_fds[2];
+  if (pipe(pipe_fds) != 0) {
+    throw Fatal("Failed to create pipe: {}", strerror(errno));
   }
+  Fd read_fd(pipe_fds[0]);
+  Fd write_fd(pipe_fds[1]);
 
   {
     SignalHandlerBlocker signal_handler_blocker;
-    ctx.compiler_pid = 0;
+    ctx.compiler_pid = fork();
   }
 
-  if (WEXITSTATUS(status) == 0 && WIFSIGNALED(status)) {
-    return -1;
+  if (ctx.compiler_pid == -1) {
+    throw Fatal("Failed to fork: {}", strerror(errno));
   }
 
-  return WEXITSTATUS(status);
+  if (ctx.compiler_pid == 0) {
+    // Child.
+    read_fd.close();
+    dup2(*write_fd, STDOUT_FILENO);
+    write_fd.close();
+    dup2(*fd_err, STDERR_FILENO);
+    fd_err.close();
+    exit(execv(argv[0], const_cast<char* const*>(argv)));
+  }
+
+  write_fd.close();
+  fd_err.close();
+
+  try {
+    char buffer[READ_BUFFER_SIZE];
+    while (true) {
+      const ssize_t n = read(*read_fd, buffer, sizeof(buffer));
+      if (n == -1 && errno == EINTR) {
+        continue;
+      }
+      if (n == -1) {
+        throw Fatal("Failed to read from pipe: {}", strerror(errno));
+      }
+      if (n == 0) {
+        break;
+      }
+      output_handler(nonstd::string_view(buffer, n));
+    }
+  } catch (...) {
+    // Closing the pipe makes the compiler fail if it's still writing.
+    read_fd.close();
+    wait_for_compiler(ctx);
+    throw;
+  }
+
+  read_fd.close();
+  return wait_for_compiler(ctx);
 }
 
 void
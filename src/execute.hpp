@@ -22,12 +22,29 @@
 
 #include "Fd.hpp"
 
+#include "third_party/nonstd/string_view.hpp"
+
+#include <functional>
 #include <string>
 
 class Context;
 
 int execute(Context& ctx, const char* const* argv, Fd&& fd_out, Fd&& fd_err);
 
+#ifndef _WIN32
+using OutputHandler = std::function<void(nonstd::string_view data)>;
+
+// Like execute() but with standard output connected to a pipe. Data is passed
+// to `output_handler` as soon as it has been read from the pipe, so the
+// output can be processed while the command is still running. If
+// `output_handler` throws, the pipe is closed and the command is waited for
+// before the exception is propagated.
+int execute_with_pipe(Context& ctx,
+                      const char* const* argv,
+                      Fd&& fd_err,
+                      const OutputHandler& output_handler);
+#endif
+
 void execute_noreturn(const char* const* argv, const std::string& temp_dir);
 
 // Find an executable named `name` in `$PATH`. Exclude any executables that are
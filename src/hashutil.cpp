@@ -21,6 +21,7 @@
 #include "Args.hpp"
 #include "Config.hpp"
 #include "Context.hpp"
+#include "Fd.hpp"
 #include "Hash.hpp"
 #include "Logging.hpp"
 #include "Sloppiness.hpp"
@@ -30,8 +31,10 @@
 #include "macroskip.hpp"
 
 #include "third_party/blake3/blake3_cpu_supports_avx2.h"
+#include "third_party/nonstd/optional.hpp"
 
 #ifdef INODE_CACHE_SUPPORTED
+#  include "FileHashCache.hpp"
 #  include "InodeCache.hpp"
 #endif
 
@@ -43,6 +46,12 @@
 #  include <immintrin.h>
 #endif
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
+using nonstd::nullopt;
+using nonstd::optional;
 using nonstd::string_view;
 
 namespace {
@@ -84,15 +93,17 @@ check_for_temporal_macros_helper(string_view str, size_t pos)
   return 0;
 }
 
+// Like check_for_temporal_macros but only considers macros starting at or
+// after `start`.
 int
-check_for_temporal_macros_bmh(string_view str)
+check_for_temporal_macros_bmh(string_view str, size_t start = 0)
 {
   int result = 0;
 
   // We're using the Boyer-Moore-Horspool algorithm, which searches starting
   // from the *end* of the needle. Our needles are 8 characters long, so i
-  // starts at 7.
-  size_t i = 7;
+  // starts at start + 7.
+  size_t i = start + 7;
 
   while (i < str.length()) {
     // Check whether the substring ending at str[i] has the form "_....E..". On
@@ -157,81 +168,160 @@ check_for_temporal_macros_avx2(string_view str)
     }
   }
 
-  result |= check_for_temporal_macros_bmh(str.substr(pos));
+  // Scan the rest of the string without cutting it so that the character
+  // before a macro at `pos` is still checked.
+  result |= check_for_temporal_macros_bmh(str, pos);
 
   return result;
 }
 #endif
 
-int
-hash_source_code_file_nocache(const Context& ctx,
-                              Hash& hash,
-                              const std::string& path,
-                              size_t size_hint,
-                              bool is_precompiled)
+// Returns true if `str[pos]` could be the start of a linemarker, an .incbin
+// directive or (if `pump` is true) a distcc-pump output line.
+bool
+is_preprocessor_marker_candidate(string_view str, size_t pos, bool pump)
 {
-  if (is_precompiled) {
-    if (hash.hash_file(path)) {
-      return HASH_SOURCE_CODE_OK;
-    } else {
-      return HASH_SOURCE_CODE_ERROR;
-    }
-  } else {
-    std::string data;
-    try {
-      data = Util::read_file(path, size_hint);
-    } catch (Error&) {
-      return HASH_SOURCE_CODE_ERROR;
+  switch (str[pos]) {
+  case '#':
+    return pos == 0 || str[pos - 1] == '\n';
+  case '.':
+    return pos + 6 < str.length() && str[pos + 6] == 'n';
+  case '_':
+    return pump && pos + 8 < str.length() && str[pos + 8] == '_';
+  default:
+    return false;
+  }
+}
+
+size_t
+find_preprocessor_marker_scalar(string_view str, size_t pos, bool pump)
+{
+  for (; pos < str.length(); ++pos) {
+    if (is_preprocessor_marker_candidate(str, pos, pump)) {
+      return pos;
     }
-    int result = hash_source_code_string(ctx, hash, data, path);
-    return result;
   }
+  return str.length();
 }
 
-#ifdef INODE_CACHE_SUPPORTED
-InodeCache::ContentType
-get_content_type(const Config& config, const std::string& path)
+#ifdef __SSE2__
+// Like the AVX2 version below but with 16 byte blocks. SSE2 is always
+// available on x86-64.
+size_t
+find_preprocessor_marker_sse2(string_view str, size_t pos, bool pump)
 {
-  if (Util::is_precompiled_header(path)) {
-    return InodeCache::ContentType::precompiled_header;
+  if (pos == 0) {
+    if (!str.empty() && is_preprocessor_marker_candidate(str, 0, pump)) {
+      return 0;
+    }
+    pos = 1;
   }
-  if (config.sloppiness() & SLOPPY_TIME_MACROS) {
-    return InodeCache::ContentType::code_with_sloppy_time_macros;
+
+  const __m128i hash_sign = _mm_set1_epi8('#');
+  const __m128i newline = _mm_set1_epi8('\n');
+  const __m128i dot = _mm_set1_epi8('.');
+  const __m128i n = _mm_set1_epi8('n');
+  const __m128i underscore = _mm_set1_epi8('_');
+
+  for (; pos + 8 + 16 <= str.length(); pos += 16) {
+    const char* const block = &str[pos];
+    const __m128i current =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    const __m128i previous =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(block - 1));
+    const __m128i plus_6 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 6));
+    const __m128i plus_8 =
+      _mm_loadu_si128(reinterpret_cast<const __m128i*>(block + 8));
+
+    const __m128i linemarker = _mm_and_si128(
+      _mm_cmpeq_epi8(current, hash_sign), _mm_cmpeq_epi8(previous, newline));
+    const __m128i incbin =
+      _mm_and_si128(_mm_cmpeq_epi8(current, dot), _mm_cmpeq_epi8(plus_6, n));
+    __m128i candidates = _mm_or_si128(linemarker, incbin);
+    if (pump) {
+      candidates = _mm_or_si128(
+        candidates,
+        _mm_and_si128(_mm_cmpeq_epi8(current, underscore),
+                      _mm_cmpeq_epi8(plus_8, underscore)));
+    }
+
+    const uint32_t mask = _mm_movemask_epi8(candidates);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
   }
-  return InodeCache::ContentType::code;
+
+  return find_preprocessor_marker_scalar(str, pos, pump);
 }
 #endif
 
-} // namespace
+#ifdef HAVE_AVX2
+size_t find_preprocessor_marker_avx2(string_view str, size_t pos, bool pump)
+  __attribute__((target("avx2")));
 
-int
-check_for_temporal_macros(string_view str)
+// Compares 32 byte blocks at offsets -1, 0, 6 and 8 from the current position
+// against the characters that identify each kind of marker, in the same
+// spirit as check_for_temporal_macros_avx2.
+size_t
+find_preprocessor_marker_avx2(string_view str, size_t pos, bool pump)
 {
-#ifdef HAVE_AVX2
-  if (blake3_cpu_supports_avx2()) {
-    return check_for_temporal_macros_avx2(str);
+  if (pos == 0) {
+    if (!str.empty() && is_preprocessor_marker_candidate(str, 0, pump)) {
+      return 0;
+    }
+    pos = 1;
   }
-#endif
-  return check_for_temporal_macros_bmh(str);
-}
 
-int
-hash_source_code_string(const Context& ctx,
-                        Hash& hash,
-                        string_view str,
-                        const std::string& path)
-{
-  int result = HASH_SOURCE_CODE_OK;
+  const __m256i hash_sign = _mm256_set1_epi8('#');
+  const __m256i newline = _mm256_set1_epi8('\n');
+  const __m256i dot = _mm256_set1_epi8('.');
+  const __m256i n = _mm256_set1_epi8('n');
+  const __m256i underscore = _mm256_set1_epi8('_');
+
+  for (; pos + 8 + 32 <= str.length(); pos += 32) {
+    const char* const block = &str[pos];
+    const __m256i current =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block));
+    const __m256i previous =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block - 1));
+    const __m256i plus_6 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 6));
+    const __m256i plus_8 =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(block + 8));
+
+    // For i in 0..31: linemarker[i] = 0xFF if block[i] == '#' and
+    // block[i - 1] == '\n', and similarly for the other markers.
+    const __m256i linemarker =
+      _mm256_and_si256(_mm256_cmpeq_epi8(current, hash_sign),
+                       _mm256_cmpeq_epi8(previous, newline));
+    const __m256i incbin = _mm256_and_si256(_mm256_cmpeq_epi8(current, dot),
+                                            _mm256_cmpeq_epi8(plus_6, n));
+    __m256i candidates = _mm256_or_si256(linemarker, incbin);
+    if (pump) {
+      candidates = _mm256_or_si256(
+        candidates,
+        _mm256_and_si256(_mm256_cmpeq_epi8(current, underscore),
+                         _mm256_cmpeq_epi8(plus_8, underscore)));
+    }
 
-  // Check for __DATE__, __TIME__ and __TIMESTAMP__if the sloppiness
-  // configuration tells us we should.
-  if (!(ctx.config.sloppiness() & SLOPPY_TIME_MACROS)) {
-    result |= check_for_temporal_macros(str);
+    const uint32_t mask = _mm256_movemask_epi8(candidates);
+    if (mask != 0) {
+      return pos + __builtin_ctz(mask);
+    }
   }
 
-  // Hash the source string.
-  hash.hash(str);
+  return find_preprocessor_marker_scalar(str, pos, pump);
+}
+#endif
 
+// Hashes the (potential) expansions of the temporal macros found in `path`
+// according to `result`, a bitmask from check_for_temporal_macros().
+//
+// Returns `result` or HASH_SOURCE_CODE_ERROR.
+int
+hash_temporal_macro_expansions(Hash& hash, int result, const std::string& path)
+{
   if (result & HASH_SOURCE_CODE_FOUND_DATE) {
     LOG("Found __DATE__ in {}", path);
 
@@ -294,40 +384,275 @@ hash_source_code_string(const Context& ctx,
   return result;
 }
 
+// Length of the longest temporal macro, "__TIMESTAMP__".
+const size_t k_max_temporal_macro_length = 13;
+
+bool
+is_identifier_char(char ch)
+{
+  return ch == '_' || isalnum(static_cast<unsigned char>(ch));
+}
+
+// Searches for temporal macros in data that is supplied in consecutive blocks.
+// A temporal macro only matches a whole identifier, so each block is scanned
+// up to the start of its trailing identifier, which is instead scanned together
+// with the next block.
+class TemporalMacroScanner
+{
+public:
+  // Scans `data`. If `last` is false, the trailing identifier in `data` may be
+  // continued by the next block and is left unscanned unless it is too long to
+  // be a temporal macro.
+  //
+  // Returns the number of bytes consumed. Remaining bytes must be passed first
+  // in `data` to the next call.
+  size_t scan(string_view data, bool last);
+
+  // Returns a bitmask of HASH_SOURCE_CODE_FOUND_* for the data scanned so far.
+  int result() const;
+
+private:
+  int m_result = 0;
+
+  // True if the previous block ended with an identifier that is too long to be
+  // a temporal macro.
+  bool m_in_long_identifier = false;
+};
+
+size_t
+TemporalMacroScanner::scan(string_view data, bool last)
+{
+  size_t begin = 0;
+  if (m_in_long_identifier) {
+    while (begin < data.length() && is_identifier_char(data[begin])) {
+      ++begin;
+    }
+    if (begin == data.length()) {
+      return begin;
+    }
+    m_in_long_identifier = false;
+  }
+
+  size_t end = data.length();
+  if (!last) {
+    size_t length = 0;
+    while (length <= k_max_temporal_macro_length && end - length > begin
+           && is_identifier_char(data[end - length - 1])) {
+      ++length;
+    }
+    if (length > k_max_temporal_macro_length) {
+      // Any macro found at the end of the block will be rejected since it is
+      // preceded by an identifier character, so it's safe to scan everything.
+      m_in_long_identifier = true;
+    } else {
+      end -= length;
+    }
+  }
+
+  m_result |= check_for_temporal_macros(data.substr(begin, end - begin));
+  return m_in_long_identifier ? data.length() : end;
+}
+
+inline int
+TemporalMacroScanner::result() const
+{
+  return m_result;
+}
+
+// Reads, scans and hashes the file in blocks that fit in the CPU cache, so that
+// the file only has to pass through memory once.
 int
-hash_source_code_file(const Context& ctx,
-                      Hash& hash,
-                      const std::string& path,
-                      size_t size_hint)
+hash_source_code_file_nocache(const Context& ctx,
+                              Hash& hash,
+                              const std::string& path,
+                              bool is_precompiled)
 {
-#ifdef INODE_CACHE_SUPPORTED
-  if (!ctx.config.inode_cache()) {
-#endif
-    return hash_source_code_file_nocache(
-      ctx, hash, path, size_hint, Util::is_precompiled_header(path));
+  if (is_precompiled) {
+    if (hash.hash_file(path)) {
+      return HASH_SOURCE_CODE_OK;
+    } else {
+      return HASH_SOURCE_CODE_ERROR;
+    }
+  }
+
+  Fd fd(open(path.c_str(), O_RDONLY | O_BINARY));
+  if (!fd) {
+    LOG("Failed to open {}: {}", path, strerror(errno));
+    return HASH_SOURCE_CODE_ERROR;
+  }
+
+  // Check for __DATE__, __TIME__ and __TIMESTAMP__ if the sloppiness
+  // configuration tells us we should.
+  const bool check_temporal_macros =
+    !(ctx.config.sloppiness() & SLOPPY_TIME_MACROS);
+  TemporalMacroScanner scanner;
+
+  // Room for the unscanned end of the previous block plus a new block.
+  char buffer[k_max_temporal_macro_length + READ_BUFFER_SIZE];
+  size_t carry = 0;
+  while (true) {
+    const ssize_t n = read(*fd, buffer + carry, READ_BUFFER_SIZE);
+    if (n == -1) {
+      if (errno == EINTR) {
+        continue;
+      }
+      LOG("Failed reading {}: {}", path, strerror(errno));
+      return HASH_SOURCE_CODE_ERROR;
+    }
+    if (n > 0) {
+      hash.hash(buffer + carry, n);
+    }
+    if (check_temporal_macros) {
+      const string_view data(buffer, carry + n);
+      const size_t consumed = scanner.scan(data, n == 0);
+      carry = data.length() - consumed;
+      memmove(buffer, buffer + consumed, carry);
+    }
+    if (n == 0) {
+      break;
+    }
+  }
+
+  return hash_temporal_macro_expansions(hash, scanner.result(), path);
+}
 
 #ifdef INODE_CACHE_SUPPORTED
+InodeCache::ContentType
+get_content_type(const Config& config, const std::string& path)
+{
+  if (Util::is_precompiled_header(path)) {
+    return InodeCache::ContentType::precompiled_header;
+  }
+  if (config.sloppiness() & SLOPPY_TIME_MACROS) {
+    return InodeCache::ContentType::code_with_sloppy_time_macros;
   }
+  return InodeCache::ContentType::code;
+}
 
-  // Reusable file hashes must be independent of the outer context. Thus hash
-  // files separately so that digests based on file contents can be reused. Then
-  // add the digest into the outer hash instead.
-  InodeCache::ContentType content_type = get_content_type(ctx.config, path);
-  Digest digest;
+// Hash the file at `path` separately and store the digest in `digest`,
+// consulting the file hash cache and the inode cache if enabled. Returns the
+// return value of hash_source_code_file_nocache.
+int
+hash_source_code_file_digest(const Context& ctx,
+                             const std::string& path,
+                             InodeCache::ContentType content_type,
+                             Digest& digest)
+{
   int return_value;
-  if (!ctx.inode_cache.get(path, content_type, digest, &return_value)) {
+
+  optional<Digest> key;
+  if (ctx.config.file_hash_cache()) {
+    const auto st = Stat::stat(path);
+    if (st) {
+      key = FileHashCache::get_key(path, st, content_type);
+      if (ctx.file_hash_cache.get(*key, digest, return_value)) {
+        return return_value;
+      }
+      if (!ctx.file_hash_cache.is_stable(st)) {
+        key = nullopt;
+      }
+    }
+  }
+
+  if (!ctx.config.inode_cache()
+      || !ctx.inode_cache.get(path, content_type, digest, &return_value)) {
     Hash file_hash;
     return_value = hash_source_code_file_nocache(
       ctx,
       file_hash,
       path,
-      size_hint,
       content_type == InodeCache::ContentType::precompiled_header);
     if (return_value == HASH_SOURCE_CODE_ERROR) {
       return HASH_SOURCE_CODE_ERROR;
     }
     digest = file_hash.digest();
-    ctx.inode_cache.put(path, content_type, digest, return_value);
+    if (ctx.config.inode_cache()) {
+      ctx.inode_cache.put(path, content_type, digest, return_value);
+    }
+  }
+
+  // Don't store the digest if the file was changed while being hashed.
+  if (key) {
+    const auto st = Stat::stat(path);
+    if (st && FileHashCache::get_key(path, st, content_type) == *key) {
+      ctx.file_hash_cache.put(*key, digest, return_value);
+    }
+  }
+
+  return return_value;
+}
+#endif
+
+} // namespace
+
+int
+check_for_temporal_macros(string_view str)
+{
+#ifdef HAVE_AVX2
+  if (blake3_cpu_supports_avx2()) {
+    return check_for_temporal_macros_avx2(str);
+  }
+#endif
+  return check_for_temporal_macros_bmh(str);
+}
+
+size_t
+find_preprocessor_marker(string_view str, size_t pos, bool pump)
+{
+#ifdef HAVE_AVX2
+  static const bool use_avx2 = blake3_cpu_supports_avx2();
+  if (use_avx2) {
+    return find_preprocessor_marker_avx2(str, pos, pump);
+  }
+#endif
+#ifdef __SSE2__
+  return find_preprocessor_marker_sse2(str, pos, pump);
+#else
+  return find_preprocessor_marker_scalar(str, pos, pump);
+#endif
+}
+
+int
+hash_source_code_string(const Context& ctx,
+                        Hash& hash,
+                        string_view str,
+                        const std::string& path)
+{
+  int result = HASH_SOURCE_CODE_OK;
+
+  // Check for __DATE__, __TIME__ and __TIMESTAMP__if the sloppiness
+  // configuration tells us we should.
+  if (!(ctx.config.sloppiness() & SLOPPY_TIME_MACROS)) {
+    result |= check_for_temporal_macros(str);
+  }
+
+  // Hash the source string.
+  hash.hash(str);
+  return hash_temporal_macro_expansions(hash, result, path);
+}
+
+int
+hash_source_code_file(const Context& ctx,
+                      Hash& hash,
+                      const std::string& path)
+{
+#ifdef INODE_CACHE_SUPPORTED
+  if (!ctx.config.inode_cache() && !ctx.config.file_hash_cache()) {
+#endif
+    return hash_source_code_file_nocache(
+      ctx, hash, path, Util::is_precompiled_header(path));
+
+#ifdef INODE_CACHE_SUPPORTED
+  }
+
+  // Reusable file hashes must be independent of the outer context. Thus hash
+  // files separately so that digests based on file contents can be reused. Then
+  // add the digest into the outer hash instead.
+  Digest digest;
+  const int return_value = hash_source_code_file_digest(
+    ctx, path, get_content_type(ctx.config, path), digest);
+  if (return_value == HASH_SOURCE_CODE_ERROR) {
+    return HASH_SOURCE_CODE_ERROR;
   }
   hash.hash(digest.bytes(), Digest::size(), Hash::HashType::binary);
   return return_value;
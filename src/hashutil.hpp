@@ -42,6 +42,16 @@ const int HASH_SOURCE_CODE_FOUND_TIMESTAMP = (1 << 3);
 // appropriately.
 int check_for_temporal_macros(nonstd::string_view str);
 
+// Search for the next position in preprocessor output `str`, starting at `pos`,
+// that could be the start of a linemarker ('#' at the beginning of a line), an
+// .incbin directive or, if `pump` is true, a distcc-pump output line. Uses
+// SIMD instructions when available. The returned position is only a candidate
+// that the caller has to verify.
+//
+// Returns the position of the candidate or `str.length()` if there is none.
+size_t
+find_preprocessor_marker(nonstd::string_view str, size_t pos, bool pump);
+
 // Hash a string. Returns a bitmask of HASH_SOURCE_CODE_* results.
 int hash_source_code_string(const Context& ctx,
                             Hash& hash,
@@ -52,8 +62,7 @@ int hash_source_code_string(const Context& ctx,
 // results.
 int hash_source_code_file(const Context& ctx,
                           Hash& hash,
-                          const std::string& path,
-                          size_t size_hint = 0);
+                          const std::string& path);
 
 // Hash a binary file using the inode cache if enabled.
 //
@@ -0,0 +1,41 @@
+// This file is a ccache modification to BLAKE3
+
+#include "blake3.c"
+
+#include "blake3_subtree_ccache.h"
+
+uint64_t blake3_hasher_count(const blake3_hasher *self) {
+  return self->chunk.chunk_counter * BLAKE3_CHUNK_LEN +
+         chunk_state_len(&self->chunk);
+}
+
+void blake3_hasher_compress_subtree(const blake3_hasher *self,
+                                    const void *input, size_t input_len,
+                                    uint64_t offset,
+                                    uint8_t out[2 * BLAKE3_OUT_LEN]) {
+  compress_subtree_to_parent_node((const uint8_t *)input, input_len,
+                                  self->key, offset / BLAKE3_CHUNK_LEN,
+                                  self->chunk.flags, out);
+}
+
+void blake3_hasher_push_subtree(blake3_hasher *self,
+                                const uint8_t cvs[2 * BLAKE3_OUT_LEN],
+                                size_t input_len) {
+  // A full chunk is kept in the chunk state until more input arrives, just
+  // like in blake3_hasher_update.
+  if (chunk_state_len(&self->chunk) == BLAKE3_CHUNK_LEN) {
+    output_t output = chunk_state_output(&self->chunk);
+    uint8_t chunk_cv[BLAKE3_OUT_LEN];
+    output_chaining_value(&output, chunk_cv);
+    hasher_push_cv(self, chunk_cv, self->chunk.chunk_counter);
+    chunk_state_reset(&self->chunk, self->key, self->chunk.chunk_counter + 1);
+  }
+
+  uint8_t cv[BLAKE3_OUT_LEN];
+  uint64_t subtree_chunks = input_len / BLAKE3_CHUNK_LEN;
+  memcpy(cv, cvs, BLAKE3_OUT_LEN);
+  hasher_push_cv(self, cv, self->chunk.chunk_counter);
+  memcpy(cv, &cvs[BLAKE3_OUT_LEN], BLAKE3_OUT_LEN);
+  hasher_push_cv(self, cv, self->chunk.chunk_counter + subtree_chunks / 2);
+  self->chunk.chunk_counter += subtree_chunks;
+}
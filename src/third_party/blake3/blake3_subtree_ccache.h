@@ -0,0 +1,35 @@
+#ifndef BLAKE3_SUBTREE_CCACHE_H
+#define BLAKE3_SUBTREE_CCACHE_H
+
+// This file is a ccache modification to BLAKE3
+
+#include "blake3.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Returns the number of bytes added to `self` so far.
+uint64_t blake3_hasher_count(const blake3_hasher *self);
+
+// Compresses a complete subtree into the chaining values of its two children.
+// `input_len` must be a power of 2 multiple (at least 2) of BLAKE3_CHUNK_LEN
+// and `offset`, the position of `input` in the hashed message, must be a
+// multiple of `input_len`. `self` is not modified, so subtrees can be
+// compressed concurrently by several threads.
+void blake3_hasher_compress_subtree(const blake3_hasher *self,
+                                    const void *input, size_t input_len,
+                                    uint64_t offset,
+                                    uint8_t out[2 * BLAKE3_OUT_LEN]);
+
+// Adds a subtree compressed by blake3_hasher_compress_subtree to `self`. The
+// bytes hashed so far must be exactly those preceding the subtree.
+void blake3_hasher_push_subtree(blake3_hasher *self,
+                                const uint8_t cvs[2 * BLAKE3_OUT_LEN],
+                                size_t input_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -333,6 +333,134 @@ fi
     expect_stat 'cache miss' 2
     expect_stat 'files in cache' 1
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_RETRIEVE_THREADS"
+
+    echo '#warning This triggers a compiler warning' >stderr.c
+    $REAL_COMPILER -c -MD stderr.c 2>reference_stderr.txt
+    mv stderr.o reference_stderr.o
+    mv stderr.d reference_stderr.d
+
+    for compression in zstd none; do
+        rm -rf $CCACHE_DIR stderr.o stderr.d
+        if [ $compression = none ]; then
+            export CCACHE_NOCOMPRESS=1
+        fi
+
+        CCACHE_RETRIEVE_THREADS=4 $CCACHE_COMPILE -c -MD stderr.c 2>stderr.txt
+        expect_stat 'cache hit (preprocessed)' 0
+        expect_stat 'cache miss' 1
+
+        rm stderr.o stderr.d
+        CCACHE_RETRIEVE_THREADS=4 $CCACHE_COMPILE -c -MD stderr.c 2>stderr.txt
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 1
+        expect_equal_object_files reference_stderr.o stderr.o
+        expect_equal_content reference_stderr.d stderr.d
+        expect_equal_text_content reference_stderr.txt stderr.txt
+
+        # Corrupt the object file data, which is written by a worker thread.
+        # The entry table follows the 15 byte header and the entry count. Each
+        # 26 byte table entry holds the file type at offset 1 and the data
+        # length at offset 10. The entry data follows the table and its 8 byte
+        # checksum in table order.
+        result_file=$(find $CCACHE_DIR -name '*R')
+        n_entries=$(od -An -tu1 -j15 -N1 $result_file)
+        offset=$((15 + 1 + n_entries * 26 + 8))
+        for i in $(seq 0 $((n_entries - 1))); do
+            entry=$((15 + 1 + i * 26))
+            data_len=0
+            for byte in $(od -An -tu1 -j$((entry + 10)) -N8 $result_file); do
+                data_len=$((data_len * 256 + byte))
+            done
+            if [ $(od -An -tu1 -j$((entry + 1)) -N1 $result_file) -eq 0 ]; then
+                break
+            fi
+            offset=$((offset + data_len))
+        done
+        printf foo | dd of=$result_file bs=1 count=3 seek=$((offset + data_len / 2)) conv=notrunc >&/dev/null
+
+        CCACHE_RETRIEVE_THREADS=4 CCACHE_DEBUG=1 $CCACHE_COMPILE -c -MD stderr.c 2>stderr.txt
+        expect_stat 'cache hit (preprocessed)' 1
+        expect_stat 'cache miss' 2
+        expect_equal_object_files reference_stderr.o stderr.o
+        if ! grep -q 'Failed to get result from cache: Failed to write to stderr.o' stderr.o.ccache-log; then
+            test_failed "Corrupt object file data was not detected"
+        fi
+        rm stderr.o.ccache-*
+    done
+    unset CCACHE_NOCOMPRESS
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_ASYNCSTORE"
+
+    echo '#warning This triggers a compiler warning' >stderr.c
+    $REAL_COMPILER -c stderr.c 2>reference_stderr.txt
+    mv stderr.o reference_stderr.o
+
+    CCACHE_ASYNCSTORE=1 $CCACHE_COMPILE -c stderr.c 2>stderr.txt
+    expect_equal_object_files reference_stderr.o stderr.o
+    expect_equal_text_content reference_stderr.txt stderr.txt
+
+    # The statistics are updated last by the background process.
+    for i in $(seq 100); do
+        if $CCACHE --print-stats | grep -q '^cache_miss[[:space:]]1$'; then
+            break
+        fi
+        sleep 0.1
+    done
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'files in cache' 1
+
+    rm stderr.o
+    CCACHE_ASYNCSTORE=1 $CCACHE_COMPILE -c stderr.c 2>stderr.txt
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_equal_object_files reference_stderr.o stderr.o
+    expect_equal_text_content reference_stderr.txt stderr.txt
+
+    # -------------------------------------------------------------------------
+    TEST "--train-dictionary"
+
+    unset CCACHE_NODIRECT
+    for i in $(seq 40); do
+        cat <<EOF >train$i.c
+int function_a_$i(int x) { return x * $i + 1; }
+int function_b_$i(int x) { return function_a_$i(x) - $i; }
+EOF
+        $CCACHE_COMPILE -c -MD train$i.c
+    done
+    expect_stat 'cache miss' 40
+
+    $CCACHE --train-dictionary >train.txt
+    expect_contains train.txt "Trained object dictionary"
+    expect_contains train.txt "Not enough data to train a stderr dictionary"
+    expect_exists $CCACHE_DIR/dictionaries/object.zdict
+
+    echo 'int test_dictionary(void) { return 17; }' >test_dictionary.c
+    $REAL_COMPILER -c -MD test_dictionary.c
+    mv test_dictionary.o reference_test_dictionary.o
+    mv test_dictionary.d reference_test_dictionary.d
+
+    $CCACHE_COMPILE -c -MD test_dictionary.c
+    expect_stat 'cache miss' 41
+    expect_contains $CCACHE_LOGFILE "Using compression dictionary"
+
+    rm test_dictionary.o test_dictionary.d
+    $CCACHE_COMPILE -c -MD test_dictionary.c
+    expect_stat 'cache hit (direct)' 1
+    expect_equal_object_files reference_test_dictionary.o test_dictionary.o
+    expect_equal_content reference_test_dictionary.d test_dictionary.d
+
+    # Data compressed with a missing dictionary is treated as missing.
+    rm $CCACHE_DIR/dictionaries/*
+    rm test_dictionary.o
+    $CCACHE_COMPILE -c -MD test_dictionary.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 42
+    expect_equal_object_files reference_test_dictionary.o test_dictionary.o
+
     # -------------------------------------------------------------------------
     TEST "CCACHE_DEBUG"
 
@@ -394,6 +522,24 @@ fi
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 0
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_STREAM_CPP_OUTPUT"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    CCACHE_STREAM_CPP_OUTPUT=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    CCACHE_STREAM_CPP_OUTPUT=1 $CCACHE_COMPILE -c test1.c -O2
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 2
+
+    $REAL_COMPILER -c -o reference_test1.o test1.c -O2
+    expect_equal_object_files reference_test1.o test1.o
+
     # -------------------------------------------------------------------------
     TEST "stats file forward compatibility"
 
@@ -1003,6 +1149,62 @@ EOF
     CCACHE_COMPILERCHECK="unknown_command" $CCACHE ./compiler.sh -c test1.c 2>/dev/null
     expect_stat 'compiler check failed' 1
 
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILER_CHECK_CACHE"
+
+    cat >compiler.sh <<EOF
+#!/bin/sh
+CCACHE_DISABLE=1 # If $COMPILER happens to be a ccache symlink...
+export CCACHE_DISABLE
+exec $COMPILER "\$@"
+EOF
+    chmod +x compiler.sh
+
+    cat >check.sh <<EOF
+#!/bin/sh
+printf x >>check.log
+echo compiler identity
+EOF
+    chmod +x check.sh
+
+    export CCACHE_COMPILERCHECK=./check.sh
+    export CCACHE_COMPILER_CHECK_CACHE=1
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'compiler check cache misses' 1
+    expect_content check.log x
+    expect_file_count 1 '*C' $CCACHE_DIR
+
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'compiler check cache hits' 1
+    expect_stat 'compiler check cache misses' 1
+    expect_content check.log x
+
+    echo "# Compiler upgrade" >>compiler.sh
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 1
+    expect_stat 'compiler check cache hits' 1
+    expect_stat 'compiler check cache misses' 2
+    expect_content check.log xx
+    expect_file_count 2 '*C' $CCACHE_DIR
+
+    # Results stay reachable when the option is toggled.
+    unset CCACHE_COMPILER_CHECK_CACHE
+    $CCACHE ./compiler.sh -c test1.c
+    expect_stat 'cache hit (preprocessed)' 3
+    expect_stat 'cache miss' 1
+    expect_content check.log xxx
+
+    # The entries are counted as cache files and removed by --clear.
+    expect_stat 'files in cache' 3
+    $CCACHE -C >/dev/null
+    expect_file_count 0 '*C' $CCACHE_DIR
+
 
     # -------------------------------------------------------------------------
 if ! $HOST_OS_WINDOWS; then
@@ -0,0 +1,112 @@
+SUITE_batch_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "batch mode not available on Windows"
+    fi
+}
+
+SUITE_batch_SETUP() {
+    unset CCACHE_NODIRECT
+
+    mkdir dir
+    generate_code 1 test1.c
+    generate_code 2 dir/test2.c
+    echo 'int x(' >error.c
+
+    cat <<EOF >compile_commands.json
+[
+  {
+    "directory": "$PWD",
+    "file": "test1.c",
+    "command": "$COMPILER -c test1.c"
+  },
+  {
+    "directory": "$PWD/dir",
+    "file": "test2.c",
+    "command": "$COMPILER -c test2.c -o test2.o"
+  }
+]
+EOF
+}
+
+SUITE_batch() {
+    # -------------------------------------------------------------------------
+    TEST "Misses are compiled and hits are retrieved"
+
+    $REAL_COMPILER -c -o reference_test1.o test1.c
+
+    $CCACHE --batch compile_commands.json -j 2 >batch.out
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_contains batch.out "compiled: test1.c"
+    expect_contains batch.out "compiled: test2.c"
+    expect_equal_object_files reference_test1.o test1.o
+    expect_exists dir/test2.o
+    expect_contains $CCACHE_LOGFILE "Reusing outcome of earlier direct lookup"
+
+    rm test1.o dir/test2.o
+    $CCACHE --batch compile_commands.json -j 2 >batch.out
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+    expect_contains batch.out "cached (direct): test1.c"
+    expect_contains batch.out "cached (direct): test2.c"
+    expect_contains batch.out "2 cached (direct), 0 cached (preprocessed), 0 compiled, 0 failed"
+    expect_equal_object_files reference_test1.o test1.o
+    expect_exists dir/test2.o
+
+    # -------------------------------------------------------------------------
+    TEST "Direct hits are shared with normal invocations"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    rm test1.o
+    $CCACHE --batch compile_commands.json >batch.out
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+    expect_contains batch.out "cached (direct): test1.c"
+    expect_missing $CCACHE_DIR/tmp/file-hash-cache.v1
+
+    # -------------------------------------------------------------------------
+    TEST "Preprocessor mode without direct mode"
+
+    CCACHE_NODIRECT=1 $CCACHE --batch compile_commands.json >batch.out
+    expect_stat 'cache miss' 2
+
+    rm test1.o dir/test2.o
+    CCACHE_NODIRECT=1 $CCACHE --batch compile_commands.json >batch.out
+    expect_stat 'cache hit (preprocessed)' 2
+    expect_stat 'cache miss' 2
+    expect_contains batch.out "cached (preprocessed): test1.c"
+    expect_contains batch.out "0 cached (direct), 2 cached (preprocessed), 0 compiled, 0 failed"
+    expect_exists test1.o
+    expect_exists dir/test2.o
+
+    # -------------------------------------------------------------------------
+    TEST "Failed compilation"
+
+    cat <<EOF >compile_commands.json
+[
+  {"directory": "$PWD", "file": "error.c", "arguments": ["$COMPILER", "-c", "error.c"]},
+  {"directory": "$PWD", "file": "test1.c", "arguments": ["$COMPILER", "-c", "test1.c"]}
+]
+EOF
+    if $CCACHE --batch compile_commands.json >batch.out 2>batch.err; then
+        test_failed "Expected batch to fail"
+    fi
+    expect_stat 'compile failed' 1
+    expect_stat 'cache miss' 1
+    expect_contains batch.out "failed (exit status 1): error.c"
+    expect_contains batch.out "compiled: test1.c"
+    expect_contains batch.out "0 cached (direct), 0 cached (preprocessed), 1 compiled, 1 failed"
+    expect_exists test1.o
+
+    # -------------------------------------------------------------------------
+    TEST "Malformed compilation database"
+
+    echo '[{"directory": "."}' >broken.json
+    if $CCACHE --batch broken.json >batch.out 2>batch.err; then
+        test_failed "Expected batch to fail"
+    fi
+    expect_contains batch.err "invalid compilation database"
+}
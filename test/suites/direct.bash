@@ -102,6 +102,36 @@ SUITE_direct() {
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 2
 
+    # -------------------------------------------------------------------------
+    TEST "Modified include file, CCACHE_STAT_THREADS"
+
+    export CCACHE_STAT_THREADS=4
+    export CCACHE_LOGFILE=stat_threads.log
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+    expect_contains stat_threads.log "Prefetched file information for 4 paths"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+
+    rm test3.h
+    $CCACHE_COMPILE -c test.c 2>/dev/null
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 2
+
     # -------------------------------------------------------------------------
     TEST "Removed but previously compiled header file"
 
@@ -426,6 +456,205 @@ EOF
     expect_stat 'cache hit (preprocessed)' 0
     expect_stat 'cache miss' 5
 
+    # -------------------------------------------------------------------------
+    TEST "Manifest journal"
+
+    cp test3.h test3.h.orig
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    manifest=`find $CCACHE_DIR -name '*M'`
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 0"
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 1"
+    expect_contains manifest.dump "Results (2):"
+
+    $CCACHE -X 5 >/dev/null
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Compression level: 5"
+    expect_contains manifest.dump "Journal frames: 1"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    cp test3.h.orig test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+
+    # The journal would become larger than the rest of the manifest.
+    echo "int test3_3;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 0"
+    expect_contains manifest.dump "Results (3):"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "Incomplete manifest journal frame is ignored"
+
+    cp test3.h test3.h.orig
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+    manifest=`find $CCACHE_DIR -name '*M'`
+
+    echo "int test3_2;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 2
+
+    # Simulate an interrupted append.
+    head -c 20 /dev/zero >>$manifest
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 1"
+    expect_contains manifest.dump "Results (2):"
+
+    cp test3.h.orig test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+
+    echo "int test3_3;" >>test3.h
+    backdate test3.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 0"
+    expect_contains manifest.dump "Results (3):"
+
+    # -------------------------------------------------------------------------
+    TEST "Least recently used manifest entries are evicted"
+
+    export CCACHE_MAX_MANIFEST_ENTRIES=2
+
+    for i in 0 1 2; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache miss' 3
+
+    manifest=`find $CCACHE_DIR -name '*M'`
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Results (2):"
+
+    for i in 2 1; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 3
+
+    # The result is still in the cache but not in the manifest.
+    echo "int test1_0;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 3
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest entries are evicted below the limit"
+
+    export CCACHE_MAX_MANIFEST_ENTRIES=10
+
+    for i in 0 1 2 3 4 5 6 7 8 9 10; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache miss' 11
+
+    manifest=`find $CCACHE_DIR -name '*M'`
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 0"
+    expect_contains manifest.dump "Results (9):"
+
+    # The next result is appended instead of rewriting the manifest.
+    echo "int test1_11;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 12
+    $CCACHE --dump-manifest $manifest >manifest.dump
+    expect_contains manifest.dump "Journal frames: 1"
+    expect_contains manifest.dump "Results (10):"
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest entries are evicted by last use of their results"
+
+    export CCACHE_MAX_MANIFEST_ENTRIES=2
+
+    for i in 0 1; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache miss' 2
+    backdate $(find $CCACHE_DIR -name '*R')
+
+    # A hit updates the result file but not the manifest.
+    manifest=`find $CCACHE_DIR -name '*M'`
+    cp $manifest manifest.saved
+    echo "int test1_0;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_equal_content $manifest manifest.saved
+
+    echo "int test1_2;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 3
+
+    echo "int test1_0;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache hit (preprocessed)' 0
+
+    echo "int test1_1;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache hit (preprocessed)' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest entries eliminated by discriminating include file"
+
+    for i in 0 1 2 3 4; do
+        echo "int test1_$i;" >test1.h
+        backdate test1.h
+        $CCACHE_COMPILE -c test.c
+    done
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 5
+
+    echo "int test1_0;" >test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 5
+    expect_stat 'manifest lookups' 5
+    # The second compilation examines the only entry. After that, test1.h
+    # eliminates all entries but the matching one, which is the oldest.
+    expect_stat 'manifest entries examined' 2
+
     # -------------------------------------------------------------------------
     TEST "-MD"
 
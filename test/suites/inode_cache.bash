@@ -98,4 +98,40 @@ inode_cache_tests() {
     echo "// replace" > test1.c
     $CCACHE_COMPILE -c test1.c
     expect_inode_cache 0 1 1 test1.c
+
+    # -------------------------------------------------------------------------
+    TEST "Show statistics"
+
+    echo "// show statistics" > test1.c
+    $CCACHE_COMPILE -c test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 1 0 0 test1.c
+
+    $CCACHE -s >stats.txt
+    expect_contains stats.txt "inode cache hits"
+    expect_contains stats.txt "inode cache hit rate"
+    expect_contains stats.txt "inode cache evictions"
+    expect_contains stats.txt "inode cache occupancy"
+
+    # -------------------------------------------------------------------------
+    TEST "Grow"
+
+    echo "// grow" > test1.c
+    CCACHE_INODE_CACHE_SIZE=1k $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 0 1 1 test1.c
+
+    CCACHE_INODE_CACHE_SIZE=1M $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 1 0 0 test1.c
+    expect_contains test1.o.ccache-log "Growing inode cache"
+
+    # -------------------------------------------------------------------------
+    TEST "Persistent"
+
+    echo "// persistent" > test1.c
+    CCACHE_INODE_CACHE_PERSISTENT=1 $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 0 1 1 test1.c
+    expect_exists $CCACHE_DIR/inode-cache.v5
+
+    CCACHE_INODE_CACHE_PERSISTENT=1 $CCACHE_COMPILE -c test1.c
+    expect_inode_cache 1 0 0 test1.c
 }
@@ -0,0 +1,92 @@
+SUITE_manifest_cache_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "manifest cache not available on Windows"
+        return
+    fi
+
+    temp_dir=$(dirname $($CCACHE -k temporary_dir))
+    fs=$(stat -fLc %T $temp_dir)
+    if [ "$fs" = "nfs" ]; then
+        echo "ccache temporary directory is on NFS"
+    fi
+}
+
+SUITE_manifest_cache_SETUP() {
+    export CCACHE_MANIFESTCACHE=1
+    unset CCACHE_NODIRECT
+
+    # Use a log file per test case so that manifest cache lookups can be
+    # counted.
+    export CCACHE_LOGFILE=$ABS_TESTDIR/run/ccache.log
+
+    cat <<EOF >test.c
+#include "test.h"
+int test;
+EOF
+    echo "int a;" >test.h
+    backdate test.h
+}
+
+expect_manifest_cache() {
+    local type=$1
+    local expected=$2
+
+    local actual=$(grep -c "manifest cache $type:" "$CCACHE_LOGFILE")
+    if [ $actual -ne $expected ]; then
+        test_failed "Found $actual (expected $expected) manifest cache $type"
+    fi
+}
+
+SUITE_manifest_cache() {
+    # -------------------------------------------------------------------------
+    TEST "Decoded manifest is reused"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_manifest_cache hit 0
+    expect_manifest_cache insert 0
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_manifest_cache hit 0
+    expect_manifest_cache miss 1
+    expect_manifest_cache insert 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 1
+    expect_manifest_cache hit 1
+    expect_manifest_cache miss 1
+    expect_manifest_cache insert 1
+
+    # -------------------------------------------------------------------------
+    TEST "Updated manifest is not taken from the cache"
+
+    $CCACHE_COMPILE -c test.c
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_manifest_cache insert 1
+
+    echo "int b;" >test.h
+    backdate test.h
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_manifest_cache hit 1
+    expect_manifest_cache insert 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 2
+    expect_manifest_cache hit 1
+    expect_manifest_cache insert 2
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 3
+    expect_stat 'cache miss' 2
+    expect_manifest_cache hit 2
+    expect_manifest_cache insert 2
+}
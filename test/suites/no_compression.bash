@@ -35,6 +35,44 @@ SUITE_no_compression() {
         test_failed "Result file seems to be compressed"
     fi
 
+    # -------------------------------------------------------------------------
+    TEST "Manifest file is uncompressed"
+
+    $CCACHE_COMPILE -c test.c
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    $CCACHE --dump-manifest $manifest_file >manifest.dump
+    expect_contains manifest.dump 'Version: 3'
+    expect_contains manifest.dump 'Compression type: none'
+    expect_contains manifest.dump "Results (1):"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    # -------------------------------------------------------------------------
+    TEST "Recompressed manifest file"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache miss' 1
+
+    $CCACHE -X 5 >/dev/null
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    $CCACHE --dump-manifest $manifest_file >manifest.dump
+    expect_contains manifest.dump 'Version: 3'
+    expect_contains manifest.dump 'Compression type: zstd'
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+
+    $CCACHE -X uncompressed >/dev/null
+    $CCACHE --dump-manifest $manifest_file >manifest.dump
+    expect_contains manifest.dump 'Compression type: none'
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 2
+    expect_stat 'cache miss' 1
+
     # -------------------------------------------------------------------------
     TEST "Hash sum equal for compressed and uncompressed files"
 
@@ -77,4 +115,24 @@ SUITE_no_compression() {
     expect_stat 'cache hit (direct)' 2
     expect_stat 'cache miss' 2
     expect_stat 'files in cache' 2
+
+    # -------------------------------------------------------------------------
+    TEST "Corrupt manifest file"
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+
+    manifest_file=$(find $CCACHE_DIR -name '*M')
+    printf foo | dd of=$manifest_file bs=3 count=1 seek=20 conv=notrunc >&/dev/null
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c test.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
 }
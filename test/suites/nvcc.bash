@@ -299,6 +299,29 @@ nvcc_tests() {
     expect_stat 'cache hit (preprocessed)' 1
     expect_stat 'cache miss' 1
     expect_stat 'files in cache' 1
+
+    # -------------------------------------------------------------------------
+    TEST "CCACHE_COMPILER_CHECK_CACHE"
+
+    export CCACHE_COMPILER_CHECK_CACHE=1
+
+    # First compile. nvcc and the set of host compilers found in PATH are one
+    # lookup each.
+    $ccache_nvcc_cuda test_cuda.cu
+    expect_stat 'cache hit (preprocessed)' 0
+    expect_stat 'cache miss' 1
+    expect_stat 'compiler check cache hits' 0
+    expect_stat 'compiler check cache misses' 2
+    $cuobjdump test_cuda.o > test1.dump
+
+    # The host compilers found in PATH are taken from the cache.
+    $ccache_nvcc_cuda test_cuda.cu
+    expect_stat 'cache hit (preprocessed)' 1
+    expect_stat 'cache miss' 1
+    expect_stat 'compiler check cache hits' 2
+    expect_stat 'compiler check cache misses' 2
+    $cuobjdump test_cuda.o > test2.dump
+    expect_equal_content test1.dump test2.dump
 }
 
 SUITE_nvcc_PROBE() {
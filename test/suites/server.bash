@@ -0,0 +1,175 @@
+SUITE_server_PROBE() {
+    if $HOST_OS_WINDOWS; then
+        echo "ccache server not available on Windows"
+        return
+    fi
+
+    local socket_path="$ABS_TESTDIR/run/ccache/server.v2.0123456789abcdef.sock"
+    if [ ${#socket_path} -ge 100 ]; then
+        echo "temporary directory path is too long for a Unix socket"
+    fi
+}
+
+SUITE_server_SETUP() {
+    export CCACHE_SERVER=1
+    export CCACHE_SERVER_IDLE_TIMEOUT=5
+    unset CCACHE_NODIRECT
+
+    # Keep the socket of each test case's server in the test directory.
+    export XDG_RUNTIME_DIR=$ABS_TESTDIR/run
+
+    # Use a log file per test case so that the log can be checked for server
+    # retrievals.
+    export CCACHE_LOGFILE=$ABS_TESTDIR/run/ccache.log
+
+    generate_code 1 test1.c
+}
+
+SUITE_server() {
+    # -------------------------------------------------------------------------
+    TEST "Direct hit retrieved by server"
+
+    $REAL_COMPILER -c -o reference_test1.o test1.c
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 1
+    expect_not_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+    expect_equal_object_files reference_test1.o test1.o
+
+    rm test1.o
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+    expect_equal_object_files reference_test1.o test1.o
+
+    # -------------------------------------------------------------------------
+    TEST "Cached stderr is forwarded by server"
+
+    cat <<EOS >warning.c
+#warning "this is a warning"
+int x;
+EOS
+    $CCACHE_COMPILE -c warning.c 2>stderr_orig.txt
+    expect_stat 'cache miss' 1
+    expect_contains stderr_orig.txt "this is a warning"
+
+    $CCACHE_COMPILE -c warning.c 2>stderr_server.txt
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+    expect_equal_content stderr_orig.txt stderr_server.txt
+
+    # -------------------------------------------------------------------------
+    TEST "Client working directory is used by server"
+
+    mkdir dir1 dir2
+    cp test1.c dir1
+    cp test1.c dir2
+
+    cd dir1
+    $CCACHE_COMPILE -c test1.c
+    cd ..
+    expect_stat 'cache miss' 1
+    expect_exists dir1/test1.o
+
+    cd dir2
+    $CCACHE_COMPILE -c test1.c
+    cd ..
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 1
+    expect_exists dir2/test1.o
+    expect_missing test1.o
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    # -------------------------------------------------------------------------
+    TEST "Client environment is used by server"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    CCACHE_RECACHE=1 $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_not_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    # -------------------------------------------------------------------------
+    TEST "Miss falls back to normal compilation"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    echo "int y;" >>test1.c
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_not_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+    expect_contains $CCACHE_LOGFILE "Reusing outcome of earlier direct lookup"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    # -------------------------------------------------------------------------
+    TEST "Manifest lookups of server misses are counted"
+
+    echo "int x;" >test1.h
+    backdate test1.h
+    echo '#include "test1.h"' >test2.c
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'cache miss' 1
+
+    echo "int y;" >>test1.h
+    backdate test1.h
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'cache hit (direct)' 0
+    expect_stat 'cache miss' 2
+    expect_stat 'manifest lookups' 1
+    expect_contains $CCACHE_LOGFILE "Reusing outcome of earlier direct lookup"
+
+    $CCACHE_COMPILE -c test2.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'manifest lookups' 2
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    # -------------------------------------------------------------------------
+    TEST "Crashed worker is replaced"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    worker_pid=$(sed -n 's/^\[[^ ]* \([0-9]*\) *\] Result retrieved by.*/\1/p' \
+        $CCACHE_LOGFILE)
+    sleep 1
+    kill -KILL $worker_pid
+    sleep 0.5
+    expect_contains $CCACHE_LOGFILE "Replacing ccache server worker $worker_pid"
+
+    rm $CCACHE_LOGFILE
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 2
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    # -------------------------------------------------------------------------
+    TEST "Changed configuration file is read by server"
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache miss' 1
+
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+
+    $CCACHE -o recache=true
+    rm $CCACHE_LOGFILE
+    $CCACHE_COMPILE -c test1.c
+    expect_stat 'cache hit (direct)' 1
+    expect_stat 'cache miss' 2
+    expect_not_contains $CCACHE_LOGFILE "Result retrieved by ccache server"
+}
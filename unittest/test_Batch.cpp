@@ -0,0 +1,102 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include "../src/Batch.hpp"
+#include "../src/exceptions.hpp"
+
+#include "third_party/doctest.h"
+
+#include <string>
+
+TEST_SUITE_BEGIN("Batch");
+
+TEST_CASE("Batch::parse_compile_commands")
+{
+  SUBCASE("Empty database")
+  {
+    CHECK(Batch::parse_compile_commands("[]").empty());
+    CHECK(Batch::parse_compile_commands(" [ \n ] \n").empty());
+  }
+
+  SUBCASE("Arguments")
+  {
+    const auto commands = Batch::parse_compile_commands(
+      R"([{"directory": "/src", "file": "a.c",)"
+      R"( "arguments": ["cc", "-c", "a.c"], "output": "a.o"}])");
+    REQUIRE(commands.size() == 1);
+    CHECK(commands[0].directory == "/src");
+    CHECK(commands[0].file == "a.c");
+    CHECK(commands[0].args == Args::from_string("cc -c a.c"));
+  }
+
+  SUBCASE("Command")
+  {
+    const auto commands = Batch::parse_compile_commands(
+      R"([{"directory": "/src", "command": "cc -DX=\"a b\" 'c d' -c a.c",)"
+      R"( "file": "a.c"},)"
+      R"( {"directory": "/src/sub", "command": "cc -c b.c", "file": "b.c"}])");
+    REQUIRE(commands.size() == 2);
+    REQUIRE(commands[0].args.size() == 5);
+    CHECK(commands[0].args[1] == "-DX=a b");
+    CHECK(commands[0].args[2] == "c d");
+    CHECK(commands[1].directory == "/src/sub");
+    CHECK(commands[1].args == Args::from_string("cc -c b.c"));
+  }
+
+  SUBCASE("Arguments take precedence over command")
+  {
+    const auto commands = Batch::parse_compile_commands(
+      R"([{"directory": "/", "file": "a.c", "command": "cc -c a.c",)"
+      R"( "arguments": ["gcc", "-c", "a.c"]}])");
+    REQUIRE(commands.size() == 1);
+    CHECK(commands[0].args[0] == "gcc");
+  }
+
+  SUBCASE("Escapes and unknown keys")
+  {
+    const auto commands = Batch::parse_compile_commands(
+      R"([{"directory": "/a\\b\/c", "file": "å😀.c",)"
+      R"( "extra": {"x": [1, -2.5e3, true, false, null]},)"
+      R"( "arguments": ["cc\t"]}])");
+    REQUIRE(commands.size() == 1);
+    CHECK(commands[0].directory == "/a\\b/c");
+    CHECK(commands[0].file == "\xc3\xa5\xf0\x9f\x98\x80.c");
+    CHECK(commands[0].args[0] == "cc\t");
+  }
+
+  SUBCASE("Malformed input")
+  {
+    CHECK_THROWS_AS(Batch::parse_compile_commands(""), Error);
+    CHECK_THROWS_AS(Batch::parse_compile_commands("{}"), Error);
+    CHECK_THROWS_AS(Batch::parse_compile_commands("[] x"), Error);
+    CHECK_THROWS_AS(Batch::parse_compile_commands(R"([{"file": "a.c)"), Error);
+    CHECK_THROWS_AS(
+      Batch::parse_compile_commands(R"([{"directory": "\q"}])"), Error);
+    CHECK_THROWS_WITH(
+      Batch::parse_compile_commands(
+        R"([{"directory": "/", "arguments": ["cc"]}])"),
+      "invalid compilation database: entry 1 lacks \"file\" at offset 40");
+    CHECK_THROWS_WITH(
+      Batch::parse_compile_commands(R"([{"directory": "/", "file": "a.c"}])"),
+      "invalid compilation database: entry 1 lacks \"arguments\" or"
+      " \"command\" at offset 34");
+  }
+}
+
+TEST_SUITE_END();
@@ -0,0 +1,164 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/CompressionDictionary.hpp"
+#include "../src/Compressor.hpp"
+#include "../src/Decompressor.hpp"
+#include "../src/File.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/exceptions.hpp"
+#include "../src/fmtmacros.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using CompressionDictionary::Kind;
+using TestUtil::TestContext;
+
+namespace {
+
+std::string
+dependency_sample(size_t i)
+{
+  return FMT(
+    "src/file{0}.o: src/file{0}.c /usr/include/stdio.h"
+    " /usr/include/x86_64-linux-gnu/bits/types.h src/file{0}.h src/common.h\n",
+    i);
+}
+
+std::vector<std::string>
+dependency_samples()
+{
+  std::vector<std::string> samples;
+  for (size_t i = 0; i < 500; ++i) {
+    samples.push_back(dependency_sample(i));
+  }
+  return samples;
+}
+
+std::string
+compress(const std::string& path,
+         const std::string& data,
+         const CompressionDictionary::Dictionary* dictionary)
+{
+  File f(path, "wb");
+  auto compressor = Compressor::create_from_type(
+    Compression::Type::zstd, f.get(), 1, 0, dictionary);
+  compressor->write(data.data(), data.size());
+  compressor->finalize();
+  f.close();
+  return Util::read_file(path);
+}
+
+std::string
+decompress(const std::string& path, size_t size)
+{
+  File f(path, "rb");
+  auto decompressor =
+    Decompressor::create_from_type(Compression::Type::zstd, f.get());
+  std::string data(size, '\0');
+  decompressor->read(&data[0], data.size());
+  decompressor->finalize();
+  return data;
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("CompressionDictionary");
+
+TEST_CASE("Compression with trained dictionary")
+{
+  if (!CompressionDictionary::is_supported()) {
+    return;
+  }
+
+  TestContext test_context;
+
+  CompressionDictionary::set_directory("dictionaries");
+  CHECK(!CompressionDictionary::get_for_kind(Kind::dependency));
+
+  const auto dictionary =
+    CompressionDictionary::train(Kind::dependency, dependency_samples());
+  REQUIRE(dictionary);
+  CHECK(Stat::stat("dictionaries/dependency.zdict"));
+  CHECK(Stat::stat(FMT("dictionaries/{:08x}.zdict", dictionary->id())));
+  CHECK(!CompressionDictionary::get_for_kind(Kind::manifest));
+
+  // Dictionaries are found on disk by a fresh lookup.
+  CompressionDictionary::set_directory("");
+  CompressionDictionary::set_directory("dictionaries");
+  const auto stored = CompressionDictionary::get_for_kind(Kind::dependency);
+  REQUIRE(stored);
+  CHECK(stored->id() == dictionary->id());
+
+  const std::string data = dependency_sample(1000);
+  const auto plain = compress("plain.zst", data, nullptr);
+  const auto with_dictionary = compress("dict.zst", data, stored.get());
+  CHECK(with_dictionary.size() < plain.size());
+
+  CHECK(decompress("plain.zst", data.size()) == data);
+  CHECK(decompress("dict.zst", data.size()) == data);
+
+  CompressionDictionary::set_directory("elsewhere");
+  CHECK_THROWS_AS(decompress("dict.zst", data.size()), Error);
+
+  CompressionDictionary::set_directory("");
+}
+
+TEST_CASE("Reused zstd streams forget the dictionary")
+{
+  if (!CompressionDictionary::is_supported()) {
+    return;
+  }
+
+  TestContext test_context;
+
+  CompressionDictionary::set_directory("dictionaries");
+  const auto dictionary =
+    CompressionDictionary::train(Kind::dependency, dependency_samples());
+  REQUIRE(dictionary);
+
+  const std::string data = dependency_sample(1000);
+  compress("dict.zst", data, dictionary.get());
+  CHECK(decompress("dict.zst", data.size()) == data);
+
+  // The streams used above are reused here, but the data must not depend on
+  // the dictionary.
+  compress("plain.zst", data, nullptr);
+  CompressionDictionary::set_directory("elsewhere");
+  CHECK(decompress("plain.zst", data.size()) == data);
+
+  CompressionDictionary::set_directory("");
+}
+
+TEST_CASE("Too few samples for a dictionary")
+{
+  if (!CompressionDictionary::is_supported()) {
+    return;
+  }
+
+  TestContext test_context;
+
+  CompressionDictionary::set_directory("dictionaries");
+  CHECK(!CompressionDictionary::train(Kind::manifest, {"foo", "bar"}));
+  CHECK(!Stat::stat("dictionaries"));
+  CompressionDictionary::set_directory("");
+}
+
+TEST_SUITE_END();
@@ -39,13 +39,16 @@ TEST_CASE("Config: default values")
 {
   Config config;
 
+  CHECK(!config.async_store());
   CHECK(config.base_dir().empty());
   CHECK(config.cache_dir().empty()); // Set later
   CHECK(config.compiler().empty());
   CHECK(config.compiler_check() == "mtime");
+  CHECK(!config.compiler_check_cache());
   CHECK(config.compiler_type() == CompilerType::auto_guess);
   CHECK(config.compression());
   CHECK(config.compression_level() == 0);
+  CHECK(config.compression_threads() == 0);
   CHECK(config.cpp_extension().empty());
   CHECK(!config.debug());
   CHECK(config.debug_dir().empty());
@@ -54,14 +57,20 @@ TEST_CASE("Config: default values")
   CHECK(!config.disable());
   CHECK(config.extra_files_to_hash().empty());
   CHECK(!config.file_clone());
+  CHECK_FALSE(config.file_hash_cache());
   CHECK(!config.hard_link());
   CHECK(config.hash_dir());
   CHECK(config.ignore_headers_in_manifest().empty());
   CHECK(config.ignore_options().empty());
+  CHECK(!config.inode_cache_persistent());
+  CHECK(config.inode_cache_size() == 10 * 1000 * 1000);
   CHECK_FALSE(config.keep_comments_cpp());
   CHECK(config.limit_multiple() == Approx(0.8));
   CHECK(config.log_file().empty());
+  CHECK_FALSE(config.manifest_cache());
   CHECK(config.max_files() == 0);
+  CHECK(config.max_manifest_entries() == 100);
+  CHECK(config.max_manifest_file_infos() == 10000);
   CHECK(config.max_size() == static_cast<uint64_t>(5) * 1000 * 1000 * 1000);
   CHECK(config.path().empty());
   CHECK_FALSE(config.pch_external_checksum());
@@ -70,9 +79,14 @@ TEST_CASE("Config: default values")
   CHECK_FALSE(config.read_only());
   CHECK_FALSE(config.read_only_direct());
   CHECK_FALSE(config.recache());
+  CHECK(config.retrieve_threads() == 0);
   CHECK(config.run_second_cpp());
+  CHECK_FALSE(config.server());
+  CHECK(config.server_idle_timeout() == 600);
   CHECK(config.sloppiness() == 0);
+  CHECK(config.stat_threads() == 0);
   CHECK(config.stats());
+  CHECK(!config.stream_cpp_output());
   CHECK(config.temporary_dir().empty()); // Set later
   CHECK(config.umask() == std::numeric_limits<uint32_t>::max());
 }
@@ -364,6 +378,7 @@ TEST_CASE("Config::visit_items")
   Util::write_file(
     "test.conf",
     "absolute_paths_in_stderr = true\n"
+    "async_store = true\n"
 #ifndef _WIN32
     "base_dir = /bd\n"
 #else
@@ -372,9 +387,11 @@ TEST_CASE("Config::visit_items")
     "cache_dir = cd\n"
     "compiler = c\n"
     "compiler_check = cc\n"
+    "compiler_check_cache = true\n"
     "compiler_type = clang\n"
     "compression = true\n"
     "compression_level = 8\n"
+    "compression_threads = 4\n"
     "cpp_extension = ce\n"
     "debug = false\n"
     "debug_dir = /dd\n"
@@ -383,15 +400,21 @@ TEST_CASE("Config::visit_items")
     "disable = true\n"
     "extra_files_to_hash = efth\n"
     "file_clone = true\n"
+    "file_hash_cache = true\n"
     "hard_link = true\n"
     "hash_dir = false\n"
     "ignore_headers_in_manifest = ihim\n"
     "ignore_options = -a=* -b\n"
     "inode_cache = false\n"
+    "inode_cache_persistent = true\n"
+    "inode_cache_size = 64.0M\n"
     "keep_comments_cpp = true\n"
     "limit_multiple = 0.0\n"
     "log_file = lf\n"
+    "manifest_cache = true\n"
     "max_files = 4711\n"
+    "max_manifest_entries = 42\n"
+    "max_manifest_file_infos = 4711\n"
     "max_size = 98.7M\n"
     "path = p\n"
     "pch_external_checksum = true\n"
@@ -400,11 +423,16 @@ TEST_CASE("Config::visit_items")
     "read_only = true\n"
     "read_only_direct = true\n"
     "recache = true\n"
+    "retrieve_threads = 4\n"
     "run_second_cpp = false\n"
+    "server = true\n"
+    "server_idle_timeout = 17\n"
     "sloppiness = include_file_mtime, include_file_ctime, time_macros,"
     " file_stat_matches, file_stat_matches_ctime, pch_defines, system_headers,"
     " clang_index_store, ivfsoverlay\n"
+    "stat_threads = 4\n"
     "stats = false\n"
+    "stream_cpp_output = true\n"
     "temporary_dir = td\n"
     "umask = 022\n");
 
@@ -421,6 +449,7 @@ TEST_CASE("Config::visit_items")
 
   std::vector<std::string> expected = {
     "(test.conf) absolute_paths_in_stderr = true",
+    "(test.conf) async_store = true",
 #ifndef _WIN32
     "(test.conf) base_dir = /bd",
 #else
@@ -429,9 +458,11 @@ TEST_CASE("Config::visit_items")
     "(test.conf) cache_dir = cd",
     "(test.conf) compiler = c",
     "(test.conf) compiler_check = cc",
+    "(test.conf) compiler_check_cache = true",
     "(test.conf) compiler_type = clang",
     "(test.conf) compression = true",
     "(test.conf) compression_level = 8",
+    "(test.conf) compression_threads = 4",
     "(test.conf) cpp_extension = ce",
     "(test.conf) debug = false",
     "(test.conf) debug_dir = /dd",
@@ -440,15 +471,21 @@ TEST_CASE("Config::visit_items")
     "(test.conf) disable = true",
     "(test.conf) extra_files_to_hash = efth",
     "(test.conf) file_clone = true",
+    "(test.conf) file_hash_cache = true",
     "(test.conf) hard_link = true",
     "(test.conf) hash_dir = false",
     "(test.conf) ignore_headers_in_manifest = ihim",
     "(test.conf) ignore_options = -a=* -b",
     "(test.conf) inode_cache = false",
+    "(test.conf) inode_cache_persistent = true",
+    "(test.conf) inode_cache_size = 64.0M",
     "(test.conf) keep_comments_cpp = true",
     "(test.conf) limit_multiple = 0.0",
     "(test.conf) log_file = lf",
+    "(test.conf) manifest_cache = true",
     "(test.conf) max_files = 4711",
+    "(test.conf) max_manifest_entries = 42",
+    "(test.conf) max_manifest_file_infos = 4711",
     "(test.conf) max_size = 98.7M",
     "(test.conf) path = p",
     "(test.conf) pch_external_checksum = true",
@@ -457,11 +494,16 @@ TEST_CASE("Config::visit_items")
     "(test.conf) read_only = true",
     "(test.conf) read_only_direct = true",
     "(test.conf) recache = true",
+    "(test.conf) retrieve_threads = 4",
     "(test.conf) run_second_cpp = false",
+    "(test.conf) server = true",
+    "(test.conf) server_idle_timeout = 17",
     "(test.conf) sloppiness = include_file_mtime, include_file_ctime,"
     " time_macros, pch_defines, file_stat_matches, file_stat_matches_ctime,"
     " system_headers, clang_index_store, ivfsoverlay",
+    "(test.conf) stat_threads = 4",
     "(test.conf) stats = false",
+    "(test.conf) stream_cpp_output = true",
     "(test.conf) temporary_dir = td",
     "(test.conf) umask = 022",
   };
@@ -0,0 +1,185 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+
+#include "../src/Config.hpp"
+#include "../src/Context.hpp"
+#include "../src/FileHashCache.hpp"
+#include "../src/Hash.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "../src/hashutil.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+namespace {
+
+void
+init(Context& ctx)
+{
+  ctx.config.set_debug(true);
+  ctx.config.set_file_hash_cache(true);
+  ctx.config.set_cache_dir(Util::get_home_directory());
+}
+
+Digest
+get_key(const std::string& path)
+{
+  return FileHashCache::get_key(
+    path, Stat::stat(path), InodeCache::ContentType::code);
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("FileHashCache");
+
+TEST_CASE("Test disabled")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_file_hash_cache(false);
+
+  const Digest key = Hash().hash("key").digest();
+  Digest digest;
+  int return_value;
+
+  CHECK(!ctx.file_hash_cache.get(key, digest, return_value));
+  CHECK(!ctx.file_hash_cache.put(key, digest, 0));
+  CHECK(ctx.file_hash_cache.get_hits() == -1);
+  CHECK(ctx.file_hash_cache.get_misses() == -1);
+  CHECK(ctx.file_hash_cache.get_errors() == -1);
+}
+
+TEST_CASE("Test put and lookup")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.file_hash_cache.drop();
+
+  const Digest key1 = Hash().hash("key1").digest();
+  const Digest key2 = Hash().hash("key2").digest();
+  const Digest digest1 = Hash().hash("digest1").digest();
+  const Digest digest2 = Hash().hash("digest2").digest();
+  Digest digest;
+  int return_value;
+
+  CHECK(!ctx.file_hash_cache.get(key1, digest, return_value));
+  CHECK(ctx.file_hash_cache.get_hits() == 0);
+  CHECK(ctx.file_hash_cache.get_misses() == 1);
+
+  CHECK(ctx.file_hash_cache.put(key1, digest1, 1));
+  CHECK(ctx.file_hash_cache.put(key2, digest2, 2));
+
+  CHECK(ctx.file_hash_cache.get(key1, digest, return_value));
+  CHECK(digest == digest1);
+  CHECK(return_value == 1);
+  CHECK(ctx.file_hash_cache.get(key2, digest, return_value));
+  CHECK(digest == digest2);
+  CHECK(return_value == 2);
+  CHECK(ctx.file_hash_cache.get_hits() == 2);
+  CHECK(ctx.file_hash_cache.get_misses() == 1);
+  CHECK(ctx.file_hash_cache.get_errors() == 0);
+}
+
+TEST_CASE("Test replaced entry")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.file_hash_cache.drop();
+
+  // Two keys that only differ after the bytes used for indexing map to the
+  // same entry.
+  Digest key1 = Hash().hash("key").digest();
+  Digest key2 = key1;
+  key2.bytes()[Digest::size() - 1] ^= 1;
+  const Digest file_digest = Hash().hash("digest").digest();
+  Digest digest;
+  int return_value;
+
+  CHECK(ctx.file_hash_cache.put(key1, file_digest, 0));
+  CHECK(ctx.file_hash_cache.put(key2, file_digest, 0));
+  CHECK(!ctx.file_hash_cache.get(key1, digest, return_value));
+  CHECK(ctx.file_hash_cache.get(key2, digest, return_value));
+}
+
+TEST_CASE("Test key")
+{
+  TestContext test_context;
+
+  Util::write_file("a", "a text");
+  Util::write_file("b", "a text");
+
+  const Digest key_a = get_key("a");
+  CHECK(get_key("a") == key_a);
+  CHECK(get_key("b") != key_a);
+  CHECK(FileHashCache::get_key(
+          "a", Stat::stat("a"), InodeCache::ContentType::precompiled_header)
+        != key_a);
+
+  Util::write_file("a", "a text 2");
+  CHECK(get_key("a") != key_a);
+}
+
+TEST_CASE("Test hash_source_code_file")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.file_hash_cache.drop();
+
+  Util::write_file("a.h", "int a;");
+  Hash expected_file_hash;
+  expected_file_hash.hash("int a;");
+  Hash expected;
+  expected.hash(expected_file_hash.digest().bytes(),
+                Digest::size(),
+                Hash::HashType::binary);
+
+  // A file that was just written may be modified again without changing its
+  // status information, so it's hashed but not stored.
+  Hash hash1;
+  CHECK(hash_source_code_file(ctx, hash1, "a.h") == HASH_SOURCE_CODE_OK);
+  CHECK(hash1.digest() == expected.digest());
+  Digest digest;
+  int return_value;
+  CHECK(!ctx.file_hash_cache.get(get_key("a.h"), digest, return_value));
+
+  ctx.file_hash_cache.set_current_time(time(nullptr) + 2);
+
+  Hash hash2;
+  CHECK(hash_source_code_file(ctx, hash2, "a.h") == HASH_SOURCE_CODE_OK);
+  CHECK(hash2.digest() == expected.digest());
+  CHECK(ctx.file_hash_cache.get(get_key("a.h"), digest, return_value));
+  CHECK(digest == expected_file_hash.digest());
+
+  Hash hash3;
+  CHECK(hash_source_code_file(ctx, hash3, "a.h") == HASH_SOURCE_CODE_OK);
+  CHECK(hash3.digest() == expected.digest());
+}
+
+TEST_SUITE_END();
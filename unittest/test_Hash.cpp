@@ -17,9 +17,45 @@
 // Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
 
 #include "../src/Hash.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
 
+#include <chrono>
+#include <functional>
+
+using TestUtil::TestContext;
+
+namespace {
+
+std::string
+generate_data(size_t size)
+{
+  std::string data(size, '\0');
+  for (size_t i = 0; i < size; ++i) {
+    data[i] = static_cast<char>(i * 7 + i / 4096);
+  }
+  return data;
+}
+
+// Digest of `data` hashed by plain BLAKE3 in READ_BUFFER_SIZE blocks.
+Digest
+serial_digest(nonstd::string_view data)
+{
+  blake3_hasher hasher;
+  blake3_hasher_init(&hasher);
+  for (size_t pos = 0; pos < data.size(); pos += READ_BUFFER_SIZE) {
+    const auto block = data.substr(pos, READ_BUFFER_SIZE);
+    blake3_hasher_update(&hasher, block.data(), block.size());
+  }
+  Digest digest;
+  blake3_hasher_finalize(&hasher, digest.bytes(), digest.size());
+  return digest;
+}
+
+} // namespace
+
 TEST_SUITE_BEGIN("Hash");
 
 TEST_CASE("known strings")
@@ -83,4 +119,59 @@ TEST_CASE("Digest::bytes")
   CHECK(memcmp(d.bytes(), expected, Digest::size()) == 0);
 }
 
+TEST_CASE("Large buffers")
+{
+  const std::string data = generate_data(9 * 1024 * 1024 + 1000);
+
+  // Hash something first so that the large buffer starts at different
+  // positions relative to the BLAKE3 chunks and subtrees.
+  for (const size_t prefix_size : {0, 1, 1024, 4096 + 7, 2 * 1024 * 1024}) {
+    for (const size_t size : {4 * 1024 * 1024, 9 * 1024 * 1024 + 1000}) {
+      CAPTURE(prefix_size);
+      CAPTURE(size);
+      Hash hash;
+      hash.hash(data.data(), prefix_size);
+      hash.hash(data.data() + prefix_size, size - prefix_size);
+      CHECK(hash.digest()
+            == serial_digest(nonstd::string_view(data).substr(0, size)));
+    }
+  }
+}
+
+TEST_CASE("Large files")
+{
+  TestContext test_context;
+
+  const std::string data = generate_data(33 * 1024 * 1024 + 1000);
+  Util::write_file("test", data);
+
+  Hash hash;
+  CHECK(hash.hash_file("test"));
+  CHECK(hash.digest() == serial_digest(data));
+}
+
+// Run with `unittest -tc=hash_benchmark --no-skip`.
+TEST_CASE("hash_benchmark" * doctest::skip())
+{
+  const std::string data = generate_data(256 * 1024 * 1024);
+  const int rounds = 5;
+
+  const auto measure = [&](const char* name,
+                           const std::function<Digest()>& compute) {
+    Digest digest;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      digest = compute();
+    }
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    const double gb_per_s =
+      rounds * data.size() / elapsed.count() / (1000 * 1000 * 1000);
+    MESSAGE(name << ": " << gb_per_s << " GB/s, " << digest.to_string());
+  };
+
+  measure("single-threaded", [&] { return serial_digest(data); });
+  measure("multithreaded", [&] { return Hash().hash(data).digest(); });
+}
+
 TEST_SUITE_END();
@@ -133,6 +133,25 @@ TEST_CASE("Test put and lookup")
   CHECK(ctx.inode_cache.get_errors() == 0);
 }
 
+TEST_CASE("Test counters in non-debug mode")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_debug(false);
+  ctx.inode_cache.drop();
+  Util::write_file("a", "a text");
+
+  Digest digest;
+  CHECK(!ctx.inode_cache.get("a", InodeCache::ContentType::code, digest));
+  CHECK(put(ctx, "a", "a text", 1));
+  CHECK(ctx.inode_cache.get("a", InodeCache::ContentType::code, digest));
+  CHECK(ctx.inode_cache.get_hits() == 0);
+  CHECK(ctx.inode_cache.get_misses() == 0);
+  CHECK(ctx.inode_cache.get_used_entries() == 1);
+}
+
 TEST_CASE("Drop file")
 {
   TestContext test_context;
@@ -194,4 +213,116 @@ TEST_CASE("Test content type")
   CHECK(return_value == 3);
 }
 
+TEST_CASE("Test eviction")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_size(1); // A single bucket
+  ctx.inode_cache.drop();
+
+  const int64_t capacity = ctx.inode_cache.get_capacity();
+  REQUIRE(capacity > 1);
+  for (int64_t i = 0; i <= capacity; ++i) {
+    Util::write_file(std::to_string(i), std::to_string(i));
+  }
+
+  for (int64_t i = 0; i < capacity; ++i) {
+    CHECK(put(ctx, std::to_string(i), std::to_string(i), 0));
+  }
+  CHECK(ctx.inode_cache.get_used_entries() == capacity);
+  CHECK(ctx.inode_cache.get_evictions() == 0);
+
+  // Reference all entries but the last one so that it's the one evicted.
+  Digest digest;
+  for (int64_t i = 0; i < capacity - 1; ++i) {
+    CHECK(ctx.inode_cache.get(
+      std::to_string(i), InodeCache::ContentType::code, digest));
+  }
+  CHECK(put(ctx, std::to_string(capacity), std::to_string(capacity), 0));
+  CHECK(ctx.inode_cache.get_used_entries() == capacity);
+  CHECK(ctx.inode_cache.get_evictions() == 1);
+
+  CHECK(!ctx.inode_cache.get(
+    std::to_string(capacity - 1), InodeCache::ContentType::code, digest));
+  CHECK(ctx.inode_cache.get(
+    std::to_string(capacity), InodeCache::ContentType::code, digest));
+  CHECK(digest == Hash().hash(std::to_string(capacity)).digest());
+  CHECK(ctx.inode_cache.get("0", InodeCache::ContentType::code, digest));
+  CHECK(ctx.inode_cache.get_errors() == 0);
+}
+
+TEST_CASE("Test grow")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_size(1);
+  ctx.inode_cache.drop();
+  Util::write_file("a", "a text");
+
+  CHECK(put(ctx, "a", "a text", 1));
+  const int64_t small_capacity = ctx.inode_cache.get_capacity();
+
+  Context ctx2;
+  init(ctx2);
+  ctx2.config.set_inode_cache_size(100 * 1000);
+
+  Digest digest;
+  int return_value;
+
+  CHECK(ctx2.inode_cache.get(
+    "a", InodeCache::ContentType::code, digest, &return_value));
+  CHECK(digest == Hash().hash("a text").digest());
+  CHECK(return_value == 1);
+  const int64_t large_capacity = ctx2.inode_cache.get_capacity();
+  CHECK(large_capacity > small_capacity);
+  CHECK(ctx2.inode_cache.get_used_entries() == 1);
+  CHECK(ctx2.inode_cache.get_hits() == 1);
+
+  // The first instance maps the new file and doesn't shrink it.
+  CHECK(ctx.inode_cache.get_capacity() == large_capacity);
+  CHECK(ctx.inode_cache.get_hits() == 1);
+}
+
+TEST_CASE("Test persistent")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_inode_cache_persistent(true);
+  ctx.inode_cache.drop();
+  Util::write_file("a", "a text");
+
+  CHECK(Util::starts_with(ctx.inode_cache.get_file(),
+                          ctx.config.cache_dir() + "/inode-cache."));
+
+  // Whether the filesystem can be identified depends on the system, but a
+  // stored value must never be returned for another file.
+  const bool stored = put(ctx, "a", "a text", 1);
+
+  Digest digest;
+  int return_value;
+
+  CHECK(ctx.inode_cache.get(
+          "a", InodeCache::ContentType::code, digest, &return_value)
+        == stored);
+  if (stored) {
+    CHECK(digest == Hash().hash("a text").digest());
+    CHECK(return_value == 1);
+  }
+
+  Util::write_file("a", "something else");
+  CHECK(!ctx.inode_cache.get(
+    "a", InodeCache::ContentType::code, digest, &return_value));
+
+  // The non-persistent cache is a separate file.
+  Context ctx2;
+  init(ctx2);
+  CHECK(ctx2.inode_cache.get_file() != ctx.inode_cache.get_file());
+}
+
 TEST_SUITE_END();
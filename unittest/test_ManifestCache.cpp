@@ -0,0 +1,137 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/Config.hpp"
+#include "../src/Context.hpp"
+#include "../src/Hash.hpp"
+#include "../src/ManifestCache.hpp"
+#include "../src/Stat.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+using TestUtil::TestContext;
+
+namespace {
+
+void
+init(Context& ctx)
+{
+  ctx.config.set_debug(true);
+  ctx.config.set_manifest_cache(true);
+  ctx.config.set_cache_dir(Util::get_home_directory());
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("ManifestCache");
+
+TEST_CASE("Test disabled")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.config.set_manifest_cache(false);
+
+  const Digest key = Hash().hash("key").digest();
+  std::string data;
+
+  CHECK(!ctx.manifest_cache.get(key, data));
+  CHECK(!ctx.manifest_cache.put(key, "data"));
+  CHECK(ctx.manifest_cache.get_hits() == -1);
+  CHECK(ctx.manifest_cache.get_misses() == -1);
+  CHECK(ctx.manifest_cache.get_errors() == -1);
+}
+
+TEST_CASE("Test put and lookup")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.manifest_cache.drop();
+
+  const Digest key1 = Hash().hash("key1").digest();
+  const Digest key2 = Hash().hash("key2").digest();
+  std::string data;
+
+  CHECK(!ctx.manifest_cache.get(key1, data));
+  CHECK(ctx.manifest_cache.get_hits() == 0);
+  CHECK(ctx.manifest_cache.get_misses() == 1);
+
+  CHECK(ctx.manifest_cache.put(key1, "data 1"));
+  CHECK(ctx.manifest_cache.put(key2, std::string(1000, 'x')));
+
+  CHECK(ctx.manifest_cache.get(key1, data));
+  CHECK(data == "data 1");
+  CHECK(ctx.manifest_cache.get(key2, data));
+  CHECK(data == std::string(1000, 'x'));
+  CHECK(ctx.manifest_cache.get_hits() == 2);
+  CHECK(ctx.manifest_cache.get_misses() == 1);
+
+  CHECK(ctx.manifest_cache.put(key1, "new data 1"));
+  CHECK(ctx.manifest_cache.get(key1, data));
+  CHECK(data == "new data 1");
+  CHECK(ctx.manifest_cache.get_errors() == 0);
+}
+
+TEST_CASE("Test overwritten data")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+  ctx.manifest_cache.drop();
+
+  const Digest key = Hash().hash("key").digest();
+  const std::string large_data(1024 * 1024, 'x');
+  std::string data;
+
+  CHECK(ctx.manifest_cache.put(key, "data"));
+
+  // Wrap around the data area so that the data for `key` is overwritten.
+  for (size_t i = 0; i < 32; ++i) {
+    const Digest other_key = Hash().hash(i).digest();
+    CHECK(ctx.manifest_cache.put(other_key, large_data));
+  }
+  CHECK(!ctx.manifest_cache.get(key, data));
+
+  const Digest last_key = Hash().hash(31).digest();
+  CHECK(ctx.manifest_cache.get(last_key, data));
+  CHECK(data == large_data);
+}
+
+TEST_CASE("Drop file")
+{
+  TestContext test_context;
+
+  Context ctx;
+  init(ctx);
+
+  std::string data;
+
+  ctx.manifest_cache.get(Hash().hash("key").digest(), data);
+  CHECK(Stat::stat(ctx.manifest_cache.get_file()));
+  CHECK(ctx.manifest_cache.drop());
+  CHECK(!Stat::stat(ctx.manifest_cache.get_file()));
+  CHECK(!ctx.manifest_cache.drop());
+}
+
+TEST_SUITE_END();
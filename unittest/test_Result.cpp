@@ -0,0 +1,294 @@
+// Copyright (C) 2021 Joel Rosdahl and other contributors
+//
+// See doc/AUTHORS.adoc for a complete list of contributors.
+//
+// This program is free software; you can redistribute it and/or modify it
+// under the terms of the GNU General Public License as published by the Free
+// Software Foundation; either version 3 of the License, or (at your option)
+// any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT
+// ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+// FITNESS FOR A PARTICULAR PURPOSE. See the GNU General Public License for
+// more details.
+//
+// You should have received a copy of the GNU General Public License along with
+// this program; if not, write to the Free Software Foundation, Inc., 51
+// Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA
+
+#include "../src/AtomicFile.hpp"
+#include "../src/CacheEntryReader.hpp"
+#include "../src/Context.hpp"
+#include "../src/File.hpp"
+#include "../src/Result.hpp"
+#include "../src/Util.hpp"
+#include "TestUtil.hpp"
+
+#include "third_party/doctest.h"
+
+#include <set>
+
+using TestUtil::TestContext;
+
+namespace {
+
+// Header, entry count, three table entries and table checksum.
+const size_t k_first_entry_data_offset = 15 + 1 + 3 * 26 + 8;
+
+class TestConsumer : public Result::Reader::Consumer
+{
+public:
+  TestConsumer(std::set<uint32_t> unwanted = {}) : m_unwanted(unwanted)
+  {
+  }
+
+  void
+  on_header(CacheEntryReader& cache_entry_reader) override
+  {
+    compression_type = cache_entry_reader.compression_type();
+  }
+
+  bool
+  on_entry_start(uint32_t entry_number,
+                 Result::FileType file_type,
+                 uint64_t /*file_len*/,
+                 nonstd::optional<std::string> /*raw_file*/) override
+  {
+    file_types.push_back(file_type);
+    data.emplace_back();
+    return m_unwanted.count(entry_number) == 0;
+  }
+
+  void
+  on_entry_data(const uint8_t* entry_data, size_t size) override
+  {
+    data.back().append(reinterpret_cast<const char*>(entry_data), size);
+  }
+
+  bool
+  on_entry_data_range(int fd, uint64_t offset, uint64_t size) override
+  {
+    if (!m_use_ranges) {
+      return false;
+    }
+    std::string range(size, '\0');
+    REQUIRE(lseek(fd, offset, SEEK_SET) == static_cast<off_t>(offset));
+    REQUIRE(read(fd, &range[0], size) == static_cast<ssize_t>(size));
+    data.back() = range;
+    ++ranges;
+    return true;
+  }
+
+  void
+  on_entry_end() override
+  {
+  }
+
+  void
+  use_ranges()
+  {
+    m_use_ranges = true;
+  }
+
+  Compression::Type compression_type = Compression::Type::none;
+  std::vector<Result::FileType> file_types;
+  std::vector<std::string> data;
+  size_t ranges = 0;
+
+private:
+  std::set<uint32_t> m_unwanted;
+  bool m_use_ranges = false;
+};
+
+std::string
+large_data()
+{
+  std::string data;
+  for (size_t i = 0; i < 100000; ++i) {
+    data += static_cast<char>(i * i % 251);
+  }
+  return data;
+}
+
+void
+write_result(const std::string& path)
+{
+  Util::write_file("object", large_data());
+  Util::write_file("stderr", "error: foo");
+  Util::write_file("dependency", "");
+
+  Context ctx;
+  Result::Writer writer(ctx, path);
+  writer.write(Result::FileType::object, "object");
+  writer.write(Result::FileType::stderr_output, "stderr");
+  writer.write(Result::FileType::dependency, "dependency");
+  REQUIRE(!writer.finalize());
+}
+
+void
+corrupt_byte(const std::string& path, size_t offset)
+{
+  std::string content = Util::read_file(path);
+  REQUIRE(offset < content.size());
+  content[offset] ^= 1;
+  Util::write_file(path, content);
+}
+
+} // namespace
+
+TEST_SUITE_BEGIN("Result");
+
+TEST_CASE("Write and read result")
+{
+  TestContext test_context;
+
+  write_result("test.result");
+
+  TestConsumer consumer;
+  CHECK(!Result::Reader("test.result").read(consumer));
+  CHECK(consumer.compression_type == Compression::Type::zstd);
+  REQUIRE(consumer.file_types.size() == 3);
+  CHECK(consumer.file_types[0] == Result::FileType::object);
+  CHECK(consumer.file_types[1] == Result::FileType::stderr_output);
+  CHECK(consumer.file_types[2] == Result::FileType::dependency);
+  CHECK(consumer.data[0] == large_data());
+  CHECK(consumer.data[1] == "error: foo");
+  CHECK(consumer.data[2] == "");
+}
+
+TEST_CASE("Write and read result without entries")
+{
+  TestContext test_context;
+
+  Context ctx;
+  Result::Writer writer(ctx, "test.result");
+  REQUIRE(!writer.finalize());
+
+  TestConsumer consumer;
+  CHECK(!Result::Reader("test.result").read(consumer));
+  CHECK(consumer.file_types.empty());
+}
+
+TEST_CASE("Unwanted entries are skipped")
+{
+  TestContext test_context;
+
+  write_result("test.result");
+
+  TestConsumer consumer({0});
+  CHECK(!Result::Reader("test.result").read(consumer));
+  REQUIRE(consumer.data.size() == 3);
+  CHECK(consumer.data[0] == "");
+  CHECK(consumer.data[1] == "error: foo");
+
+  // Unwanted entries are not even decompressed, so corruption of their data
+  // goes unnoticed.
+  corrupt_byte("test.result", k_first_entry_data_offset + 10);
+  TestConsumer corrupt_consumer({0});
+  CHECK(!Result::Reader("test.result").read(corrupt_consumer));
+  CHECK(corrupt_consumer.data[1] == "error: foo");
+}
+
+TEST_CASE("Files modified after registration are not stored")
+{
+  TestContext test_context;
+
+  Util::write_file("object", "foo");
+
+  Context ctx;
+  Result::Writer writer(ctx, "test.result");
+  writer.write(Result::FileType::object, "object");
+  Util::write_file("object", "foobar");
+
+  const auto error = writer.finalize();
+  REQUIRE(error);
+  CHECK(*error == "object was modified while being stored");
+  CHECK(!Stat::stat("test.result"));
+}
+
+TEST_CASE("Corrupt result")
+{
+  TestContext test_context;
+
+  write_result("test.result");
+  const std::string content = Util::read_file("test.result");
+
+  SUBCASE("Corrupt entry table")
+  {
+    corrupt_byte("test.result", 20);
+    TestConsumer consumer;
+    const auto error = Result::Reader("test.result").read(consumer);
+    REQUIRE(error);
+    CHECK(error->find("Incorrect entry table checksum") == 0);
+  }
+
+  SUBCASE("Truncated result")
+  {
+    Util::write_file("test.result", content.substr(0, content.size() - 1));
+    TestConsumer consumer;
+    const auto error = Result::Reader("test.result").read(consumer);
+    REQUIRE(error);
+    CHECK(error->find("Bad result file size") == 0);
+  }
+
+  SUBCASE("Corrupt entry data")
+  {
+    corrupt_byte("test.result", k_first_entry_data_offset + 10);
+    TestConsumer consumer;
+    CHECK(Result::Reader("test.result").read(consumer));
+  }
+}
+
+TEST_CASE("Recompress result")
+{
+  TestContext test_context;
+
+  write_result("test.result");
+
+  {
+    File input("test.result", "rb");
+    AtomicFile output("test.result", AtomicFile::Mode::binary);
+    Result::recompress(
+      input.get(), output.stream(), Compression::Type::none, 0);
+    output.commit();
+  }
+
+  TestConsumer consumer;
+  CHECK(!Result::Reader("test.result").read(consumer));
+  CHECK(consumer.compression_type == Compression::Type::none);
+  REQUIRE(consumer.data.size() == 3);
+  CHECK(consumer.data[0] == large_data());
+  CHECK(consumer.data[1] == "error: foo");
+  CHECK(Util::read_file("test.result").size() > large_data().size());
+
+#ifdef HAVE_SYS_MMAN_H
+  // Uncompressed data can be copied straight from the result file.
+  TestConsumer range_consumer;
+  range_consumer.use_ranges();
+  CHECK(!Result::Reader("test.result").read(range_consumer));
+  CHECK(range_consumer.ranges == 3);
+  CHECK(range_consumer.data == consumer.data);
+#endif
+
+  {
+    File input("test.result", "rb");
+    AtomicFile output("test.result", AtomicFile::Mode::binary);
+    Result::recompress(
+      input.get(), output.stream(), Compression::Type::zstd, 1);
+    output.commit();
+  }
+
+  TestConsumer zstd_consumer;
+  CHECK(!Result::Reader("test.result").read(zstd_consumer));
+  CHECK(zstd_consumer.compression_type == Compression::Type::zstd);
+  CHECK(zstd_consumer.data == consumer.data);
+
+  // Compressed data is never passed as a file range.
+  TestConsumer compressed_range_consumer;
+  compressed_range_consumer.use_ranges();
+  CHECK(!Result::Reader("test.result").read(compressed_range_consumer));
+  CHECK(compressed_range_consumer.ranges == 0);
+  CHECK(compressed_range_consumer.data == consumer.data);
+}
+
+TEST_SUITE_END();
@@ -125,6 +125,33 @@ TEST_CASE("Util::common_dir_prefix_length")
   CHECK(Util::common_dir_prefix_length("/a/b", "/a/bc") == 2);
 }
 
+TEST_CASE("Util::copy_fd_range")
+{
+  TestContext test_context;
+
+  Util::write_file("src", "0123456789");
+
+  SUBCASE("Copy to file")
+  {
+    Fd src(open("src", O_RDONLY | O_BINARY));
+    Fd dest(open("dest", O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666));
+    Util::write_fd(*dest, "ab", 2);
+    Util::copy_fd_range(*src, 3, *dest, 4);
+    Util::copy_fd_range(*src, 0, *dest, 0);
+    Util::copy_fd_range(*src, 8, *dest, 2);
+    dest.close();
+    CHECK(Util::read_file("dest") == "ab345689");
+  }
+
+  SUBCASE("Copy past end of file")
+  {
+    Fd src(open("src", O_RDONLY | O_BINARY));
+    Fd dest(open("dest", O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666));
+    CHECK_THROWS_WITH(Util::copy_fd_range(*src, 8, *dest, 3),
+                      "unexpected end of file");
+  }
+}
+
 TEST_CASE("Util::create_dir")
 {
   TestContext test_context;
@@ -338,6 +365,15 @@ TEST_CASE("Util::format_parsable_size_with_suffix")
         == "17.1G");
 }
 
+TEST_CASE("Util::get_boot_id")
+{
+  const std::string boot_id = Util::get_boot_id();
+  CHECK(Util::get_boot_id() == boot_id);
+#ifdef __linux__
+  CHECK(boot_id.length() == 36);
+#endif
+}
+
 TEST_CASE("Util::get_extension")
 {
   CHECK(Util::get_extension("") == "");
@@ -363,6 +399,15 @@ os_path(std::string path)
   return path;
 }
 
+TEST_CASE("Util::get_filesystem_id")
+{
+  TestContext test_context;
+
+  Util::write_file("a", "");
+  CHECK(Util::get_filesystem_id("a") == Util::get_filesystem_id("."));
+  CHECK(Util::get_filesystem_id("does_not_exist") == 0);
+}
+
 TEST_CASE("Util::get_level_1_files")
 {
   TestContext test_context;
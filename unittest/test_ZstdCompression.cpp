@@ -24,6 +24,8 @@
 
 #include "third_party/doctest.h"
 
+#include <vector>
+
 using TestUtil::TestContext;
 
 TEST_SUITE_BEGIN("ZstdCompression");
@@ -120,4 +122,34 @@ TEST_CASE("Large uncompressible Compression::Type::zstd roundtrip")
   decompressor->finalize();
 }
 
+TEST_CASE("Multithreaded Compression::Type::zstd roundtrip")
+{
+  TestContext test_context;
+
+  // Large enough for libzstd to split the work into several jobs.
+  std::vector<char> data(16 * 1024 * 1024);
+  for (size_t i = 0; i < data.size(); ++i) {
+    data[i] = static_cast<char>(i * i % 251);
+  }
+
+  File f("data.zstd", "wb");
+  auto compressor =
+    Compressor::create_from_type(Compression::Type::zstd, f.get(), 1, 2);
+  CHECK(compressor->actual_compression_level() == 1);
+  for (size_t i = 0; i < data.size(); i += 65536) {
+    compressor->write(&data[i], 65536);
+  }
+  compressor->finalize();
+
+  f.open("data.zstd", "rb");
+  auto decompressor =
+    Decompressor::create_from_type(Compression::Type::zstd, f.get());
+
+  std::vector<char> buffer(data.size());
+  decompressor->read(buffer.data(), buffer.size());
+  CHECK(buffer == data);
+
+  decompressor->finalize();
+}
+
 TEST_SUITE_END();
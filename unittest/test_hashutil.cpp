@@ -18,14 +18,59 @@
 
 #include "../src/Context.hpp"
 #include "../src/Hash.hpp"
+#include "../src/Util.hpp"
 #include "../src/hashutil.hpp"
 #include "TestUtil.hpp"
 
 #include "third_party/doctest.h"
 
+#include <chrono>
+
 using nonstd::string_view;
 using TestUtil::TestContext;
 
+namespace {
+
+// Straightforward version of find_preprocessor_marker to compare with.
+size_t
+find_preprocessor_marker_reference(string_view str, size_t pos, bool pump)
+{
+  for (; pos < str.length(); ++pos) {
+    if ((str[pos] == '#' && (pos == 0 || str[pos - 1] == '\n'))
+        || (str[pos] == '.' && str.substr(pos, 7) == ".incbin")
+        || (pump && str.substr(pos, 9) == "_________")) {
+      return pos;
+    }
+  }
+  return str.length();
+}
+
+// Generates something that looks like preprocessed C++ code.
+std::string
+generate_preprocessed_code(size_t size)
+{
+  static const string_view lines[] = {
+    "# 1 \"/usr/include/c++/10/vector\" 1 3\n",
+    "  template<typename _Tp, typename _Alloc = std::allocator<_Tp> >\n",
+    "    class vector : protected _Vector_base<_Tp, _Alloc>\n",
+    "      { return this->_M_impl._M_start[__n]; }\n",
+    "      const_reference operator[](size_type __n) const noexcept\n",
+    "\n",
+    "  std::__throw_out_of_range_fmt(__N(\"vector::_M_range_check\"));\n",
+  };
+  std::string result;
+  result.reserve(size);
+  const size_t num_lines = sizeof(lines) / sizeof(lines[0]);
+  for (size_t i = 0; result.size() < size; ++i) {
+    // Linemarkers are relatively rare in real preprocessor output.
+    const auto line = i % 50 == 0 ? lines[0] : lines[1 + i % (num_lines - 1)];
+    result.append(line.data(), line.size());
+  }
+  return result;
+}
+
+} // namespace
+
 TEST_SUITE_BEGIN("hashutil");
 
 TEST_CASE("hash_command_output_simple")
@@ -231,6 +276,114 @@ TEST_CASE("check_for_temporal_macros")
   for (size_t i = 0; i < sizeof(temporal_at_avx_boundary) - 8; ++i) {
     CHECK(check_for_temporal_macros(temporal_at_avx_boundary.substr(i)));
   }
+
+  for (size_t i = 0; i < 64; ++i) {
+    CHECK(!check_for_temporal_macros(std::string(i, ' ') + "a__DATE__"));
+  }
+}
+
+TEST_CASE("hash_source_code_file")
+{
+  TestContext test_context;
+
+  Context ctx;
+
+  // Place each fragment at all offsets around the end of the first block read
+  // from the file.
+  const string_view fragments[] = {
+    "__DATE__",
+    "__TIME__",
+    "__TIMESTAMP__",
+    "a__DATE__",
+    "__TIME__a",
+    "abcdefghijklmnopqrstuvwxyz __TIMESTAMP__",
+    "abcdefghijklmnopqrstuvwxyz__DATE__",
+  };
+  for (const auto fragment : fragments) {
+    for (size_t offset = 0; offset < 48; ++offset) {
+      const std::string data = std::string(READ_BUFFER_SIZE - offset, ' ')
+                               + std::string(fragment) + "\nint x;\n";
+      Util::write_file("test.c", data);
+
+      Hash h1;
+      Hash h2;
+      const int expected = hash_source_code_string(ctx, h1, data, "test.c");
+      REQUIRE(hash_source_code_file(ctx, h2, "test.c") == expected);
+      REQUIRE(h1.digest() == h2.digest());
+    }
+  }
+}
+
+TEST_CASE("find_preprocessor_marker")
+{
+  CHECK(find_preprocessor_marker("", 0, false) == 0);
+  CHECK(find_preprocessor_marker("#", 0, false) == 0);
+  CHECK(find_preprocessor_marker("a#", 0, false) == 2);
+  CHECK(find_preprocessor_marker("a\n#", 0, false) == 2);
+  CHECK(find_preprocessor_marker("a\n#", 3, false) == 3);
+
+  SUBCASE("Same result as reference at all positions")
+  {
+    // Place each marker (and non-markers) at all offsets relative to the
+    // SIMD block boundaries.
+    const string_view fragments[] = {
+      "\n# 1 \"x\"",
+      ".incbin",
+      "x.incbix",
+      "#not at start of line",
+      "__________Using distcc-pump",
+      "________ not pump",
+    };
+    for (const auto fragment : fragments) {
+      for (size_t offset = 0; offset < 80; ++offset) {
+        const std::string str = std::string(offset, 'x')
+                                + std::string(fragment) + std::string(80, 'y');
+        for (const bool pump : {false, true}) {
+          size_t expected = 0;
+          size_t actual = 0;
+          // The candidates found must include all real markers.
+          while (expected < str.length()) {
+            expected = find_preprocessor_marker_reference(str, expected, pump);
+            actual = find_preprocessor_marker(str, actual, pump);
+            while (actual < expected) {
+              actual = find_preprocessor_marker(str, actual + 1, pump);
+            }
+            REQUIRE(actual == expected);
+            ++expected;
+            ++actual;
+          }
+        }
+      }
+    }
+  }
+}
+
+// Run with `unittest -tc=find_preprocessor_marker_benchmark --no-skip`.
+TEST_CASE("find_preprocessor_marker_benchmark" * doctest::skip())
+{
+  const std::string code = generate_preprocessed_code(64 * 1024 * 1024);
+  const int rounds = 10;
+
+  const auto measure = [&](const char* name,
+                           size_t (*find)(string_view, size_t, bool)) {
+    size_t markers = 0;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < rounds; ++i) {
+      for (size_t pos = find(code, 0, false); pos < code.length();
+           pos = find(code, pos + 1, false)) {
+        ++markers;
+      }
+    }
+    const std::chrono::duration<double> elapsed =
+      std::chrono::steady_clock::now() - start;
+    MESSAGE(name
+            << ": "
+            << rounds * code.length() / elapsed.count() / (1000 * 1000 * 1000)
+            << " GB/s, " << markers / rounds << " candidates");
+  };
+
+  measure("reference", find_preprocessor_marker_reference);
+  measure("find_preprocessor_marker", find_preprocessor_marker);
 }
 
 TEST_SUITE_END();